@@ -18,19 +18,19 @@ SKETCHCNT=32
 if [ "x$1" = "x${REPLY}" ]; then
 	POLICY="dstIP"
 	ADDITIONAL="-r"
-	COMMAND="mergecap $2 -w - | ./dnsanalyzer -w ${WINDOW} -i ${INTERVAL} -a ${AGGREG} -p ${GAMMAPAR} -t ${THRESH} -P ${POLICY} -c ${HASHCNT} -s ${SKETCHCNT} ${ADDITIONAL}"
+	COMMAND="./dnsanalyzer -w ${WINDOW} -i ${INTERVAL} -a ${AGGREG} -p ${GAMMAPAR} -t ${THRESH} -P ${POLICY} -c ${HASHCNT} -s ${SKETCHCNT} ${ADDITIONAL} -f \"$2\""
 	echo "#${COMMAND}"
 	sh -c "${COMMAND}"
 	echo ok
 else if [ "x$1" = "x${QUERY}" ]; then
 	POLICY="srcIP"
 	ADDITIONAL="-q"
-	COMMAND="mergecap $2 -w - | ./dnsanalyzer -w ${WINDOW} -i ${INTERVAL} -a ${AGGREG} -p ${GAMMAPAR} -t ${THRESH} -P ${POLICY} -c ${HASHCNT} -s ${SKETCHCNT} ${ADDITIONAL}"
+	COMMAND="./dnsanalyzer -w ${WINDOW} -i ${INTERVAL} -a ${AGGREG} -p ${GAMMAPAR} -t ${THRESH} -P ${POLICY} -c ${HASHCNT} -s ${SKETCHCNT} ${ADDITIONAL} -f \"$2\""
 	echo "#${COMMAND}"
 	sh -c "${COMMAND}"
 else if [ "x$1" = "x${WHOLE}" ]; then
 	POLICY="srcIP"
-	COMMAND="mergecap $2 -w - | ./dnsanalyzer -w ${WINDOW} -i ${INTERVAL} -a ${AGGREG} -p ${GAMMAPAR} -t ${THRESH} -P ${POLICY} -c ${HASHCNT} -s ${SKETCHCNT}"
+	COMMAND="./dnsanalyzer -w ${WINDOW} -i ${INTERVAL} -a ${AGGREG} -p ${GAMMAPAR} -t ${THRESH} -P ${POLICY} -c ${HASHCNT} -s ${SKETCHCNT} -f \"$2\""
 	echo "#${COMMAND}"
 	sh -c "${COMMAND}"
 else
@@ -22,19 +22,21 @@ class StructAnomalies:
     cnt_found = None
     cnt_all = None
     anomalies = None
+    policy = None
     def __init__(self, from_time=None, to_time=None, cnt_found=None,
-                 cnt_all=None, anomalies=None):
+                 cnt_all=None, anomalies=None, policy=None):
         self.from_time = from_time
         self.to_time = to_time
         self.cnt_found = cnt_found
         self.cnt_all = cnt_all
         self.anomalies = anomalies
+        self.policy = policy
     def __str__(self):
         return "%s(from_time=%r, to_time=%r, cnt_found=%r, cnt_all=%r, "\
-            "anomalies=%r)" % (
+            "anomalies=%r, policy=%r)" % (
             self.__class__.__name__,
             self.from_time, self.to_time, self.cnt_found, self.cnt_all,
-            self.anomalies)
+            self.anomalies, self.policy)
 
 
 class AnomalyParser:
@@ -42,6 +44,8 @@ class AnomalyParser:
         self.from_re = re.compile("From: ")
         self.to_re = re.compile("To: ")
         self.found_re = re.compile("found anomalies ")
+        # set when dnsanalyzer runs several policies at once
+        self.policy_re = re.compile("^\\[([^\\]]*)\\] *")
         self.ok_re = re.compile("ok")
 
         self.st_expect_from_or_ok = 0
@@ -88,12 +92,17 @@ class AnomalyParser:
     def _parse_found_line(self, line):
         if not self.found_re.search(line):
             return None
-        data = re.split(" : ", self.found_re.sub("", line.strip()))
+        data = self.found_re.sub("", line.strip())
+        policy = self.policy_re.match(data)
+        if policy:
+            data = data[policy.end():]
+            policy = policy.group(1)
+        data = re.split(" : ", data)
         num = re.findall("[0-9]+", data[0])
         num_found = int(num[0])
         num_all = int(num[1])
         data = re.split(", ", data[1].strip())
-        return (num_found, num_all, data)
+        return (num_found, num_all, data, policy)
 
     def get_next_anomalies(self):
         """
@@ -131,7 +140,7 @@ class AnomalyParser:
                     self.state = self.st_expect_from_or_ok
                     return StructAnomalies(from_time, to_time,
                         found_anomalies[0], found_anomalies[1],
-                        found_anomalies[2])
+                        found_anomalies[2], found_anomalies[3])
                 else:
                     raise ParserError("Error parsing \"found anomalies\" "\
                         "at line %d" % self.cntr_line)
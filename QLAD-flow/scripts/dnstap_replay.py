@@ -0,0 +1,163 @@
+#!/usr/bin/python
+
+# Replays the DNS messages of a pcap file as dnstap over Frame Streams,
+# standing in for a name server in front of `dnsanalyzer -D <socket>`.
+# Only the standard library is needed.
+#
+# example of usage:
+#./dnstap_replay.py /data/dnscap/sample.pcap /run/qlad/dnstap.sock
+
+import socket
+import struct
+import sys
+
+CONTENT_TYPE = b"protobuf:dnstap.Dnstap"
+
+CONTROL_ACCEPT = 1
+CONTROL_START = 2
+CONTROL_STOP = 3
+CONTROL_READY = 4
+CONTROL_FINISH = 5
+
+AUTH_QUERY = 1
+AUTH_RESPONSE = 2
+
+DLT_OFFSETS = {0: 4, 1: 14, 12: 0, 101: 0, 108: 4}
+
+
+def varint(value):
+    out = bytearray()
+    while True:
+        byte = value & 0x7f
+        value >>= 7
+        if value:
+            out.append(byte | 0x80)
+        else:
+            out.append(byte)
+            return bytes(out)
+
+
+def field(number, value):
+    """Encodes a varint or a bytes protobuf field."""
+    if isinstance(value, bytes):
+        return varint(number << 3 | 2) + varint(len(value)) + value
+    return varint(number << 3) + varint(value)
+
+
+def fixed32(number, value):
+    return varint(number << 3 | 5) + struct.pack("<I", value)
+
+
+def control(kind, content_type=True):
+    payload = struct.pack(">I", kind)
+    if content_type:
+        payload += struct.pack(">II", 1, len(CONTENT_TYPE)) + CONTENT_TYPE
+    return struct.pack(">II", 0, len(payload)) + payload
+
+
+def read_control(sock):
+    escape, length = struct.unpack(">II", recv_all(sock, 8))
+    return struct.unpack(">I", recv_all(sock, length)[:4])[0]
+
+
+def recv_all(sock, size):
+    data = b""
+    while len(data) < size:
+        chunk = sock.recv(size - len(data))
+        if not chunk:
+            raise IOError("reader closed the connection")
+        data += chunk
+    return data
+
+
+def packets(path):
+    """Yields time-stamp, link type and data of the pcap file packets."""
+    with open(path, "rb") as pcap:
+        header = pcap.read(24)
+        magic = struct.unpack("<I", header[:4])[0]
+        order = "<" if magic in (0xa1b2c3d4, 0xa1b23c4d) else ">"
+        nano = struct.unpack(order + "I", header[:4])[0] == 0xa1b23c4d
+        link = struct.unpack(order + "I", header[20:24])[0] & 0x0fffffff
+        while True:
+            record = pcap.read(16)
+            if len(record) < 16:
+                return
+            sec, frac, caplen, _ = struct.unpack(order + "IIII", record)
+            yield sec, frac if nano else frac * 1000, link, pcap.read(caplen)
+
+
+def message(sec, nsec, link, data):
+    """Builds a Dnstap protobuf of a UDP DNS packet, None for others."""
+    data = data[DLT_OFFSETS.get(link, 0):]
+    if len(data) < 1:
+        return None
+    version = data[0] >> 4
+    if version == 4:
+        header = (data[0] & 0x0f) * 4
+        if data[9] != 17:
+            return None
+        family, source, destination = 1, data[12:16], data[16:20]
+    elif version == 6:
+        header = 40
+        if data[6] != 17:
+            return None
+        family, source, destination = 2, data[8:24], data[24:40]
+    else:
+        return None
+    udp = data[header:header + 8]
+    dns = data[header + 8:]
+    if len(udp) < 8 or len(dns) < 12:
+        return None
+    sport, dport = struct.unpack(">HH", udp[:4])
+    response = dns[2] & 0x80
+
+    if response:
+        body = (field(1, AUTH_RESPONSE) + field(2, family) + field(3, 1)
+                + field(4, destination) + field(5, source)
+                + field(6, dport) + field(7, sport)
+                + field(12, sec) + fixed32(13, nsec) + field(14, dns))
+    else:
+        body = (field(1, AUTH_QUERY) + field(2, family) + field(3, 1)
+                + field(4, source) + field(5, destination)
+                + field(6, sport) + field(7, dport)
+                + field(8, sec) + fixed32(9, nsec) + field(10, dns))
+    return field(14, body) + field(15, 1)
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.stderr.write("usage: %s <pcap file> <socket>\n" % sys.argv[0])
+        return 1
+
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    sock.connect(sys.argv[2])
+
+    sock.sendall(control(CONTROL_READY))
+    if read_control(sock) != CONTROL_ACCEPT:
+        sys.stderr.write("reader did not accept the stream\n")
+        return 1
+    sock.sendall(control(CONTROL_START))
+
+    sent = 0
+    frames = []
+    for sec, nsec, link, data in packets(sys.argv[1]):
+        frame = message(sec, nsec, link, data)
+        if frame is None:
+            continue
+        frames.append(struct.pack(">I", len(frame)) + frame)
+        sent += 1
+        if len(frames) == 1024:
+            sock.sendall(b"".join(frames))
+            frames = []
+    sock.sendall(b"".join(frames))
+
+    sock.sendall(control(CONTROL_STOP, False))
+    if read_control(sock) != CONTROL_FINISH:
+        sys.stderr.write("reader did not finish the stream\n")
+        return 1
+    sys.stderr.write("sent %d messages\n" % sent)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,47 @@
+#!/bin/sh
+
+# Replays a capture file over a veth pair into dnsdump capturing with
+# several fanout threads, then analyses the per-thread files together.
+# Needs root, iproute2 and tcpreplay. REPLAY_OPTIONS are passed to
+# tcpreplay (e.g. "--topspeed"), THREADS sets the dnsdump thread count.
+# example of usage:
+#./fanout_capture_test.sh /data/dnscap/sample.pcap -w 60 -i 10 -P qname
+
+NETNS=qlad-fanout
+OUTER=qlad2
+INNER=qlad3
+THREADS=${THREADS:-4}
+
+if [ $# -lt 1 ]; then
+	echo "usage: $0 <pcap file> [dnsanalyzer options]" >&2
+	exit 1
+fi
+FILE="$1"
+shift
+OUTPUT=$(mktemp -d) || exit 1
+
+cleanup() {
+	[ -n "${DUMP}" ] && kill -INT "${DUMP}" 2>/dev/null && wait "${DUMP}"
+	ip netns del "${NETNS}" 2>/dev/null
+	ip link del "${OUTER}" 2>/dev/null
+	rm -rf "${OUTPUT}"
+}
+trap cleanup EXIT INT TERM
+
+ip netns add "${NETNS}" || exit 1
+ip link add "${OUTER}" type veth peer name "${INNER}" || exit 1
+ip link set "${INNER}" netns "${NETNS}"
+ip link set "${OUTER}" up
+ip netns exec "${NETNS}" ip link set "${INNER}" up
+
+./dnsdump -t "${THREADS}" -w "${OUTPUT}/dump" "${OUTER}" &
+DUMP=$!
+sleep 1
+
+ip netns exec "${NETNS}" tcpreplay ${REPLAY_OPTIONS} -i "${INNER}" "${FILE}"
+sleep 1
+# dnsdump prints the counters of every thread when stopped
+kill -INT "${DUMP}" && wait "${DUMP}"
+DUMP=
+
+./dnsanalyzer "$@" -f "${OUTPUT}/dump.*"
@@ -0,0 +1,37 @@
+#!/bin/sh
+
+# Replays a capture file over a veth pair into a live dnsanalyzer.
+# Needs root, iproute2 and tcpreplay. The packets are sent with their
+# original timing, set REPLAY_OPTIONS (e.g. "--multiplier=10") to change it.
+# example of usage:
+#./live_capture_test.sh /data/dnscap/sample.pcap -w 60 -i 10 -P qname
+
+NETNS=qlad-replay
+OUTER=qlad0
+INNER=qlad1
+
+if [ $# -lt 1 ]; then
+	echo "usage: $0 <pcap file> [dnsanalyzer options]" >&2
+	exit 1
+fi
+FILE="$1"
+shift
+
+cleanup() {
+	[ -n "${ANALYZER}" ] && kill -INT "${ANALYZER}" 2>/dev/null && wait "${ANALYZER}"
+	ip netns del "${NETNS}" 2>/dev/null
+	ip link del "${OUTER}" 2>/dev/null
+}
+trap cleanup EXIT INT TERM
+
+ip netns add "${NETNS}" || exit 1
+ip link add "${OUTER}" type veth peer name "${INNER}" || exit 1
+ip link set "${INNER}" netns "${NETNS}"
+ip link set "${OUTER}" up
+ip netns exec "${NETNS}" ip link set "${INNER}" up
+
+./dnsanalyzer -I "${OUTER}" "$@" &
+ANALYZER=$!
+sleep 1
+
+ip netns exec "${NETNS}" tcpreplay ${REPLAY_OPTIONS} -i "${INNER}" "${FILE}"
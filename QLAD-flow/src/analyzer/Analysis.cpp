@@ -0,0 +1,157 @@
+/*
+ * This file is part of the DNS traffic analyser project.
+ *
+ * Copyright (C) 2011 CZ.NIC, z.s.p.o.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <cassert>
+
+#include "Analysis.h"
+#include "policies/CompositePolicy.h"
+#include "policies/IPPolicy.h"
+#include "policies/QueryNamePolicy.h"
+#include "policies/dns/PacketParser.h"
+
+AnalysisSet::AnalysisSet( const Settings &opt, const ::std::string &stream )
+: mNeed( 0 ), mSampler( NULL )
+{
+	unsigned count = 0;
+	for (unsigned type = 0; type < POLICY_TYPE_COUNT; ++type)
+		{ count += opt.usesPolicy( (policyType) type ); }
+
+	for (unsigned type = 0; type < POLICY_TYPE_COUNT; ++type) {
+		if ( !opt.usesPolicy( (policyType) type ) )
+			{ continue; }
+
+		/* Keep the output unchanged for a single analysis. */
+		::std::string label = stream;
+		if ( count > 1 ) {
+			label += stream.empty() ? "" : ":";
+			label += policyTypeNames[type];
+		}
+		Analysis *analysis = NULL;
+		switch ( type ) {
+			case srcIP :
+				analysis = new PolicyAnalysis<SrcIPPolicy>(
+				  opt, label );
+				break;
+			case dstIP :
+				analysis = new PolicyAnalysis<DstIPPolicy>(
+				  opt, label );
+				break;
+			case queryName :
+				analysis = new PolicyAnalysis<QueryNamePolicy>(
+				  opt, label );
+				break;
+			case composite :
+				analysis = new PolicyAnalysis<CompositePolicy>(
+				  opt, label );
+				break;
+			default :
+				break;
+		}
+		assert( analysis );
+		mAnalyses.push_back( analysis );
+		mStorages.push_back( &analysis->storage() );
+		mNeed |= mStorages.back()->need();
+	}
+}
+/* ------------------------------------------------------------------------- */
+AnalysisSet::~AnalysisSet()
+{
+	for (Analyses::iterator it = mAnalyses.begin();
+	  it != mAnalyses.end(); ++it)
+		{ delete *it; }
+}
+/* ------------------------------------------------------------------------- */
+void AnalysisSet::detect()
+{
+	for (Analyses::iterator it = mAnalyses.begin();
+	  it != mAnalyses.end(); ++it)
+		{ (*it)->detect(); }
+}
+/* ------------------------------------------------------------------------- */
+void AnalysisSet::finish()
+{
+	for (Analyses::iterator it = mAnalyses.begin();
+	  it != mAnalyses.end(); ++it)
+		{ (*it)->finish(); }
+}
+/* ------------------------------------------------------------------------- */
+void AnalysisSet::addPackets( const PacketView *packets, size_t count )
+{
+	if (count == 0)
+		{ return; }
+	decode( packets, count, mDecoded );
+	for (Storages::const_iterator it = mStorages.begin();
+	  it != mStorages.end(); ++it)
+		{ (*it)->addRecords( packets, &mDecoded[0], count ); }
+}
+/* ------------------------------------------------------------------------- */
+void AnalysisSet::decode( const PacketView *packets, size_t count,
+  Decoded &decoded ) const
+{
+	decoded.resize( count );
+	PacketParser parser;
+	parser( packets, count, count ? &decoded[0] : NULL, mNeed );
+	if (mSampler && count)
+		{ mSampler->sample( packets, &decoded[0], count ); }
+}
+/* ------------------------------------------------------------------------- */
+AnalysisSet::SetRecords::~SetRecords()
+{
+	for (size_t i = 0; i < parts.size(); ++i)
+		{ delete parts[i]; }
+}
+/* ------------------------------------------------------------------------- */
+IStagedStorage::Records * AnalysisSet::createRecords() const
+{
+	SetRecords *records = new SetRecords;
+	for (size_t i = 0; i < mStorages.size(); ++i)
+		{ records->parts.push_back( mStorages[i]->createRecords() ); }
+	return records;
+}
+/* ------------------------------------------------------------------------- */
+void AnalysisSet::parse( const PacketView *packets, size_t count,
+  Records &records ) const
+{
+	SetRecords &set = static_cast<SetRecords &>( records );
+	assert( set.parts.size() == mStorages.size() );
+	decode( packets, count, set.decoded );
+	for (size_t i = 0; i < mStorages.size(); ++i) {
+		mStorages[i]->parse( packets,
+		  count ? &set.decoded[0] : NULL, count, *set.parts[i] );
+	}
+}
+/* ------------------------------------------------------------------------- */
+unsigned AnalysisSet::shardCount() const
+{
+	assert( !mStorages.empty() );
+	return mStorages.front()->shardCount();
+}
+/* ------------------------------------------------------------------------- */
+void AnalysisSet::store( const Records &records, unsigned shard )
+{
+	const SetRecords &set = static_cast<const SetRecords &>( records );
+	assert( set.parts.size() == mStorages.size() );
+	for (size_t i = 0; i < mStorages.size(); ++i) {
+		assert( mStorages[i]->shardCount() == shardCount() );
+		mStorages[i]->store( *set.parts[i], shard );
+	}
+}
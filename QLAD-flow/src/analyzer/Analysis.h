@@ -0,0 +1,254 @@
+/*
+ * This file is part of the DNS traffic analyser project.
+ *
+ * Copyright (C) 2011 CZ.NIC, z.s.p.o.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <algorithm>
+#include <list>
+#include <string>
+#include <vector>
+
+#include "capture/FailureSampler.h"
+#include "Detector.h"
+#include "IStorage.h"
+#include "proc/ThreadPool.h"
+#include "Settings.h"
+#include "Storage.h"
+
+/*!
+ * @class Analysis Analysis.h "Analysis.h"
+ * @brief Policy independent interface of one running analysis.
+ *
+ * Owns the Storage filled by the capture and the Detectors started on it.
+ */
+class Analysis
+{
+public:
+	virtual ~Analysis() {}
+
+	/*! @brief Place the capture stores decoded packets into. */
+	virtual IRecordStorage & storage() = 0;
+
+	/*!
+	 * @brief Starts detection on the data captured so far.
+	 *
+	 * Syncs the storage with the analysis window and adds a new
+	 * Detector to the global ThreadPool. Frees detectors that are
+	 * already done.
+	 */
+	virtual void detect() = 0;
+
+	/*! @brief Blocks until all started detections are complete. */
+	virtual void finish() = 0;
+};
+
+/*!
+ * @class PolicyAnalysis Analysis.h "Analysis.h"
+ * @brief Analysis of the traffic identified by the POLICY.
+ * @tparam POLICY Specifies Storage and Detector classes.
+ */
+template<typename POLICY>
+class PolicyAnalysis: public Analysis
+{
+public:
+	typedef Storage<POLICY> TStorage;
+	typedef Detector<POLICY> TDetector;
+
+	/*!
+	 * @brief Prepares empty storage.
+	 * @param opt Detection parameters, must outlive the instance.
+	 * @param label Stream and policy label for the output, empty for
+	 * none.
+	 */
+	PolicyAnalysis( const Settings &opt, const ::std::string &label )
+	: mOpt( opt ), mLabel( label ),
+	  mStorage( opt.window_size, ::std::max( 1u, opt.parser_threads ) )
+		{}
+
+	/*! @brief Waits for running detectors. */
+	~PolicyAnalysis()
+		{ finish(); }
+
+	IRecordStorage & storage()
+		{ return mStorage; }
+
+	void detect();
+
+	void finish();
+
+protected:
+	const Settings &mOpt;        /*!< @brief Detection parameters. */
+	const ::std::string mLabel;  /*!< @brief Output label. */
+	TStorage mStorage;           /*!< @brief Captured traffic. */
+
+	/*! @brief Detections in progress, in the order of creation. */
+	::std::list<TDetector *> mDetectors;
+
+private:
+	/*! @brief DO NOT COPY! */
+	PolicyAnalysis( const PolicyAnalysis & );
+
+	/*! @brief DO NOT COPY! */
+	PolicyAnalysis & operator = ( const PolicyAnalysis & );
+};
+
+/*!
+ * @class AnalysisSet Analysis.h "Analysis.h"
+ * @brief Several analyses fed by a single capture.
+ *
+ * Decodes every captured packet into a PacketRecord and distributes it to
+ * the storages of all the contained analyses, so that the input is read
+ * and decoded once no matter how many policies are used.
+ */
+class AnalysisSet: public IStagedStorage
+{
+public:
+	/*!
+	 * @brief Creates analyses for all policies requested in opt.
+	 * @param opt Detection parameters, must outlive the instance.
+	 * @param stream Name of the analysed stream, empty for none.
+	 *
+	 * The output is labelled by the stream name and, when there are
+	 * several policies, by the policy, e.g. "ns1:qname".
+	 */
+	AnalysisSet( const Settings &opt, const ::std::string &stream );
+
+	/*! @brief Waits for and destroys all analyses. */
+	~AnalysisSet();
+
+	/*! @brief Passes the packet to all analyses. */
+	void addPacket( const PacketView &packet )
+		{ addPackets( &packet, 1 ); }
+
+	/*!
+	 * @brief Decodes the packets and passes them to all analyses, one
+	 * after another.
+	 */
+	void addPackets( const PacketView *packets, size_t count );
+
+	Records * createRecords() const;
+
+	/*! @brief Decodes the packets and parses them for all analyses. */
+	void parse( const PacketView *packets, size_t count,
+	  Records &records ) const;
+
+	/*! @brief Same for all the analyses. */
+	unsigned shardCount() const;
+
+	void store( const Records &records, unsigned shard );
+
+	/*! @brief Starts detection in all analyses. */
+	void detect();
+
+	/*! @brief Blocks until detection is complete in all analyses. */
+	void finish();
+
+	/*!
+	 * @brief Passes the packets that fail to decode to a sampler.
+	 * @param sampler Sampler shared with other sets, NULL for none.
+	 */
+	void setSampler( FailureSampler *sampler )
+		{ mSampler = sampler; }
+
+protected:
+	typedef ::std::vector<Analysis *> Analyses;
+	typedef ::std::vector<IRecordStorage *> Storages;
+	typedef ::std::vector<PacketRecord> Decoded;
+
+	/*! @brief Records of all the storages, in mStorages order. */
+	class SetRecords: public Records {
+	public:
+		~SetRecords();
+
+		/*! @brief The decoded packets. */
+		Decoded decoded;
+		/*! @brief Records of the individual storages. */
+		::std::vector<Records *> parts;
+	};
+
+	/*!
+	 * @brief Decodes packets, as far as the storages need.
+	 * @param packets Packets to decode.
+	 * @param count Number of packets.
+	 * @param decoded Receives a record for every packet.
+	 */
+	void decode( const PacketView *packets, size_t count,
+	  Decoded &decoded ) const;
+
+	Analyses mAnalyses; /*!< @brief Analyses in policyType order. */
+	Storages mStorages; /*!< @brief Their storages, cached. */
+	Decoded mDecoded;   /*!< @brief Records of addPackets(). */
+	/*! @brief PacketRecord::Need flags of all mStorages. */
+	unsigned mNeed;
+	/*! @brief Sampler of failed packets, NULL for none. */
+	FailureSampler *mSampler;
+
+private:
+	/*! @brief DO NOT COPY! */
+	AnalysisSet( const AnalysisSet & );
+
+	/*! @brief DO NOT COPY! */
+	AnalysisSet & operator = ( const AnalysisSet & );
+};
+/* ------------------------------------------------------------------------- */
+/* IMPLEMENTATION */
+/* ------------------------------------------------------------------------- */
+template<typename POLICY>
+void PolicyAnalysis<POLICY>::detect()
+{
+	/* Make sure there is only relevant data, merge the shards. */
+	mStorage.sync();
+
+	/* Analyse stored data. - Creates and runs all the Engines. */
+	TDetector *detector = new TDetector(
+	  mStorage, mOpt.hash_count, mOpt.sketch_count,
+	  mOpt.aggregation_count, mOpt.detection_threshold,
+	  mOpt.aggregate, mOpt.analysed_parameter,
+	  mOpt.gnuplot_anomalies_dir,
+#ifdef GNUPLOT_INTERMED
+	  mOpt.gnuplot_intermediate_dir,
+#else
+	  NULL,
+#endif
+	  mLabel.empty() ? NULL : mLabel.c_str()
+	);
+
+	/* Collects result from the Engines. */
+	ThreadPool::globalInstance().addJob( detector );
+	mDetectors.push_back( detector );
+
+	/* Remove finished detectors. */
+	while (!mDetectors.empty() && mDetectors.front()->done()) {
+		delete mDetectors.front();
+		mDetectors.pop_front();
+	}
+}
+/* ------------------------------------------------------------------------- */
+template<typename POLICY>
+void PolicyAnalysis<POLICY>::finish()
+{
+	while ( !mDetectors.empty() ) {
+		mDetectors.front()->waitForDone();
+		delete mDetectors.front();
+		mDetectors.pop_front();
+	}
+}
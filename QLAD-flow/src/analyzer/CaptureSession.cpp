@@ -21,102 +21,294 @@
 #endif
 
 #include <cassert>
+#include <cstring>
+#include <stdint.h>
 #include <ctime>
 #include <iostream>
 
 #include "CaptureSession.h"
-#include "pcap_defines.h"
+#include "capture/DnstapSource.h"
+#include "capture/MappedPcapSource.h"
+#include "capture/MergeSource.h"
+#include "capture/PcapSource.h"
+#include "capture/ReorderSource.h"
+#include "capture/RingSource.h"
+#include "capture/SharedRingSource.h"
 
-extern const unsigned char IPOffsetTable[];
-
-CaptureSession & CaptureSession::instance()
+bool CaptureSession::openOffline( const ::std::vector< ::std::string > &files,
+  const char *filter, unsigned max_open )
 {
-	static CaptureSession static_instance;
-	return static_instance;
+	assert( !mSource );
+	assert( !files.empty() );
+
+	if (files.size() == 1
+	  && MappedPcapSource::suitable( files.front().c_str() )) {
+		MappedPcapSource *source = new MappedPcapSource();
+		mSource = source;
+		if (!source->open( files.front().c_str(), filter ))
+			{ close(); return false; }
+	} else if (files.size() == 1) {
+		PcapSource *source = new PcapSource();
+		mSource = source;
+		if (!source->open( files.front().c_str(), filter ))
+			{ close(); return false; }
+	} else {
+		MergeSource *source = new MergeSource( max_open );
+		mSource = source;
+		if (!source->open( files, filter ))
+			{ close(); return false; }
+	}
+
+	if (!prepare())
+		{ close(); return false; }
+	return true;
 }
 /* ------------------------------------------------------------------------- */
-bool CaptureSession::openOffline( const char *file, const char *filter )
+bool CaptureSession::openLive( const char *interface, const char *filter )
 {
-	assert( !mInterface );
-
-	struct bpf_program filter_program;
+	assert( !mSource );
+	assert( interface );
 
-	char errbuff[PCAP_ERRBUF_SIZE];
-	mInterface = pcap_open_offline( file, errbuff );
-	if (!mInterface) {
-		std::cerr << "Failed to open file " << file
-			<< " " << errbuff << std::endl;
-		return false;
-	}
+	RingSource *source = new RingSource();
+	mSource = source;
+	if (!source->open( interface, filter ))
+		{ close(); return false; }
 
-	mIPOffset = IPOffsetTable[pcap_datalink( mInterface )];
-	int res = pcap_compile( mInterface, &filter_program, filter,
-	  PCAP_FILTER_OPTIMIZE, PCAP_NETMASK_UNKNOWN );
-	if (res) {
-		std::cerr << "Failed to compile filter " << filter
-		  << " " << errbuff << std::endl;
-		return false;
-	}
+	if (!prepare())
+		{ close(); return false; }
+	return true;
+}
+/* ------------------------------------------------------------------------- */
+bool CaptureSession::openRing( const char *name, const char *filter )
+{
+	assert( !mSource );
+	assert( name );
 
-	res = pcap_setfilter( mInterface, &filter_program );
+	SharedRingSource *source = new SharedRingSource();
+	mSource = source;
+	if (!source->open( name, filter ))
+		{ close(); return false; }
 
-	/* pcap documentation is not exactly verbose about this, but
-	 * pcap_compile makes a copy of the filter, therefore we should
-	 * free our copy in all cases. */
-	pcap_freecode( &filter_program );
+	if (!prepare())
+		{ close(); return false; }
+	return true;
+}
+/* ------------------------------------------------------------------------- */
+bool CaptureSession::openDnstap( const char *path, const char *filter )
+{
+	assert( !mSource );
+	assert( path );
 
-	if (res) {
-		std::cerr << "Failed to set filter " << filter
-		  << " " << errbuff << std::endl;
-		return false;
-	}
+	DnstapSource *source = new DnstapSource();
+	mSource = source;
+	if (!source->open( path, filter ))
+		{ close(); return false; }
 
+	if (!prepare())
+		{ close(); return false; }
 	return true;
 }
 /* ------------------------------------------------------------------------- */
 void CaptureSession::close()
 {
-	assert( mInterface );
-	pcap_close( mInterface );
-	mInterface = NULL;
+	assert( mSource );
+	delete mSource;
+	mSource = NULL;
+
+	if (mTcp && (mTcp->evicted() || mTcp->gaps())) {
+		std::cerr << "DNS over TCP: " << mTcp->evicted()
+		  << " flows evicted, " << mTcp->gaps()
+		  << " gaps in flows" << std::endl;
+	}
+	delete mTcp;
+	mTcp = NULL;
+
+	if (mFragments && (mFragments->reassembled() || mFragments->evicted()
+	  || mFragments->expired() || mFragments->invalid())) {
+		std::cerr << "IP fragments: " << mFragments->reassembled()
+		  << " datagrams reassembled, " << mFragments->evicted()
+		  << " evicted, " << mFragments->expired()
+		  << " timed out, " << mFragments->invalid() << " invalid"
+		  << std::endl;
+	}
+	delete mFragments;
+	mFragments = NULL;
+
+	if (mOutOfOrder) {
+		std::cerr << mOutOfOrder << " packets out of time order, "
+		  << mIgnored << " of them older than their window were "
+		  "ignored" << std::endl;
+	}
 }
 /* ------------------------------------------------------------------------- */
 void CaptureSession::startCapture( IStorage *storage, unsigned interval )
 {
-	assert( mInterface );
-	SessionParams current = { storage, interval, mIPOffset };
-	pcap_loop( mInterface, PCAP_INFINITE_COUNT, capture,
-	  reinterpret_cast<u_char *>( &current ) );
+	assert( mSource );
+	assert( storage );
+
+	for (;;) {
+		if (mBatchNext == mBatchSize) {
+			mBatchSize = mSource->nextBatch( mBatch, BATCH_SIZE );
+			mBatchNext = 0;
+			if (mBatchSize == 0) {
+				mExhausted = true;
+				return;
+			}
+		}
+
+		if (!mStarted) {
+			mWindowStart = mBatch[0].header.ts.tv_sec;
+			mStarted = true;
+		}
+
+		const time_t end = mWindowStart + (time_t) interval;
+		for (; mBatchNext < mBatchSize; ++mBatchNext) {
+			const PacketSource::Packet &packet = mBatch[mBatchNext];
+
+			/* Window complete, keep the rest for the next one. */
+			if (packet.header.ts.tv_sec >= end) {
+				flush( storage );
+				mWindowStart = packet.header.ts.tv_sec;
+				return;
+			}
+
+			queue( storage, packet );
+		}
+		flush( storage );
+	}
 }
 /* ------------------------------------------------------------------------- */
-void CaptureSession::stopCapture()
+bool CaptureSession::prepare()
 {
-	assert( mInterface );
-	pcap_breakloop( mInterface );
+	if (mReorderLatency) {
+		mSource = new ReorderSource( mSource, mReorderLatency,
+		  mReorderPackets );
+	}
+
+	/* messages come without link and IP headers */
+	const int link = mSource->datalink();
+	mFormat = link == PacketSource::LINK_MESSAGE
+	  ? IStorage::DNS_MESSAGE : IStorage::IP_PACKET;
+	mDecoder = LinkDecoder( link );
+	if (mTcpMemory && mFormat == IStorage::IP_PACKET)
+		{ mTcp = new TcpReassembler( mTcpMemory ); }
+	if (mFragmentMemory && mFormat == IStorage::IP_PACKET)
+		{ mFragments = new FragmentReassembler( mFragmentMemory ); }
+	mExhausted = false;
+	mStarted = false;
+	mLatest = 0;
+	mOutOfOrder = mIgnored = 0;
+	mBatchSize = mBatchNext = 0;
+	mViewCount = 0;
+	mScratchUsed = 0;
+
+	if (mFormat == IStorage::IP_PACKET && !LinkDecoder::supported( link )) {
+		std::cerr << "Unsupported link type " << link << std::endl;
+		return false;
+	}
+	return true;
 }
 /* ------------------------------------------------------------------------- */
-void CaptureSession::capture( u_char *arg, const pcap_pkthdr *header,
-  const u_char *packet )
+void CaptureSession::queue( IStorage *storage,
+  const PacketSource::Packet &packet )
 {
-	assert( arg );
-	assert( header );
-	assert( packet );
+	const pcap_pkthdr &header = packet.header;
 
-	const SessionParams *params = reinterpret_cast<SessionParams*>( arg );
+	/* The flows keep only packets in chronological order. */
+	if ( header.ts.tv_sec < mLatest ) {
+		++mOutOfOrder;
+		if ( header.ts.tv_sec < mWindowStart )
+			{ ++mIgnored; return; }
+	} else {
+		mLatest = header.ts.tv_sec;
+	}
+	/* TCP segments may add several views */
+	if ( mViewCount == BATCH_SIZE )
+		flush( storage );
 
-	static time_t start_time = header->ts.tv_sec;
-	/* One packet is not statistically significant, we may ignore it. */
-	if (header->ts.tv_sec >= (start_time + (time_t)params->interval) ) {
-		CaptureSession::instance().stopCapture();
-		start_time = header->ts.tv_sec;
+	IStorage::PacketView view =
+	  { NULL, header.caplen, header.ts.tv_sec, mFormat, PacketMeta() };
+	size_t offset = 0;
+	if ( mFormat == IStorage::IP_PACKET ) {
+		/* nothing but the link header or not IP */
+		if ( !mDecoder.decode( packet.data, header.caplen, offset,
+		  view.meta ) )
+			{ return; }
+		view.size = view.meta.length;
+	}
+
+	const u_char *ip = packet.data + offset;
+	bool reassembled = false;
+	if ( mFragments && view.meta.fragment ) {
+		/* the last fragment of a datagram stands for all of them */
+		ip = mFragments->add( ip, view.meta, header.ts.tv_sec );
+		if ( !ip )
+			return;
+		view.size = view.meta.length;
+		reassembled = true;
+	}
+
+	if ( mTcp && TcpReassembler::accepts( ip, view.meta ) ) {
+		queueMessages( storage, ip, view );
 		return;
 	}
-	/* Create copy, to free pcap buffer */
-	const IStorage::PacketData data(
-	  reinterpret_cast<const char *>( packet ) + params->offset,
-	  header->caplen - params->offset );
-
-	//ignore packet not in chronological order
-	if ( header->ts.tv_sec < start_time ) return;
-	params->storage->addPacket( data, header->ts.tv_sec );
+
+	/* Hand the capture buffer over directly, the storage parses it in
+	 * place and does not keep any reference past the flush. */
+	const char *data = reinterpret_cast<const char *>( ip );
+	const size_t size = view.size;
+
+	/* The parsers need 2-byte alignment, which records in a mapped
+	 * file do not have. A reassembled datagram is overwritten by the
+	 * next one. */
+	if (reassembled || reinterpret_cast<uintptr_t>( data ) % 2) {
+		char *copy = reserve( storage, size );
+		memcpy( copy, data, size );
+		data = copy;
+	}
+
+	view.data = data;
+	mViews[mViewCount++] = view;
+}
+/* ------------------------------------------------------------------------- */
+void CaptureSession::queueMessages( IStorage *storage, const u_char *ip,
+  const IStorage::PacketView &packet )
+{
+	MessageRecord record;
+	const unsigned count = mTcp->add( ip, packet.meta, record );
+
+	for (unsigned i = 0; i < count; ++i) {
+		const TcpReassembler::Message &message = mTcp->message( i );
+		if (mViewCount == BATCH_SIZE)
+			{ flush( storage ); }
+
+		const size_t size = sizeof( record ) + message.size;
+		char *copy = reserve( storage, size );
+		memcpy( copy, &record, sizeof( record ) );
+		memcpy( copy + sizeof( record ), message.data, message.size );
+
+		const IStorage::PacketView view = { copy, size, packet.arrival,
+		  IStorage::DNS_MESSAGE, PacketMeta() };
+		mViews[mViewCount++] = view;
+	}
+}
+/* ------------------------------------------------------------------------- */
+char * CaptureSession::reserve( IStorage *storage, size_t size )
+{
+	if (mScratchUsed + size > mScratch.size()) {
+		flush( storage );
+		if (size > mScratch.size())
+			{ mScratch.resize( size ); }
+	}
+	char *copy = &mScratch[mScratchUsed];
+	mScratchUsed += (size + 1) & ~(size_t)1;
+	return copy;
+}
+/* ------------------------------------------------------------------------- */
+void CaptureSession::flush( IStorage *storage )
+{
+	if (mViewCount)
+		{ storage->addPackets( mViews, mViewCount ); }
+	mViewCount = 0;
+	mScratchUsed = 0;
 }
@@ -22,109 +22,271 @@
 #include "config.h"
 #endif
 
-#include <pcap.h>
+#include <ctime>
+#include <string>
+#include <vector>
 
+#include "capture/LinkDecoder.h"
+#include "capture/FragmentReassembler.h"
+#include "capture/PacketSource.h"
+#include "capture/TcpReassembler.h"
 #include "IStorage.h"
 
 
 /*!
  * @class CaptureSession CaptureSession.h "CaptureSession.h"
- * @brief Pcap API wrapper class.
+ * @brief Capture input wrapper class.
  *
- * CaptureSession is a singleton providing interface for currently
- * prepared/running capture from pcap capture file.
+ * CaptureSession provides interface for currently prepared/running
+ * capture from pcap capture files, from a network interface, from the
+ * shared memory ring of dnsdump or from dnstap writers. Several files are
+ * merged in time-stamp order in-process.
+ *
+ * All the capture state belongs to the instance, so independent sessions
+ * may run on separate threads, each feeding its own storage.
  */
 class CaptureSession
 {
 public:
+	/*! @brief Default contructor, zeroes members. */
+	CaptureSession(): mSource( NULL ),
+	  mFormat( IStorage::IP_PACKET ), mReorderLatency( 0 ),
+	  mReorderPackets( 0 ), mTcp( NULL ), mTcpMemory( 0 ),
+	  mFragments( NULL ), mFragmentMemory( 0 ),
+	  mExhausted( false ), mStarted( false ),
+	  mWindowStart( 0 ), mLatest( 0 ), mOutOfOrder( 0 ), mIgnored( 0 ),
+	  mBatchSize( 0 ), mBatchNext( 0 ), mViewCount( 0 ),
+	  mScratch( SCRATCH_SIZE ), mScratchUsed( 0 ) {};
+
+	/*! @brief Closes the session if still opened. */
+	~CaptureSession()
+		{ if (mSource) { close(); } }
+
+	/*!
+	 * @brief Puts the packets of the following sessions in time order.
+	 * @param latency Longest disorder put right, in milliseconds, 0
+	 * delivers the packets as read
+	 * @param max_packets Maximum number of packets held for reordering
+	 *
+	 * Takes effect on the next open, see ReorderSource.
+	 */
+	void setReorder( unsigned latency, unsigned max_packets )
+		{ mReorderLatency = latency; mReorderPackets = max_packets; }
+
+	/*!
+	 * @brief Reassembles DNS messages sent over TCP in the following
+	 * sessions.
+	 * @param memory Upper bound on the memory of the TCP flows in
+	 * bytes, 0 stores the TCP segments as any other packets
+	 *
+	 * Takes effect on the next open, see TcpReassembler. The messages
+	 * are stored as IStorage::DNS_MESSAGE instead of their segments.
+	 */
+	void setTcpMemory( size_t memory )
+		{ mTcpMemory = memory; }
+
+	/*!
+	 * @brief Reassembles fragmented IP datagrams in the following
+	 * sessions.
+	 * @param memory Upper bound on the memory of the fragments in
+	 * bytes, 0 skips the fragments
+	 *
+	 * Takes effect on the next open, see FragmentReassembler.
+	 */
+	void setFragmentMemory( size_t memory )
+		{ mFragmentMemory = memory; }
+
+	/*!
+	 * @brief Attempts to open files as pcap capture files.
+	 * @param files Paths to the files to open, "-" for stdin
+	 * @param filter Pcap filter expression to apply
+	 * @param max_open Maximum number of files opened at once
+	 * @return true on success, false on failure
+	 *
+	 * Initializes mSource (expects it to be uninitialized) and
+	 * mDecoder based on the datalink type of the input. A single file
+	 * is read directly, mapped into memory if it is an uncompressed
+	 * pcap file, more files are merged by a MergeSource.
+	 * On error returns false and prints human readable text on stderr.
+	 * If the session is already opened the results are undefined.
+	 */
+	bool openOffline( const ::std::vector< ::std::string > &files,
+	  const char *filter, unsigned max_open );
+
+	/*!
+	 * @brief Attempts to capture live traffic of a network interface.
+	 * @param interface Name of the interface, "any" for all of them
+	 * @param filter Pcap filter expression to apply
+	 * @return true on success, false on failure
+	 *
+	 * Packets are read from a ring shared with the kernel, see
+	 * RingSource. The capture goes on until PacketSource::stop().
+	 * On error returns false and prints human readable text on stderr.
+	 * If the session is already opened the results are undefined.
+	 */
+	bool openLive( const char *interface, const char *filter );
+
 	/*!
-	 * @brief Gets global instance.
-	 * @return Reference to global instance
+	 * @brief Attempts to consume packets published by dnsdump.
+	 * @param name Name of the shared memory ring
+	 * @param filter Pcap filter expression to apply
+	 * @return true on success, false on failure
 	 *
-	 * Standard singleton function to access the instance.
+	 * See SharedRingSource. The capture goes on until dnsdump closes
+	 * the ring or until PacketSource::stop().
+	 * On error returns false and prints human readable text on stderr.
+	 * If the session is already opened the results are undefined.
 	 */
-	static CaptureSession & instance();
+	bool openRing( const char *name, const char *filter );
 
 	/*!
-	 * @brief Attempts to open file as pcap capture file.
-	 * @param file Path to the file to open
+	 * @brief Attempts to receive dnstap messages from name servers.
+	 * @param path Unix socket to listen on
+	 * @param filter Pcap filter expression, only the query and response
+	 * filters are supported
 	 * @return true on success, false on failure
 	 *
-	 * Initializes mInterface (expects it to be uninitialized) and
-	 * mIPOffset based on the datalink type of the mInterface.
+	 * The messages are stored without their packets, see DnstapSource.
+	 * The capture goes on until PacketSource::stop().
 	 * On error returns false and prints human readable text on stderr.
 	 * If the session is already opened the results are undefined.
 	 */
-	bool openOffline( const char *file, const char *filter );
+	bool openDnstap( const char *path, const char *filter );
 
 	/*!
 	 * @brief Closes opened session
 	 *
-	 * Correctly closes internal pcap handle.
+	 * Correctly closes the input and reports the packets found out of
+	 * time order.
 	 * If the session was not opened the results are undefined.
 	 */
 	void close();
 
 	/*!
-	 * @brief Starts capture using the provided callback.
+	 * @brief Captures packets into the storage.
 	 * @param storage Will use this storage to store packets
 	 * @param interval Time span of the communication to capture
 	 *
-	 * Wrapper for pcap_loop with infinite count.
+	 * Returns when a packet arrives interval seconds or more after the
+	 * start of the current window, or at the end of the input. The packet
+	 * crossing the window boundary starts the next window and is stored
+	 * by the next call. Packets are fetched and stored in batches.
 	 */
 	void startCapture( IStorage *storage, unsigned interval );
 
-	/*!
-	 * @brief Stops running capture.
-	 *
-	 * Wrapper for pcap_breakloop.
-	 */
-	void stopCapture();
-
 	/*!
 	 * @brief Checks whether starting a capture is possible.
 	 * @return true if the session is properly opened and there is data
 	 * to be read, false otherwise;
 	 *
-	 * Checks whether mInterface is not NULL, and there is still
-	 * something to get from the opened file.
+	 * Checks whether mSource is not NULL, and there is still
+	 * something to get from it.
 	 */
 	bool canCapture()
-		{ return mInterface && !feof( pcap_file( mInterface ) ); };
+		{ return mSource && !mExhausted; };
 
 protected:
-	/*! @brief Pointer to pcap structure used for capture */
-	pcap_t *mInterface;
-	/*! @brief Offset of the IP header, in bytes */
-	unsigned mIPOffset;
-
-	/*! @brief Parameters used in one capture session */
-	struct SessionParams {
-		/*! @brief Place to store the packets. */
-		IStorage * storage;
-		/*! @brief Max time between the first and the last packet. */
-		unsigned interval;
-		/*! @brief Size of the link header. */
-		unsigned offset;
+	enum {
+		BATCH_SIZE = 256,           /*!< @brief Packets per batch. */
+		SCRATCH_SIZE = 256 * 1024   /*!< @brief Initial size of
+		                                mScratch. */
 	};
 
+	/*! @brief Source of the captured packets */
+	PacketSource *mSource;
+	/*! @brief Finds the IP header of packets. */
+	LinkDecoder mDecoder;
+	/*! @brief Kind of data delivered by mSource. */
+	IStorage::Format mFormat;
+	/*! @brief Reorder latency in milliseconds, 0 for none. */
+	unsigned mReorderLatency;
+	/*! @brief Maximum number of packets held for reordering. */
+	unsigned mReorderPackets;
+	/*! @brief Reassembles DNS over TCP, NULL for none. */
+	TcpReassembler *mTcp;
+	/*! @brief Memory limit of mTcp, 0 for no reassembly. */
+	size_t mTcpMemory;
+	/*! @brief Reassembles IP fragments, NULL for none. */
+	FragmentReassembler *mFragments;
+	/*! @brief Memory limit of mFragments, 0 for no reassembly. */
+	size_t mFragmentMemory;
+
+	/*! @brief The input has no more packets. */
+	bool mExhausted;
+	/*! @brief The first window has started. */
+	bool mStarted;
+	/*! @brief Time-stamp of the start of the current window. */
+	time_t mWindowStart;
+	/*! @brief Latest second of the captured packets. */
+	time_t mLatest;
+	/*! @brief Packets from an earlier second than a previous one. */
+	unsigned long mOutOfOrder;
+	/*! @brief Out of order packets older than their window. */
+	unsigned long mIgnored;
+
+	/*! @brief Packets fetched from mSource. */
+	PacketSource::Packet mBatch[BATCH_SIZE];
+	/*! @brief Number of packets in mBatch. */
+	unsigned mBatchSize;
+	/*! @brief First packet of mBatch not handled yet. */
+	unsigned mBatchNext;
+
+	/*! @brief Packets prepared for the storage. */
+	IStorage::PacketView mViews[BATCH_SIZE];
+	/*! @brief Number of prepared packets in mViews. */
+	unsigned mViewCount;
+	/*! @brief Aligned copies of misaligned packets. */
+	::std::vector<char> mScratch;
+	/*! @brief Used part of mScratch. */
+	size_t mScratchUsed;
+
 	/*!
-	 * @brief Function to call on every packet, follows pcap interface.
-	 * @param arg User structure (pointer to SessionParams)
-	 * @param header Pointer to the pcap header
-	 *               (packet time-stamp and length)
-	 * @param data Pointer to the captured packet data (pcap buffer)
+	 * @brief Resets the capture state for the newly opened mSource.
+	 * @return false if the link type of mSource is not supported.
+	 */
+	bool prepare();
+
+	/*!
+	 * @brief Prepares one packet for the storage.
+	 * @param storage Place to store the packet
+	 * @param packet Packet read from mSource
 	 *
-	 * Reads packet data to IStorage::PacketData.
-	 * Checks time and calls stopCapture() if arrival time of a new packet
-	 * is later than allowed by interval parameter. The last packet
-	 * is lost.
+	 * Decodes the link and tunnel headers of the packet and adds
+	 * IStorage::PacketView of the IP packet to mViews, without copying
+	 * it out of the capture buffer unless the IP header is not aligned
+	 * to 2 bytes. Packets without an IP header are skipped. Packets out of order are counted, those older
+	 * than the current window are ignored. Fragments are passed to
+	 * mFragments, a complete datagram is copied and queued in their
+	 * place. DNS over TCP segments are passed to mTcp instead, see
+	 * queueMessages().
 	 */
-	static void capture( u_char *arg, const pcap_pkthdr *header,
-	  const u_char *data );
+	void queue( IStorage *storage, const PacketSource::Packet &packet );
 
-	/*! @brief Default contructor, zeroes members. */
-	CaptureSession(): mInterface( NULL ), mIPOffset( 0 ) {};
+	/*!
+	 * @brief Prepares the messages completed by a TCP segment.
+	 * @param storage Place to store the messages
+	 * @param ip The IP packet of the segment
+	 * @param packet View of the segment
+	 *
+	 * Copies every message after a MessageRecord with the addresses of
+	 * the segment and adds them to mViews as IStorage::DNS_MESSAGE.
+	 */
+	void queueMessages( IStorage *storage, const u_char *ip,
+	  const IStorage::PacketView &packet );
+
+	/*!
+	 * @brief Takes aligned space of mScratch.
+	 * @param storage Place to store the packets, if mScratch is full
+	 * @param size Bytes needed
+	 * @return Space for a copy valid until the next flush().
+	 */
+	char * reserve( IStorage *storage, size_t size );
+
+	/*!
+	 * @brief Hands the prepared packets over to the storage.
+	 * @param storage Place to store the packets
+	 */
+	void flush( IStorage *storage );
 
 private:
 	/*! @brief Copy-constructor, FORBIDDEN */
@@ -25,14 +25,25 @@
 #include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 
 #include "Engine.h"
+#include "log/Log.h"
 #include "proc/ThreadPool.h"
+#include "sync/Mutex.h"
+#include "sync/MutexLocker.h"
 #include "sync/Signaler.h"
 #include "Storage.h"
 #include "statistics/GammaParameters.h"
 #include "GnuPlot.h"
 
+/*!
+ * @brief Serializes output of concurrently running detectors.
+ * @return Mutex shared by detectors of all policies.
+ */
+inline Mutex & detectorOutputGuard()
+	{ static Mutex guard; return guard; }
+
 /*!
  * @class Detector Detector.h "Detector.h"
  * @brief Engine creation and final detection class.
@@ -62,6 +73,8 @@ public:
 	 * gnuplot files that graph the anomalies
 	 * @param gnuplot_intermediate_dir not NULL iff the detector should
 	 * create gnuplot files containing intermediate data plots
+	 * @param label not NULL iff the output should be marked with the
+	 * policy, needed when several analyses share the output
 	 *
 	 * Creates Engines that will use the storage data, and adds them to the
 	 * global ThreadPool.
@@ -75,14 +88,16 @@ public:
 	  unsigned (*aggregate)(unsigned),
 	  GammaParameters::type analysed_parameter,
 	  const char * gnuplot_anomalies_dir,
-	  const char * gnuplot_intermediate_dir
+	  const char * gnuplot_intermediate_dir,
+	  const char * label = NULL
 	);
 
 	/*!
 	 * @brief Uses results of engines' analysis to detect anomalies.
 	 *
-	 * Waits for engines to finish analysis. Sets done indicator when
-	 * finished.
+	 * Waits for engines to finish analysis. Logs the packets the
+	 * policy discarded since the previous detection. Sets done
+	 * indicator when finished.
 	 */
 	void run();
 
@@ -110,6 +125,15 @@ protected:
 	 *  data. */
 	const char * mGnuplotIntermediateDir;
 
+	/*! @brief Policy label of the output, NULL for none. */
+	const char * mLabel;
+
+	/*!
+	 * @brief Logs the discarded packets by their reason.
+	 * @param end_time End of the window, as printed.
+	 */
+	void logFailures( const char *end_time ) const;
+
 private:
 	/*! @brief DO NOT COPY! */
 	Detector( const Detector & );
@@ -130,11 +154,13 @@ Detector<POLICY>::Detector(
   unsigned (*aggregate)( unsigned ),
   GammaParameters::type analysed_parameter,
   const char * gnuplot_anomalies_dir,
-  const char * gnuplot_intermediate_dir
+  const char * gnuplot_intermediate_dir,
+  const char * label
 )
 : mDone( false ), mStorage( storage ),
   mGnuplotAnomaliesDir( gnuplot_anomalies_dir ),
-  mGnuplotIntermediateDir (gnuplot_intermediate_dir )
+  mGnuplotIntermediateDir (gnuplot_intermediate_dir ),
+  mLabel( label )
 {
 	for (unsigned i = 0; i < hash_iterations; ++i) {
 		TEngine engine( i, mStorage, sketch_count,
@@ -183,23 +209,32 @@ void Detector<POLICY>::run()
 		anomalies.swap( tmp );
 	}
 
+	const time_t start_time = mStorage.startTime();
+	const time_t end_time = mStorage.endTime();
+
+	/* man page says that 26B is enough */
+	char time_string_start[26];
+	char time_string_stop[26];
+	ctime_r( &start_time, time_string_start );
+	ctime_r( &end_time, time_string_stop );
+	time_string_start[24] = '\0';
+	time_string_stop[24] = '\0';
+
+	logFailures( time_string_stop );
+
 	/* output anomalies */
 	if (anomalies.size() > 0) {
-		const time_t start_time = mStorage.startTime();
-		const time_t end_time = mStorage.endTime();
-
-		/* man page says that 26B is enough */
-		char time_string_start[26];
-		char time_string_stop[26];
-		ctime_r( &start_time, time_string_start );
-		ctime_r( &end_time, time_string_stop );
-		time_string_start[24] = '\0';
-		time_string_stop[24] = '\0';
-
-		::std::cout
+
+		/* Compose the whole report first, other detectors may be
+		 * writing theirs at the same time. */
+		::std::ostringstream report;
+		report
 		  << "From: " << time_string_start
 		  << "\nTo: " << time_string_stop
-		  << "\n\tfound anomalies (" << anomalies.size() << " / "
+		  << "\n\tfound anomalies ";
+		if ( mLabel != NULL )
+			{ report << "[" << mLabel << "] "; }
+		report << "(" << anomalies.size() << " / "
 		  << mStorage.size() << ") : ";
 		typename AnomalySet::const_iterator it;
 
@@ -208,18 +243,24 @@ void Detector<POLICY>::run()
 
 		for (it = anomalies.begin(); it != anomalies.end(); ++it) {
 			if (it != anomalies.begin())
-				{ ::std::cout << ", "; }
-			::std::cout << *it;
+				{ report << ", "; }
+			report << *it;
 			plotter.addAnomaly(&(*it), &mStorage.at(*it));
 		}
 
-		::std::cout << ::std::endl;
+		report << "\n";
+		{
+			MutexLocker lock( detectorOutputGuard() );
+			::std::cout << report.str() << ::std::flush;
+		}
 
 		if ( mGnuplotAnomaliesDir != NULL )
 		{
 			::std::ostringstream name;
-			name << mGnuplotAnomaliesDir << "/"
-			  << time_string_start << ".gp";
+			name << mGnuplotAnomaliesDir << "/";
+			if ( mLabel != NULL )
+				{ name << mLabel << "-"; }
+			name << time_string_start << ".gp";
 			::std::ofstream file(name.str().c_str());
 			plotter.plot(file,
 			  ::std::string(time_string_start) + ".png", true);
@@ -227,3 +268,27 @@ void Detector<POLICY>::run()
 	}
 	mDone = true;
 }
+/* ------------------------------------------------------------------------- */
+template<typename POLICY>
+void Detector<POLICY>::logFailures( const char *end_time ) const
+{
+	const FailureCounts &failures = mStorage.failures();
+	if (failures.total() == 0)
+		{ return; }
+
+	::std::ostringstream line;
+	line << "To: " << end_time << " discarded packets ";
+	if ( mLabel != NULL )
+		{ line << "[" << mLabel << "] "; }
+	line << "(" << failures.total() << " / " << failures.packets
+	  << ") :";
+	const char *separator = " ";
+	for (unsigned i = 0; i < PacketRecord::FAILURE_COUNT; ++i) {
+		if (failures.discarded[i] == 0)
+			{ continue; }
+		line << separator << PacketParser::FAILURES[i] << " "
+		  << failures.discarded[i];
+		separator = ", ";
+	}
+	GlobalLog.logAnalyzerInfo( "%s\n", line.str().c_str() );
+}
@@ -129,7 +129,7 @@ GnuPlot::GnuPlot( unsigned seq, ::std::string dir, const Engine<POLICY> &eng )
 	mInput = itmp.str();
 }
 /* ------------------------------------------------------------------------- */
-GnuPlot::~GnuPlot()
+inline GnuPlot::~GnuPlot()
 {
 	::std::ofstream fGpi( ( mDir + mInput + ".gpi" ).c_str() );
 
@@ -161,14 +161,14 @@ GnuPlot::~GnuPlot()
 	fGpi << "\nunset multiplot" << ::std::endl;
 }
 /* ------------------------------------------------------------------------- */
-::std::string GnuPlot::fileIteration( unsigned index )
+inline ::std::string GnuPlot::fileIteration( unsigned index )
 {
 	::std::ostringstream name;
 	name << mDir << mInput << ".h" << index << ".gpi";
 	return name.str();
 }
 /* ------------------------------------------------------------------------- */
-::std::string GnuPlot::fileSketches( unsigned index, unsigned aggregation )
+inline ::std::string GnuPlot::fileSketches( unsigned index, unsigned aggregation )
 {
 	::std::ostringstream name;
 	name << mDir << mInput << ".h" << index << ".a" << aggregation <<
@@ -176,7 +176,7 @@ GnuPlot::~GnuPlot()
 	return name.str();;
 }
 /* ------------------------------------------------------------------------- */
-::std::string GnuPlot::fileDistances( unsigned index )
+inline ::std::string GnuPlot::fileDistances( unsigned index )
 {
 	::std::ostringstream name;
 	name << mDir << mInput << ".h" << index << ".d.txt";
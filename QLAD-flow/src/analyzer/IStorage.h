@@ -22,8 +22,11 @@
 #include "config.h"
 #endif
 
+#include <cstddef>
 #include <ctime>
-#include <string>
+
+#include "capture/LinkDecoder.h"
+#include "policies/PacketRecord.h"
 
 /*!
  * @class IStorage IStorage.h "IStorage.h"
@@ -31,13 +34,137 @@
  */
 class IStorage {
 public:
-	/*! @brief Exports used data type. */
-	typedef ::std::string PacketData;
+	/*! @brief Kinds of data referenced by a PacketView. */
+	enum Format {
+		IP_PACKET = 0,   /*!< @brief IPv4 or IPv6 packet. */
+		DNS_MESSAGE      /*!< @brief MessageRecord followed by the
+		                     DNS message, no packet headers. */
+	};
+
+	/*!
+	 * @struct PacketView IStorage.h "IStorage.h"
+	 * @brief Non-owning reference to a packet in the capture buffer.
+	 *
+	 * The referenced bytes are only valid for the duration of the
+	 * addPacket() call, implementations must not keep the pointer.
+	 */
+	struct PacketView {
+		const char *data; /*!< @brief Start of the IP header. */
+		size_t size;      /*!< @brief Number of bytes available. */
+		time_t arrival;   /*!< @brief Time of packet arrival. */
+		Format format;    /*!< @brief Kind of data. */
+		PacketMeta meta;  /*!< @brief Layout of an IP_PACKET. */
+	};
+
+	virtual ~IStorage() {}
 
 	/*!
 	 * @brief Adds a new packet.
-	 * @param data Packet to add.
-	 * @param arrival Time of packet arrival.
+	 * @param packet Packet to add, parsed in place.
 	 */
-	virtual void addPacket( const PacketData &data, const time_t arrival ) = 0;
+	virtual void addPacket( const PacketView &packet ) = 0;
+
+	/*!
+	 * @brief Adds several packets in their arrival order.
+	 * @param packets Packets to add, parsed in place.
+	 * @param count Number of packets.
+	 */
+	virtual void addPackets( const PacketView *packets, size_t count )
+	{
+		for (size_t i = 0; i < count; ++i)
+			{ addPacket( packets[i] ); }
+	}
+};
+
+/*!
+ * @class IStagedStorage IStorage.h "IStorage.h"
+ * @brief Storage able to parse packets separately from storing them.
+ *
+ * The storage is divided into shards. parse() only reads the storage and
+ * may run on several threads at once, it sorts the parsed records by
+ * shard. store() takes the records of one shard; every shard must be
+ * stored by a single thread in the original packet order, different
+ * shards may be stored in parallel. Together they have the same effect
+ * as addPackets().
+ */
+class IStagedStorage: public IStorage {
+public:
+	/*! @brief Storage specific results of parsing a batch of packets. */
+	class Records {
+	public:
+		virtual ~Records() {}
+	};
+
+	/*!
+	 * @brief Creates empty records for this storage.
+	 * @return New records, owned by the caller.
+	 */
+	virtual Records * createRecords() const = 0;
+
+	/*!
+	 * @brief Parses packets, does not modify the storage.
+	 * @param packets Packets to parse in place.
+	 * @param count Number of packets.
+	 * @param records Created by createRecords(), previous content is
+	 * replaced.
+	 */
+	virtual void parse( const PacketView *packets, size_t count,
+	  Records &records ) const = 0;
+
+	/*! @brief Number of independently stored shards. */
+	virtual unsigned shardCount() const = 0;
+
+	/*!
+	 * @brief Stores the parsed packets of one shard.
+	 * @param records Filled by parse().
+	 * @param shard Shard to store, less than shardCount().
+	 */
+	virtual void store( const Records &records, unsigned shard ) = 0;
+};
+
+/*!
+ * @class IRecordStorage IStorage.h "IStorage.h"
+ * @brief Storage of packets decoded into PacketRecords beforehand.
+ *
+ * The packets are decoded once no matter how many storages take them, a
+ * storage only projects its identifier out of the records. Otherwise
+ * the same as IStagedStorage, every packet comes with its record.
+ */
+class IRecordStorage {
+public:
+	typedef IStagedStorage::Records Records;
+
+	virtual ~IRecordStorage() {}
+
+	/*!
+	 * @brief Adds decoded packets in their arrival order.
+	 * @param packets Packets the records were decoded from.
+	 * @param records Record of every packet.
+	 * @param count Number of packets.
+	 */
+	virtual void addRecords( const IStorage::PacketView *packets,
+	  const PacketRecord *records, size_t count ) = 0;
+
+	/*! @brief PacketRecord::Need flags of the policy. */
+	virtual unsigned need() const = 0;
+
+	/*! @brief See IStagedStorage::createRecords(). */
+	virtual Records * createRecords() const = 0;
+
+	/*!
+	 * @brief Parses decoded packets, does not modify the storage.
+	 * @param packets Packets the records were decoded from.
+	 * @param records Record of every packet.
+	 * @param count Number of packets.
+	 * @param parsed Created by createRecords(), previous content is
+	 * replaced.
+	 */
+	virtual void parse( const IStorage::PacketView *packets,
+	  const PacketRecord *records, size_t count, Records &parsed ) const = 0;
+
+	/*! @brief See IStagedStorage::shardCount(). */
+	virtual unsigned shardCount() const = 0;
+
+	/*! @brief See IStagedStorage::store(). */
+	virtual void store( const Records &records, unsigned shard ) = 0;
 };
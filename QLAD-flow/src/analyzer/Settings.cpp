@@ -21,6 +21,7 @@
 #endif
 
 #include <getopt.h>
+#include <glob.h>
 #include <iostream>
 #include <cstdlib>
 #include <sys/stat.h>
@@ -38,11 +39,8 @@ static unsigned shift_one( unsigned i ) {
 	return 1 << i;
 }
 
-/* So that we can detect when it gets set more than once. */
-static const char *file_stdin = PCAP_STDIN;
-
-const char * const policyTypeNames[3] =
-  { "srcIP", "dstIP", "qname" };
+const char * const policyTypeNames[POLICY_TYPE_COUNT] =
+  { "srcIP", "dstIP", "qname", "composite" };
 
 Settings::Settings( int argc, char *argv[] ) :
   window_size( WINDOW_SIZE_DEFAULT ),
@@ -56,11 +54,21 @@ Settings::Settings( int argc, char *argv[] ) :
   gnuplot_intermediate_dir( NULL ),
 #endif
   aggregate( shift_one ),
-  file( file_stdin ),
+  max_open_files( MAX_OPEN_FILES_DEFAULT ),
   filter( PCAP_FILTER_NONE ),
   thread_count( sysconf(_SC_NPROCESSORS_ONLN) ),
+  parser_threads( PARSER_THREADS_DEFAULT ),
+  reorder_window( REORDER_WINDOW_DEFAULT ),
+  reorder_packets( REORDER_PACKETS_DEFAULT ),
+  tcp_memory( TCP_MEMORY_DEFAULT ),
+  fragment_memory( FRAGMENT_MEMORY_DEFAULT ),
+  qname_labels( QNAME_LABELS_DEFAULT ),
+  suffix_list( NULL ),
+  composite_key( COMPOSITE_KEY_DEFAULT ),
+  bad_packets( NULL ),
+  bad_packet_rate( BAD_PACKET_RATE_DEFAULT ),
   analysed_parameter( ANALYSED_GAMMA_PARAMETER ),
-  policy( ANALYSIS_POLICY )
+  policies( POLICY_BIT( ANALYSIS_POLICY ) )
 {
 	/* This is a hack not to have to duplicate all the member variable
 	 * initializations. To be replaced with constructor delegation once we
@@ -87,6 +95,21 @@ static struct option long_opts[] = {
 	{"thread-count", required_argument, NULL, 'T'},
 	{"analysed-gamma-parameter", required_argument, NULL, 'p'},
 	{"policy", required_argument, NULL, 'P'},
+	{"max-open-files", required_argument, NULL, 'm'},
+	{"parser-threads", required_argument, NULL, 'j'},
+	{"interface", required_argument, NULL, 'I'},
+	{"ring", required_argument, NULL, 'R'},
+	{"dnstap-socket", required_argument, NULL, 'D'},
+	{"reorder-window", required_argument, NULL, 'o'},
+	{"reorder-packets", required_argument, NULL, 'O'},
+	{"tcp-memory", required_argument, NULL, 'M'},
+	{"fragment-memory", required_argument, NULL, 'F'},
+	{"qname-labels", required_argument, NULL, 'L'},
+	{"public-suffixes", required_argument, NULL, 'S'},
+	{"composite-key", required_argument, NULL, 'k'},
+	{"bad-packets", required_argument, NULL, 'b'},
+	{"bad-packet-rate", required_argument, NULL, 'B'},
+	{"stream", required_argument, NULL, 'N'},
 	{NULL, no_argument, NULL, 0}
 };
 
@@ -116,7 +139,9 @@ static const char *desc[] = {
 	STR(DETECTION_INTERVAL_DEFAULT) "s, minimum is\n\t"
 	STR(DETECTION_INTERVAL_MIN) ")",
 
-	"\tInput file in pcap(tcpdump) format ('-' for stdin, the default)",
+	"\tInput file in pcap(tcpdump) format ('-' for stdin, the default). "
+	"May be given\n\tmore times and may be a quoted glob pattern, all the "
+	"files are merged in\n\ttime-stamp order",
 
 	"\tSketch distance limit for anomaly (float, default is "
 	STR(DETECTION_TRESHOLD_DEFAULT) ")",
@@ -139,7 +164,67 @@ static const char *desc[] = {
 	ANALYSED_GAMMA_PARAMETER_NAME_STR ")" ,
 
 	"\tSelects whether to base the analysis on the <srcIP> or the <dstIP> "
-	"or <qname> policy. (string, default is " ANALYSIS_POLICY_NAME_STR ")",
+	"or <qname>\n\tor <composite> policy. A comma separated list runs "
+	"several analyses\n\t"
+	"over a single pass of the input. (string, default is "
+	ANALYSIS_POLICY_NAME_STR ")",
+
+	"\tMaximum number of input files opened at once while merging "
+	"(integer, default\n\tis " STR(MAX_OPEN_FILES_DEFAULT) ", minimum is "
+	STR(MAX_OPEN_FILES_MIN) ")",
+
+	"\tNumber of threads parsing captured packets in parallel with the "
+	"capture (integer,\n\tdefault is " STR(PARSER_THREADS_DEFAULT)
+	", 0 parses on the capturing thread, maximum is "
+	STR(PARSER_THREADS_MAX) ")",
+
+	"\tCapture live traffic of the network interface ('any' for all of "
+	"them) instead\n\tof reading input files, until interrupted",
+
+	"\tConsume packets published by 'dnsdump -R <name>' into the shared "
+	"memory ring\n\tof the name instead of reading input files",
+
+	"\tReceive dnstap messages from name servers on the Unix socket "
+	"instead of\n\treading input files, until interrupted",
+
+	"\tPut packets up to the given time out of order back in time-stamp "
+	"order\n\t(milliseconds, default is " STR(REORDER_WINDOW_DEFAULT)
+	", 0 keeps the input order)",
+
+	"\tMaximum number of packets held for reordering (integer, default is "
+	STR(REORDER_PACKETS_DEFAULT) ",\n\tminimum is "
+	STR(REORDER_PACKETS_MIN) ")",
+
+	"\tMemory for reassembling DNS messages over TCP (MiB, default is "
+	STR(TCP_MEMORY_DEFAULT) ",\n\t0 counts the TCP segments as packets "
+	"instead)",
+
+	"\tMemory for reassembling fragmented IP datagrams (MiB, default is "
+	STR(FRAGMENT_MEMORY_DEFAULT) ",\n\t0 skips the fragments)",
+
+	"\tLabels of the query names kept by the qname policy, the public "
+	"suffix\n\tcounted as one (integer, default is "
+	STR(QNAME_LABELS_DEFAULT) ", minimum is " STR(QNAME_LABELS_MIN) ")",
+
+	"\tPublic suffix list (publicsuffix.org format) telling the suffixes "
+	"of\n\tthe query names, default is the last label",
+
+	"\tFields of the composite policy key, a comma separated list of "
+	"src, dst, qname\n\tand qtype, addresses followed by their IPv4 "
+	"and IPv6 prefix lengths\n\t(string, default is "
+	COMPOSITE_KEY_DEFAULT ")",
+
+	"\tWrite samples of the malformed DNS packets into given pcap file, "
+	"default is\n\tdisabled",
+
+	"\tMaximum number of malformed DNS packets written per second "
+	"(integer,\n\tdefault is " STR(BAD_PACKET_RATE_DEFAULT) ")",
+
+	"\tAnalyse the input as a separate stream labelled by the name "
+	"(<name>=<input>).\n\tThe input is a file pattern, "
+	"interface:<name>, ring:<name> or\n\tdnstap:<path>. "
+	"May be given more times, all streams are analysed at\n\tonce, "
+	"patterns of the same name are merged",
 
 };
 
@@ -167,7 +252,7 @@ void Settings::parse( int argc, char *argv[] )
 #ifdef GNUPLOT_INTERMED
 	  "G:"
 #endif
-	  "T:p:P:", long_opts, NULL )) != -1)
+	  "T:p:P:m:j:I:R:D:o:O:M:F:L:S:k:b:B:N:", long_opts, NULL )) != -1)
 	{
 		struct stat file_info;
 
@@ -206,11 +291,7 @@ void Settings::parse( int argc, char *argv[] )
 		case 1: /* Non-option arguments. That's what that - in
 			   optstring does. */
 		case 'f':
-			if ( file != file_stdin ) {
-				::std::cerr << "Warning: only the last input "
-				  "will be used.\n";
-			}
-			file = optarg;
+			stream( "" ).addInput( optarg );
 			break;
 
 		case 's':
@@ -336,15 +417,141 @@ void Settings::parse( int argc, char *argv[] )
 			break;
 
 		case 'P' :
-			if ( strncmp( optarg, "srcIP", 6 ) == 0) {
-				policy = srcIP;
-			} else if ( strncmp( optarg, "dstIP", 6 ) == 0) {
-				policy = dstIP;
-			} else if ( strncmp( optarg, "qname", 6 ) == 0) {
-				policy = queryName;
-			} else {
-				::std::cerr
-				  << "passed unknown policy name\n";
+			policies = 0;
+			for ( char *name = strtok( optarg, "," ); name;
+			      name = strtok( NULL, "," ) ) {
+				unsigned type = 0;
+				while ( type < POLICY_TYPE_COUNT && strcmp(
+				  name, policyTypeNames[type] ) != 0 )
+					{ ++type; }
+				if ( type == POLICY_TYPE_COUNT ) {
+					::std::cerr
+					  << "passed unknown policy name\n";
+					exit(1);
+				}
+				policies |= POLICY_BIT( type );
+			}
+			break;
+
+		case 'm' :
+			max_open_files = strtoul(optarg, &err_pos, 10);
+			if ((*err_pos != '\0') ||
+			    (static_cast<signed>(max_open_files) < 1)) {
+				::std::cerr <<
+				  "invalid max open files parameter\n";
+				exit(1);
+			}
+			break;
+
+		case 'j' :
+			parser_threads = strtoul(optarg, &err_pos, 10);
+			if ((*err_pos != '\0') ||
+			    (static_cast<signed>(parser_threads) < 0)) {
+				::std::cerr <<
+				  "invalid parser thread count parameter\n";
+				exit(1);
+			}
+			break;
+
+		case 'I' :
+			stream( "" ).interface = optarg;
+			break;
+
+		case 'R' :
+			stream( "" ).ring = optarg;
+			break;
+
+		case 'D' :
+			stream( "" ).dnstap_socket = optarg;
+			break;
+
+		case 'N' : {
+			const char *input = strchr( optarg, '=' );
+			if ( !input || input == optarg || !*++input ) {
+				::std::cerr << "invalid stream parameter\n";
+				exit(1);
+			}
+			Stream &named = stream(
+			  ::std::string( optarg, input - 1 - optarg ) );
+			if ( strncmp( input, "interface:", 10 ) == 0 )
+				named.interface = input + 10;
+			else if ( strncmp( input, "ring:", 5 ) == 0 )
+				named.ring = input + 5;
+			else if ( strncmp( input, "dnstap:", 7 ) == 0 )
+				named.dnstap_socket = input + 7;
+			else
+				named.addInput( input );
+			break;
+		}
+
+		case 'o' :
+			reorder_window = strtoul(optarg, &err_pos, 10);
+			if ((*err_pos != '\0') ||
+			    (static_cast<signed>(reorder_window) < 0)) {
+				::std::cerr <<
+				  "invalid reorder window parameter\n";
+				exit(1);
+			}
+			break;
+
+		case 'O' :
+			reorder_packets = strtoul(optarg, &err_pos, 10);
+			if ((*err_pos != '\0') ||
+			    (static_cast<signed>(reorder_packets) < 1)) {
+				::std::cerr <<
+				  "invalid reorder packets parameter\n";
+				exit(1);
+			}
+			break;
+
+		case 'M' :
+			tcp_memory = strtoul(optarg, &err_pos, 10);
+			if ((*err_pos != '\0') ||
+			    (static_cast<signed>(tcp_memory) < 0)) {
+				::std::cerr <<
+				  "invalid TCP memory parameter\n";
+				exit(1);
+			}
+			break;
+
+		case 'F' :
+			fragment_memory = strtoul(optarg, &err_pos, 10);
+			if ((*err_pos != '\0') ||
+			    (static_cast<signed>(fragment_memory) < 0)) {
+				::std::cerr <<
+				  "invalid fragment memory parameter\n";
+				exit(1);
+			}
+			break;
+
+		case 'L' :
+			qname_labels = strtoul(optarg, &err_pos, 10);
+			if ((*err_pos != '\0') ||
+			    (static_cast<signed>(qname_labels) < 0)) {
+				::std::cerr <<
+				  "invalid query name labels parameter\n";
+				exit(1);
+			}
+			break;
+
+		case 'S' :
+			suffix_list = optarg;
+			break;
+
+		case 'k' :
+			composite_key = optarg;
+			break;
+
+		case 'b' :
+			bad_packets = optarg;
+			break;
+
+		case 'B' :
+			bad_packet_rate = strtoul(optarg, &err_pos, 10);
+			if ((*err_pos != '\0') ||
+			    (static_cast<signed>(bad_packet_rate) < 0)) {
+				::std::cerr <<
+				  "invalid bad packet rate parameter\n";
 				exit(1);
 			}
 			break;
@@ -355,6 +562,38 @@ void Settings::parse( int argc, char *argv[] )
 			exit( 1 );
 		}
 	}
+
+	if ( streams.empty() )
+		stream( "" ).files.push_back( PCAP_STDIN );
+}
+/* ------------------------------------------------------------------------- */
+Settings::Stream & Settings::stream( const ::std::string &name )
+{
+	for (size_t i = 0; i < streams.size(); ++i) {
+		if ( streams[i].name == name )
+			{ return streams[i]; }
+	}
+	streams.push_back( Stream( name ) );
+	return streams.back();
+}
+/* ------------------------------------------------------------------------- */
+void Settings::Stream::addInput( const char *pattern )
+{
+	if ( strcmp( pattern, PCAP_STDIN ) == 0 ) {
+		files.push_back( pattern );
+		return;
+	}
+
+	/* Patterns without a match are kept, opening them reports the
+	 * error. */
+	glob_t matches;
+	if ( glob( pattern, GLOB_NOCHECK, NULL, &matches ) != 0 ) {
+		files.push_back( pattern );
+		return;
+	}
+	for (size_t i = 0; i < matches.gl_pathc; ++i)
+		{ files.push_back( matches.gl_pathv[i] ); }
+	globfree( &matches );
 }
 /* ------------------------------------------------------------------------- */
 bool Settings::isValid() const
@@ -367,5 +606,24 @@ bool Settings::isValid() const
 	ok = ok && aggregation_count >= AGGREGATION_COUNT_MIN;
 	ok = ok && aggregation_count <= AGGREGATION_COUNT_MAX;
 	ok = ok && thread_count >= 1;
+	ok = ok && policies != 0;
+	ok = ok && max_open_files >= MAX_OPEN_FILES_MIN;
+	ok = ok && parser_threads <= PARSER_THREADS_MAX;
+	ok = ok && reorder_packets >= REORDER_PACKETS_MIN;
+	ok = ok && qname_labels >= QNAME_LABELS_MIN;
+	/* several streams need names to tell their output apart */
+	ok = ok && !streams.empty();
+	for (size_t s = 0; ok && s < streams.size(); ++s) {
+		const Stream &input = streams[s];
+		ok = streams.size() == 1 || !input.name.empty();
+		/* live inputs are not mixed with files or each other */
+		ok = ok && (!input.files.empty()) + (input.interface != NULL)
+		  + (input.ring != NULL) + (input.dnstap_socket != NULL) == 1;
+		/* stdin cannot be merged with other inputs */
+		const bool alone = streams.size() == 1
+		  && input.files.size() == 1;
+		for (size_t i = 0; ok && !alone && i < input.files.size(); ++i)
+			{ ok = input.files[i] != PCAP_STDIN; }
+	}
 	return ok;
 }
@@ -23,6 +23,8 @@
 #endif
 
 #include <cstddef>
+#include <string>
+#include <vector>
 #include "statistics/GammaParameters.h"
 
 /*!
@@ -31,9 +33,16 @@
 typedef enum {
 	srcIP     = 0,
 	dstIP     = 1,
-	queryName = 2
+	queryName = 2,
+	composite = 3,
+	POLICY_TYPE_COUNT
 } policyType;
 
+/*!
+ * @brief Bit of the policyType in Settings::policies.
+ */
+#define POLICY_BIT( type ) ( 1u << (type) )
+
 /*!
  * @brief Policy names.
  */
@@ -46,6 +55,45 @@ extern const char * const policyTypeNames[];
 class Settings
 {
 public:
+	/*!
+	 * @brief Input analysed independently of the others.
+	 *
+	 * Exactly one of the kinds of input is set.
+	 */
+	struct Stream {
+		/*! @brief Output label, empty for the only stream. */
+		::std::string name;
+
+		/*! @brief Pcap files to use, merged in time-stamp order. */
+		::std::vector< ::std::string > files;
+
+		/*! @brief Network interface to capture on, NULL to read
+		 * files. */
+		const char *interface;
+
+		/*! @brief Shared memory ring of dnsdump, NULL to read
+		 * files. */
+		const char *ring;
+
+		/*! @brief Unix socket to receive dnstap on, NULL to read
+		 * files. */
+		const char *dnstap_socket;
+
+		/*! @brief Creates stream without input. */
+		Stream( const ::std::string &label = "" ): name( label ),
+		  interface( NULL ), ring( NULL ), dnstap_socket( NULL ) {}
+
+		/*! @brief Whether the input is captured live. */
+		bool live() const
+			{ return interface || ring || dnstap_socket; }
+
+		/*!
+		 * @brief Appends input files matching a glob pattern.
+		 * @param pattern File name, glob pattern or "-" for stdin.
+		 */
+		void addInput( const char *pattern );
+	};
+
 	/*! @brief Time span of analysed communication. */
 	size_t window_size;
 	/*! @brief Time between analyses. */
@@ -71,8 +119,11 @@ public:
 	/*! @brief Function to use for index to time conversion. */
 	unsigned (*aggregate)( unsigned );
 
-	/*! @brief Pcap file to use. */
-	const char *file;
+	/*! @brief Inputs, each analysed on its own. */
+	::std::vector<Stream> streams;
+
+	/*! @brief Maximum number of input files opened at once. */
+	unsigned max_open_files;
 
 	/*! @brief Pcap filter text. */
 	const char *filter;
@@ -80,11 +131,45 @@ public:
 	/*! @brief Number of threads. */
 	unsigned thread_count;
 
+	/*! @brief Number of packet parsing threads, 0 for none. */
+	unsigned parser_threads;
+
+	/*! @brief Disorder of the input put right, ms, 0 for none. */
+	unsigned reorder_window;
+	/*! @brief Maximum number of packets held for reordering. */
+	unsigned reorder_packets;
+
+	/*! @brief Memory of DNS over TCP reassembly, MiB, 0 for none. */
+	unsigned tcp_memory;
+	/*! @brief Memory of IP fragment reassembly, MiB, 0 for none. */
+	unsigned fragment_memory;
+
+	/*! @brief Labels of a query name identifier, the suffix counted
+	 * as one. */
+	unsigned qname_labels;
+	/*! @brief Public suffix list for query names, NULL for none. */
+	const char *suffix_list;
+	/*! @brief Fields of the composite policy key. */
+	const char *composite_key;
+
+	/*! @brief Pcap file of malformed DNS packets, NULL for none. */
+	const char *bad_packets;
+	/*! @brief Malformed DNS packets written per second. */
+	unsigned bad_packet_rate;
+
 	/*! @brief Analysed Gamma distribution parameter */
 	GammaParameters::type analysed_parameter;
 
-	/*! @brief Analysis to be used. */
-	policyType policy;
+	/*! @brief Analyses to be used, set of POLICY_BIT() values. */
+	unsigned policies;
+
+	/*!
+	 * @brief Checks whether an analysis was requested.
+	 * @param type Policy to check.
+	 * @return true if the policy is among #policies.
+	 */
+	bool usesPolicy( policyType type ) const
+		{ return policies & POLICY_BIT( type ); }
 
 	/*! @brief Assigns default values. */
 	Settings( int argc = 0, char *argv[] = NULL );
@@ -92,4 +177,12 @@ public:
 	void parse( int argc, char *argv[] );
 	/*! @brief Checks Settings against a set of requirements. */
 	bool isValid() const;
+
+protected:
+	/*!
+	 * @brief Finds the stream of the name, creating it if needed.
+	 * @param name Name of the stream, empty for the unnamed one.
+	 * @return The stream.
+	 */
+	Stream & stream( const ::std::string &name );
 };
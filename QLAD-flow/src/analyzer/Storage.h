@@ -22,11 +22,18 @@
 #include "config.h"
 #endif
 
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
 #include <ctime>
+#include <iterator>
 #include <map>
 #include <ostream>
+#include <utility>
+#include <vector>
 
 #include "IStorage.h"
+#include "policies/dns/PacketParser.h"
 #include "struct/SparseFlow.h"
 
 /*!
@@ -34,67 +41,205 @@
  * @brief Data storage class.
  * @tparam POLICY Identifiers used to identify flows and parsing function.
  *
- * Stores identifier traffic. Identifier type and parsing function is
- * provided by the POLICY class. Range startTime-endTime is inclusive,
+ * Stores identifier traffic. Identifier type and its projection out of a
+ * PacketRecord is provided by the POLICY class. Range startTime-endTime is inclusive,
  * i.e. there is a packet that arrived at endTime.
+ *
+ * Flows are partitioned into shards by the hash of their identifier.
+ * Every shard has its own map, traffic summary and time bounds, so
+ * different shards can be filled by different threads without locking,
+ * see store(). Iteration merges the shards in identifier order, so it
+ * does not depend on the shard count.
  */
 template<typename POLICY>
-class Storage:
-	public IStorage,
-	public ::std::map<typename POLICY::id_t, SparseFlow>
+class Storage: public IRecordStorage
 {
 public:
 	typedef Storage< POLICY > THIS;
 	/*! @brief Convenience typedef, exports identifier type */
 	typedef typename POLICY::id_t Identifier;
+	/*! @brief Flows of one shard. */
+	typedef ::std::map<Identifier, SparseFlow> Map;
+	/*! @brief Identifier and its flow. */
+	typedef typename Map::value_type value_type;
 
-	/*! @brief Enable default constructor */
-	Storage( size_t window_size )
-	  : mWindowSize( window_size ), mStartTime( 0 ), mEndTime( 0 ) {}
+	class const_iterator;
+
+	/*!
+	 * @brief Creates empty storage.
+	 * @param window_size Maximum timespan of stored communication.
+	 * @param shards Number of shards, at least 1.
+	 */
+	Storage( size_t window_size, unsigned shards = 1 )
+	  : mWindowSize( window_size ), mShards( shards )
+		{ assert( shards > 0 ); }
+
+	/*! @brief Packet data, see IStorage. */
+	typedef IStorage::PacketView PacketView;
 
 	/*!
 	 * @brief Plot new time-point using the packet data.
-	 * @param data Packet data to parse.
-	 * @param time Time point to plot.
+	 * @param packet Packet data to parse and its arrival time.
 	 *
-	 * Parses POLICY::id_t type from the packet data and plot the
-	 * time point in its respective data Flow.
+	 * Decodes the packet, takes POLICY::id_t type out of it and plot
+	 * the time point in its respective data Flow. Several storages
+	 * should rather share the decoding, see addRecords().
 	 */
-	void addPacket( const PacketData &data, time_t time );
+	void addPacket( const PacketView &packet )
+	{
+		PacketRecord record;
+		PacketParser()( packet, record );
+		THIS::addRecords( &packet, &record, 1 );
+	}
+
+	/*!
+	 * @brief Plot time-points of decoded packets.
+	 * @param packets Packet data and arrival times.
+	 * @param records Record decoded from every packet.
+	 * @param count Number of packets.
+	 *
+	 * Takes POLICY::id_t type out of every record and plot the time
+	 * point in its respective data Flow.
+	 */
+	void addRecords( const PacketView *packets, const PacketRecord *records,
+	  size_t count );
+
+	/*! @brief Identifiers of valid packets and their arrival times. */
+	class Points: public Records {
+	public:
+		/*! @brief Parsed identifier and arrival time pairs. */
+		typedef ::std::vector< ::std::pair<Identifier, time_t> > List;
+
+		/*! @brief Points of every shard. */
+		::std::vector<List> shards;
+		/*! @brief Packets without a valid identifier. */
+		FailureCounts failures;
+	};
+
+	unsigned need() const
+		{ return POLICY::NEED; }
+
+	Records * createRecords() const
+	{
+		Points *points = new Points;
+		points->shards.resize( mShards.size() );
+		return points;
+	}
+
+	void parse( const PacketView *packets, const PacketRecord *records,
+	  size_t count, Records &parsed ) const;
+
+	unsigned shardCount() const
+		{ return mShards.size(); }
+
+	void store( const Records &records, unsigned shard );
 
 	/*!
 	 * @brief Get the time of the beginning of the stored time window.
 	 * @return Arrival time of the oldest packet.
 	 */
-	time_t startTime() const
-		{ return mStartTime; }
+	time_t startTime() const;
 
 	/*!
 	 * @brief Get the time of the end of the stored time window.
 	 * @return Arrival time of the last packet.
 	 */
-	time_t endTime() const
-		{ return mEndTime; }
+	time_t endTime() const;
 
 	/*!
 	 * @brief Number of seconds in used time window.
 	 * @return Size of the window specified at construction.
 	 */
 	unsigned windowSize() const
-		{ return mEndTime - mStartTime + 1; }
+		{ return endTime() - startTime() + 1; }
 
 	/*!
 	 * @brief Sync data stored in flow with designated time window.
 	 *
 	 * Remove flows that are outside of the window. Shift the flows
-	 * that started earlier than #mStartTime.
+	 * that started earlier than startTime(). Merges the traffic of all
+	 * shards for allTraffic().
 	 */
 	void sync();
 
+	/*!
+	 * @brief Traffic of all the stored flows together.
+	 *
+	 * With more shards only valid after sync().
+	 */
 	const SparseFlow & allTraffic() const
-		{ return mAllTraffic; }
+		{ return mShards.size() == 1 ? mShards[0].allTraffic : mAllTraffic; }
+
+	/*! @brief Number of stored flows. */
+	size_t size() const;
+
+	/*!
+	 * @brief Packets discarded by the policy.
+	 * @return Counts of the packets added between the last two calls
+	 * of sync().
+	 */
+	const FailureCounts & failures() const
+		{ return mFailures; }
+
+	/*!
+	 * @brief Flow of the identifier.
+	 * @param id Identifier of a stored flow.
+	 * @return The flow.
+	 */
+	const SparseFlow & at( const Identifier &id ) const
+		{ return mShards[shardOf( id )].flows.at( id ); }
+
+	/*! @brief Iterator to the flow with the lowest identifier. */
+	const_iterator begin() const
+		{ return const_iterator( &mShards, false ); }
+
+	/*! @brief Iterator behind the last flow. */
+	const_iterator end() const
+		{ return const_iterator( &mShards, true ); }
 
 protected:
+	enum {
+		SHARD_HASH = 0   /*!< @brief POLICY::hash() index for shards. */
+	};
+
+	/*! @brief Independent part of the storage. */
+	struct Shard {
+		Shard(): startTime( 0 ), endTime( 0 ) {}
+
+		Map flows;              /*!< @brief Flows of the shard. */
+		SparseFlow allTraffic;  /*!< @brief Traffic of the shard. */
+		time_t startTime;       /*!< @brief Window start by the shard. */
+		time_t endTime;         /*!< @brief Last packet of the shard. */
+		/*! @brief Discarded packets counted by the shard's thread
+		 * since the last sync(). */
+		FailureCounts failures;
+	};
+
+	/*!
+	 * @brief Takes identifier of the packet out of its record.
+	 * @param packet Packet data of either IStorage::Format.
+	 * @param record Record decoded from the packet.
+	 * @return Identifier, not necessarily valid.
+	 */
+	static Identifier identify( const PacketView &packet,
+	  const PacketRecord &record )
+		{ return POLICY::parseIdentifier( record, packet.data ); }
+
+	/*! @brief Shard of the identifier. */
+	unsigned shardOf( const Identifier &id ) const
+	{
+		return mShards.size() == 1 ? 0
+		  : POLICY::hash( SHARD_HASH, id ) % mShards.size();
+	}
+
+	/*!
+	 * @brief Plot time-point of a valid identifier.
+	 * @param shard Shard of the identifier.
+	 * @param id Identifier parsed from a packet.
+	 * @param time Arrival time of the packet.
+	 */
+	void addPoint( Shard &shard, const Identifier &id, time_t time );
+
 	/*! @brief Maximum timespan of stored communication. */
 	const size_t mWindowSize;
 
@@ -102,11 +247,90 @@ private:
 	/*! @brief FORBIDDEN operator. */
 	Storage & operator = ( const Storage & );
 
-	time_t mStartTime; /*!< @brief Time stamp of the first stored
-	                               packet. */
-	time_t mEndTime;   /*!< @brief Time stamp of the last stored packet. */
+	::std::vector<Shard> mShards; /*!< @brief Stored flows. */
 
+	/*! @brief Merged traffic of all shards, if more. */
 	SparseFlow mAllTraffic;
+
+	/*! @brief Discarded packets merged by the last sync(). */
+	FailureCounts mFailures;
+};
+
+/*!
+ * @class Storage::const_iterator Storage.h "Storage.h"
+ * @brief Walks the flows of all shards in identifier order.
+ *
+ * Merges the ordered shards, so the walk is the same for any number of
+ * shards.
+ */
+template<typename POLICY>
+class Storage<POLICY>::const_iterator
+{
+public:
+	typedef ::std::forward_iterator_tag iterator_category;
+	typedef typename Storage<POLICY>::value_type value_type;
+	typedef ptrdiff_t difference_type;
+	typedef const value_type * pointer;
+	typedef const value_type & reference;
+
+	/*! @brief Singular iterator. */
+	const_iterator(): mShards( NULL ), mShard( 0 ) {}
+
+	reference operator * () const
+		{ return *mPositions[mShard]; }
+
+	pointer operator -> () const
+		{ return &*mPositions[mShard]; }
+
+	const_iterator & operator ++ ()
+		{ ++mPositions[mShard]; selectLowest(); return *this; }
+
+	const_iterator operator ++ ( int )
+		{ const_iterator old( *this ); ++*this; return old; }
+
+	bool operator == ( const const_iterator &other ) const
+	{
+		return mShard == other.mShard && (mShard == mShards->size()
+		  || mPositions[mShard] == other.mPositions[mShard]);
+	}
+
+	bool operator != ( const const_iterator &other ) const
+		{ return !(*this == other); }
+
+private:
+	friend class Storage<POLICY>;
+
+	/*! @brief Iterator to the first flow or behind the last one. */
+	const_iterator( const ::std::vector<Shard> *shards, bool end )
+	: mShards( shards ), mShard( shards->size() )
+	{
+		if (end)
+			{ return; }
+		mPositions.reserve( mShards->size() );
+		for (unsigned i = 0; i < mShards->size(); ++i)
+			{ mPositions.push_back( (*mShards)[i].flows.begin() ); }
+		selectLowest();
+	}
+
+	/*! @brief Points mShard to the shard with the lowest identifier. */
+	void selectLowest()
+	{
+		mShard = mPositions.size();
+		for (unsigned i = 0; i < mPositions.size(); ++i) {
+			if (mPositions[i] == (*mShards)[i].flows.end())
+				{ continue; }
+			if (mShard == mPositions.size()
+			  || mPositions[i]->first < mPositions[mShard]->first)
+				{ mShard = i; }
+		}
+	}
+
+	/*! @brief Position in each of the shards. */
+	typedef ::std::vector<typename Map::const_iterator> Positions;
+
+	const ::std::vector<Shard> *mShards;  /*!< @brief Walked shards. */
+	Positions mPositions;                 /*!< @brief Merge heads. */
+	unsigned mShard;  /*!< @brief Shard of the current flow or count. */
 };
 
 /*!
@@ -126,40 +350,133 @@ template<typename POLICY>
 /* IMPLEMENTATION */
 /* ------------------------------------------------------------------------- */
 template<typename POLICY>
-void Storage<POLICY>::addPacket( const PacketData &data, time_t time )
+void Storage<POLICY>::addRecords( const PacketView *packets,
+  const PacketRecord *records, size_t count )
+{
+	FailureCounts &failures = mShards[0].failures;
+	failures.packets += count;
+	for (size_t i = 0; i < count; ++i) {
+		const Identifier id = identify( packets[i], records[i] );
+		if (POLICY::isValid( id )) {
+			addPoint( mShards[shardOf( id )], id,
+			  packets[i].arrival );
+		} else {
+			++failures.discarded[records[i].discardReason()];
+		}
+	}
+}
+/* ------------------------------------------------------------------------- */
+template<typename POLICY>
+void Storage<POLICY>::parse( const PacketView *packets,
+  const PacketRecord *records, size_t count, Records &parsed ) const
 {
-	const Identifier id =
-	  POLICY::parseIdentifier( data.data(), data.size() );
-
-	if (POLICY::isValid( id )) {
-		/* update time window information */
-		mEndTime = ::std::max( mEndTime, time );
-		mStartTime =
-		  ::std::max<time_t>( mStartTime, mEndTime - mWindowSize + 1 );
-
-		/* find destination flow and add packet, shift if necessary */
-		SparseFlow & destination = (*this)[id];
-		destination.addPoint( time );
-		if (destination.startTime() < mStartTime)
-			{ destination.deleteBefore( mStartTime ); }
-		mAllTraffic.addPoint( time );
+	Points &points = static_cast<Points &>( parsed );
+	assert( points.shards.size() == mShards.size() );
+	for (size_t i = 0; i < points.shards.size(); ++i)
+		{ points.shards[i].clear(); }
+	points.failures.clear();
+	points.failures.packets = count;
+
+	for (size_t i = 0; i < count; ++i) {
+		const Identifier id = identify( packets[i], records[i] );
+		if (POLICY::isValid( id )) {
+			points.shards[shardOf( id )].push_back(
+			  ::std::make_pair( id, packets[i].arrival ) );
+		} else {
+			++points.failures.discarded[records[i].discardReason()];
+		}
 	}
 }
 /* ------------------------------------------------------------------------- */
 template<typename POLICY>
+void Storage<POLICY>::store( const Records &records, unsigned shard )
+{
+	const Points &all = static_cast<const Points &>( records );
+	const typename Points::List &points = all.shards[shard];
+	Shard &destination = mShards[shard];
+	for (size_t i = 0; i < points.size(); ++i) {
+		addPoint( destination, points[i].first,
+		  points[i].second );
+	}
+	/* the batch is stored by every shard, counted by the first */
+	if (shard == 0)
+		{ destination.failures += all.failures; }
+}
+/* ------------------------------------------------------------------------- */
+template<typename POLICY>
+time_t Storage<POLICY>::startTime() const
+{
+	time_t start = 0;
+	for (size_t i = 0; i < mShards.size(); ++i)
+		{ start = ::std::max( start, mShards[i].startTime ); }
+	return start;
+}
+/* ------------------------------------------------------------------------- */
+template<typename POLICY>
+time_t Storage<POLICY>::endTime() const
+{
+	time_t end = 0;
+	for (size_t i = 0; i < mShards.size(); ++i)
+		{ end = ::std::max( end, mShards[i].endTime ); }
+	return end;
+}
+/* ------------------------------------------------------------------------- */
+template<typename POLICY>
+size_t Storage<POLICY>::size() const
+{
+	size_t size = 0;
+	for (size_t i = 0; i < mShards.size(); ++i)
+		{ size += mShards[i].flows.size(); }
+	return size;
+}
+/* ------------------------------------------------------------------------- */
+template<typename POLICY>
+void Storage<POLICY>::addPoint( Shard &shard, const Identifier &id,
+  time_t time )
+{
+	/* update time window information, the shard only knows its own
+	 * packets, sync() applies the window of the whole storage */
+	shard.endTime = ::std::max( shard.endTime, time );
+	shard.startTime = ::std::max<time_t>( shard.startTime,
+	  shard.endTime - mWindowSize + 1 );
+
+	/* find destination flow and add packet, shift if necessary */
+	SparseFlow & destination = shard.flows[id];
+	destination.addPoint( time );
+	if (destination.startTime() < shard.startTime)
+		{ destination.deleteBefore( shard.startTime ); }
+	shard.allTraffic.addPoint( time );
+}
+/* ------------------------------------------------------------------------- */
+template<typename POLICY>
 void Storage<POLICY>::sync()
 {
-	mAllTraffic.deleteBefore( mStartTime );
-	typename THIS::iterator it;
-	/* check all stored flows */
-	for ( it = this->begin(); it != this->end(); ) {
-		it->second.deleteBefore( mStartTime );
-
-		/* drop flows that are empty in this time window */
-		if ( it->second.empty() )
-			this->erase( it++ );
-		else
-			++it;
+	const time_t start = startTime();
+	mFailures.clear();
+	for (size_t i = 0; i < mShards.size(); ++i) {
+		Shard &shard = mShards[i];
+		mFailures += shard.failures;
+		shard.failures.clear();
+		shard.startTime = start;
+		shard.allTraffic.deleteBefore( start );
+
+		typename Map::iterator it;
+		/* check all stored flows */
+		for ( it = shard.flows.begin(); it != shard.flows.end(); ) {
+			it->second.deleteBefore( start );
+
+			/* drop flows that are empty in this time window */
+			if ( it->second.empty() )
+				shard.flows.erase( it++ );
+			else
+				++it;
+		}
+	}
+
+	if (mShards.size() > 1) {
+		mAllTraffic.clear();
+		for (size_t i = 0; i < mShards.size(); ++i)
+			{ mAllTraffic.merge( mShards[i].allTraffic ); }
 	}
 }
 /* ------------------------------------------------------------------------- */
@@ -0,0 +1,523 @@
+/*
+ * This file is part of the DNS traffic analyser project.
+ *
+ * Copyright (C) 2011 CZ.NIC, z.s.p.o.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <pcap.h>
+#include <unistd.h>
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+#ifdef HAVE_LIBBZ2
+#include <bzlib.h>
+#endif
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+#endif
+
+#include "Decompressor.h"
+
+/*! @brief Name accepted for the standard input. */
+#define STDIN_NAME "-"
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @brief Number of threads decompressing zstd frames.
+ * @return One less than the number of processors, within limits.
+ */
+static unsigned frame_workers()
+{
+	const long cpus = sysconf( _SC_NPROCESSORS_ONLN );
+	if (cpus <= 2)
+		{ return 1; }
+	return ::std::min<long>( cpus - 1, Decompressor::MAX_WORKERS );
+}
+/* ------------------------------------------------------------------------- */
+FILE * Decompressor::open( const char *file, char *errbuff )
+{
+	const bool is_stdin = strcmp( file, STDIN_NAME ) == 0;
+	FILE *input = is_stdin ? stdin : fopen( file, "rb" );
+	if (!input) {
+		snprintf( errbuff, PCAP_ERRBUF_SIZE, "%s", strerror( errno ) );
+		return NULL;
+	}
+
+	const long position = ftell( input );
+	unsigned char magic[MAGIC_SIZE];
+	const size_t magic_size = fread( magic, 1, MAGIC_SIZE, input );
+
+	Format format = FORMAT_PLAIN;
+	const char *missing = NULL;
+	if (magic_size >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+		format = FORMAT_GZIP;
+		missing = "zlib";
+#ifdef HAVE_LIBZ
+		missing = NULL;
+#endif
+	} else if (magic_size >= 3 && memcmp( magic, "BZh", 3 ) == 0) {
+		format = FORMAT_BZIP2;
+		missing = "libbz2";
+#ifdef HAVE_LIBBZ2
+		missing = NULL;
+#endif
+	} else if (magic_size == 4 && magic[0] == 0x28 && magic[1] == 0xb5
+	  && magic[2] == 0x2f && magic[3] == 0xfd) {
+		format = FORMAT_ZSTD;
+		missing = "libzstd";
+#ifdef HAVE_LIBZSTD
+		missing = NULL;
+#endif
+	}
+
+	if (missing) {
+		snprintf( errbuff, PCAP_ERRBUF_SIZE,
+		  "compressed input, built without %s", missing );
+		if (!is_stdin)
+			{ fclose( input ); }
+		return NULL;
+	}
+
+	/* Plain files are handed over as they are, when possible. */
+	if (format == FORMAT_PLAIN && position >= 0
+	  && fseek( input, position, SEEK_SET ) == 0)
+		{ return input; }
+
+	Decompressor *decompressor = new Decompressor( input, file, format,
+	  reinterpret_cast<const char *>( magic ), magic_size );
+	FILE *stream = decompressor->start();
+	if (!stream) {
+		snprintf( errbuff, PCAP_ERRBUF_SIZE, "%s", strerror( errno ) );
+		delete decompressor;
+	}
+	return stream;
+}
+/* ------------------------------------------------------------------------- */
+Decompressor::Decompressor( FILE *file, const char *name, Format format,
+  const char *magic, size_t magic_size )
+: mFile( file ), mName( name ), mFormat( format ),
+  mInput( ::std::max<size_t>( INPUT_SIZE,
+    format == FORMAT_ZSTD ? FRAME_LIMIT : 0 ) ),
+  mBegin( 0 ), mEnd( magic_size ), mEof( false ),
+  mBlocks( format == FORMAT_ZSTD ? 2 * frame_workers() : 2 ),
+  mFree( mBlocks.size() ), mOrdered( mBlocks.size() ),
+  mWork( mBlocks.size() ), mProducer( produce, this ),
+  mCurrent( NULL ), mPosition( 0 ), mFailed( false ), mRunning( false )
+{
+	::std::copy( magic, magic + magic_size, mInput.begin() );
+	for (unsigned i = 0; i < mBlocks.size(); ++i) {
+		mBlocks[i] = new Block;
+		mFree.push( mBlocks[i] );
+	}
+}
+/* ------------------------------------------------------------------------- */
+Decompressor::~Decompressor()
+{
+	mFree.close();
+	mOrdered.close();
+	mWork.close();
+	if (mRunning)
+		{ mProducer.join(); }
+	for (unsigned i = 0; i < mWorkers.size(); ++i) {
+		mWorkers[i]->join();
+		delete mWorkers[i];
+	}
+	for (unsigned i = 0; i < mBlocks.size(); ++i)
+		{ delete mBlocks[i]; }
+	if (mFile != stdin)
+		{ fclose( mFile ); }
+}
+/* ------------------------------------------------------------------------- */
+FILE * Decompressor::start()
+{
+	cookie_io_functions_t functions;
+	memset( &functions, 0, sizeof( functions ) );
+	functions.read = streamRead;
+	functions.close = streamClose;
+	FILE *stream = fopencookie( this, "rb", functions );
+	if (!stream)
+		{ return NULL; }
+
+	const unsigned workers = mFormat == FORMAT_ZSTD ? frame_workers() : 0;
+	for (unsigned i = 0; i < workers; ++i) {
+		mWorkers.push_back( new Thread( work, this ) );
+		mWorkers.back()->run();
+	}
+	mProducer.run();
+	mRunning = true;
+	return stream;
+}
+/* ------------------------------------------------------------------------- */
+ssize_t Decompressor::read( char *buffer, size_t size )
+{
+	while (!mFailed && (!mCurrent || mPosition == mCurrent->size)) {
+		if (mCurrent)
+			{ mFree.push( mCurrent ); }
+		if (!mOrdered.pop( mCurrent )) {
+			mCurrent = NULL;
+			return 0;
+		}
+		mCurrent->ready.down();
+		mPosition = 0;
+		mFailed = mCurrent->failed;
+	}
+
+	if (mFailed) {
+		errno = EIO;
+		return -1;
+	}
+
+	const size_t count = ::std::min( size, mCurrent->size - mPosition );
+	memcpy( buffer, &mCurrent->output[mPosition], count );
+	mPosition += count;
+	return count;
+}
+/* ------------------------------------------------------------------------- */
+ssize_t Decompressor::streamRead( void *cookie, char *buffer, size_t size )
+{
+	return static_cast<Decompressor *>( cookie )->read( buffer, size );
+}
+/* ------------------------------------------------------------------------- */
+int Decompressor::streamClose( void *cookie )
+{
+	delete static_cast<Decompressor *>( cookie );
+	return 0;
+}
+/* ------------------------------------------------------------------------- */
+void * Decompressor::produce( Decompressor *instance )
+{
+	assert( instance );
+
+	switch (instance->mFormat) {
+		case FORMAT_PLAIN:
+			instance->copy();
+			break;
+#ifdef HAVE_LIBZ
+		case FORMAT_GZIP:
+			instance->inflateGzip();
+			break;
+#endif
+#ifdef HAVE_LIBBZ2
+		case FORMAT_BZIP2:
+			instance->inflateBzip2();
+			break;
+#endif
+#ifdef HAVE_LIBZSTD
+		case FORMAT_ZSTD:
+			instance->inflateZstd();
+			break;
+#endif
+		default:
+			assert( !"format not compiled in" );
+	}
+
+	/* The queued blocks stay available. */
+	instance->mWork.close();
+	instance->mOrdered.close();
+	return NULL;
+}
+/* ------------------------------------------------------------------------- */
+void * Decompressor::work( Decompressor *instance )
+{
+	assert( instance );
+#ifdef HAVE_LIBZSTD
+	ZSTD_DCtx *context = ZSTD_createDCtx();
+	Block *block;
+	while (instance->mWork.pop( block )) {
+		const size_t res = ZSTD_decompressDCtx( context,
+		  &block->output[0], block->output.size(),
+		  &block->input[0], block->input.size() );
+		if (ZSTD_isError( res )) {
+			std::cerr << "Failed to decompress " << instance->mName
+			  << ": " << ZSTD_getErrorName( res ) << std::endl;
+			block->failed = true;
+		} else {
+			block->size = res;
+		}
+		block->ready.up();
+	}
+	ZSTD_freeDCtx( context );
+#else
+	(void) instance;
+#endif
+	return NULL;
+}
+/* ------------------------------------------------------------------------- */
+bool Decompressor::refill()
+{
+	if (mEof)
+		{ return false; }
+
+	memmove( &mInput[0], &mInput[mBegin], mEnd - mBegin );
+	mEnd -= mBegin;
+	mBegin = 0;
+
+	const size_t wanted = mInput.size() - mEnd;
+	const size_t count = fread( &mInput[mEnd], 1, wanted, mFile );
+	mEnd += count;
+	if (count < wanted) {
+		mEof = true;
+		if (ferror( mFile )) {
+			std::cerr << "Failed to read " << mName << ": "
+			  << strerror( errno ) << std::endl;
+		}
+	}
+	return count > 0;
+}
+/* ------------------------------------------------------------------------- */
+Decompressor::Block * Decompressor::take()
+{
+	Block *block;
+	if (!mFree.pop( block ))
+		{ return NULL; }
+	block->size = 0;
+	block->failed = false;
+	if (block->output.size() < BLOCK_SIZE)
+		{ block->output.resize( BLOCK_SIZE ); }
+	return block;
+}
+/* ------------------------------------------------------------------------- */
+void Decompressor::emit( Block *block, bool ready )
+{
+	/* Queues hold all the blocks, pushing never blocks. */
+	if (mOrdered.push( block ) && ready)
+		{ block->ready.up(); }
+}
+/* ------------------------------------------------------------------------- */
+bool Decompressor::fail( const char *reason )
+{
+	std::cerr << "Failed to decompress " << mName << ": " << reason
+	  << std::endl;
+	Block *block = take();
+	if (block) {
+		block->failed = true;
+		emit( block );
+	}
+	return false;
+}
+/* ------------------------------------------------------------------------- */
+bool Decompressor::copy()
+{
+	for (;;) {
+		if (mBegin == mEnd && !refill())
+			{ return ferror( mFile ) ? fail( "read error" ) : true; }
+		Block *block = take();
+		if (!block)
+			{ return false; }
+		block->size = mEnd - mBegin;
+		::std::copy( &mInput[mBegin], &mInput[mEnd],
+		  block->output.begin() );
+		mBegin = mEnd;
+		emit( block );
+	}
+}
+/* ------------------------------------------------------------------------- */
+#ifdef HAVE_LIBZ
+bool Decompressor::inflateGzip()
+{
+	z_stream stream;
+	memset( &stream, 0, sizeof( stream ) );
+	/* 32 enables gzip header detection */
+	if (inflateInit2( &stream, MAX_WBITS + 32 ) != Z_OK)
+		{ return fail( "cannot initialise zlib" ); }
+
+	Block *block = NULL;
+	bool inside = true;
+	bool ok = true;
+	for (;;) {
+		if (mBegin == mEnd && !refill())
+			{ break; }
+		if (!block && !(block = take())) {
+			ok = false;
+			break;
+		}
+
+		stream.next_in = reinterpret_cast<Bytef *>( &mInput[mBegin] );
+		stream.avail_in = mEnd - mBegin;
+		stream.next_out =
+		  reinterpret_cast<Bytef *>( &block->output[block->size] );
+		stream.avail_out = block->output.size() - block->size;
+		const int res = inflate( &stream, Z_NO_FLUSH );
+		mBegin = mEnd - stream.avail_in;
+		block->size = block->output.size() - stream.avail_out;
+		inside = res != Z_STREAM_END;
+
+		if (res == Z_STREAM_END) {
+			/* gzip members may be concatenated */
+			inflateReset( &stream );
+		} else if (res != Z_OK && res != Z_BUF_ERROR) {
+			emit( block );
+			block = NULL;
+			ok = fail( stream.msg ? stream.msg : "corrupted data" );
+			break;
+		}
+
+		if (block->size == block->output.size()) {
+			emit( block );
+			block = NULL;
+		}
+	}
+	inflateEnd( &stream );
+
+	if (block)
+		{ emit( block ); }
+	if (ok && inside && mEof)
+		{ ok = fail( "unexpected end of data" ); }
+	return ok;
+}
+#endif
+/* ------------------------------------------------------------------------- */
+#ifdef HAVE_LIBBZ2
+bool Decompressor::inflateBzip2()
+{
+	bz_stream stream;
+	memset( &stream, 0, sizeof( stream ) );
+	if (BZ2_bzDecompressInit( &stream, 0, 0 ) != BZ_OK)
+		{ return fail( "cannot initialise libbz2" ); }
+
+	Block *block = NULL;
+	bool inside = true;
+	bool ok = true;
+	for (;;) {
+		if (mBegin == mEnd && !refill())
+			{ break; }
+		if (!block && !(block = take())) {
+			ok = false;
+			break;
+		}
+
+		stream.next_in = &mInput[mBegin];
+		stream.avail_in = mEnd - mBegin;
+		stream.next_out = &block->output[block->size];
+		stream.avail_out = block->output.size() - block->size;
+		const int res = BZ2_bzDecompress( &stream );
+		mBegin = mEnd - stream.avail_in;
+		block->size = block->output.size() - stream.avail_out;
+		inside = res != BZ_STREAM_END;
+
+		if (res == BZ_STREAM_END) {
+			/* parallel compressors write concatenated streams */
+			BZ2_bzDecompressEnd( &stream );
+			memset( &stream, 0, sizeof( stream ) );
+			BZ2_bzDecompressInit( &stream, 0, 0 );
+		} else if (res != BZ_OK) {
+			emit( block );
+			block = NULL;
+			ok = fail( "corrupted data" );
+			break;
+		}
+
+		if (block->size == block->output.size()) {
+			emit( block );
+			block = NULL;
+		}
+	}
+	BZ2_bzDecompressEnd( &stream );
+
+	if (block)
+		{ emit( block ); }
+	if (ok && inside && mEof)
+		{ ok = fail( "unexpected end of data" ); }
+	return ok;
+}
+#endif
+/* ------------------------------------------------------------------------- */
+#ifdef HAVE_LIBZSTD
+bool Decompressor::inflateZstd()
+{
+	ZSTD_DCtx *context = ZSTD_createDCtx();
+	bool ok = true;
+	for (;;) {
+		if (mBegin == mEnd && !refill())
+			{ break; }
+
+		const char *frame = &mInput[mBegin];
+		size_t frame_size = ZSTD_findFrameCompressedSize( frame,
+		  mEnd - mBegin );
+		/* Read on while the whole frame may still fit. */
+		if (ZSTD_isError( frame_size ) && (mBegin > 0
+		  || mEnd < mInput.size()) && refill())
+			{ continue; }
+
+		const unsigned long long content = ZSTD_isError( frame_size )
+		  ? ZSTD_CONTENTSIZE_UNKNOWN
+		  : ZSTD_getFrameContentSize( frame, mEnd - mBegin );
+		if (content > FRAME_LIMIT) {
+			/* unknown size included */
+			if (!(ok = streamZstd( context )))
+				{ break; }
+			continue;
+		}
+
+		Block *block = take();
+		if (!block) {
+			ok = false;
+			break;
+		}
+		block->input.assign( frame, frame + frame_size );
+		block->output.resize( ::std::max<size_t>( content, 1 ) );
+		mBegin += frame_size;
+		emit( block, false );
+		mWork.push( block );
+	}
+	ZSTD_freeDCtx( context );
+	return ok;
+}
+/* ------------------------------------------------------------------------- */
+bool Decompressor::streamZstd( ZSTD_DCtx *context )
+{
+	ZSTD_DCtx_reset( context, ZSTD_reset_session_only );
+
+	Block *block = NULL;
+	for (;;) {
+		if (mBegin == mEnd && !refill()) {
+			if (block)
+				{ emit( block ); }
+			return fail( "unexpected end of data" );
+		}
+		if (!block && !(block = take()))
+			{ return false; }
+
+		ZSTD_inBuffer in = { &mInput[mBegin], mEnd - mBegin, 0 };
+		ZSTD_outBuffer out = { &block->output[block->size],
+		  block->output.size() - block->size, 0 };
+		const size_t res = ZSTD_decompressStream( context, &out, &in );
+		mBegin += in.pos;
+		block->size += out.pos;
+
+		if (ZSTD_isError( res )) {
+			emit( block );
+			return fail( ZSTD_getErrorName( res ) );
+		}
+		if (res == 0 || block->size == block->output.size()) {
+			emit( block );
+			block = NULL;
+		}
+		if (res == 0)
+			{ return true; }
+	}
+}
+#endif
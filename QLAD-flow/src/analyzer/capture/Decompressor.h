@@ -0,0 +1,209 @@
+/*
+ * This file is part of the DNS traffic analyser project.
+ *
+ * Copyright (C) 2011 CZ.NIC, z.s.p.o.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "proc/Thread.h"
+#include "struct/BoundedQueue.h"
+#include "sync/Semaphore.h"
+
+struct ZSTD_DCtx_s;
+
+/*!
+ * @class Decompressor Decompressor.h "capture/Decompressor.h"
+ * @brief Transparent in-process decompression of capture files.
+ *
+ * Recognises gzip, bzip2 and zstd compressed input by its magic bytes and
+ * presents the decompressed data as a standard FILE stream, which can be
+ * handed over to pcap_fopen_offline().
+ *
+ * Decompression runs on a background thread filling a pair of buffers,
+ * while the reader consumes the other one. Zstd input consisting of
+ * several frames (e.g. written by pzstd or zstd --rsyncable) is
+ * decompressed by a few worker threads in parallel, frames too large or of
+ * unknown size are streamed by the background thread itself. The
+ * decompressed data are always delivered in the original order.
+ */
+class Decompressor
+{
+public:
+	/*!
+	 * @brief Opens file, decompressing it if needed.
+	 * @param file Path to the file to open, "-" for stdin
+	 * @param errbuff Receives error text, PCAP_ERRBUF_SIZE bytes
+	 * @return Stream with uncompressed data, NULL on failure
+	 *
+	 * Uncompressed seekable files are returned as they are. Closing the
+	 * returned stream stops the background threads. Standard input is
+	 * never closed, libpcap does not close it either.
+	 */
+	static FILE * open( const char *file, char *errbuff );
+
+	enum {
+		MAX_WORKERS = 4              /*!< @brief Zstd frame workers. */
+	};
+
+protected:
+	/*! @brief Recognised input formats. */
+	enum Format {
+		FORMAT_PLAIN,
+		FORMAT_GZIP,
+		FORMAT_BZIP2,
+		FORMAT_ZSTD
+	};
+
+	enum {
+		MAGIC_SIZE = 4,              /*!< @brief Bytes to recognise. */
+		INPUT_SIZE = 1024 * 1024,    /*!< @brief Compressed input buffer.*/
+		BLOCK_SIZE = 1024 * 1024,    /*!< @brief Streamed block size. */
+		FRAME_LIMIT = 8 * 1024 * 1024  /*!< @brief Largest zstd frame
+		                                    decompressed in parallel. */
+	};
+
+	/*! @brief Piece of decompressed data, in the delivery order. */
+	struct Block {
+		::std::vector<char> input;  /*!< @brief Frame for a worker. */
+		::std::vector<char> output; /*!< @brief Decompressed data. */
+		size_t size;                /*!< @brief Valid bytes of output. */
+		bool failed;                /*!< @brief Input is corrupted. */
+		Semaphore ready;            /*!< @brief Raised once filled. */
+	};
+
+	/*!
+	 * @brief Prepares decompression, does not start it.
+	 * @param file Opened compressed file
+	 * @param name File name for messages
+	 * @param format Compression of the file
+	 * @param magic Bytes already read from the file
+	 * @param magic_size Number of bytes already read
+	 */
+	Decompressor( FILE *file, const char *name, Format format,
+	  const char *magic, size_t magic_size );
+
+	/*! @brief Stops the threads and closes the file. */
+	~Decompressor();
+
+	/*!
+	 * @brief Starts the threads and wraps the instance in a stream.
+	 * @return The stream, NULL on failure.
+	 */
+	FILE * start();
+
+	/*!
+	 * @brief Copies decompressed data.
+	 * @param buffer Destination
+	 * @param size Size of the destination
+	 * @return Number of copied bytes, 0 at the end, -1 on error.
+	 */
+	ssize_t read( char *buffer, size_t size );
+
+	/*! @brief Stream read callback. */
+	static ssize_t streamRead( void *cookie, char *buffer, size_t size );
+
+	/*! @brief Stream close callback, destroys the instance. */
+	static int streamClose( void *cookie );
+
+	/*!
+	 * @brief Background thread body, decompresses the input.
+	 * @param instance The instance to work for.
+	 * @return NOT USED
+	 */
+	static void * produce( Decompressor *instance );
+
+	/*!
+	 * @brief Worker thread body, decompresses zstd frames.
+	 * @param instance The instance to work for.
+	 * @return NOT USED
+	 */
+	static void * work( Decompressor *instance );
+
+	/*!
+	 * @brief Moves unread input to the front and reads more.
+	 * @return false if nothing could be read.
+	 */
+	bool refill();
+
+	/*! @brief Gets an empty block, NULL once stopped. */
+	Block * take();
+
+	/*!
+	 * @brief Queues block for delivery.
+	 * @param block The block.
+	 * @param ready Block is filled already, no worker will process it.
+	 */
+	void emit( Block *block, bool ready = true );
+
+	/*!
+	 * @brief Reports corrupted input to the reader.
+	 * @param reason Text to print.
+	 * @return false
+	 */
+	bool fail( const char *reason );
+
+	/*! @brief Passes plain input through. */
+	bool copy();
+#ifdef HAVE_LIBZ
+	/*! @brief Decompresses gzip input, concatenated members included. */
+	bool inflateGzip();
+#endif
+#ifdef HAVE_LIBBZ2
+	/*! @brief Decompresses bzip2 input, concatenated streams included. */
+	bool inflateBzip2();
+#endif
+#ifdef HAVE_LIBZSTD
+	/*! @brief Splits zstd input into frames. */
+	bool inflateZstd();
+
+	/*! @brief Decompresses one zstd frame on the current thread. */
+	bool streamZstd( ZSTD_DCtx_s *context );
+#endif
+
+	FILE *mFile;                     /*!< @brief Compressed input. */
+	const ::std::string mName;       /*!< @brief File name. */
+	const Format mFormat;            /*!< @brief Input compression. */
+	::std::vector<char> mInput;      /*!< @brief Compressed data. */
+	size_t mBegin;                   /*!< @brief First unused byte. */
+	size_t mEnd;                     /*!< @brief End of read data. */
+	bool mEof;                       /*!< @brief Whole file was read. */
+	::std::vector<Block *> mBlocks;  /*!< @brief All blocks. */
+	BoundedQueue<Block *> mFree;     /*!< @brief Blocks to fill. */
+	BoundedQueue<Block *> mOrdered;  /*!< @brief Blocks to deliver. */
+	BoundedQueue<Block *> mWork;     /*!< @brief Frames for workers. */
+	Thread mProducer;                /*!< @brief Decompressing thread. */
+	::std::vector<Thread *> mWorkers;/*!< @brief Zstd frame workers. */
+	Block *mCurrent;                 /*!< @brief Block being read. */
+	size_t mPosition;                /*!< @brief Read offset in it. */
+	bool mFailed;                    /*!< @brief Read error reported. */
+	bool mRunning;                   /*!< @brief Threads were started. */
+
+private:
+	/*! @brief Copy-constructor, FORBIDDEN */
+	Decompressor( const Decompressor & );
+
+	/*! @brief FORBIDDEN operator */
+	Decompressor & operator = ( const Decompressor & );
+};
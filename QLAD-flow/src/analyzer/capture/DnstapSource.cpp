@@ -0,0 +1,587 @@
+/*
+ * This file is part of the DNS traffic analyser project.
+ *
+ * Copyright (C) 2011 CZ.NIC, z.s.p.o.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "DnstapSource.h"
+#include "pcap_defines.h"
+#include "policies/MessageRecord.h"
+
+/*! @brief Frame Streams content type of dnstap. */
+#define CONTENT_TYPE "protobuf:dnstap.Dnstap"
+
+/*! @brief Frame Streams control frame types and fields. */
+enum {
+	CONTROL_ACCEPT = 0x01,
+	CONTROL_START = 0x02,
+	CONTROL_STOP = 0x03,
+	CONTROL_READY = 0x04,
+	CONTROL_FINISH = 0x05,
+	FIELD_CONTENT_TYPE = 0x01
+};
+
+/*! @brief Protobuf wire types. */
+enum {
+	WIRE_VARINT = 0,
+	WIRE_FIXED64 = 1,
+	WIRE_BYTES = 2,
+	WIRE_FIXED32 = 5
+};
+
+/*! @brief Field numbers of the dnstap messages. */
+enum {
+	DNSTAP_MESSAGE = 14,          /*!< @brief Dnstap.message */
+	DNSTAP_TYPE = 15,             /*!< @brief Dnstap.type */
+	DNSTAP_TYPE_MESSAGE = 1,      /*!< @brief Dnstap.Type.MESSAGE */
+	MESSAGE_TYPE = 1,             /*!< @brief Message.type */
+	MESSAGE_FAMILY = 2,           /*!< @brief Message.socket_family */
+	MESSAGE_QUERY_ADDRESS = 4,
+	MESSAGE_RESPONSE_ADDRESS = 5,
+	MESSAGE_QUERY_SEC = 8,
+	MESSAGE_QUERY_NSEC = 9,
+	MESSAGE_QUERY = 10,
+	MESSAGE_RESPONSE_SEC = 12,
+	MESSAGE_RESPONSE_NSEC = 13,
+	MESSAGE_RESPONSE = 14,
+	FAMILY_INET = 1,              /*!< @brief SocketFamily.INET */
+	FAMILY_INET6 = 2              /*!< @brief SocketFamily.INET6 */
+};
+
+/*! @brief One decoded protobuf field. */
+struct Field {
+	unsigned number;    /*!< @brief Field number. */
+	unsigned wire;      /*!< @brief Wire type. */
+	uint64_t value;     /*!< @brief Numeric value. */
+	const char *data;   /*!< @brief Bytes of WIRE_BYTES fields. */
+	size_t size;        /*!< @brief Number of the bytes. */
+};
+
+/*! @brief Bytes of a field if it was present. */
+struct Bytes {
+	Bytes(): data( NULL ), size( 0 ) {}
+
+	const char *data;   /*!< @brief The bytes, NULL if missing. */
+	size_t size;        /*!< @brief Number of the bytes. */
+};
+
+/*!
+ * @brief Reads big endian 32-bit number.
+ * @param data Position of the number
+ * @return The number
+ */
+static uint32_t read_be32( const char *data )
+{
+	uint32_t value;
+	memcpy( &value, data, sizeof( value ) );
+	return ntohl( value );
+}
+
+/*!
+ * @brief Reads protobuf base 128 varint.
+ * @param pos Position, moved behind the number
+ * @param end End of the data
+ * @param value Receives the number
+ * @return false if the data ends early
+ */
+static bool read_varint( const char *&pos, const char *end, uint64_t &value )
+{
+	value = 0;
+	for (unsigned shift = 0; pos < end && shift < 64; shift += 7) {
+		const unsigned char byte = *pos++;
+		value |= (uint64_t)(byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+			{ return true; }
+	}
+	return false;
+}
+
+/*!
+ * @brief Reads one protobuf field.
+ * @param pos Position, moved behind the field
+ * @param end End of the data
+ * @param field Receives the field
+ * @return false if the data is malformed
+ */
+static bool read_field( const char *&pos, const char *end, Field &field )
+{
+	uint64_t key;
+	if (!read_varint( pos, end, key ))
+		{ return false; }
+	field.number = key >> 3;
+	field.wire = key & 0x07;
+
+	switch (field.wire) {
+	case WIRE_VARINT:
+		return read_varint( pos, end, field.value );
+	case WIRE_BYTES:
+		if (!read_varint( pos, end, field.value )
+		  || field.value > (uint64_t)(end - pos))
+			{ return false; }
+		field.data = pos;
+		field.size = field.value;
+		pos += field.size;
+		return true;
+	case WIRE_FIXED64:
+	case WIRE_FIXED32: {
+		const size_t size = field.wire == WIRE_FIXED64 ? 8 : 4;
+		if ((size_t)(end - pos) < size)
+			{ return false; }
+		field.value = 0;
+		for (size_t i = size; i-- > 0;)
+			{ field.value = field.value << 8 | (unsigned char)pos[i]; }
+		pos += size;
+		return true;
+	}
+	default:
+		return false;
+	}
+}
+
+/*!
+ * @brief Sends a control frame to a writer.
+ * @param socket Connected socket
+ * @param type Control frame type
+ * @param content_type Include the dnstap content type
+ */
+static void send_control( int socket, uint32_t type, bool content_type )
+{
+	char frame[64];
+	size_t size = 8;
+	const uint32_t header[] = { htonl( type ), htonl( FIELD_CONTENT_TYPE ),
+	  htonl( sizeof( CONTENT_TYPE ) - 1 ) };
+	memcpy( frame + size, header, content_type ? 12 : 4 );
+	size += content_type ? 12 : 4;
+	if (content_type) {
+		memcpy( frame + size, CONTENT_TYPE, sizeof( CONTENT_TYPE ) - 1 );
+		size += sizeof( CONTENT_TYPE ) - 1;
+	}
+	const uint32_t escape[] = { 0, htonl( size - 8 ) };
+	memcpy( frame, escape, sizeof( escape ) );
+
+	/* tiny frame, the writer waits for it */
+	if (send( socket, frame, size, MSG_NOSIGNAL ) != (ssize_t)size) {
+		::std::cerr << "Failed to answer dnstap writer: "
+		  << strerror( errno ) << ::std::endl;
+	}
+}
+/* ------------------------------------------------------------------------- */
+DnstapSource::DnstapSource()
+: mListener( -1 ), mSelection( ALL ), mNext( 0 ), mRecords( READ_SIZE ),
+  mRecordsUsed( 0 ), mMalformed( 0 )
+{}
+/* ------------------------------------------------------------------------- */
+bool DnstapSource::open( const char *path, const char *filter )
+{
+	assert( mListener < 0 );
+
+	/* the pcap filters cannot apply to messages, recognise ours */
+	mSelection = ALL;
+	if (filter && strcmp( filter, PCAP_FILTER_DNS_QUERY ) == 0) {
+		mSelection = QUERIES;
+	} else if (filter && strcmp( filter, PCAP_FILTER_DNS_RESPONSE ) == 0) {
+		mSelection = RESPONSES;
+	} else if (filter && *filter) {
+		::std::cerr << "Filter " << filter
+		  << " is not supported for dnstap input" << ::std::endl;
+		return false;
+	}
+
+	sockaddr_un address;
+	memset( &address, 0, sizeof( address ) );
+	address.sun_family = AF_UNIX;
+	if (strlen( path ) >= sizeof( address.sun_path )) {
+		::std::cerr << "Socket path " << path << " is too long"
+		  << ::std::endl;
+		return false;
+	}
+	strcpy( address.sun_path, path );
+
+	/* a socket left behind by a previous run */
+	struct stat file_info;
+	if (stat( path, &file_info ) == 0 && S_ISSOCK( file_info.st_mode ))
+		{ unlink( path ); }
+
+	mListener = socket( AF_UNIX, SOCK_STREAM, 0 );
+	if (mListener < 0
+	  || bind( mListener, reinterpret_cast<sockaddr *>( &address ),
+	    sizeof( address ) ) != 0
+	  || listen( mListener, SOMAXCONN ) != 0) {
+		::std::cerr << "Failed to listen on " << path << " "
+		  << strerror( errno ) << ::std::endl;
+		if (mListener >= 0)
+			{ ::close( mListener ); }
+		mListener = -1;
+		return false;
+	}
+
+	mPath = path;
+	mNext = 0;
+	mMalformed = 0;
+	return true;
+}
+/* ------------------------------------------------------------------------- */
+void DnstapSource::close()
+{
+	assert( mListener >= 0 );
+
+	while (!mConnections.empty())
+		{ disconnect( mConnections.size() - 1 ); }
+	::close( mListener );
+	mListener = -1;
+	unlink( mPath.c_str() );
+
+	if (mMalformed) {
+		::std::cerr << "Ignored " << mMalformed
+		  << " malformed dnstap frames" << ::std::endl;
+	}
+}
+/* ------------------------------------------------------------------------- */
+unsigned DnstapSource::nextBatch( Packet *packets, unsigned max )
+{
+	assert( mListener >= 0 );
+
+	/* the previous batch is not used any more */
+	mRecordsUsed = 0;
+	mOffsets.clear();
+
+	for (;;) {
+		if (stopped())
+			{ return 0; }
+
+		/* serve the writers in turns, so none of them lags behind */
+		unsigned count = 0;
+		const size_t writers = mConnections.size();
+		for (size_t i = 0; i < writers && count < max; ++i) {
+			Connection &connection =
+			  *mConnections[(mNext + i) % writers];
+			count += process( connection, packets + count,
+			  max - count );
+		}
+		++mNext;
+
+		for (size_t i = mConnections.size(); i-- > 0;) {
+			const Connection &connection = *mConnections[i];
+			if (connection.done
+			  || (connection.closed && connection.drained))
+				{ disconnect( i ); }
+		}
+
+		if (count) {
+			assert( mOffsets.size() == count );
+			for (unsigned i = 0; i < count; ++i) {
+				packets[i].data = reinterpret_cast<const u_char *>(
+				  &mRecords[mOffsets[i]] );
+			}
+			return count;
+		}
+
+		::std::vector<pollfd> wait( mConnections.size() + 1 );
+		wait[0].fd = mListener;
+		wait[0].events = POLLIN;
+		for (size_t i = 0; i < mConnections.size(); ++i) {
+			wait[i + 1].fd = mConnections[i]->socket;
+			wait[i + 1].events = POLLIN;
+		}
+		/* EINTR just lets the loop check stopped() */
+		if (poll( &wait[0], wait.size(), POLL_TIMEOUT ) <= 0)
+			{ continue; }
+
+		for (size_t i = 0; i < mConnections.size(); ++i) {
+			if (wait[i + 1].revents && !receive( *mConnections[i] ))
+				{ mConnections[i]->closed = true; }
+		}
+		if (wait[0].revents & POLLIN)
+			{ accept(); }
+	}
+}
+/* ------------------------------------------------------------------------- */
+void DnstapSource::accept()
+{
+	const int socket = ::accept( mListener, NULL, NULL );
+	if (socket < 0) {
+		::std::cerr << "Failed to accept dnstap writer: "
+		  << strerror( errno ) << ::std::endl;
+		return;
+	}
+
+	Connection *connection = new Connection;
+	connection->socket = socket;
+	connection->buffer.resize( READ_SIZE );
+	connection->begin = connection->end = 0;
+	connection->started = false;
+	connection->drained = true;
+	connection->closed = false;
+	connection->done = false;
+	mConnections.push_back( connection );
+}
+/* ------------------------------------------------------------------------- */
+bool DnstapSource::receive( Connection &connection )
+{
+	::std::vector<char> &buffer = connection.buffer;
+
+	/* move the incomplete frame to the front to make room */
+	if (connection.begin == connection.end) {
+		connection.begin = connection.end = 0;
+	} else if (connection.end == buffer.size() && connection.begin) {
+		memmove( &buffer[0], &buffer[connection.begin],
+		  connection.end - connection.begin );
+		connection.end -= connection.begin;
+		connection.begin = 0;
+	}
+	/* a frame larger than the buffer, process() checks the limit */
+	if (connection.end == buffer.size())
+		{ buffer.resize( buffer.size() * 2 ); }
+
+	const ssize_t res = recv( connection.socket, &buffer[connection.end],
+	  buffer.size() - connection.end, 0 );
+	if (res < 0 && errno == EINTR)
+		{ return true; }
+	if (res <= 0)
+		{ return false; }
+
+	connection.end += res;
+	connection.drained = false;
+	return true;
+}
+/* ------------------------------------------------------------------------- */
+unsigned DnstapSource::process( Connection &connection, Packet *packets,
+  unsigned max )
+{
+	unsigned count = 0;
+	while (count < max && !connection.done) {
+		const char *data = &connection.buffer[0] + connection.begin;
+		const size_t available = connection.end - connection.begin;
+
+		/* data frames have a length, control frames a zero escape
+		 * and a length */
+		const bool is_control =
+		  available >= 4 && read_be32( data ) == 0;
+		const size_t header = is_control ? 8 : 4;
+		if (available < header)
+			{ break; }
+		const size_t size = read_be32( data + header - 4 );
+		if (size > MAX_FRAME) {
+			::std::cerr << "Oversized dnstap frame, dropping the writer"
+			  << ::std::endl;
+			connection.done = true;
+			break;
+		}
+		if (available < header + size)
+			{ break; }
+		connection.begin += header + size;
+
+		if (is_control) {
+			if (!control( connection, data + header, size ))
+				{ connection.done = true; }
+		} else if (!connection.started) {
+			++mMalformed;
+		} else if (decode( data + header, size, packets[count] )) {
+			++count;
+		}
+	}
+
+	connection.drained = count < max || connection.done;
+	return count;
+}
+/* ------------------------------------------------------------------------- */
+bool DnstapSource::control( Connection &connection, const char *frame,
+  size_t size )
+{
+	if (size < 4) {
+		++mMalformed;
+		return false;
+	}
+	const uint32_t type = read_be32( frame );
+
+	/* READY and START list the content types, one has to be dnstap */
+	bool content_types = false;
+	bool dnstap = false;
+	for (size_t pos = 4; pos + 8 <= size;) {
+		const uint32_t field = read_be32( frame + pos );
+		const uint32_t length = read_be32( frame + pos + 4 );
+		pos += 8;
+		if (length > size - pos)
+			{ break; }
+		if (field == FIELD_CONTENT_TYPE) {
+			content_types = true;
+			dnstap = dnstap || (length == sizeof( CONTENT_TYPE ) - 1
+			  && memcmp( frame + pos, CONTENT_TYPE, length ) == 0);
+		}
+		pos += length;
+	}
+
+	switch (type) {
+	case CONTROL_READY:
+	case CONTROL_START:
+		if (content_types && !dnstap) {
+			::std::cerr << "Dnstap writer offers another content"
+			  " type, dropping it" << ::std::endl;
+			return false;
+		}
+		if (type == CONTROL_READY)
+			{ send_control( connection.socket, CONTROL_ACCEPT, true ); }
+		else
+			{ connection.started = true; }
+		return true;
+	case CONTROL_STOP:
+		/* only bidirectional writers wait for FINISH, it does not
+		 * hurt the others */
+		send_control( connection.socket, CONTROL_FINISH, false );
+		return false;
+	default:
+		++mMalformed;
+		return false;
+	}
+}
+/* ------------------------------------------------------------------------- */
+bool DnstapSource::decode( const char *frame, size_t size, Packet &packet )
+{
+	Field field = Field();
+
+	/* find the Message in the Dnstap envelope */
+	Bytes message;
+	uint64_t dnstap_type = DNSTAP_TYPE_MESSAGE;
+	for (const char *pos = frame, *end = frame + size; pos < end;) {
+		if (!read_field( pos, end, field )) {
+			++mMalformed;
+			return false;
+		}
+		if (field.number == DNSTAP_MESSAGE && field.wire == WIRE_BYTES) {
+			message.data = field.data;
+			message.size = field.size;
+		} else if (field.number == DNSTAP_TYPE
+		  && field.wire == WIRE_VARINT) {
+			dnstap_type = field.value;
+		}
+	}
+	if (dnstap_type != DNSTAP_TYPE_MESSAGE || !message.data)
+		{ return false; }
+
+	uint64_t type = 0, family = 0;
+	uint64_t query_sec = 0, query_nsec = 0;
+	uint64_t response_sec = 0, response_nsec = 0;
+	Bytes query_address, response_address, query, response;
+	const char *end = message.data + message.size;
+	for (const char *pos = message.data; pos < end;) {
+		if (!read_field( pos, end, field )) {
+			++mMalformed;
+			return false;
+		}
+		Bytes bytes;
+		bytes.data = field.data;
+		bytes.size = field.size;
+		const bool is_bytes = field.wire == WIRE_BYTES;
+		switch (field.number) {
+		case MESSAGE_TYPE: type = field.value; break;
+		case MESSAGE_FAMILY: family = field.value; break;
+		case MESSAGE_QUERY_SEC: query_sec = field.value; break;
+		case MESSAGE_QUERY_NSEC: query_nsec = field.value; break;
+		case MESSAGE_RESPONSE_SEC: response_sec = field.value; break;
+		case MESSAGE_RESPONSE_NSEC: response_nsec = field.value; break;
+		case MESSAGE_QUERY_ADDRESS:
+			if (is_bytes) { query_address = bytes; }
+			break;
+		case MESSAGE_RESPONSE_ADDRESS:
+			if (is_bytes) { response_address = bytes; }
+			break;
+		case MESSAGE_QUERY:
+			if (is_bytes) { query = bytes; }
+			break;
+		case MESSAGE_RESPONSE:
+			if (is_bytes) { response = bytes; }
+			break;
+		default:
+			break;
+		}
+	}
+
+	/* all the query types are odd, the responses even */
+	const bool is_query = type % 2 == 1;
+	if (type == 0 || (mSelection == QUERIES && !is_query)
+	  || (mSelection == RESPONSES && is_query))
+		{ return false; }
+
+	/* orient the message as its packet would be */
+	const Bytes &source = is_query ? query_address : response_address;
+	const Bytes &destination = is_query ? response_address : query_address;
+	const Bytes &dns = is_query ? query : response;
+	uint64_t sec = is_query ? query_sec : response_sec;
+	uint64_t nsec = is_query ? query_nsec : response_nsec;
+	if (sec == 0) {
+		sec = is_query ? response_sec : query_sec;
+		nsec = is_query ? response_nsec : query_nsec;
+	}
+
+	const unsigned version = family == FAMILY_INET6 ? 6
+	  : family == FAMILY_INET ? 4 : source.size == 16 ? 6 : 4;
+#ifdef NO_IPV6
+	if (version == 6)
+		{ return false; }
+#endif
+	const size_t address_size = version == 6 ? 16 : 4;
+
+	/* records start aligned to 2 bytes, see MessageRecord */
+	const size_t record_size = sizeof( MessageRecord ) + dns.size;
+	if (mRecordsUsed + record_size > mRecords.size()) {
+		mRecords.resize( ::std::max( mRecords.size() * 2,
+		  mRecordsUsed + record_size ) );
+	}
+	MessageRecord *record =
+	  reinterpret_cast<MessageRecord *>( &mRecords[mRecordsUsed] );
+	memset( record, 0, sizeof( MessageRecord ) );
+	record->family = version;
+	if (source.size == address_size)
+		{ memcpy( record->source, source.data, address_size ); }
+	if (destination.size == address_size)
+		{ memcpy( record->destination, destination.data, address_size ); }
+	if (dns.size)
+		{ memcpy( record + 1, dns.data, dns.size ); }
+
+	mOffsets.push_back( mRecordsUsed );
+	mRecordsUsed += (record_size + 1) & ~(size_t)1;
+
+	packet.header.ts.tv_sec = sec;
+	packet.header.ts.tv_usec = nsec / 1000;
+	packet.header.caplen = packet.header.len = record_size;
+	packet.data = NULL;
+	return true;
+}
+/* ------------------------------------------------------------------------- */
+void DnstapSource::disconnect( size_t index )
+{
+	assert( index < mConnections.size() );
+	::close( mConnections[index]->socket );
+	delete mConnections[index];
+	mConnections.erase( mConnections.begin() + index );
+}
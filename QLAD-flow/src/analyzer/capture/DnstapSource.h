@@ -0,0 +1,179 @@
+/*
+ * This file is part of the DNS traffic analyser project.
+ *
+ * Copyright (C) 2011 CZ.NIC, z.s.p.o.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "PacketSource.h"
+
+/*!
+ * @class DnstapSource DnstapSource.h "capture/DnstapSource.h"
+ * @brief PacketSource receiving dnstap messages from name servers.
+ *
+ * Listens on a Unix socket for Frame Streams connections carrying
+ * dnstap protobuf messages, as written by name servers with dnstap
+ * logging enabled. Both the bidirectional handshake and plain
+ * unidirectional streams are accepted, from several writers at once.
+ *
+ * Every message is delivered as a MessageRecord with the sender and
+ * receiver addresses followed by the DNS message itself, datalink() is
+ * LINK_MESSAGE. The time-stamp is the query or response time recorded
+ * by the name server. The protobuf fields are read in place, the only
+ * copy is the DNS message into the reused record buffer.
+ *
+ * Delivered records stay valid until the next call to next() or
+ * nextBatch(). The source is live, it ends only after stop().
+ */
+class DnstapSource: public PacketSource
+{
+public:
+	/*! @brief Creates closed source. */
+	DnstapSource();
+
+	/*! @brief Closes the socket if still opened. */
+	~DnstapSource()
+		{ if (mListener >= 0) { close(); } }
+
+	/*!
+	 * @brief Starts listening on a Unix socket.
+	 * @param path Path of the socket, a stale socket is replaced
+	 * @param filter Either of the query and response filters of
+	 * pcap_defines.h, or none
+	 * @return true on success, false on failure
+	 *
+	 * On error returns false and prints human readable text on stderr.
+	 */
+	bool open( const char *path, const char *filter );
+
+	/*! @brief Closes all connections and removes the socket. */
+	void close();
+
+	bool next( Packet &packet )
+		{ return nextBatch( &packet, 1 ) == 1; }
+
+	/*!
+	 * @brief Waits for messages and fetches them.
+	 *
+	 * Returns 0 only after stop() was called.
+	 */
+	unsigned nextBatch( Packet *packets, unsigned max );
+
+	int datalink() const
+		{ return LINK_MESSAGE; }
+
+protected:
+	enum {
+		READ_SIZE = 256 * 1024,   /*!< @brief Initial buffer size. */
+		MAX_FRAME = 1024 * 1024,  /*!< @brief Longer frames are
+		                              considered corrupted. */
+		POLL_TIMEOUT = 500        /*!< @brief Milliseconds to wait
+		                              before checking stop(). */
+	};
+
+	/*! @brief Messages to deliver. */
+	enum Selection {
+		ALL,        /*!< @brief Queries and responses. */
+		QUERIES,    /*!< @brief Only queries. */
+		RESPONSES   /*!< @brief Only responses. */
+	};
+
+	/*! @brief One connected writer. */
+	struct Connection {
+		int socket;                 /*!< @brief Connected socket. */
+		::std::vector<char> buffer; /*!< @brief Received data. */
+		size_t begin;               /*!< @brief First unused byte. */
+		size_t end;                 /*!< @brief End of the data. */
+		bool started;               /*!< @brief START was received. */
+		bool drained;               /*!< @brief No complete frame is
+		                                left in buffer. */
+		bool closed;                /*!< @brief Writer hung up. */
+		bool done;                  /*!< @brief STOP was received or
+		                                the stream is broken. */
+	};
+
+	/*! @brief Accepts a new writer. */
+	void accept();
+
+	/*!
+	 * @brief Reads available data of a writer.
+	 * @param connection The writer
+	 * @return false when the connection is over
+	 */
+	bool receive( Connection &connection );
+
+	/*!
+	 * @brief Handles the complete frames received from a writer.
+	 * @param connection The writer
+	 * @param packets Receives the decoded messages
+	 * @param max Capacity of packets
+	 * @return Number of decoded messages
+	 *
+	 * Records of the decoded messages are appended to mRecords, the
+	 * data pointers of packets are set by nextBatch().
+	 */
+	unsigned process( Connection &connection, Packet *packets,
+	  unsigned max );
+
+	/*!
+	 * @brief Handles a control frame.
+	 * @param connection The writer
+	 * @param frame Control frame, without the escape and length
+	 * @param size Frame size
+	 * @return false if the connection is to be closed
+	 */
+	bool control( Connection &connection, const char *frame, size_t size );
+
+	/*!
+	 * @brief Decodes a dnstap data frame into a record.
+	 * @param frame Protobuf encoded Dnstap message
+	 * @param size Frame size
+	 * @param packet Receives the time-stamp and size of the record
+	 * @return false if the frame does not carry a selected DNS message
+	 *
+	 * Appends the record to mRecords and its offset to mOffsets.
+	 */
+	bool decode( const char *frame, size_t size, Packet &packet );
+
+	/*! @brief Closes the connection at the index. */
+	void disconnect( size_t index );
+
+	int mListener;                  /*!< @brief Listening socket. */
+	::std::string mPath;            /*!< @brief Socket path. */
+	Selection mSelection;           /*!< @brief Delivered messages. */
+	::std::vector<Connection *> mConnections; /*!< @brief Writers. */
+	size_t mNext;                   /*!< @brief Next writer to serve. */
+	::std::vector<char> mRecords;   /*!< @brief Delivered records. */
+	size_t mRecordsUsed;            /*!< @brief Used part of mRecords. */
+	::std::vector<size_t> mOffsets; /*!< @brief Of delivered records. */
+	unsigned long mMalformed;       /*!< @brief Undecodable frames. */
+
+private:
+	/*! @brief Copy-constructor, FORBIDDEN */
+	DnstapSource( const DnstapSource & );
+
+	/*! @brief FORBIDDEN operator */
+	DnstapSource & operator = ( const DnstapSource & );
+};
@@ -0,0 +1,96 @@
+/*
+ * This file is part of the DNS traffic analyser project.
+ *
+ * Copyright (C) 2011 CZ.NIC, z.s.p.o.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <cassert>
+#include <iostream>
+
+#include "FailureSampler.h"
+#include "sync/MutexLocker.h"
+
+bool FailureSampler::open( const char *path, unsigned rate )
+{
+	assert( !mDumper );
+	assert( path );
+
+	mPcap = pcap_open_dead( DLT_RAW, 65535 );
+	mDumper = mPcap ? pcap_dump_open( mPcap, path ) : NULL;
+	if (!mDumper) {
+		::std::cerr << "Cannot create " << path << " "
+		  << (mPcap ? pcap_geterr( mPcap ) : "") << ::std::endl;
+		close();
+		return false;
+	}
+	mRate = rate;
+	mSecond = 0;
+	mInSecond = 0;
+	mWritten = mDropped = 0;
+	return true;
+}
+/* ------------------------------------------------------------------------- */
+void FailureSampler::close()
+{
+	if (mDumper) {
+		pcap_dump_close( mDumper );
+		mDumper = NULL;
+		::std::cerr << "Malformed DNS packets: " << mWritten
+		  << " written, " << mDropped << " over the rate limit"
+		  << ::std::endl;
+	}
+	if (mPcap)
+		{ pcap_close( mPcap ); }
+	mPcap = NULL;
+}
+/* ------------------------------------------------------------------------- */
+void FailureSampler::sample( const IStorage::PacketView *packets,
+  const PacketRecord *records, size_t count )
+{
+	for (size_t i = 0; i < count; ++i) {
+		if (records[i].failure >= PacketRecord::FAIL_MALFORMED
+		  && packets[i].format == IStorage::IP_PACKET)
+			{ write( packets[i] ); }
+	}
+}
+/* ------------------------------------------------------------------------- */
+void FailureSampler::write( const IStorage::PacketView &packet )
+{
+	MutexLocker lock( mGuard );
+	if (!mDumper)
+		{ return; }
+
+	/* the streams interleave, a late packet uses the newest budget */
+	if (packet.arrival > mSecond) {
+		mSecond = packet.arrival;
+		mInSecond = 0;
+	}
+	if (mInSecond == mRate)
+		{ ++mDropped; return; }
+	++mInSecond;
+	++mWritten;
+
+	pcap_pkthdr header;
+	header.ts.tv_sec = packet.arrival;
+	header.ts.tv_usec = 0;
+	header.caplen = header.len = packet.size;
+	pcap_dump( reinterpret_cast<u_char *>( mDumper ), &header,
+	  reinterpret_cast<const u_char *>( packet.data ) );
+}
@@ -0,0 +1,96 @@
+/*
+ * This file is part of the DNS traffic analyser project.
+ *
+ * Copyright (C) 2011 CZ.NIC, z.s.p.o.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <cstddef>
+#include <ctime>
+#include <stdint.h>
+#include <pcap.h>
+
+#include "IStorage.h"
+#include "policies/PacketRecord.h"
+#include "sync/Mutex.h"
+
+/*!
+ * @class FailureSampler FailureSampler.h "capture/FailureSampler.h"
+ * @brief Writes samples of the packets that are not valid DNS to a pcap
+ * file.
+ *
+ * Packets to or from port 53 that failed to decode for one of the reasons
+ * from PacketRecord::FAIL_MALFORMED on are written as raw IP, at most a
+ * given number per second of their arrival time, so that a flood of bad
+ * packets neither slows the analysis nor fills the disk. Packets older
+ * than the newest second seen count against its budget. DNS messages
+ * without their packet are not written. Any thread may sample.
+ */
+class FailureSampler
+{
+public:
+	/*! @brief Creates closed sampler. */
+	FailureSampler(): mPcap( NULL ), mDumper( NULL ), mRate( 0 ),
+	  mSecond( 0 ), mInSecond( 0 ), mWritten( 0 ), mDropped( 0 ) {}
+
+	/*! @brief Closes the file. */
+	~FailureSampler()
+		{ close(); }
+
+	/*!
+	 * @brief Creates the pcap file.
+	 * @param path File to write.
+	 * @param rate Maximum packets written per second.
+	 * @return False if the file cannot be created.
+	 */
+	bool open( const char *path, unsigned rate );
+
+	/*! @brief Closes the file and reports the written packets. */
+	void close();
+
+	/*!
+	 * @brief Writes the failed packets of a batch.
+	 * @param packets Decoded packets.
+	 * @param records Their records.
+	 * @param count Number of packets.
+	 */
+	void sample( const IStorage::PacketView *packets,
+	  const PacketRecord *records, size_t count );
+
+private:
+	/*! @brief Writes the packet unless over the rate. */
+	void write( const IStorage::PacketView &packet );
+
+	pcap_t *mPcap;           /*!< @brief Raw IP link of the file. */
+	pcap_dumper_t *mDumper;  /*!< @brief The file. */
+	unsigned mRate;          /*!< @brief Packets per second. */
+	time_t mSecond;          /*!< @brief Second being sampled. */
+	unsigned mInSecond;      /*!< @brief Packets written in it. */
+	uint64_t mWritten;       /*!< @brief Packets written. */
+	uint64_t mDropped;       /*!< @brief Packets over the rate. */
+	Mutex mGuard;            /*!< @brief Guards the file and counters. */
+
+	/*! @brief DO NOT COPY! */
+	FailureSampler( const FailureSampler & );
+
+	/*! @brief DO NOT COPY! */
+	FailureSampler & operator = ( const FailureSampler & );
+};
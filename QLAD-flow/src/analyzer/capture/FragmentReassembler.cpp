@@ -0,0 +1,309 @@
+/*
+ * This file is part of the DNS traffic analyser project.
+ *
+ * Copyright (C) 2011 CZ.NIC, z.s.p.o.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <cassert>
+#include <cstring>
+#include <netinet/in.h>
+
+#include "FragmentReassembler.h"
+
+/* key layout */
+#define KEY_SOURCE 1
+#define KEY_DESTINATION 17
+#define KEY_PROTOCOL 33
+#define KEY_ID 34
+
+/*! @brief Reads 16-bit field in network byte order. */
+static inline unsigned read16( const u_char *position )
+	{ return position[0] << 8 | position[1]; }
+/* ------------------------------------------------------------------------- */
+FragmentReassembler::FragmentReassembler( size_t memory )
+: mFree( 0 ), mNow( 0 ), mBuffered( 0 ), mReassembled( 0 ), mEvicted( 0 ),
+  mExpired( 0 ), mInvalid( 0 )
+{
+	size_t datagrams = memory / DATAGRAM_SHARE;
+	if (datagrams < MIN_DATAGRAMS)
+		{ datagrams = MIN_DATAGRAMS; }
+	size_t buckets = 1;
+	while (buckets < datagrams)
+		{ buckets *= 2; }
+
+	mDatagrams.resize( datagrams + 1 );
+	mBuckets.assign( buckets, 0 );
+	for (size_t i = datagrams; i > 0; --i) {
+		mDatagrams[i].chain = mFree;
+		mFree = i;
+	}
+	memset( mWheel, 0, sizeof( mWheel ) );
+
+	/* the table itself counts too */
+	const size_t table = mDatagrams.size() * sizeof( Datagram )
+	  + mBuckets.size() * sizeof( unsigned );
+	mBudget = memory > table ? memory - table : 0;
+}
+/* ------------------------------------------------------------------------- */
+const u_char * FragmentReassembler::add( const u_char *ip,
+  PacketMeta &meta, time_t now )
+{
+	expire( now );
+
+	/* nothing else is analysed */
+	if (meta.protocol != IPPROTO_UDP && meta.protocol != IPPROTO_TCP)
+		{ return NULL; }
+
+	unsigned char key[KEY_SIZE];
+	memset( key, 0, sizeof( key ) );
+	key[0] = meta.version;
+	key[KEY_PROTOCOL] = meta.protocol;
+	uint32_t offset;
+	size_t declared;
+	bool more;
+	/* the decoder checked the header length */
+	if (meta.version == 4) {
+		const unsigned field = read16( ip + 6 );
+		offset = (field & 0x1fff) * 8;
+		more = field & 0x2000;
+		declared = read16( ip + 2 );
+		memcpy( key + KEY_SOURCE, ip + 12, 4 );
+		memcpy( key + KEY_DESTINATION, ip + 16, 4 );
+		memcpy( key + KEY_ID, ip + 4, 2 );
+	} else {
+		/* the decoder stops behind the fragment header */
+		const u_char *fragment = ip + meta.transport - 8;
+		const unsigned field = read16( fragment + 2 );
+		offset = field & 0xfff8;
+		more = field & 0x0001;
+		declared = read16( ip + 4 ) + 40;
+		memcpy( key + KEY_SOURCE, ip + 8, 16 );
+		memcpy( key + KEY_DESTINATION, ip + 24, 16 );
+		memcpy( key + KEY_ID, fragment + 4, 4 );
+	}
+	/* cut by the snapshot length, the datagram cannot be completed */
+	if (meta.length < declared)
+		{ return NULL; }
+
+	const uint32_t code = hash( key );
+	unsigned index = find( key, code );
+	if (!index)
+		{ index = create( key, code ); }
+	Datagram &datagram = mDatagrams[index];
+	const size_t capacity =
+	  datagram.header.capacity() + datagram.data.capacity();
+
+	if (!insert( datagram, ip + meta.transport, offset,
+	  meta.length - meta.transport, more )) {
+		++mInvalid;
+		remove( index );
+		return NULL;
+	}
+	if (offset == 0 && datagram.header.empty())
+		{ datagram.header.assign( ip, ip + meta.transport ); }
+	account( capacity,
+	  datagram.header.capacity() + datagram.data.capacity() );
+
+	/* make room, the datagrams closest to their expiry first */
+	while (mBuffered > mBudget) {
+		const unsigned victim = oldest();
+		assert( victim );
+		++mEvicted;
+		remove( victim );
+		if (victim == index)
+			{ return NULL; }
+	}
+
+	if (!datagram.total || datagram.received != datagram.total
+	  || datagram.header.empty())
+		{ return NULL; }
+
+	/* complete, IPv6 counts the payload only */
+	const size_t length = datagram.header.size() + datagram.total;
+	if (length > (meta.version == 4 ? 0xffffu : 0xffffu + 40)) {
+		++mInvalid;
+		remove( index );
+		return NULL;
+	}
+	mOutput.assign( datagram.header.begin(), datagram.header.end() );
+	mOutput.insert( mOutput.end(), datagram.data.begin(),
+	  datagram.data.begin() + datagram.total );
+	if (meta.version == 4) {
+		mOutput[2] = length >> 8;
+		mOutput[3] = length;
+		/* keep the don't fragment flag */
+		mOutput[6] &= 0x40;
+		mOutput[7] = 0;
+	} else {
+		mOutput[4] = (length - 40) >> 8;
+		mOutput[5] = length - 40;
+	}
+	meta.length = length;
+	meta.transport = datagram.header.size();
+	meta.fragment = 0;
+
+	++mReassembled;
+	remove( index );
+	return &mOutput[0];
+}
+/* ------------------------------------------------------------------------- */
+bool FragmentReassembler::insert( Datagram &datagram, const u_char *payload,
+  uint32_t offset, uint32_t size, bool more )
+{
+	const uint32_t end = offset + size;
+	/* all but the last fragment carry multiples of 8 bytes */
+	if ((more && (size == 0 || size % 8)) || end > 0xffff)
+		{ return false; }
+	if (datagram.total && (end > datagram.total
+	  || (!more && end != datagram.total)))
+		{ return false; }
+
+	for (unsigned i = 0; i < datagram.count; ++i) {
+		const Piece &piece = datagram.pieces[i];
+		/* retransmitted or duplicated on the way */
+		if (piece.begin == offset && piece.end == end)
+			{ return true; }
+		if (offset < piece.end && piece.begin < end)
+			{ return false; }
+		if (!more && piece.end > end)
+			{ return false; }
+	}
+	if (datagram.count == MAX_FRAGMENTS)
+		{ return false; }
+
+	if (datagram.data.size() < end)
+		{ datagram.data.resize( end ); }
+	if (size)
+		{ memcpy( &datagram.data[offset], payload, size ); }
+	const Piece piece = { offset, end };
+	datagram.pieces[datagram.count++] = piece;
+	datagram.received += size;
+	if (!more)
+		{ datagram.total = end; }
+	return true;
+}
+/* ------------------------------------------------------------------------- */
+unsigned FragmentReassembler::find( const unsigned char *key,
+  uint32_t hash ) const
+{
+	unsigned index = mBuckets[hash & (mBuckets.size() - 1)];
+	while (index && memcmp( mDatagrams[index].key, key, KEY_SIZE ) != 0)
+		{ index = mDatagrams[index].chain; }
+	return index;
+}
+/* ------------------------------------------------------------------------- */
+unsigned FragmentReassembler::create( const unsigned char *key,
+  uint32_t hash )
+{
+	if (!mFree) {
+		++mEvicted;
+		remove( oldest() );
+	}
+
+	const unsigned index = mFree;
+	Datagram &datagram = mDatagrams[index];
+	mFree = datagram.chain;
+
+	memcpy( datagram.key, key, KEY_SIZE );
+	datagram.count = 0;
+	datagram.received = datagram.total = 0;
+	unsigned &bucket = mBuckets[hash & (mBuckets.size() - 1)];
+	datagram.chain = bucket;
+	bucket = index;
+
+	/* the deadlines of a slot are all the same */
+	datagram.deadline = mNow + TIMEOUT;
+	unsigned &slot = mWheel[datagram.deadline % WHEEL_SIZE];
+	datagram.earlier = 0;
+	datagram.later = slot;
+	if (slot)
+		{ mDatagrams[slot].earlier = index; }
+	slot = index;
+	return index;
+}
+/* ------------------------------------------------------------------------- */
+void FragmentReassembler::remove( unsigned index )
+{
+	assert( index );
+	Datagram &datagram = mDatagrams[index];
+
+	unsigned *link = &mBuckets[hash( datagram.key ) & (mBuckets.size() - 1)];
+	while (*link != index)
+		{ link = &mDatagrams[*link].chain; }
+	*link = datagram.chain;
+
+	if (datagram.earlier)
+		{ mDatagrams[datagram.earlier].later = datagram.later; }
+	else
+		{ mWheel[datagram.deadline % WHEEL_SIZE] = datagram.later; }
+	if (datagram.later)
+		{ mDatagrams[datagram.later].earlier = datagram.earlier; }
+
+	const size_t capacity =
+	  datagram.header.capacity() + datagram.data.capacity();
+	::std::vector<u_char>().swap( datagram.header );
+	::std::vector<u_char>().swap( datagram.data );
+	account( capacity, 0 );
+
+	datagram.chain = mFree;
+	mFree = index;
+}
+/* ------------------------------------------------------------------------- */
+void FragmentReassembler::expire( time_t now )
+{
+	if (now <= mNow)
+		{ return; }
+
+	/* the deadlines are less than a turn of the wheel ahead */
+	const time_t last = now - mNow < WHEEL_SIZE ? now : mNow + WHEEL_SIZE;
+	for (time_t second = mNow + 1; second <= last; ++second) {
+		unsigned &slot = mWheel[second % WHEEL_SIZE];
+		while (slot) {
+			assert( mDatagrams[slot].deadline <= now );
+			++mExpired;
+			remove( slot );
+		}
+	}
+	mNow = now;
+}
+/* ------------------------------------------------------------------------- */
+unsigned FragmentReassembler::oldest() const
+{
+	for (time_t second = mNow + 1; second <= mNow + WHEEL_SIZE; ++second) {
+		const unsigned slot = mWheel[second % WHEEL_SIZE];
+		if (slot)
+			{ return slot; }
+	}
+	return 0;
+}
+/* ------------------------------------------------------------------------- */
+void FragmentReassembler::account( size_t before, size_t after )
+{
+	mBuffered += after;
+	mBuffered -= before;
+}
+/* ------------------------------------------------------------------------- */
+uint32_t FragmentReassembler::hash( const unsigned char *key )
+{
+	/* FNV-1a */
+	uint32_t hash = 2166136261u;
+	for (unsigned i = 0; i < KEY_SIZE; ++i)
+		{ hash = (hash ^ key[i]) * 16777619u; }
+	return hash;
+}
@@ -0,0 +1,183 @@
+/*
+ * This file is part of the DNS traffic analyser project.
+ *
+ * Copyright (C) 2011 CZ.NIC, z.s.p.o.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <cstddef>
+#include <ctime>
+#include <stdint.h>
+#include <vector>
+
+#include "LinkDecoder.h"
+
+/*!
+ * @class FragmentReassembler FragmentReassembler.h
+ * "capture/FragmentReassembler.h"
+ * @brief Reassembles fragmented UDP and TCP datagrams of IPv4 and IPv6.
+ *
+ * Fragments are collected per datagram in a table of a fixed size. A
+ * datagram not complete within TIMEOUT seconds of its first fragment is
+ * dropped by an expiry wheel with a slot per second. When the table is
+ * full or the buffered fragments exceed the memory limit, the datagrams
+ * closest to their expiry are evicted, so a flood of fragments cannot
+ * exhaust the memory.
+ *
+ * Fragments overlapping other than as exact duplicates, datagrams of
+ * more than MAX_FRAGMENTS pieces or larger than an IP packet may be are
+ * dropped as invalid, as RFC 5722 requires for IPv6.
+ */
+class FragmentReassembler
+{
+public:
+	enum {
+		TIMEOUT = 30,       /*!< @brief Seconds to complete a datagram. */
+		MAX_FRAGMENTS = 32  /*!< @brief Pieces of one datagram. */
+	};
+
+	/*!
+	 * @brief Creates empty datagram table.
+	 * @param memory Upper bound on the memory taken by the fragments, in
+	 * bytes
+	 */
+	explicit FragmentReassembler( size_t memory );
+
+	/*!
+	 * @brief Adds a fragment to its datagram.
+	 * @param ip The IP packet of the fragment.
+	 * @param meta Its layout, receives the layout of the datagram if
+	 * complete.
+	 * @param now Time of the fragment, expires older datagrams.
+	 * @return The complete datagram valid until the next call, NULL if
+	 * there is none.
+	 *
+	 * The datagram starts with the headers of the first fragment, with
+	 * the total length and fragment offset of an IPv4 header updated and
+	 * the fragment header of IPv6 left in place.
+	 */
+	const u_char * add( const u_char *ip, PacketMeta &meta, time_t now );
+
+	/*! @brief Number of datagrams reassembled. */
+	unsigned long reassembled() const
+		{ return mReassembled; }
+
+	/*! @brief Number of datagrams evicted to make room. */
+	unsigned long evicted() const
+		{ return mEvicted; }
+
+	/*! @brief Number of datagrams not completed in time. */
+	unsigned long expired() const
+		{ return mExpired; }
+
+	/*! @brief Number of datagrams dropped for invalid fragments. */
+	unsigned long invalid() const
+		{ return mInvalid; }
+
+protected:
+	enum {
+		KEY_SIZE = 1 + 2 * 16 + 1 + 4,
+		                        /*!< @brief Family, addresses, protocol,
+		                            identification. */
+		DATAGRAM_SHARE = 4096,  /*!< @brief Memory per datagram of the
+		                            table size, in bytes. */
+		MIN_DATAGRAMS = 16,     /*!< @brief Smallest table. */
+		WHEEL_SIZE = 32         /*!< @brief Slots of the expiry wheel,
+		                            more than TIMEOUT. */
+	};
+
+	/*! @brief Received part of a datagram. */
+	struct Piece {
+		uint32_t begin;  /*!< @brief Offset of the first byte. */
+		uint32_t end;    /*!< @brief Offset past the last byte. */
+	};
+
+	/*! @brief Fragments of one datagram. */
+	struct Datagram {
+		unsigned char key[KEY_SIZE];   /*!< @brief Identity. */
+		time_t deadline;               /*!< @brief Time of expiry. */
+		::std::vector<u_char> header;  /*!< @brief Headers of the first
+		                                   fragment. */
+		::std::vector<u_char> data;    /*!< @brief The payload. */
+		Piece pieces[MAX_FRAGMENTS];   /*!< @brief Received parts. */
+		unsigned count;                /*!< @brief Used pieces. */
+		uint32_t received;             /*!< @brief Payload bytes. */
+		uint32_t total;                /*!< @brief Payload size, 0 until
+		                                   the last fragment. */
+		unsigned chain;                /*!< @brief Next datagram of the
+		                                   bucket or free one. */
+		unsigned earlier;              /*!< @brief Wheel slot neighbour. */
+		unsigned later;                /*!< @brief Wheel slot neighbour. */
+	};
+
+	/*! @brief Datagram of the key, 0 if none. */
+	unsigned find( const unsigned char *key, uint32_t hash ) const;
+
+	/*! @brief Starts a datagram, evicts one if the table is full. */
+	unsigned create( const unsigned char *key, uint32_t hash );
+
+	/*! @brief Releases the datagram. */
+	void remove( unsigned index );
+
+	/*! @brief Drops the datagrams expired by now. */
+	void expire( time_t now );
+
+	/*! @brief Datagram closest to its expiry, 0 if none. */
+	unsigned oldest() const;
+
+	/*!
+	 * @brief Stores a fragment.
+	 * @return false if the fragment is invalid.
+	 */
+	bool insert( Datagram &datagram, const u_char *payload,
+	  uint32_t offset, uint32_t size, bool more );
+
+	/*! @brief Counts the change of the datagram buffer capacity. */
+	void account( size_t before, size_t after );
+
+	/*! @brief Hash of a datagram key. */
+	static uint32_t hash( const unsigned char *key );
+
+	/*!
+	 * @brief Datagrams, the first one is a sentinel so that index 0
+	 * stands for none.
+	 */
+	::std::vector<Datagram> mDatagrams;
+	::std::vector<unsigned> mBuckets;  /*!< @brief Hash chains. */
+	unsigned mFree;                    /*!< @brief Unused datagrams. */
+	unsigned mWheel[WHEEL_SIZE];       /*!< @brief Datagrams by the second
+	                                       of their expiry. */
+	time_t mNow;                       /*!< @brief Latest time seen. */
+	size_t mBuffered;                  /*!< @brief Memory of buffers. */
+	size_t mBudget;                    /*!< @brief Limit of mBuffered. */
+	::std::vector<u_char> mOutput;     /*!< @brief Of the last add(). */
+	unsigned long mReassembled;        /*!< @brief Datagrams completed. */
+	unsigned long mEvicted;            /*!< @brief Datagrams evicted. */
+	unsigned long mExpired;            /*!< @brief Datagrams timed out. */
+	unsigned long mInvalid;            /*!< @brief Datagrams invalid. */
+
+private:
+	/*! @brief Copy-constructor, FORBIDDEN */
+	FragmentReassembler( const FragmentReassembler & );
+
+	/*! @brief FORBIDDEN operator */
+	FragmentReassembler & operator = ( const FragmentReassembler & );
+};
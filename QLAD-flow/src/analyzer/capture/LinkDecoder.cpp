@@ -0,0 +1,332 @@
+/*
+ * This file is part of the DNS traffic analyser project.
+ *
+ * Copyright (C) 2011 CZ.NIC, z.s.p.o.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <algorithm>
+#include <netinet/in.h>
+
+#include "LinkDecoder.h"
+
+#ifndef DLT_IPV4
+#define DLT_IPV4 228
+#endif
+#ifndef DLT_IPV6
+#define DLT_IPV6 229
+#endif
+#ifndef DLT_LINUX_SLL2
+#define DLT_LINUX_SLL2 276
+#endif
+
+/* EtherTypes */
+#define ETHERTYPE_IPV4 0x0800
+#define ETHERTYPE_IPV6 0x86dd
+#define ETHERTYPE_VLAN 0x8100
+#define ETHERTYPE_QINQ 0x88a8
+#define ETHERTYPE_QINQ_OLD 0x9100
+#define ETHERTYPE_MPLS 0x8847
+#define ETHERTYPE_MPLS_MULTICAST 0x8848
+#define ETHERTYPE_PPPOE 0x8864
+#define ETHERTYPE_BRIDGING 0x6558
+#define ETHERTYPE_ERSPAN_2 0x88be
+#define ETHERTYPE_ERSPAN_3 0x22eb
+
+/* PPP protocols */
+#define PPP_IPV4 0x0021
+#define PPP_IPV6 0x0057
+
+/* GRE flags */
+#define GRE_CHECKSUM 0x8000
+#define GRE_KEY 0x2000
+#define GRE_SEQUENCE 0x1000
+#define GRE_VERSION 0x0007
+
+/*! @brief Reads 16-bit field in network byte order. */
+static inline unsigned be16( const u_char *position )
+	{ return position[0] << 8 | position[1]; }
+/* ------------------------------------------------------------------------- */
+bool LinkDecoder::supported( int datalink )
+{
+	switch (datalink) {
+	case DLT_NULL:
+	case DLT_LOOP:
+	case DLT_EN10MB:
+	case DLT_RAW:
+	case DLT_IPV4:
+	case DLT_IPV6:
+	case DLT_PFLOG:
+	case DLT_LINUX_SLL:
+	case DLT_LINUX_SLL2:
+		return true;
+	default:
+		return false;
+	}
+}
+/* ------------------------------------------------------------------------- */
+bool LinkDecoder::walk( const u_char *data, size_t caplen, size_t &offset,
+  PacketMeta &meta ) const
+{
+	Frame frame = { data, caplen, 0 };
+
+	switch (mDatalink) {
+	case DLT_EN10MB:
+		return ethernet( frame, 0, offset, meta );
+	case DLT_RAW:
+	case DLT_IPV4:
+	case DLT_IPV6:
+		if (caplen >= 20 && data[0] >> 4 == 4
+		  && plainIPv4( data, caplen, meta )) {
+			offset = 0;
+			return true;
+		}
+		return ip( frame, 0, offset, meta );
+	case DLT_NULL:
+	case DLT_LOOP:
+		/* address family, the IP version tells enough */
+		return ip( frame, 4, offset, meta );
+	case DLT_LINUX_SLL:
+		return caplen >= 16
+		  && payload( be16( data + 14 ), frame, 16, offset, meta );
+	case DLT_LINUX_SLL2:
+		return caplen >= 20
+		  && payload( be16( data ), frame, 20, offset, meta );
+	case DLT_PFLOG:
+		/* header length is padded to 32 bits */
+		return caplen >= 1
+		  && ip( frame, (data[0] + 3) & ~3u, offset, meta );
+	default:
+		return false;
+	}
+}
+/* ------------------------------------------------------------------------- */
+bool LinkDecoder::ethernet( Frame &frame, size_t position, size_t &offset,
+  PacketMeta &meta )
+{
+	if (position + 14 > frame.size)
+		{ return false; }
+	return payload( be16( frame.data + position + 12 ), frame,
+	  position + 14, offset, meta );
+}
+/* ------------------------------------------------------------------------- */
+bool LinkDecoder::payload( unsigned type, Frame &frame, size_t position,
+  size_t &offset, PacketMeta &meta )
+{
+	const u_char *data = frame.data;
+	for (;;) {
+		if (++frame.depth > MAX_DEPTH)
+			{ return false; }
+
+		switch (type) {
+		case ETHERTYPE_IPV4:
+		case ETHERTYPE_IPV6:
+			return ip( frame, position, offset, meta );
+
+		case ETHERTYPE_VLAN:
+		case ETHERTYPE_QINQ:
+		case ETHERTYPE_QINQ_OLD:
+			if (position + 4 > frame.size)
+				{ return false; }
+			type = be16( data + position + 2 );
+			position += 4;
+			break;
+
+		case ETHERTYPE_MPLS:
+		case ETHERTYPE_MPLS_MULTICAST:
+			/* labels up to the bottom of the stack */
+			do {
+				if (position + 4 > frame.size
+				  || ++frame.depth > MAX_DEPTH)
+					{ return false; }
+				position += 4;
+			} while (!(data[position - 2] & 1));
+			if (position >= frame.size)
+				{ return false; }
+			/* no type, guessed by the first nibble */
+			switch (data[position] >> 4) {
+			case 4:
+			case 6:
+				return ip( frame, position, offset, meta );
+			case 0:
+				/* pseudowire control word, Ethernet follows */
+				return ethernet( frame, position + 4, offset,
+				  meta );
+			default:
+				return false;
+			}
+
+		case ETHERTYPE_PPPOE:
+			if (position + 8 > frame.size)
+				{ return false; }
+			switch (be16( data + position + 6 )) {
+			case PPP_IPV4:
+				type = ETHERTYPE_IPV4;
+				break;
+			case PPP_IPV6:
+				type = ETHERTYPE_IPV6;
+				break;
+			default:
+				return false;
+			}
+			position += 8;
+			break;
+
+		default:
+			return false;
+		}
+	}
+}
+/* ------------------------------------------------------------------------- */
+bool LinkDecoder::ip( Frame &frame, size_t position, size_t &offset,
+  PacketMeta &meta )
+{
+	if (++frame.depth > MAX_DEPTH || position >= frame.size)
+		{ return false; }
+
+	const u_char *header = frame.data + position;
+	const size_t available = frame.size - position;
+	size_t length, transport;
+	unsigned protocol;
+	bool fragment;
+
+	switch (header[0] >> 4) {
+	case 4: {
+		if (available < 20)
+			{ return false; }
+		transport = (header[0] & 0x0f) * 4;
+		const size_t total = be16( header + 2 );
+		if (transport < 20 || total < transport
+		  || available < transport)
+			{ return false; }
+		length = ::std::min( total, available );
+		/* more fragments flag or fragment offset */
+		fragment = be16( header + 6 ) & 0x3fff;
+		protocol = header[9];
+		break;
+	}
+
+	case 6: {
+		if (available < 40)
+			{ return false; }
+		length = ::std::min( (size_t) be16( header + 4 ) + 40,
+		  available );
+		transport = 40;
+		protocol = header[6];
+		fragment = false;
+		/* extension headers, the transport header follows */
+		for (bool walk = true; walk; ) {
+			switch (protocol) {
+			case IPPROTO_HOPOPTS:
+			case IPPROTO_ROUTING:
+			case IPPROTO_DSTOPTS:
+				if (transport + 8 > length)
+					{ return false; }
+				protocol = header[transport];
+				transport += (header[transport + 1] + 1) * 8;
+				break;
+			case IPPROTO_AH:
+				if (transport + 8 > length)
+					{ return false; }
+				protocol = header[transport];
+				transport += (header[transport + 1] + 2) * 4;
+				break;
+			case IPPROTO_FRAGMENT:
+				if (transport + 8 > length)
+					{ return false; }
+				protocol = header[transport];
+				transport += 8;
+				fragment = true;
+				walk = false;
+				break;
+			default:
+				walk = false;
+				break;
+			}
+		}
+		if (transport > length || transport > 0xffff)
+			{ return false; }
+		break;
+	}
+
+	default:
+		return false;
+	}
+
+	if (!fragment) {
+		/* tunnels end with the outer packet */
+		switch (protocol) {
+		case IPPROTO_IPIP:
+		case IPPROTO_IPV6:
+			frame.size = position + length;
+			return ip( frame, position + transport, offset, meta );
+		case IPPROTO_GRE:
+			frame.size = position + length;
+			return gre( frame, position + transport,
+			  position + length, offset, meta );
+		default:
+			break;
+		}
+	}
+
+	offset = position;
+	meta.length = length;
+	meta.transport = transport;
+	meta.version = header[0] >> 4;
+	meta.protocol = protocol;
+	meta.fragment = fragment;
+	return true;
+}
+/* ------------------------------------------------------------------------- */
+bool LinkDecoder::gre( Frame &frame, size_t position, size_t end,
+  size_t &offset, PacketMeta &meta )
+{
+	if (position + 4 > end)
+		{ return false; }
+	const u_char *header = frame.data + position;
+	const unsigned flags = be16( header );
+	const unsigned type = be16( header + 2 );
+	/* version 1 is PPTP */
+	if (flags & GRE_VERSION)
+		{ return false; }
+
+	position += 4;
+	position += flags & GRE_CHECKSUM ? 4 : 0;
+	position += flags & GRE_KEY ? 4 : 0;
+	position += flags & GRE_SEQUENCE ? 4 : 0;
+	if (position > end)
+		{ return false; }
+
+	switch (type) {
+	case ETHERTYPE_BRIDGING:
+		return ethernet( frame, position, offset, meta );
+	case ETHERTYPE_ERSPAN_2:
+		/* type I has neither the sequence number nor a header */
+		return ethernet( frame,
+		  position + (flags & GRE_SEQUENCE ? 8 : 0), offset, meta );
+	case ETHERTYPE_ERSPAN_3:
+		if (position + 12 > end)
+			{ return false; }
+		/* optional platform specific subheader */
+		return ethernet( frame,
+		  position + (frame.data[position + 11] & 1 ? 20 : 12),
+		  offset, meta );
+	default:
+		return payload( type, frame, position, offset, meta );
+	}
+}
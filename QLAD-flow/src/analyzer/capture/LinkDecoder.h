@@ -0,0 +1,234 @@
+/*
+ * This file is part of the DNS traffic analyser project.
+ *
+ * Copyright (C) 2011 CZ.NIC, z.s.p.o.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pcap.h>
+
+/*!
+ * @struct PacketMeta LinkDecoder.h "capture/LinkDecoder.h"
+ * @brief Layout of a decoded IP packet, see LinkDecoder.
+ *
+ * Offsets are relative to the IP header, so they stay valid when the
+ * packet is copied from the IP header on.
+ */
+struct PacketMeta {
+	uint32_t length;     /*!< @brief IP header and payload, at most the
+	                         captured part. */
+	uint16_t transport;  /*!< @brief Offset of the transport header. */
+	uint8_t version;     /*!< @brief IP version, 4 or 6. */
+	uint8_t protocol;    /*!< @brief IPPROTO_* of the transport header. */
+	uint8_t fragment;    /*!< @brief Non-zero for a fragment, the
+	                         transport header is missing unless it is
+	                         the first one. */
+};
+
+/*!
+ * @class LinkDecoder LinkDecoder.h "capture/LinkDecoder.h"
+ * @brief Finds the IP packet inside the frames of a link type.
+ *
+ * Walks the link header and the encapsulations found in mirrored traffic
+ * in a single pass: 802.1Q/802.1ad VLAN tags (QinQ included), MPLS label
+ * stacks (with IP or Ethernet pseudowire payload), PPPoE sessions, GRE,
+ * ERSPAN type II and III, IP in IP and IPv6 extension headers. The
+ * innermost IP packet is described by a PacketMeta, so the policies do
+ * not walk the headers again.
+ *
+ * The decoder holds no state besides the link type, decode() may be
+ * called from any number of threads.
+ */
+class LinkDecoder
+{
+public:
+	/*!
+	 * @brief Creates decoder of frames.
+	 * @param datalink One of the pcap DLT_* values.
+	 */
+	explicit LinkDecoder( int datalink = DLT_RAW )
+	: mDatalink( datalink ) {}
+
+	/*!
+	 * @brief Checks whether frames of the link type can be decoded.
+	 * @param datalink One of the pcap DLT_* values.
+	 * @return true for supported link types.
+	 */
+	static bool supported( int datalink );
+
+	/*!
+	 * @brief Finds the innermost IP packet of a frame.
+	 * @param data Captured frame, link header included.
+	 * @param caplen Captured length.
+	 * @param offset Receives the offset of the IP header.
+	 * @param meta Receives the layout of the IP packet.
+	 * @return false if there is no complete IP header in the frame.
+	 */
+	bool decode( const u_char *data, size_t caplen, size_t &offset,
+	  PacketMeta &meta ) const
+	{
+		/* UDP and TCP in untagged Ethernet skip the walk */
+		if (mDatalink == DLT_EN10MB && caplen >= 14 + 20) {
+			/* EtherType and IP version tested at once */
+			uint32_t head;
+			memcpy( &head, data + 12, sizeof( head ) );
+			head &= htonl( 0xfffff000 );
+			if ((head == htonl( 0x08004000 )
+			  && plainIPv4( data + 14, caplen - 14, meta ))
+			  || (head == htonl( 0x86dd6000 )
+			  && plainIPv6( data + 14, caplen - 14, meta ))) {
+				offset = 14;
+				return true;
+			}
+		}
+		return walk( data, caplen, offset, meta );
+	}
+
+	/*! @brief The link type. */
+	int datalink() const
+		{ return mDatalink; }
+
+protected:
+	enum {
+		MAX_DEPTH = 16  /*!< @brief Limit of nested headers. */
+	};
+
+	/*! @brief Frame being decoded. */
+	struct Frame {
+		const u_char *data;  /*!< @brief First byte. */
+		size_t size;         /*!< @brief Captured length. */
+		unsigned depth;      /*!< @brief Headers walked so far. */
+	};
+
+	/*!
+	 * @brief Finds the innermost IP packet of a frame, see decode().
+	 * @param data Captured frame, link header included.
+	 * @param caplen Captured length.
+	 * @param offset Receives the offset of the IP header.
+	 * @param meta Receives the layout of the IP packet.
+	 * @return false if there is no complete IP header in the frame.
+	 *
+	 * Kept out of line, so the inlined fast path needs no stack frame.
+	 */
+	bool walk( const u_char *data, size_t caplen, size_t &offset,
+	  PacketMeta &meta ) const __attribute__(( noinline ));
+
+	/*!
+	 * @brief Decodes a complete IPv4 packet carrying UDP or TCP.
+	 * @param header The IP header, version 4 and 20 bytes at least.
+	 * @param available Captured bytes from the header on.
+	 * @param meta Receives the IP packet layout.
+	 * @return false if the complete walk is needed.
+	 */
+	static bool plainIPv4( const u_char *header, size_t available,
+	  PacketMeta &meta )
+	{
+		const unsigned transport = (header[0] & 0x0f) * 4;
+		const unsigned total = header[2] << 8 | header[3];
+		const unsigned protocol = header[9];
+		if (transport < 20 || total < transport || available < total
+		  || (protocol != IPPROTO_UDP && protocol != IPPROTO_TCP))
+			{ return false; }
+
+		meta.length = total;
+		meta.transport = transport;
+		meta.version = 4;
+		meta.protocol = protocol;
+		meta.fragment = ((header[6] << 8 | header[7]) & 0x3fff) != 0;
+		return true;
+	}
+
+	/*!
+	 * @brief Decodes a complete IPv6 packet carrying UDP or TCP.
+	 * @param header The IP header, version 6.
+	 * @param available Captured bytes from the header on.
+	 * @param meta Receives the IP packet layout.
+	 * @return false if the complete walk is needed.
+	 */
+	static bool plainIPv6( const u_char *header, size_t available,
+	  PacketMeta &meta )
+	{
+		const unsigned total = (header[4] << 8 | header[5]) + 40;
+		const unsigned protocol = header[6];
+		if (available < total
+		  || (protocol != IPPROTO_UDP && protocol != IPPROTO_TCP))
+			{ return false; }
+
+		meta.length = total;
+		meta.transport = 40;
+		meta.version = 6;
+		meta.protocol = protocol;
+		meta.fragment = 0;
+		return true;
+	}
+
+	/*!
+	 * @brief Decodes an Ethernet frame.
+	 * @param frame The frame.
+	 * @param position Offset of the Ethernet header.
+	 * @param offset Receives the offset of the innermost IP header.
+	 * @param meta Receives the IP packet layout.
+	 * @return false if no IP packet was found.
+	 */
+	static bool ethernet( Frame &frame, size_t position, size_t &offset,
+	  PacketMeta &meta );
+
+	/*!
+	 * @brief Decodes the payload of an EtherType.
+	 * @param type The EtherType.
+	 * @param frame The frame.
+	 * @param position Offset of the payload.
+	 * @param offset Receives the offset of the innermost IP header.
+	 * @param meta Receives the IP packet layout.
+	 * @return false if no IP packet was found.
+	 */
+	static bool payload( unsigned type, Frame &frame, size_t position,
+	  size_t &offset, PacketMeta &meta );
+
+	/*!
+	 * @brief Decodes an IP packet and any packet tunnelled in it.
+	 * @param frame The frame.
+	 * @param position Offset of the IP header.
+	 * @param offset Receives the offset of the innermost IP header.
+	 * @param meta Receives the IP packet layout.
+	 * @return false if the IP header is broken.
+	 */
+	static bool ip( Frame &frame, size_t position, size_t &offset,
+	  PacketMeta &meta );
+
+	/*!
+	 * @brief Decodes a GRE header and its payload.
+	 * @param frame The frame.
+	 * @param position Offset of the GRE header.
+	 * @param end End of the IP payload carrying GRE.
+	 * @param offset Receives the offset of the innermost IP header.
+	 * @param meta Receives the IP packet layout.
+	 * @return false if no IP packet was found.
+	 */
+	static bool gre( Frame &frame, size_t position, size_t end,
+	  size_t &offset, PacketMeta &meta );
+
+	int mDatalink;  /*!< @brief Link type of the frames. */
+};
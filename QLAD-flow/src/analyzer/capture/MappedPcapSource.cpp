@@ -0,0 +1,481 @@
+/*
+ * This file is part of the DNS traffic analyser project.
+ *
+ * Copyright (C) 2011 CZ.NIC, z.s.p.o.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "LinkDecoder.h"
+#include "MappedPcapSource.h"
+#include "pcap_defines.h"
+
+/*! @brief File magic, microsecond time-stamps. */
+#define MAGIC_MICRO 0xa1b2c3d4
+/*! @brief File magic, nanosecond time-stamps. */
+#define MAGIC_NANO 0xa1b23c4d
+/*! @brief pcapng section header block type, also the file magic. */
+#define BLOCK_SECTION 0x0a0d0d0a
+/*! @brief pcapng interface description block type. */
+#define BLOCK_INTERFACE 0x00000001
+/*! @brief pcapng obsolete packet block type. */
+#define BLOCK_PACKET 0x00000002
+/*! @brief pcapng simple packet block type. */
+#define BLOCK_SIMPLE 0x00000003
+/*! @brief pcapng enhanced packet block type. */
+#define BLOCK_ENHANCED 0x00000006
+/*! @brief pcapng byte-order magic. */
+#define BYTE_ORDER_MAGIC 0x1a2b3c4d
+/*! @brief pcapng if_tsresol option. */
+#define OPTION_TSRESOL 9
+/*! @brief pcapng if_tsoffset option. */
+#define OPTION_TSOFFSET 14
+
+/*! @brief LINKTYPE_RAW, files do not store the platform DLT_RAW. */
+#define LINKTYPE_RAW 101
+
+
+/*! @brief Converts link type stored in a file to DLT_* value. */
+static int link_type( uint32_t stored )
+	{ return stored == LINKTYPE_RAW ? DLT_RAW : (int) stored; }
+/* ------------------------------------------------------------------------- */
+MappedPcapSource::MappedPcapSource()
+: mMap( NULL ), mSize( 0 ), mPosition( 0 ), mAdvised( 0 ), mReleased( 0 ),
+  mDatalink( -1 ), mSwapped( false ), mNano( false ), mNg( false ),
+  mFiltered( false )
+{
+	timerclear( &mLastTime );
+}
+/* ------------------------------------------------------------------------- */
+bool MappedPcapSource::suitable( const char *file )
+{
+	struct stat file_info;
+	if (stat( file, &file_info ) != 0 || !S_ISREG( file_info.st_mode )
+	  || file_info.st_size < FILE_HEADER_SIZE)
+		{ return false; }
+
+	FILE *input = fopen( file, "rb" );
+	if (!input)
+		{ return false; }
+	uint32_t magic = 0;
+	const bool read = fread( &magic, sizeof( magic ), 1, input ) == 1;
+	fclose( input );
+
+	return read && (magic == MAGIC_MICRO || magic == MAGIC_NANO
+	  || magic == bswap_32( MAGIC_MICRO ) || magic == bswap_32( MAGIC_NANO )
+	  || magic == BLOCK_SECTION);
+}
+/* ------------------------------------------------------------------------- */
+bool MappedPcapSource::open( const char *file, const char *filter )
+{
+	assert( !mMap );
+
+	const int fd = ::open( file, O_RDONLY );
+	struct stat file_info;
+	if (fd < 0 || fstat( fd, &file_info ) != 0) {
+		std::cerr << "Failed to open file " << file << " "
+		  << strerror( errno ) << std::endl;
+		if (fd >= 0)
+			{ ::close( fd ); }
+		return false;
+	}
+
+	mSize = file_info.st_size;
+	void *map = mSize >= FILE_HEADER_SIZE
+	  ? mmap( NULL, mSize, PROT_READ, MAP_PRIVATE, fd, 0 ) : MAP_FAILED;
+	/* the mapping holds its own reference to the file */
+	::close( fd );
+	if (map == MAP_FAILED) {
+		std::cerr << "Failed to map file " << file << " "
+		  << strerror( errno ) << std::endl;
+		return false;
+	}
+	mMap = static_cast<const u_char *>( map );
+	madvise( map, mSize, MADV_SEQUENTIAL );
+
+	uint32_t magic;
+	memcpy( &magic, mMap, sizeof( magic ) );
+	mNg = magic == BLOCK_SECTION;
+	mAdvised = mReleased = 0;
+	mFilterText = filter ? filter : "";
+	if (mNg) {
+		/* packets of any interface start with the IP header */
+		mDatalink = DLT_RAW;
+		mPosition = 0;
+		timerclear( &mLastTime );
+		advise();
+		const uint32_t length = mSize >= BLOCK_HEADER_SIZE + 16
+		  && section( mMap ) ? field( mMap + 4 ) : 0;
+		if (length < BLOCK_HEADER_SIZE + 16 || length % 4
+		  || length > mSize) {
+			std::cerr << "File " << file << " is not a valid pcapng "
+			  "file" << std::endl;
+			close();
+			return false;
+		}
+		/* check the filter against the leading interfaces now */
+		mPosition = length;
+		while (mSize - mPosition >= BLOCK_HEADER_SIZE
+		  && field( mMap + mPosition ) == BLOCK_INTERFACE) {
+			const uint32_t length = field( mMap + mPosition + 4 );
+			if (length < BLOCK_HEADER_SIZE + 8 || length % 4
+			  || length > mSize - mPosition
+			  || !addInterface( mMap + mPosition, length )) {
+				close();
+				return false;
+			}
+			mPosition += length;
+		}
+		return true;
+	}
+
+	mSwapped = magic == bswap_32( MAGIC_MICRO )
+	  || magic == bswap_32( MAGIC_NANO );
+	magic = field( mMap );
+	if (magic != MAGIC_MICRO && magic != MAGIC_NANO) {
+		std::cerr << "File " << file << " is not a pcap file"
+		  << std::endl;
+		close();
+		return false;
+	}
+	mNano = magic == MAGIC_NANO;
+	/* link type is the last field of the file header */
+	mDatalink = link_type( field( mMap + FILE_HEADER_SIZE - 4 ) & 0x0fffffff );
+	mPosition = FILE_HEADER_SIZE;
+	advise();
+
+	mFiltered = filter && *filter;
+	if (mFiltered) {
+		pcap_t *dead = pcap_open_dead( mDatalink, MAX_CAPLEN );
+		const int res = pcap_compile( dead, &mFilter, filter,
+		  PCAP_FILTER_OPTIMIZE, PCAP_NETMASK_UNKNOWN );
+		if (res) {
+			std::cerr << "Failed to compile filter " << filter
+			  << " " << pcap_geterr( dead ) << std::endl;
+			mFiltered = false;
+		}
+		pcap_close( dead );
+		if (res) {
+			close();
+			return false;
+		}
+	}
+
+	return true;
+}
+/* ------------------------------------------------------------------------- */
+void MappedPcapSource::close()
+{
+	assert( mMap );
+	munmap( const_cast<u_char *>( mMap ), mSize );
+	mMap = NULL;
+	if (mFiltered)
+		{ pcap_freecode( &mFilter ); }
+	mFiltered = false;
+	clearInterfaces();
+}
+/* ------------------------------------------------------------------------- */
+unsigned MappedPcapSource::nextRecords( Packet *packets, unsigned max )
+{
+	assert( mMap );
+
+	advise();
+
+	unsigned count = 0;
+	while (count < max && mSize - mPosition >= RECORD_HEADER_SIZE) {
+		const u_char *record = mMap + mPosition;
+		Packet &packet = packets[count];
+		packet.header.ts.tv_sec = field( record );
+		packet.header.ts.tv_usec = field( record + 4 );
+		packet.header.caplen = field( record + 8 );
+		packet.header.len = field( record + 12 );
+		packet.data = record + RECORD_HEADER_SIZE;
+
+		const size_t caplen = packet.header.caplen;
+		if (caplen > MAX_CAPLEN
+		  || caplen > mSize - mPosition - RECORD_HEADER_SIZE) {
+			std::cerr << "Truncated or corrupted packet at offset "
+			  << mPosition << ", ignoring the rest of the file"
+			  << std::endl;
+			mPosition = mSize;
+			break;
+		}
+		mPosition += RECORD_HEADER_SIZE + caplen;
+
+		if (mNano)
+			{ packet.header.ts.tv_usec /= 1000; }
+		if (!mFiltered
+		  || pcap_offline_filter( &mFilter, &packet.header, packet.data ))
+			{ ++count; }
+	}
+
+	return count;
+}
+/* ------------------------------------------------------------------------- */
+unsigned MappedPcapSource::nextBlocks( Packet *packets, unsigned max )
+{
+	assert( mMap );
+
+	advise();
+
+	unsigned count = 0;
+	while (count < max && mSize - mPosition >= BLOCK_HEADER_SIZE) {
+		const u_char *block = mMap + mPosition;
+		const uint32_t type = field( block );
+		if (type == BLOCK_SECTION && !section( block )) {
+			std::cerr << "Unsupported section at offset " << mPosition
+			  << ", ignoring the rest of the file" << std::endl;
+			mPosition = mSize;
+			break;
+		}
+
+		const uint32_t length = field( block + 4 );
+		if (length < BLOCK_HEADER_SIZE || length % 4
+		  || length > mSize - mPosition) {
+			std::cerr << "Truncated or corrupted block at offset "
+			  << mPosition << ", ignoring the rest of the file"
+			  << std::endl;
+			mPosition = mSize;
+			break;
+		}
+		mPosition += length;
+
+		/* block bodies end before the trailing length */
+		const uint32_t body = length - BLOCK_HEADER_SIZE;
+		switch (type) {
+		case BLOCK_ENHANCED:
+			if (body >= 20 && field( block + 20 ) <= body - 20) {
+				const uint64_t time =
+				  (uint64_t) field( block + 12 ) << 32
+				  | field( block + 16 );
+				count += deliver( packets[count], field( block + 8 ),
+				  time, block + 28, field( block + 20 ),
+				  field( block + 24 ) );
+			}
+			break;
+		case BLOCK_SIMPLE:
+			if (body >= 4 && !mInterfaces.empty()) {
+				/* no time-stamp, keeps the previous one */
+				const uint32_t len = field( block + 8 );
+				const uint32_t caplen = ::std::min( ::std::min( len,
+				  body - 4 ), mInterfaces[0].snaplen ? mInterfaces[0]
+				  .snaplen : len );
+				const timeval last = mLastTime;
+				Packet &packet = packets[count];
+				count += deliver( packet, 0, 0, block + 12, caplen,
+				  len );
+				packet.header.ts = mLastTime = last;
+			}
+			break;
+		case BLOCK_PACKET:
+			if (body >= 20 && field( block + 20 ) <= body - 20) {
+				const uint64_t time =
+				  (uint64_t) field( block + 12 ) << 32
+				  | field( block + 16 );
+				count += deliver( packets[count], field16( block + 8 ),
+				  time, block + 28, field( block + 20 ),
+				  field( block + 24 ) );
+			}
+			break;
+		case BLOCK_INTERFACE:
+			if (body >= 8)
+				{ addInterface( block, length ); }
+			break;
+		default:
+			/* statistics, name resolution, custom blocks */
+			break;
+		}
+	}
+
+	return count;
+}
+/* ------------------------------------------------------------------------- */
+bool MappedPcapSource::deliver( Packet &packet, uint32_t interface,
+  uint64_t time, const u_char *data, uint32_t caplen, uint32_t len )
+{
+	if (interface >= mInterfaces.size())
+		{ return false; }
+	const Interface &info = mInterfaces[interface];
+	if (!info.usable)
+		{ return false; }
+
+	timeval &ts = packet.header.ts;
+	switch (info.resolution) {
+	case MICRO:
+		ts.tv_sec = time / 1000000;
+		ts.tv_usec = time % 1000000;
+		break;
+	case NANO:
+		ts.tv_sec = time / 1000000000;
+		ts.tv_usec = time % 1000000000 / 1000;
+		break;
+	case DECIMAL:
+		ts.tv_sec = time / info.units;
+		ts.tv_usec = info.units > 1000000
+		  ? time % info.units / info.scale
+		  : time % info.units * info.scale;
+		break;
+	case BINARY:
+		ts.tv_sec = time >> info.shift;
+		/* 2^44 microseconds fit 64 bits */
+		ts.tv_usec = info.shift > 44
+		  ? ((time & (info.units - 1)) >> (info.shift - 44)) * 1000000
+		    >> 44
+		  : (time & (info.units - 1)) * 1000000 >> info.shift;
+		break;
+	}
+	ts.tv_sec += info.tsoffset;
+	mLastTime = ts;
+
+	packet.header.caplen = caplen;
+	packet.header.len = len;
+	if (info.filtered
+	  && !pcap_offline_filter( &info.filter, &packet.header, data ))
+		{ return false; }
+
+	size_t offset;
+	PacketMeta meta;
+	if (!info.decoder.decode( data, caplen, offset, meta ))
+		{ return false; }
+	packet.data = data + offset;
+	packet.header.caplen -= offset;
+	packet.header.len = len > offset ? len - offset : 0;
+	return true;
+}
+/* ------------------------------------------------------------------------- */
+bool MappedPcapSource::section( const u_char *block )
+{
+	if (mSize - (block - mMap) < BLOCK_HEADER_SIZE + 16)
+		{ return false; }
+
+	uint32_t magic;
+	memcpy( &magic, block + 8, sizeof( magic ) );
+	if (magic != BYTE_ORDER_MAGIC && magic != bswap_32( BYTE_ORDER_MAGIC ))
+		{ return false; }
+	/* each section has its own byte order and interfaces */
+	mSwapped = magic != BYTE_ORDER_MAGIC;
+	clearInterfaces();
+	return field16( block + 12 ) == 1;
+}
+/* ------------------------------------------------------------------------- */
+bool MappedPcapSource::addInterface( const u_char *block, uint32_t length )
+{
+	Interface info = Interface();
+	info.datalink = link_type( field16( block + 8 ) );
+	info.decoder = LinkDecoder( info.datalink );
+	info.snaplen = field( block + 12 );
+	info.resolution = MICRO;
+	info.units = 1000000;
+
+	/* options follow the fixed part, each padded to 32 bits */
+	const u_char *option = block + 16;
+	const u_char *end = block + length - 4;
+	while (end - option >= 4) {
+		const uint16_t code = field16( option );
+		const uint16_t size = field16( option + 2 );
+		if (code == 0 || size > end - option - 4)
+			{ break; }
+		if (code == OPTION_TSRESOL && size >= 1) {
+			const unsigned exponent = option[4] & 0x7f;
+			if (option[4] & 0x80 && exponent < 64) {
+				info.resolution = BINARY;
+				info.shift = exponent;
+				info.units = (uint64_t) 1 << exponent;
+			} else if (!(option[4] & 0x80) && exponent < 20) {
+				info.units = 1;
+				for (unsigned i = 0; i < exponent; ++i)
+					{ info.units *= 10; }
+				info.resolution = exponent == 6 ? MICRO
+				  : exponent == 9 ? NANO : DECIMAL;
+				info.scale = info.units > 1000000
+				  ? info.units / 1000000 : 1000000 / info.units;
+			}
+		} else if (code == OPTION_TSOFFSET && size >= 8) {
+			uint64_t value;
+			memcpy( &value, option + 4, sizeof( value ) );
+			info.tsoffset = mSwapped ? bswap_64( value ) : value;
+		}
+		option += 4 + ((size + 3) & ~3);
+	}
+
+	info.usable = LinkDecoder::supported( info.datalink );
+	if (!info.usable) {
+		std::cerr << "Unsupported link type " << info.datalink
+		  << " of interface " << mInterfaces.size()
+		  << ", skipping its packets" << std::endl;
+	}
+
+	info.filtered = info.usable && !mFilterText.empty();
+	if (info.filtered) {
+		pcap_t *dead = pcap_open_dead( info.datalink, MAX_CAPLEN );
+		const int res = pcap_compile( dead, &info.filter,
+		  mFilterText.c_str(), PCAP_FILTER_OPTIMIZE,
+		  PCAP_NETMASK_UNKNOWN );
+		if (res) {
+			std::cerr << "Failed to compile filter " << mFilterText
+			  << " for interface " << mInterfaces.size() << " "
+			  << pcap_geterr( dead ) << std::endl;
+			info.filtered = info.usable = false;
+			mInterfaces.push_back( info );
+			pcap_close( dead );
+			return false;
+		}
+		pcap_close( dead );
+	}
+
+	mInterfaces.push_back( info );
+	return true;
+}
+/* ------------------------------------------------------------------------- */
+void MappedPcapSource::clearInterfaces()
+{
+	for (unsigned i = 0; i < mInterfaces.size(); ++i) {
+		if (mInterfaces[i].filtered)
+			{ pcap_freecode( &mInterfaces[i].filter ); }
+	}
+	mInterfaces.clear();
+}
+/* ------------------------------------------------------------------------- */
+void MappedPcapSource::advise()
+{
+	const size_t page = sysconf( _SC_PAGESIZE );
+	u_char *map = const_cast<u_char *>( mMap );
+
+	if (mPosition + READ_AHEAD / 2 > mAdvised && mAdvised < mSize) {
+		const size_t start = mAdvised & ~(page - 1);
+		madvise( map + start, ::std::min<size_t>( READ_AHEAD,
+		  mSize - start ), MADV_WILLNEED );
+		mAdvised = start + READ_AHEAD;
+	}
+
+	const size_t done = mPosition & ~(page - 1);
+	if (done >= mReleased + READ_AHEAD) {
+		madvise( map + mReleased, done - mReleased, MADV_DONTNEED );
+		mReleased = done;
+	}
+}
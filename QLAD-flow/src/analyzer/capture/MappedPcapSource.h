@@ -0,0 +1,216 @@
+/*
+ * This file is part of the DNS traffic analyser project.
+ *
+ * Copyright (C) 2011 CZ.NIC, z.s.p.o.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <byteswap.h>
+#include <cstring>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "LinkDecoder.h"
+#include "PacketSource.h"
+
+/*!
+ * @class MappedPcapSource MappedPcapSource.h "capture/MappedPcapSource.h"
+ * @brief PacketSource reading an uncompressed capture file mapped in memory.
+ *
+ * Walks the record headers of the mapped file directly, without copying
+ * the packets and without a libpcap call per packet. The kernel is told
+ * to read ahead of the current position and to drop the pages already
+ * processed, so the resident size stays small even for huge files.
+ *
+ * Both the classic pcap and the pcapng format are read. The interfaces of
+ * a pcapng file may differ in link type, so its packets are delivered
+ * from the IP header on, found by the LinkDecoder of their interface, and
+ * datalink() is DLT_RAW. The filter is compiled for every interface.
+ * Time-stamps of any resolution and offset are converted to microseconds
+ * as the blocks are read.
+ *
+ * Delivered packets point into the mapping and stay valid until the next
+ * call to next() or nextBatch(). They are not aligned in any way.
+ */
+class MappedPcapSource: public PacketSource
+{
+public:
+	/*! @brief Creates closed source. */
+	MappedPcapSource();
+
+	/*! @brief Closes the file if still opened. */
+	~MappedPcapSource()
+		{ if (mMap) { close(); } }
+
+	/*!
+	 * @brief Checks whether file can be read by this class.
+	 * @param file Path to the file
+	 * @return true for a regular file in the classic pcap or pcapng format.
+	 */
+	static bool suitable( const char *file );
+
+	/*!
+	 * @brief Maps pcap file into memory.
+	 * @param file Path to the file to open
+	 * @param filter Pcap filter expression to apply
+	 * @return true on success, false on failure
+	 *
+	 * On error returns false and prints human readable text on stderr.
+	 */
+	bool open( const char *file, const char *filter );
+
+	/*! @brief Unmaps the opened file. */
+	void close();
+
+	bool next( Packet &packet )
+		{ return nextBatch( &packet, 1 ) == 1; }
+
+	unsigned nextBatch( Packet *packets, unsigned max )
+		{ return mNg ? nextBlocks( packets, max )
+		    : nextRecords( packets, max ); }
+
+	int datalink() const
+		{ return mDatalink; }
+
+protected:
+	enum {
+		FILE_HEADER_SIZE = 24,          /*!< @brief pcap_file_header */
+		RECORD_HEADER_SIZE = 16,        /*!< @brief On-disk record
+		                                    header size. */
+		MAX_CAPLEN = 262144,            /*!< @brief Larger records are
+		                                    considered corrupted. */
+		READ_AHEAD = 16 * 1024 * 1024,  /*!< @brief Bytes advised to be
+		                                    read ahead. */
+		BLOCK_HEADER_SIZE = 12          /*!< @brief pcapng block type,
+		                                    length and trailing length. */
+	};
+
+	/*! @brief Time-stamp units of a pcapng interface. */
+	enum Resolution {
+		MICRO,    /*!< @brief Microseconds, the default. */
+		NANO,     /*!< @brief Nanoseconds. */
+		DECIMAL,  /*!< @brief Other power of ten. */
+		BINARY    /*!< @brief Power of two. */
+	};
+
+	/*! @brief Interface of a pcapng section. */
+	struct Interface {
+		int datalink;          /*!< @brief Link type. */
+		LinkDecoder decoder;   /*!< @brief Decoder of the link type. */
+		uint32_t snaplen;      /*!< @brief Maximum captured length. */
+		Resolution resolution; /*!< @brief Time-stamp units. */
+		uint64_t units;        /*!< @brief Units per second. */
+		uint64_t scale;        /*!< @brief Units per microsecond or
+		                           microseconds per unit, DECIMAL. */
+		unsigned shift;        /*!< @brief Binary digits, BINARY. */
+		int64_t tsoffset;      /*!< @brief Seconds to add. */
+		bool usable;           /*!< @brief Link type is supported and
+		                           the filter compiled. */
+		bool filtered;         /*!< @brief filter is to be applied. */
+		bpf_program filter;    /*!< @brief Compiled filter. */
+	};
+
+	/*! @brief Reads 32-bit header field in the byte order of the file. */
+	uint32_t field( const u_char *position ) const
+	{
+		uint32_t value;
+		memcpy( &value, position, sizeof( value ) );
+		return mSwapped ? bswap_32( value ) : value;
+	}
+
+	/*! @brief Reads 16-bit header field in the byte order of the file. */
+	uint16_t field16( const u_char *position ) const
+	{
+		uint16_t value;
+		memcpy( &value, position, sizeof( value ) );
+		return mSwapped ? bswap_16( value ) : value;
+	}
+
+	/*! @brief Walks classic pcap records, see nextBatch(). */
+	unsigned nextRecords( Packet *packets, unsigned max );
+
+	/*! @brief Walks pcapng blocks, see nextBatch(). */
+	unsigned nextBlocks( Packet *packets, unsigned max );
+
+	/*!
+	 * @brief Starts a pcapng section.
+	 * @param block Section header block
+	 * @return false if the block is not a valid section header.
+	 */
+	bool section( const u_char *block );
+
+	/*!
+	 * @brief Adds a pcapng interface.
+	 * @param block Interface description block
+	 * @param length Length of the block
+	 * @return false if the filter does not compile for the interface.
+	 */
+	bool addInterface( const u_char *block, uint32_t length );
+
+	/*! @brief Frees the interfaces of the current section. */
+	void clearInterfaces();
+
+	/*!
+	 * @brief Delivers a pcapng packet.
+	 * @param packet Receives the packet
+	 * @param interface Interface number
+	 * @param time Time-stamp in the units of the interface
+	 * @param data Captured bytes
+	 * @param caplen Number of captured bytes
+	 * @param len Length on the wire
+	 * @return false if the packet is to be skipped.
+	 */
+	bool deliver( Packet &packet, uint32_t interface, uint64_t time,
+	  const u_char *data, uint32_t caplen, uint32_t len );
+
+	/*!
+	 * @brief Keeps the kernel reading ahead of the current position.
+	 *
+	 * Releases the pages before the position, no delivered packet
+	 * points there any more.
+	 */
+	void advise();
+
+	const u_char *mMap;       /*!< @brief Mapped file. */
+	size_t mSize;             /*!< @brief File size. */
+	size_t mPosition;         /*!< @brief Offset of the next record. */
+	size_t mAdvised;          /*!< @brief End of the read ahead area. */
+	size_t mReleased;         /*!< @brief Start of the resident area. */
+	int mDatalink;            /*!< @brief Link type of the file. */
+	bool mSwapped;            /*!< @brief File has foreign byte order. */
+	bool mNano;               /*!< @brief Nanosecond time-stamps. */
+	bool mNg;                 /*!< @brief File is pcapng. */
+	bool mFiltered;           /*!< @brief mFilter is to be applied. */
+	bpf_program mFilter;      /*!< @brief Compiled filter. */
+	::std::string mFilterText; /*!< @brief Filter of pcapng interfaces. */
+	::std::vector<Interface> mInterfaces; /*!< @brief pcapng section
+	                                         interfaces. */
+	timeval mLastTime;        /*!< @brief Time-stamp of the last packet,
+	                              used for simple packet blocks. */
+
+private:
+	/*! @brief Copy-constructor, FORBIDDEN */
+	MappedPcapSource( const MappedPcapSource & );
+
+	/*! @brief FORBIDDEN operator */
+	MappedPcapSource & operator = ( const MappedPcapSource & );
+};
@@ -0,0 +1,379 @@
+/*
+ * This file is part of the DNS traffic analyser project.
+ *
+ * Copyright (C) 2011 CZ.NIC, z.s.p.o.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+
+#include "MergeSource.h"
+#include "PcapSource.h"
+#include "pcap_defines.h"
+#include "proc/Thread.h"
+#include "struct/BoundedQueue.h"
+
+/*!
+ * @class MergeSource::Reader
+ * @brief Reads one capture file ahead on a background thread.
+ *
+ * The thread copies packets (headers included) into fixed chunks and
+ * queues them, the merging thread walks the queued chunks. Chunks are
+ * recycled, so reading does not allocate once running.
+ */
+class MergeSource::Reader
+{
+public:
+	/*!
+	 * @brief Creates a reader, the file is not opened yet.
+	 * @param index Input number, orders packets with equal time-stamps.
+	 */
+	Reader( unsigned index )
+	: mIndex( index ), mThread( readAhead, this ),
+	  mFree( CHUNK_COUNT ), mFull( CHUNK_COUNT ),
+	  mCurrent( NULL ), mPosition( 0 ), mRecordSize( 0 ), mStop( false )
+	{
+		for (unsigned i = 0; i < CHUNK_COUNT; ++i) {
+			mChunks[i].buffer.resize( CHUNK_SIZE );
+			mFree.push( &mChunks[i] );
+		}
+	}
+
+	/*!
+	 * @brief Opens the file and starts reading ahead.
+	 * @return false if the file cannot be opened.
+	 */
+	bool open( const char *file, const char *filter )
+	{
+		if (!mSource.open( file, filter ))
+			{ return false; }
+		mThread.run();
+		return true;
+	}
+
+	/*!
+	 * @brief Moves to the next packet.
+	 * @return false at the end of the file.
+	 *
+	 * Blocks until the background thread provides the packet.
+	 */
+	bool advance();
+
+	/*! @brief The current packet. */
+	const Packet & packet() const
+		{ return mPacket; }
+
+	/*! @brief Input number. */
+	unsigned index() const
+		{ return mIndex; }
+
+	/*! @brief Stops the background thread and closes the file. */
+	void close()
+	{
+		mStop = true;
+		mFree.close();
+		mFull.close();
+		mThread.join();
+		mSource.close();
+	}
+
+protected:
+	enum {
+		CHUNK_COUNT = 3,          /*!< @brief Double buffering + one. */
+		CHUNK_SIZE = 256 * 1024,  /*!< @brief Default chunk size. */
+		ALIGN = 8                 /*!< @brief Record alignment. */
+	};
+
+	/*! @brief Packets stored back to back, each preceded by header. */
+	struct Chunk {
+		::std::vector<u_char> buffer; /*!< @brief Records. */
+		size_t used;                  /*!< @brief Bytes used. */
+	};
+
+	/*! @brief Size of a record rounded up to keep alignment. */
+	static size_t aligned( size_t size )
+		{ return (size + ALIGN - 1) & ~(size_t)(ALIGN - 1); }
+
+	/*!
+	 * @brief Background thread body, fills free chunks.
+	 * @param reader The instance to work for.
+	 * @return NOT USED
+	 */
+	static void * readAhead( Reader *reader );
+
+	const unsigned mIndex;          /*!< @brief Input number. */
+	PcapSource mSource;             /*!< @brief The opened file. */
+	Thread mThread;                 /*!< @brief Reads ahead. */
+	Chunk mChunks[CHUNK_COUNT];     /*!< @brief Chunk pool. */
+	BoundedQueue<Chunk *> mFree;    /*!< @brief Chunks to fill. */
+	BoundedQueue<Chunk *> mFull;    /*!< @brief Chunks to walk. */
+	Chunk *mCurrent;                /*!< @brief Chunk being walked. */
+	size_t mPosition;               /*!< @brief Current record offset. */
+	size_t mRecordSize;             /*!< @brief Current record size. */
+	Packet mPacket;                 /*!< @brief Current packet. */
+	volatile bool mStop;            /*!< @brief Stop reading ahead. */
+
+private:
+	/*! @brief Copy-constructor, FORBIDDEN */
+	Reader( const Reader & );
+
+	/*! @brief FORBIDDEN operator */
+	Reader & operator = ( const Reader & );
+};
+/* ------------------------------------------------------------------------- */
+void * MergeSource::Reader::readAhead( Reader *reader )
+{
+	assert( reader );
+
+	Packet packet;
+	bool pending = false;
+	bool more = true;
+	Chunk *chunk;
+
+	while (more && !reader->mStop && reader->mFree.pop( chunk )) {
+		chunk->used = 0;
+		for (;;) {
+			if (!pending && !(more = reader->mSource.next( packet )))
+				{ break; }
+			pending = false;
+
+			const size_t header = aligned( sizeof( pcap_pkthdr ) );
+			const size_t size = header
+			  + aligned( packet.header.caplen );
+			if (chunk->used + size > chunk->buffer.size()) {
+				if (chunk->used == 0) {
+					/* huge packet, make room */
+					chunk->buffer.resize( size );
+				} else {
+					/* keep for the next chunk */
+					pending = true;
+					break;
+				}
+			}
+
+			u_char *record = &chunk->buffer[chunk->used];
+			*reinterpret_cast<pcap_pkthdr *>( record ) =
+			  packet.header;
+			::std::copy( packet.data,
+			  packet.data + packet.header.caplen, record + header );
+			chunk->used += size;
+		}
+		if (chunk->used && !reader->mFull.push( chunk ))
+			{ break; }
+	}
+
+	/* nothing more to read, the queued chunks stay available */
+	reader->mFull.close();
+	return NULL;
+}
+/* ------------------------------------------------------------------------- */
+bool MergeSource::Reader::advance()
+{
+	mPosition += mRecordSize;
+	if (!mCurrent || mPosition >= mCurrent->used) {
+		if (mCurrent)
+			{ mFree.push( mCurrent ); }
+		if (!mFull.pop( mCurrent )) {
+			mCurrent = NULL;
+			return false;
+		}
+		mPosition = 0;
+	}
+
+	const u_char *record = &mCurrent->buffer[mPosition];
+	const size_t header = aligned( sizeof( pcap_pkthdr ) );
+	mPacket.header = *reinterpret_cast<const pcap_pkthdr *>( record );
+	mPacket.data = record + header;
+	mRecordSize = header + aligned( mPacket.header.caplen );
+	return true;
+}
+/* ------------------------------------------------------------------------- */
+/* MergeSource */
+/* ------------------------------------------------------------------------- */
+bool MergeSource::Later::operator () (
+  const Reader *a, const Reader *b ) const
+{
+	const timeval &ta = a->packet().header.ts;
+	const timeval &tb = b->packet().header.ts;
+	if (ta.tv_sec != tb.tv_sec)
+		{ return ta.tv_sec > tb.tv_sec; }
+	if (ta.tv_usec != tb.tv_usec)
+		{ return ta.tv_usec > tb.tv_usec; }
+	return a->index() > b->index();
+}
+/* ------------------------------------------------------------------------- */
+/*! @brief Orders inputs by the time-stamp of their first packet. */
+static bool input_earlier( const timeval &a, const timeval &b )
+	{ return timercmp( &a, &b, < ); }
+/* ------------------------------------------------------------------------- */
+MergeSource::MergeSource( unsigned max_open )
+: mMaxOpen( max_open ), mDatalink( -1 ), mNextInput( 0 ), mOpen( 0 ),
+  mCurrent( NULL ), mLate( 0 ), mWarned( false )
+{
+	assert( max_open > 0 );
+	timerclear( &mLast );
+}
+/* ------------------------------------------------------------------------- */
+MergeSource::~MergeSource()
+{
+	close();
+}
+/* ------------------------------------------------------------------------- */
+bool MergeSource::open( const ::std::vector< ::std::string > &files,
+  const char *filter )
+{
+	assert( mInputs.empty() );
+
+	for (unsigned i = 0; i < files.size(); ++i) {
+		Input input;
+		input.file = files[i];
+		int datalink;
+		switch (PcapSource::probe( files[i].c_str(), input.first,
+		  datalink )) {
+			case -1:
+				return false;
+			case 0:
+				/* nothing to merge */
+				continue;
+		}
+
+		if (mDatalink == -1) {
+			mDatalink = datalink;
+		} else if (mDatalink != datalink) {
+			std::cerr << "File " << files[i] << " uses link type "
+			  << datalink << " instead of " << mDatalink
+			  << std::endl;
+			return false;
+		}
+
+		/* insertion keeps inputs with equal start in given order */
+		::std::vector<Input>::iterator pos = mInputs.end();
+		while (pos != mInputs.begin()
+		  && input_earlier( input.first, (pos - 1)->first ))
+			{ --pos; }
+		mInputs.insert( pos, input );
+	}
+
+	if (mInputs.empty()) {
+		std::cerr << "No packets in the input files" << std::endl;
+		return false;
+	}
+
+	/* Check the filter now, not in the middle of the merge. */
+	pcap_t *dead = pcap_open_dead( mDatalink, 65535 );
+	struct bpf_program filter_program;
+	const int res = pcap_compile( dead, &filter_program, filter,
+	  PCAP_FILTER_OPTIMIZE, PCAP_NETMASK_UNKNOWN );
+	if (res) {
+		std::cerr << "Failed to compile filter " << filter
+		  << " " << pcap_geterr( dead ) << std::endl;
+	} else {
+		pcap_freecode( &filter_program );
+	}
+	pcap_close( dead );
+
+	mFilter = filter;
+	return res == 0;
+}
+/* ------------------------------------------------------------------------- */
+void MergeSource::close()
+{
+	if (mCurrent)
+		{ finish( mCurrent ); }
+	mCurrent = NULL;
+	while (!mHeap.empty()) {
+		finish( mHeap.top() );
+		mHeap.pop();
+	}
+	if (mLate) {
+		std::cerr << mLate << " packets merged out of order, "
+		  "consider raising the limit of opened files" << std::endl;
+	}
+	mInputs.clear();
+	mNextInput = 0;
+	mLate = 0;
+}
+/* ------------------------------------------------------------------------- */
+bool MergeSource::next( Packet &packet )
+{
+	/* The packet delivered last time is no longer needed. */
+	if (mCurrent) {
+		if (mCurrent->advance())
+			{ mHeap.push( mCurrent ); }
+		else
+			{ finish( mCurrent ); }
+		mCurrent = NULL;
+	}
+
+	openDue();
+	if (mHeap.empty())
+		{ return false; }
+
+	mCurrent = mHeap.top();
+	mHeap.pop();
+	packet = mCurrent->packet();
+
+	if (timercmp( &packet.header.ts, &mLast, < ))
+		{ ++mLate; }
+	else
+		{ mLast = packet.header.ts; }
+	return true;
+}
+/* ------------------------------------------------------------------------- */
+void MergeSource::openDue()
+{
+	while (mNextInput < mInputs.size()) {
+		const Input &input = mInputs[mNextInput];
+
+		/* Not needed before the currently earliest packet. */
+		if (!mHeap.empty() && timercmp(
+		  &mHeap.top()->packet().header.ts, &input.first, < ))
+			{ return; }
+
+		if (mOpen >= mMaxOpen) {
+			if (!mWarned) {
+				std::cerr << "More than " << mMaxOpen
+				  << " input files overlap in time, "
+				  "postponing " << input.file << std::endl;
+				mWarned = true;
+			}
+			return;
+		}
+
+		Reader *reader = new Reader( mNextInput++ );
+		if (!reader->open( input.file.c_str(), mFilter.c_str() )) {
+			delete reader;
+			continue;
+		}
+		++mOpen;
+		if (reader->advance())
+			{ mHeap.push( reader ); }
+		else
+			{ finish( reader ); }
+	}
+}
+/* ------------------------------------------------------------------------- */
+void MergeSource::finish( Reader *reader )
+{
+	assert( mOpen > 0 );
+	reader->close();
+	delete reader;
+	--mOpen;
+}
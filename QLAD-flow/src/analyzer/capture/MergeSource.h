@@ -0,0 +1,124 @@
+/*
+ * This file is part of the DNS traffic analyser project.
+ *
+ * Copyright (C) 2011 CZ.NIC, z.s.p.o.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <queue>
+#include <string>
+#include <vector>
+
+#include "PacketSource.h"
+
+/*!
+ * @class MergeSource MergeSource.h "capture/MergeSource.h"
+ * @brief PacketSource merging several capture files in time-stamp order.
+ *
+ * Performs a k-way merge using a heap of per-file readers. Every opened
+ * file is read ahead by a background thread into a small pool of chunks,
+ * so decoding the files overlaps with the analysis.
+ *
+ * Files are opened lazily in the order of their first packet, only when
+ * the merge reaches that time, and at most a fixed number of them at once.
+ * A sequence of consecutive captures thus needs only one or two opened
+ * files. If more files overlap in time than the limit allows, the packets
+ * of the postponed files are delivered late, which is counted by
+ * latePackets().
+ */
+class MergeSource: public PacketSource
+{
+public:
+	/*!
+	 * @brief Creates closed source.
+	 * @param max_open Maximum number of simultaneously opened files
+	 */
+	MergeSource( unsigned max_open );
+
+	/*! @brief Closes the files if still opened. */
+	~MergeSource();
+
+	/*!
+	 * @brief Prepares the merge of the files.
+	 * @param files Paths of the files to merge
+	 * @param filter Pcap filter expression to apply to all files
+	 * @return true on success, false on failure
+	 *
+	 * Reads the first packet of every file to find the order in which
+	 * the files should be opened. All files must use the same link type.
+	 * On error returns false and prints human readable text on stderr.
+	 */
+	bool open( const ::std::vector< ::std::string > &files,
+	  const char *filter );
+
+	/*! @brief Closes all opened files. */
+	void close();
+
+	bool next( Packet &packet );
+
+	int datalink() const
+		{ return mDatalink; }
+
+	/*! @brief Number of packets delivered earlier than a previous one. */
+	unsigned long latePackets() const
+		{ return mLate; }
+
+protected:
+	class Reader;
+
+	/*! @brief Input file waiting to be opened. */
+	struct Input {
+		::std::string file; /*!< @brief Path to the file. */
+		timeval first;      /*!< @brief Time-stamp of its first packet. */
+	};
+
+	/*! @brief Heap ordering, the earliest packet on the top. */
+	struct Later {
+		bool operator () ( const Reader *a, const Reader *b ) const;
+	};
+
+	typedef ::std::priority_queue< Reader *, ::std::vector<Reader *>,
+	  Later > ReaderHeap;
+
+	/*! @brief Opens the files whose first packet is due. */
+	void openDue();
+
+	/*! @brief Stops, closes and destroys the reader. */
+	void finish( Reader *reader );
+
+	const unsigned mMaxOpen;       /*!< @brief Limit of opened files. */
+	::std::string mFilter;         /*!< @brief Filter for every file. */
+	int mDatalink;                 /*!< @brief Common link type. */
+	::std::vector<Input> mInputs;  /*!< @brief Ordered by first packet. */
+	unsigned mNextInput;           /*!< @brief First unopened input. */
+	unsigned mOpen;                /*!< @brief Number of opened files. */
+	ReaderHeap mHeap;              /*!< @brief Readers with a packet. */
+	Reader *mCurrent;              /*!< @brief Delivered the last packet. */
+	timeval mLast;                 /*!< @brief Last delivered time-stamp. */
+	unsigned long mLate;           /*!< @brief Packets out of order. */
+	bool mWarned;                  /*!< @brief Limit warning printed. */
+
+private:
+	/*! @brief Copy-constructor, FORBIDDEN */
+	MergeSource( const MergeSource & );
+
+	/*! @brief FORBIDDEN operator */
+	MergeSource & operator = ( const MergeSource & );
+};
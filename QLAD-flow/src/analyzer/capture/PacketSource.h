@@ -0,0 +1,97 @@
+/*
+ * This file is part of the DNS traffic analyser project.
+ *
+ * Copyright (C) 2011 CZ.NIC, z.s.p.o.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <csignal>
+#include <pcap.h>
+
+/*!
+ * @class PacketSource PacketSource.h "capture/PacketSource.h"
+ * @brief Pull interface of a stream of captured packets.
+ *
+ * Implementations deliver packets one by one or in batches, in the order
+ * they should be analysed. The delivered data stays valid until the next
+ * call to next() or nextBatch() or until the source is destroyed,
+ * whichever comes first.
+ *
+ * Live sources wait for more packets instead of reporting the end of the
+ * input, until stop() is called.
+ */
+class PacketSource
+{
+public:
+	enum {
+		/*! @brief datalink() of sources delivering MessageRecord
+		 * data instead of packets. */
+		LINK_MESSAGE = DLT_USER0
+	};
+
+	/*! @brief One captured packet, link header included. */
+	struct Packet {
+		pcap_pkthdr header;  /*!< @brief Time-stamp and lengths. */
+		const u_char *data;  /*!< @brief Captured bytes. */
+	};
+
+	virtual ~PacketSource() {}
+
+	/*!
+	 * @brief Fetches the next packet.
+	 * @param packet Receives the packet.
+	 * @return false when there are no more packets.
+	 */
+	virtual bool next( Packet &packet ) = 0;
+
+	/*!
+	 * @brief Fetches several packets at once.
+	 * @param packets Receives the packets.
+	 * @param max Capacity of packets, at least 1.
+	 * @return Number of fetched packets, 0 when there are no more.
+	 *
+	 * All packets of the batch stay valid together. The default
+	 * implementation fetches a single packet.
+	 */
+	virtual unsigned nextBatch( Packet *packets, unsigned max )
+		{ (void)max; return next( *packets ) ? 1 : 0; }
+
+	/*!
+	 * @brief Link layer type of the delivered packets.
+	 * @return One of the pcap DLT_* values.
+	 */
+	virtual int datalink() const = 0;
+
+	/*!
+	 * @brief Makes all the live sources report the end of the input.
+	 *
+	 * Safe to call from a signal handler.
+	 */
+	static void stop()
+		{ stopped() = 1; }
+
+protected:
+	/*! @brief Set by stop(). */
+	static volatile sig_atomic_t & stopped()
+	{
+		static volatile sig_atomic_t flag = 0;
+		return flag;
+	}
+};
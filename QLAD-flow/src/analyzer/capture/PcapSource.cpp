@@ -0,0 +1,127 @@
+/*
+ * This file is part of the DNS traffic analyser project.
+ *
+ * Copyright (C) 2011 CZ.NIC, z.s.p.o.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <cassert>
+#include <iostream>
+
+#include "Decompressor.h"
+#include "PcapSource.h"
+#include "pcap_defines.h"
+
+bool PcapSource::open( const char *file, const char *filter )
+{
+	assert( !mInterface );
+
+	struct bpf_program filter_program;
+
+	char errbuff[PCAP_ERRBUF_SIZE];
+	mInterface = openFile( file, errbuff );
+	if (!mInterface) {
+		std::cerr << "Failed to open file " << file
+			<< " " << errbuff << std::endl;
+		return false;
+	}
+
+	int res = pcap_compile( mInterface, &filter_program, filter,
+	  PCAP_FILTER_OPTIMIZE, PCAP_NETMASK_UNKNOWN );
+	if (res) {
+		std::cerr << "Failed to compile filter " << filter
+		  << " " << pcap_geterr( mInterface ) << std::endl;
+		return false;
+	}
+
+	res = pcap_setfilter( mInterface, &filter_program );
+
+	/* pcap documentation is not exactly verbose about this, but
+	 * pcap_compile makes a copy of the filter, therefore we should
+	 * free our copy in all cases. */
+	pcap_freecode( &filter_program );
+
+	if (res) {
+		std::cerr << "Failed to set filter " << filter
+		  << " " << pcap_geterr( mInterface ) << std::endl;
+		return false;
+	}
+
+	return true;
+}
+/* ------------------------------------------------------------------------- */
+void PcapSource::close()
+{
+	assert( mInterface );
+	pcap_close( mInterface );
+	mInterface = NULL;
+}
+/* ------------------------------------------------------------------------- */
+bool PcapSource::next( Packet &packet )
+{
+	assert( mInterface );
+
+	pcap_pkthdr *header;
+	const u_char *data;
+	switch ( pcap_next_ex( mInterface, &header, &data ) ) {
+		case 1:
+			packet.header = *header;
+			packet.data = data;
+			return true;
+		case -2:
+			/* end of file */
+			return false;
+		default:
+			std::cerr << "Failed to read packet "
+			  << pcap_geterr( mInterface ) << std::endl;
+			return false;
+	}
+}
+/* ------------------------------------------------------------------------- */
+int PcapSource::probe( const char *file, timeval &first, int &datalink )
+{
+	char errbuff[PCAP_ERRBUF_SIZE];
+	pcap_t *interface = openFile( file, errbuff );
+	if (!interface) {
+		std::cerr << "Failed to open file " << file
+			<< " " << errbuff << std::endl;
+		return -1;
+	}
+
+	pcap_pkthdr *header;
+	const u_char *data;
+	const int found = pcap_next_ex( interface, &header, &data ) == 1;
+	if (found)
+		{ first = header->ts; }
+	datalink = pcap_datalink( interface );
+	pcap_close( interface );
+
+	return found;
+}
+/* ------------------------------------------------------------------------- */
+pcap_t * PcapSource::openFile( const char *file, char *errbuff )
+{
+	FILE *stream = Decompressor::open( file, errbuff );
+	if (!stream)
+		{ return NULL; }
+
+	pcap_t *interface = pcap_fopen_offline( stream, errbuff );
+	if (!interface && stream != stdin)
+		{ fclose( stream ); }
+	return interface;
+}
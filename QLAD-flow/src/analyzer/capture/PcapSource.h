@@ -0,0 +1,94 @@
+/*
+ * This file is part of the DNS traffic analyser project.
+ *
+ * Copyright (C) 2011 CZ.NIC, z.s.p.o.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <pcap.h>
+
+#include "PacketSource.h"
+
+/*!
+ * @class PcapSource PcapSource.h "capture/PcapSource.h"
+ * @brief PacketSource reading a capture file through libpcap.
+ */
+class PcapSource: public PacketSource
+{
+public:
+	/*! @brief Creates closed source. */
+	PcapSource(): mInterface( NULL ) {}
+
+	/*! @brief Closes the file if still opened. */
+	~PcapSource()
+		{ if (mInterface) { close(); } }
+
+	/*!
+	 * @brief Attempts to open file as pcap capture file.
+	 *
+	 * Gzip, bzip2 and zstd compressed files are decompressed on the fly.
+	 *
+	 * @param file Path to the file to open, "-" for stdin
+	 * @param filter Pcap filter expression to apply
+	 * @return true on success, false on failure
+	 *
+	 * On error returns false and prints human readable text on stderr.
+	 */
+	bool open( const char *file, const char *filter );
+
+	/*! @brief Closes the opened file. */
+	void close();
+
+	bool next( Packet &packet );
+
+	int datalink() const
+		{ return pcap_datalink( mInterface ); }
+
+	/*!
+	 * @brief Reads time-stamp of the first packet of a file.
+	 * @param file Path to the file to read
+	 * @param first Receives the time-stamp
+	 * @param datalink Receives the link type of the file
+	 * @return 1 if first was set, 0 for a file without packets,
+	 * -1 if the file cannot be opened
+	 *
+	 * Does not keep the file opened.
+	 */
+	static int probe( const char *file, timeval &first, int &datalink );
+
+protected:
+	/*!
+	 * @brief Opens capture file, compressed ones included.
+	 * @param file Path to the file to open, "-" for stdin
+	 * @param errbuff Receives error text, PCAP_ERRBUF_SIZE bytes
+	 * @return Pcap handle, NULL on failure
+	 */
+	static pcap_t * openFile( const char *file, char *errbuff );
+
+	/*! @brief Pointer to pcap structure used for capture */
+	pcap_t *mInterface;
+
+private:
+	/*! @brief Copy-constructor, FORBIDDEN */
+	PcapSource( const PcapSource & );
+
+	/*! @brief FORBIDDEN operator */
+	PcapSource & operator = ( const PcapSource & );
+};
@@ -0,0 +1,130 @@
+/*
+ * This file is part of the DNS traffic analyser project.
+ *
+ * Copyright (C) 2011 CZ.NIC, z.s.p.o.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+
+#include "ReorderSource.h"
+
+/*! @brief Time-stamp in microseconds. */
+static int64_t microseconds( const timeval &time )
+	{ return (int64_t) time.tv_sec * 1000000 + time.tv_usec; }
+/* ------------------------------------------------------------------------- */
+ReorderSource::ReorderSource( PacketSource *source, unsigned latency,
+  unsigned max_packets )
+: mSource( source ), mLatency( (int64_t) latency * 1000 ),
+  mMaxPackets( max_packets ), mEnd( false ), mSequence( 0 ),
+  mNewest( 0 ), mReleased( 0 ), mLate( 0 )
+{
+	assert( source );
+	assert( max_packets > 0 );
+}
+/* ------------------------------------------------------------------------- */
+ReorderSource::~ReorderSource()
+{
+	if (mLate) {
+		std::cerr << mLate << " packets arrived more than "
+		  << mLatency / 1000 << " ms late and were dropped, "
+		  "consider raising the reorder window" << std::endl;
+	}
+
+	while (!mHeap.empty()) {
+		delete mHeap.top();
+		mHeap.pop();
+	}
+	for (size_t i = 0; i < mFree.size(); ++i)
+		{ delete mFree[i]; }
+	for (size_t i = 0; i < mDelivered.size(); ++i)
+		{ delete mDelivered[i]; }
+	delete mSource;
+}
+/* ------------------------------------------------------------------------- */
+unsigned ReorderSource::nextBatch( Packet *packets, unsigned max )
+{
+	assert( max > 0 );
+
+	/* The packets delivered last time are no longer needed. */
+	mFree.insert( mFree.end(), mDelivered.begin(), mDelivered.end() );
+	mDelivered.clear();
+
+	while (!releasable() && fill())
+		{}
+
+	unsigned count = 0;
+	for (; count < max && !mHeap.empty() && releasable(); ++count) {
+		Record *record = mHeap.top();
+		mHeap.pop();
+		mReleased = record->time;
+		mDelivered.push_back( record );
+		packets[count].header = record->header;
+		packets[count].data = &record->data[0];
+	}
+	return count;
+}
+/* ------------------------------------------------------------------------- */
+bool ReorderSource::fill()
+{
+	if (mEnd)
+		{ return false; }
+
+	const unsigned count = mSource->nextBatch( mInput, BATCH_SIZE );
+	if (count == 0) {
+		mEnd = true;
+		return false;
+	}
+
+	for (unsigned i = 0; i < count; ++i) {
+		const Packet &packet = mInput[i];
+		const int64_t time = microseconds( packet.header.ts );
+		if (time < mReleased) {
+			++mLate;
+			continue;
+		}
+
+		Record *record;
+		if (mFree.empty()) {
+			record = new Record();
+		} else {
+			record = mFree.back();
+			mFree.pop_back();
+		}
+		record->header = packet.header;
+		record->time = time;
+		record->sequence = mSequence++;
+		/* keeps one byte for empty packets to have valid data */
+		record->data.resize( packet.header.caplen + 1 );
+		::std::copy( packet.data, packet.data + packet.header.caplen,
+		  record->data.begin() );
+		mHeap.push( record );
+		mNewest = ::std::max( mNewest, time );
+	}
+	return true;
+}
+/* ------------------------------------------------------------------------- */
+bool ReorderSource::releasable() const
+{
+	if (mHeap.empty())
+		{ return false; }
+	return mEnd || mHeap.size() > mMaxPackets
+	  || mNewest - mHeap.top()->time >= mLatency;
+}
@@ -0,0 +1,128 @@
+/*
+ * This file is part of the DNS traffic analyser project.
+ *
+ * Copyright (C) 2011 CZ.NIC, z.s.p.o.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <queue>
+#include <stdint.h>
+#include <vector>
+
+#include "PacketSource.h"
+
+/*!
+ * @class ReorderSource ReorderSource.h "capture/ReorderSource.h"
+ * @brief PacketSource delivering the packets of another one in
+ * time-stamp order.
+ *
+ * Packets are copied into a heap ordered by their time-stamps and
+ * released once a packet at least the given latency newer has been read,
+ * or when more than the given number of packets is held. Inputs merged
+ * from several capture nodes or slightly disordered by the capture thus
+ * need no separate sorting pass.
+ *
+ * A packet older than one already delivered cannot be put into its place
+ * any more. Such packets are dropped, counted by latePackets() and
+ * reported on destruction. The held packets are delivered when the
+ * wrapped source ends. Live sources deliver held packets only as newer
+ * ones arrive.
+ */
+class ReorderSource: public PacketSource
+{
+public:
+	/*!
+	 * @brief Wraps a source.
+	 * @param source Source of the packets, owned and destroyed by this
+	 * @param latency Longest disorder put right, in milliseconds
+	 * @param max_packets Maximum number of packets held
+	 */
+	ReorderSource( PacketSource *source, unsigned latency,
+	  unsigned max_packets );
+
+	/*! @brief Reports the late packets, destroys the wrapped source. */
+	~ReorderSource();
+
+	bool next( Packet &packet )
+		{ return nextBatch( &packet, 1 ) == 1; }
+
+	unsigned nextBatch( Packet *packets, unsigned max );
+
+	int datalink() const
+		{ return mSource->datalink(); }
+
+	/*! @brief Number of packets dropped for arriving too late. */
+	unsigned long latePackets() const
+		{ return mLate; }
+
+protected:
+	enum {
+		BATCH_SIZE = 256  /*!< @brief Packets read from mSource at once. */
+	};
+
+	/*! @brief Copy of a held packet. */
+	struct Record {
+		pcap_pkthdr header;          /*!< @brief Time-stamp, lengths. */
+		int64_t time;                /*!< @brief Time-stamp in us. */
+		uint64_t sequence;           /*!< @brief Order of arrival. */
+		::std::vector<u_char> data;  /*!< @brief Captured bytes. */
+	};
+
+	/*! @brief Heap ordering, the earliest packet on the top. */
+	struct Later {
+		bool operator () ( const Record *a, const Record *b ) const
+		{
+			return a->time != b->time ? a->time > b->time
+			  : a->sequence > b->sequence;
+		}
+	};
+
+	typedef ::std::priority_queue< Record *, ::std::vector<Record *>,
+	  Later > RecordHeap;
+
+	/*!
+	 * @brief Reads a batch of mSource into the heap.
+	 * @return false at the end of mSource.
+	 */
+	bool fill();
+
+	/*! @brief Whether the earliest held packet may be delivered. */
+	bool releasable() const;
+
+	PacketSource * const mSource;      /*!< @brief Wrapped source. */
+	const int64_t mLatency;            /*!< @brief Held time span, us. */
+	const size_t mMaxPackets;          /*!< @brief Held packet limit. */
+	RecordHeap mHeap;                  /*!< @brief Held packets. */
+	::std::vector<Record *> mFree;     /*!< @brief Recycled records. */
+	::std::vector<Record *> mDelivered;/*!< @brief Last batch. */
+	Packet mInput[BATCH_SIZE];         /*!< @brief Batch of mSource. */
+	bool mEnd;                         /*!< @brief mSource has ended. */
+	uint64_t mSequence;                /*!< @brief Next arrival number. */
+	int64_t mNewest;                   /*!< @brief Newest time read. */
+	int64_t mReleased;                 /*!< @brief Last time delivered. */
+	unsigned long mLate;               /*!< @brief Dropped packets. */
+
+private:
+	/*! @brief Copy-constructor, FORBIDDEN */
+	ReorderSource( const ReorderSource & );
+
+	/*! @brief FORBIDDEN operator */
+	ReorderSource & operator = ( const ReorderSource & );
+};
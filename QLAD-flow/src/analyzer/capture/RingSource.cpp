@@ -0,0 +1,270 @@
+/*
+ * This file is part of the DNS traffic analyser project.
+ *
+ * Copyright (C) 2011 CZ.NIC, z.s.p.o.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <arpa/inet.h>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "RingSource.h"
+#include "pcap_defines.h"
+
+/*! @brief Interface name capturing on all the interfaces. */
+#define ANY_INTERFACE "any"
+
+/*!
+ * @brief Prints error of a failed system call.
+ * @param what The failed action
+ * @param interface Interface it was done for
+ */
+static void report( const char *what, const char *interface )
+{
+	::std::cerr << what << " on interface " << interface << " failed: "
+	  << strerror( errno ) << ::std::endl;
+}
+
+/*!
+ * @brief Finds out whether the interface delivers Ethernet frames.
+ * @param interface Name of the interface
+ * @param ethernet Receives the result
+ * @return true on success, false on failure
+ */
+static bool is_ethernet( const char *interface, bool &ethernet )
+{
+	ethernet = false;
+	if (strcmp( interface, ANY_INTERFACE ) == 0)
+		{ return true; }
+
+	const int fd = socket( AF_INET, SOCK_DGRAM, 0 );
+	if (fd < 0)
+		{ return false; }
+	ifreq request;
+	memset( &request, 0, sizeof( request ) );
+	strncpy( request.ifr_name, interface, sizeof( request.ifr_name ) - 1 );
+	const int res = ioctl( fd, SIOCGIFHWADDR, &request );
+	::close( fd );
+
+	/* Linux gives loopback an Ethernet header as well */
+	ethernet = request.ifr_hwaddr.sa_family == ARPHRD_ETHER
+	  || request.ifr_hwaddr.sa_family == ARPHRD_LOOPBACK;
+	return res == 0;
+}
+/* ------------------------------------------------------------------------- */
+RingSource::RingSource()
+: mSocket( -1 ), mRing( NULL ), mCurrent( NULL ), mPacket( NULL ),
+  mRemaining( 0 ), mBlock( 0 ), mDatalink( -1 )
+{}
+/* ------------------------------------------------------------------------- */
+bool RingSource::open( const char *interface, const char *filter )
+{
+	assert( mSocket < 0 );
+
+	const unsigned index = strcmp( interface, ANY_INTERFACE ) == 0
+	  ? 0 : if_nametoindex( interface );
+	bool ethernet;
+	if ((index == 0 && strcmp( interface, ANY_INTERFACE ) != 0)
+	  || !is_ethernet( interface, ethernet )) {
+		report( "Looking up", interface );
+		return false;
+	}
+	mDatalink = ethernet ? DLT_EN10MB : DLT_RAW;
+
+	/* nothing is delivered until the socket is bound, the filter and the
+	 * ring are in place by then */
+	mSocket = socket( AF_PACKET, ethernet ? SOCK_RAW : SOCK_DGRAM, 0 );
+	if (mSocket < 0) {
+		report( "Opening packet socket", interface );
+		return false;
+	}
+
+	if (filter && *filter && !attachFilter( filter ))
+		{ close(); return false; }
+
+	const int version = TPACKET_V3;
+	if (setsockopt( mSocket, SOL_PACKET, PACKET_VERSION, &version,
+	  sizeof( version ) ) != 0) {
+		report( "Selecting TPACKET_V3", interface );
+		close();
+		return false;
+	}
+
+	tpacket_req3 request;
+	memset( &request, 0, sizeof( request ) );
+	request.tp_block_size = BLOCK_SIZE;
+	request.tp_block_nr = BLOCK_COUNT;
+	request.tp_frame_size = FRAME_SIZE;
+	request.tp_frame_nr = BLOCK_SIZE / FRAME_SIZE * BLOCK_COUNT;
+	request.tp_retire_blk_tov = RETIRE_TIMEOUT;
+	if (setsockopt( mSocket, SOL_PACKET, PACKET_RX_RING, &request,
+	  sizeof( request ) ) != 0) {
+		report( "Setting up ring", interface );
+		close();
+		return false;
+	}
+
+	void *ring = mmap( NULL, (size_t)BLOCK_SIZE * BLOCK_COUNT,
+	  PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, mSocket, 0 );
+	/* locking may be denied by RLIMIT_MEMLOCK, it is not required */
+	if (ring == MAP_FAILED) {
+		ring = mmap( NULL, (size_t)BLOCK_SIZE * BLOCK_COUNT,
+		  PROT_READ | PROT_WRITE, MAP_SHARED, mSocket, 0 );
+	}
+	if (ring == MAP_FAILED) {
+		report( "Mapping ring", interface );
+		close();
+		return false;
+	}
+	mRing = static_cast<u_char *>( ring );
+	mCurrent = NULL;
+	mRemaining = 0;
+	mBlock = 0;
+
+	sockaddr_ll address;
+	memset( &address, 0, sizeof( address ) );
+	address.sll_family = AF_PACKET;
+	address.sll_protocol = htons( ETH_P_ALL );
+	address.sll_ifindex = index;
+	if (bind( mSocket, reinterpret_cast<sockaddr *>( &address ),
+	  sizeof( address ) ) != 0) {
+		report( "Binding", interface );
+		close();
+		return false;
+	}
+
+	return true;
+}
+/* ------------------------------------------------------------------------- */
+bool RingSource::attachFilter( const char *filter )
+{
+	pcap_t *dead = pcap_open_dead( mDatalink, SNAPLEN );
+	bpf_program program;
+	if (pcap_compile( dead, &program, filter, PCAP_FILTER_OPTIMIZE,
+	  PCAP_NETMASK_UNKNOWN )) {
+		::std::cerr << "Failed to compile filter " << filter << " "
+		  << pcap_geterr( dead ) << ::std::endl;
+		pcap_close( dead );
+		return false;
+	}
+	pcap_close( dead );
+
+	/* struct bpf_insn and struct sock_filter share the layout */
+	sock_fprog code;
+	code.len = program.bf_len;
+	code.filter = reinterpret_cast<sock_filter *>( program.bf_insns );
+	const int res = setsockopt( mSocket, SOL_SOCKET, SO_ATTACH_FILTER,
+	  &code, sizeof( code ) );
+	if (res != 0) {
+		::std::cerr << "Failed to attach filter " << filter << " "
+		  << strerror( errno ) << ::std::endl;
+	}
+	pcap_freecode( &program );
+	return res == 0;
+}
+/* ------------------------------------------------------------------------- */
+void RingSource::close()
+{
+	assert( mSocket >= 0 );
+
+	tpacket_stats_v3 stats;
+	socklen_t length = sizeof( stats );
+	if (mRing && getsockopt( mSocket, SOL_PACKET, PACKET_STATISTICS,
+	  &stats, &length ) == 0 && stats.tp_drops) {
+		::std::cerr << "Capture dropped " << stats.tp_drops
+		  << " of " << stats.tp_packets << " packets"
+		  << ::std::endl;
+	}
+
+	if (mRing)
+		{ munmap( mRing, (size_t)BLOCK_SIZE * BLOCK_COUNT ); }
+	mRing = NULL;
+	mCurrent = NULL;
+	::close( mSocket );
+	mSocket = -1;
+}
+/* ------------------------------------------------------------------------- */
+unsigned RingSource::nextBatch( Packet *packets, unsigned max )
+{
+	assert( mRing );
+
+	/* the previous batch is not used any more */
+	if (mCurrent && mRemaining == 0)
+		{ release(); }
+
+	while (!mCurrent) {
+		if (stopped())
+			{ return 0; }
+
+		tpacket_block_desc *desc = block( mBlock );
+		if (!(desc->hdr.bh1.block_status & TP_STATUS_USER)) {
+			pollfd wait = { mSocket, POLLIN | POLLERR, 0 };
+			/* EINTR just lets the loop check stopped() */
+			poll( &wait, 1, POLL_TIMEOUT );
+			continue;
+		}
+		/* read the packets only after the status */
+		__sync_synchronize();
+
+		mCurrent = desc;
+		mRemaining = desc->hdr.bh1.num_pkts;
+		mPacket = reinterpret_cast<const u_char *>( desc )
+		  + desc->hdr.bh1.offset_to_first_pkt;
+		if (mRemaining == 0)
+			{ release(); }
+	}
+
+	unsigned count = 0;
+	for (; count < max && mRemaining; ++count, --mRemaining) {
+		const tpacket3_hdr *header =
+		  reinterpret_cast<const tpacket3_hdr *>( mPacket );
+		Packet &packet = packets[count];
+		packet.header.ts.tv_sec = header->tp_sec;
+		packet.header.ts.tv_usec = header->tp_nsec / 1000;
+		packet.header.caplen = header->tp_snaplen;
+		packet.header.len = header->tp_len;
+		packet.data = mPacket + header->tp_mac;
+		mPacket += header->tp_next_offset;
+	}
+
+	return count;
+}
+/* ------------------------------------------------------------------------- */
+void RingSource::release()
+{
+	assert( mCurrent );
+	/* the kernel may overwrite the block as soon as it sees the status */
+	__sync_synchronize();
+	mCurrent->hdr.bh1.block_status = TP_STATUS_KERNEL;
+	mCurrent = NULL;
+	mRemaining = 0;
+	mBlock = (mBlock + 1) % BLOCK_COUNT;
+}
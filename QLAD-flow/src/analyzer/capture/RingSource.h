@@ -0,0 +1,126 @@
+/*
+ * This file is part of the DNS traffic analyser project.
+ *
+ * Copyright (C) 2011 CZ.NIC, z.s.p.o.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <cstddef>
+#include <linux/if_packet.h>
+
+#include "PacketSource.h"
+
+/*!
+ * @class RingSource RingSource.h "capture/RingSource.h"
+ * @brief PacketSource capturing from a network interface.
+ *
+ * Reads packets from a TPACKET_V3 ring shared with the kernel through
+ * PACKET_MMAP. The kernel fills whole blocks of packets and hands them
+ * over when they are full or when the retire timeout expires, so there
+ * is no system call per packet, only a poll() when the ring is empty.
+ * The filter is compiled into BPF and runs in the kernel.
+ *
+ * Delivered packets point into the ring and stay valid until the next
+ * call to next() or nextBatch(), a batch never spans two blocks.
+ */
+class RingSource: public PacketSource
+{
+public:
+	/*! @brief Creates closed source. */
+	RingSource();
+
+	/*! @brief Closes the socket if still opened. */
+	~RingSource()
+		{ if (mSocket >= 0) { close(); } }
+
+	/*!
+	 * @brief Starts capture on a network interface.
+	 * @param interface Name of the interface, "any" for all of them
+	 * @param filter Pcap filter expression to apply
+	 * @return true on success, false on failure
+	 *
+	 * Ethernet and loopback interfaces are captured with their link
+	 * header, other ones and "any" deliver raw IP packets.
+	 * On error returns false and prints human readable text on stderr.
+	 */
+	bool open( const char *interface, const char *filter );
+
+	/*! @brief Prints capture statistics and closes the socket. */
+	void close();
+
+	bool next( Packet &packet )
+		{ return nextBatch( &packet, 1 ) == 1; }
+
+	/*!
+	 * @brief Waits for packets and fetches them.
+	 *
+	 * Returns 0 only after stop() was called.
+	 */
+	unsigned nextBatch( Packet *packets, unsigned max );
+
+	int datalink() const
+		{ return mDatalink; }
+
+protected:
+	enum {
+		BLOCK_SIZE = 1 << 20,    /*!< @brief Bytes per ring block. */
+		BLOCK_COUNT = 64,        /*!< @brief Blocks in the ring. */
+		FRAME_SIZE = 2048,       /*!< @brief Nominal frame size. */
+		RETIRE_TIMEOUT = 100,    /*!< @brief Milliseconds before a
+		                             partly filled block is handed
+		                             over. */
+		POLL_TIMEOUT = 500,      /*!< @brief Milliseconds to wait for a
+		                             block before checking stop(). */
+		SNAPLEN = 65535          /*!< @brief Filter snapshot length. */
+	};
+
+	/*! @brief Descriptor of the block at the index. */
+	tpacket_block_desc * block( unsigned index ) const
+	{
+		return reinterpret_cast<tpacket_block_desc *>(
+		  mRing + (size_t)index * BLOCK_SIZE );
+	}
+
+	/*!
+	 * @brief Compiles and attaches the filter to mSocket.
+	 * @param filter Pcap filter expression
+	 * @return true on success, false on failure
+	 */
+	bool attachFilter( const char *filter );
+
+	/*! @brief Returns the current block to the kernel. */
+	void release();
+
+	int mSocket;                  /*!< @brief Packet socket. */
+	u_char *mRing;                /*!< @brief Mapped ring. */
+	tpacket_block_desc *mCurrent; /*!< @brief Block being read. */
+	const u_char *mPacket;        /*!< @brief Next packet in mCurrent. */
+	unsigned mRemaining;          /*!< @brief Packets left in mCurrent. */
+	unsigned mBlock;              /*!< @brief Index of the next block. */
+	int mDatalink;                /*!< @brief Link type of the packets. */
+
+private:
+	/*! @brief Copy-constructor, FORBIDDEN */
+	RingSource( const RingSource & );
+
+	/*! @brief FORBIDDEN operator */
+	RingSource & operator = ( const RingSource & );
+};
@@ -0,0 +1,195 @@
+/*
+ * This file is part of the DNS traffic analyser project.
+ *
+ * Copyright (C) 2011 CZ.NIC, z.s.p.o.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "SharedRingSource.h"
+#include "pcap_defines.h"
+
+SharedRingSource::SharedRingSource()
+: mRing( NULL ), mMapSize( 0 ), mTail( 0 ), mFiltered( false )
+{}
+/* ------------------------------------------------------------------------- */
+bool SharedRingSource::open( const char *name, const char *filter )
+{
+	assert( !mRing );
+
+	const int fd = shm_open( name, O_RDWR, 0 );
+	struct stat info;
+	if (fd < 0 || fstat( fd, &info ) != 0) {
+		::std::cerr << "Failed to open ring " << name << " "
+		  << strerror( errno ) << ::std::endl;
+		if (fd >= 0)
+			{ ::close( fd ); }
+		return false;
+	}
+
+	mMapSize = info.st_size;
+	void *map = mMapSize >= sizeof( packet_ring_header )
+	  ? mmap( NULL, mMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 )
+	  : MAP_FAILED;
+	::close( fd );
+	if (map == MAP_FAILED) {
+		::std::cerr << "Failed to map ring " << name << " "
+		  << strerror( errno ) << ::std::endl;
+		return false;
+	}
+	mRing = static_cast<packet_ring_header *>( map );
+
+	if (__atomic_load_n( &mRing->magic, __ATOMIC_ACQUIRE )
+	    != PACKET_RING_MAGIC
+	  || mRing->version != PACKET_RING_VERSION
+	  || mRing->size & (mRing->size - 1)
+	  || mMapSize != sizeof( packet_ring_header ) + mRing->size) {
+		::std::cerr << "Shared memory " << name
+		  << " is not a dnsdump ring" << ::std::endl;
+		munmap( mRing, mMapSize );
+		mRing = NULL;
+		return false;
+	}
+
+	if (!attach()) {
+		::std::cerr << "Ring " << name << " is consumed by process "
+		  << mRing->consumer << ::std::endl;
+		munmap( mRing, mMapSize );
+		mRing = NULL;
+		return false;
+	}
+	/* go on where the previous consumer stopped */
+	mTail = __atomic_load_n( &mRing->tail, __ATOMIC_ACQUIRE );
+
+	mFiltered = filter && *filter;
+	if (mFiltered) {
+		pcap_t *dead = pcap_open_dead( datalink(), mRing->snaplen );
+		const int res = pcap_compile( dead, &mFilter, filter,
+		  PCAP_FILTER_OPTIMIZE, PCAP_NETMASK_UNKNOWN );
+		if (res) {
+			::std::cerr << "Failed to compile filter " << filter
+			  << " " << pcap_geterr( dead ) << ::std::endl;
+			mFiltered = false;
+		}
+		pcap_close( dead );
+		if (res) {
+			close();
+			return false;
+		}
+	}
+
+	return true;
+}
+/* ------------------------------------------------------------------------- */
+bool SharedRingSource::attach()
+{
+	const int32_t self = getpid();
+	int32_t current = 0;
+	if (__atomic_compare_exchange_n( &mRing->consumer, &current, self,
+	  false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ))
+		{ return true; }
+
+	/* take over from a consumer that died without detaching */
+	return kill( current, 0 ) != 0 && errno == ESRCH
+	  && __atomic_compare_exchange_n( &mRing->consumer, &current, self,
+	    false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE );
+}
+/* ------------------------------------------------------------------------- */
+void SharedRingSource::close()
+{
+	assert( mRing );
+
+	const uint64_t dropped =
+	  __atomic_load_n( &mRing->dropped, __ATOMIC_RELAXED );
+	if (dropped) {
+		::std::cerr << "Ring dropped " << dropped << " of "
+		  << dropped + __atomic_load_n( &mRing->published,
+		    __ATOMIC_RELAXED )
+		  << " packets, the analysis could not keep up" << ::std::endl;
+	}
+
+	__atomic_store_n( &mRing->tail, mTail, __ATOMIC_RELEASE );
+	__atomic_store_n( &mRing->consumer, 0, __ATOMIC_RELEASE );
+	munmap( mRing, mMapSize );
+	mRing = NULL;
+	if (mFiltered)
+		{ pcap_freecode( &mFilter ); }
+	mFiltered = false;
+}
+/* ------------------------------------------------------------------------- */
+unsigned SharedRingSource::nextBatch( Packet *packets, unsigned max )
+{
+	assert( mRing );
+
+	const unsigned char *area = packet_ring_data( mRing );
+	const uint64_t mask = mRing->size - 1;
+	unsigned sleep = MIN_SLEEP;
+
+	for (;;) {
+		/* the previous batch is not used any more */
+		__atomic_store_n( &mRing->tail, mTail, __ATOMIC_RELEASE );
+
+		const uint64_t head =
+		  __atomic_load_n( &mRing->head, __ATOMIC_ACQUIRE );
+		unsigned count = 0;
+		while (count < max && mTail != head) {
+			const packet_ring_record *record =
+			  reinterpret_cast<const packet_ring_record *>(
+			    area + (mTail & mask) );
+			if (record->size & PACKET_RING_PADDING) {
+				mTail += record->size & ~PACKET_RING_PADDING;
+				continue;
+			}
+			mTail += record->size;
+
+			Packet &packet = packets[count];
+			packet.header.ts.tv_sec = record->sec;
+			packet.header.ts.tv_usec = record->usec;
+			packet.header.caplen = record->caplen;
+			packet.header.len = record->len;
+			packet.data =
+			  reinterpret_cast<const u_char *>( record + 1 );
+			if (!mFiltered || pcap_offline_filter( &mFilter,
+			  &packet.header, packet.data ))
+				{ ++count; }
+		}
+		if (count)
+			{ return count; }
+
+		/* closed is set after the last record was published */
+		if (__atomic_load_n( &mRing->closed, __ATOMIC_ACQUIRE )
+		  && __atomic_load_n( &mRing->head, __ATOMIC_ACQUIRE ) == mTail)
+			{ return 0; }
+		if (stopped())
+			{ return 0; }
+
+		usleep( sleep );
+		sleep = ::std::min<unsigned>( sleep * 2, MAX_SLEEP );
+	}
+}
@@ -0,0 +1,102 @@
+/*
+ * This file is part of the DNS traffic analyser project.
+ *
+ * Copyright (C) 2011 CZ.NIC, z.s.p.o.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <cstddef>
+#include <stdint.h>
+
+#include "PacketSource.h"
+#include "packet_ring.h"
+
+/*!
+ * @class SharedRingSource SharedRingSource.h "capture/SharedRingSource.h"
+ * @brief PacketSource consuming the shared memory ring of dnsdump.
+ *
+ * Attaches as the single consumer of a packet ring published by
+ * `dnsdump -R`, see packet_ring.h. Packets are read straight from the
+ * shared memory, the space is handed back to the producer once the batch
+ * is done with. When the ring is empty the source sleeps for a growing
+ * period up to MAX_SLEEP.
+ *
+ * The input ends when dnsdump closes the ring and everything is read, or
+ * after stop(). Packets the producer had to drop because the consumer
+ * fell behind are reported on close().
+ */
+class SharedRingSource: public PacketSource
+{
+public:
+	/*! @brief Creates closed source. */
+	SharedRingSource();
+
+	/*! @brief Detaches from the ring if still attached. */
+	~SharedRingSource()
+		{ if (mRing) { close(); } }
+
+	/*!
+	 * @brief Attaches to a ring.
+	 * @param name Name of the shared memory object, as given to dnsdump
+	 * @param filter Pcap filter expression to apply
+	 * @return true on success, false on failure
+	 *
+	 * Fails if another living process consumes the ring.
+	 * On error returns false and prints human readable text on stderr.
+	 */
+	bool open( const char *name, const char *filter );
+
+	/*! @brief Prints the drop counters and detaches from the ring. */
+	void close();
+
+	bool next( Packet &packet )
+		{ return nextBatch( &packet, 1 ) == 1; }
+
+	unsigned nextBatch( Packet *packets, unsigned max );
+
+	int datalink() const
+		{ return mRing->datalink; }
+
+protected:
+	enum {
+		MIN_SLEEP = 50,      /*!< @brief First sleep on empty ring, us. */
+		MAX_SLEEP = 10000    /*!< @brief Longest sleep, us. */
+	};
+
+	/*!
+	 * @brief Registers this process as the consumer.
+	 * @return true on success, false if another one is attached
+	 */
+	bool attach();
+
+	packet_ring_header *mRing; /*!< @brief Mapped ring. */
+	size_t mMapSize;           /*!< @brief Size of the mapping. */
+	uint64_t mTail;            /*!< @brief End of the delivered records. */
+	bool mFiltered;            /*!< @brief mFilter is to be applied. */
+	bpf_program mFilter;       /*!< @brief Compiled filter. */
+
+private:
+	/*! @brief Copy-constructor, FORBIDDEN */
+	SharedRingSource( const SharedRingSource & );
+
+	/*! @brief FORBIDDEN operator */
+	SharedRingSource & operator = ( const SharedRingSource & );
+};
@@ -0,0 +1,332 @@
+/*
+ * This file is part of the DNS traffic analyser project.
+ *
+ * Copyright (C) 2011 CZ.NIC, z.s.p.o.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <cassert>
+#include <cstring>
+#include <netinet/in.h>
+
+#include "TcpReassembler.h"
+
+/* TCP flags */
+#define TCP_FIN 0x01
+#define TCP_SYN 0x02
+#define TCP_RST 0x04
+
+/*! @brief Port of the name servers. */
+#define DNS_PORT 53
+
+/*! @brief Reads 16-bit field in network byte order. */
+static inline unsigned read16( const u_char *position )
+	{ return position[0] << 8 | position[1]; }
+
+/*! @brief Reads 32-bit field in network byte order. */
+static inline uint32_t read32( const u_char *position )
+{
+	return (uint32_t) position[0] << 24 | position[1] << 16
+	  | position[2] << 8 | position[3];
+}
+/* ------------------------------------------------------------------------- */
+TcpReassembler::TcpReassembler( size_t memory )
+: mFree( 0 ), mOldest( 0 ), mNewest( 0 ), mClosing( 0 ), mBuffered( 0 ),
+  mEvicted( 0 ), mGaps( 0 )
+{
+	size_t flows = memory / FLOW_SHARE;
+	if (flows < MIN_FLOWS)
+		{ flows = MIN_FLOWS; }
+	size_t buckets = 1;
+	while (buckets < flows)
+		{ buckets *= 2; }
+
+	mFlows.resize( flows + 1 );
+	mBuckets.assign( buckets, 0 );
+	for (size_t i = flows; i > 0; --i) {
+		mFlows[i].chain = mFree;
+		mFree = i;
+	}
+
+	/* the table itself counts too */
+	const size_t table = mFlows.size() * sizeof( Flow )
+	  + mBuckets.size() * sizeof( unsigned );
+	mBudget = memory > table ? memory - table : 0;
+}
+/* ------------------------------------------------------------------------- */
+bool TcpReassembler::accepts( const u_char *ip, const PacketMeta &meta )
+{
+	if (meta.protocol != IPPROTO_TCP || meta.fragment
+	  || meta.length < meta.transport + 4u)
+		{ return false; }
+	const u_char *tcp = ip + meta.transport;
+	return read16( tcp ) == DNS_PORT || read16( tcp + 2 ) == DNS_PORT;
+}
+/* ------------------------------------------------------------------------- */
+unsigned TcpReassembler::add( const u_char *ip, const PacketMeta &meta,
+  MessageRecord &record )
+{
+	mMessages.clear();
+	/* the messages of the last call are not needed any more */
+	if (mClosing) {
+		remove( mClosing );
+		mClosing = 0;
+	}
+
+	if (meta.length < meta.transport + 20u)
+		{ return 0; }
+	const u_char *tcp = ip + meta.transport;
+	const unsigned offset = (tcp[12] >> 4) * 4;
+	if (offset < 20 || meta.length < meta.transport + offset)
+		{ return 0; }
+	const u_char *payload = tcp + offset;
+	size_t size = meta.length - meta.transport - offset;
+	const unsigned flags = tcp[13];
+	uint32_t sequence = read32( tcp + 4 );
+
+	/* the decoder checked the header length */
+	memset( &record, 0, sizeof( record ) );
+	record.family = meta.version;
+	if (meta.version == 4) {
+		memcpy( record.source, ip + 12, 4 );
+		memcpy( record.destination, ip + 16, 4 );
+	} else {
+		memcpy( record.source, ip + 8, MessageRecord::ADDRESS_SIZE );
+		memcpy( record.destination, ip + 24,
+		  MessageRecord::ADDRESS_SIZE );
+	}
+
+	unsigned char key[KEY_SIZE];
+	key[0] = record.family;
+	memcpy( key + 1, record.source, MessageRecord::ADDRESS_SIZE );
+	memcpy( key + 1 + MessageRecord::ADDRESS_SIZE, record.destination,
+	  MessageRecord::ADDRESS_SIZE );
+	memcpy( key + 1 + 2 * MessageRecord::ADDRESS_SIZE, tcp, 4 );
+	const uint32_t code = hash( key );
+	unsigned index = find( key, code );
+
+	if (flags & TCP_RST) {
+		if (index)
+			{ remove( index ); }
+		return 0;
+	}
+
+	if (flags & TCP_SYN) {
+		if (!index)
+			{ index = create( key, code ); }
+		Flow &flow = mFlows[index];
+		const size_t capacity = flow.data.capacity();
+		::std::vector<u_char>().swap( flow.data );
+		flow.start = 0;
+		account( flow, capacity );
+		/* the SYN takes a sequence number */
+		flow.next = ++sequence;
+	}
+
+	if (size == 0) {
+		if (index && (flags & TCP_FIN))
+			{ remove( index ); }
+		return 0;
+	}
+
+	if (!index) {
+		/* the start was missed, hope for a message boundary */
+		index = create( key, code );
+		mFlows[index].next = sequence;
+	}
+	touch( index );
+	Flow &flow = mFlows[index];
+	size_t capacity = flow.data.capacity();
+
+	const int32_t ahead = sequence - flow.next;
+	if (ahead > 0) {
+		/* no segments are held, continue behind the gap */
+		++mGaps;
+		flow.data.clear();
+		flow.start = 0;
+	} else if (ahead < 0) {
+		/* retransmission */
+		if ((size_t) -ahead >= size) {
+			if (flags & TCP_FIN)
+				{ mClosing = index; }
+			return 0;
+		}
+		payload += -ahead;
+		size -= -ahead;
+	}
+	flow.next = sequence + (ahead < 0 ? -ahead : 0) + size;
+
+	/* drop the messages cut out by the last segment */
+	flow.data.erase( flow.data.begin(), flow.data.begin() + flow.start );
+	flow.start = 0;
+
+	if (flow.data.empty()) {
+		const size_t used = extract( payload, size );
+		payload += used;
+		size -= used;
+	}
+
+	if (size) {
+		flow.data.insert( flow.data.end(), payload, payload + size );
+		account( flow, capacity );
+		capacity = flow.data.capacity();
+
+		/* make room, the oldest flows first */
+		while (mBuffered > mBudget && mOldest != index) {
+			const Flow &oldest = mFlows[mOldest];
+			if (oldest.data.size() > oldest.start)
+				{ ++mEvicted; }
+			remove( mOldest );
+		}
+		if (mBuffered > mBudget) {
+			++mEvicted;
+			remove( index );
+			return mMessages.size();
+		}
+
+		flow.start = extract( &flow.data[0], flow.data.size() );
+	} else {
+		account( flow, capacity );
+	}
+
+	if (flags & TCP_FIN)
+		{ mClosing = index; }
+	return mMessages.size();
+}
+/* ------------------------------------------------------------------------- */
+unsigned TcpReassembler::find( const unsigned char *key, uint32_t hash )
+  const
+{
+	unsigned index = mBuckets[hash & (mBuckets.size() - 1)];
+	while (index && memcmp( mFlows[index].key, key, KEY_SIZE ) != 0)
+		{ index = mFlows[index].chain; }
+	return index;
+}
+/* ------------------------------------------------------------------------- */
+unsigned TcpReassembler::create( const unsigned char *key, uint32_t hash )
+{
+	if (!mFree) {
+		/* idle flows are evicted silently */
+		assert( mOldest );
+		const Flow &oldest = mFlows[mOldest];
+		if (oldest.data.size() > oldest.start)
+			{ ++mEvicted; }
+		remove( mOldest );
+	}
+
+	const unsigned index = mFree;
+	Flow &flow = mFlows[index];
+	mFree = flow.chain;
+
+	memcpy( flow.key, key, KEY_SIZE );
+	flow.next = 0;
+	flow.start = 0;
+	unsigned &bucket = mBuckets[hash & (mBuckets.size() - 1)];
+	flow.chain = bucket;
+	bucket = index;
+
+	/* the newest one */
+	flow.older = mNewest;
+	flow.newer = 0;
+	if (mNewest)
+		{ mFlows[mNewest].newer = index; }
+	else
+		{ mOldest = index; }
+	mNewest = index;
+	return index;
+}
+/* ------------------------------------------------------------------------- */
+void TcpReassembler::remove( unsigned index )
+{
+	assert( index );
+	Flow &flow = mFlows[index];
+	if (mClosing == index)
+		{ mClosing = 0; }
+
+	unsigned *link = &mBuckets[hash( flow.key ) & (mBuckets.size() - 1)];
+	while (*link != index)
+		{ link = &mFlows[*link].chain; }
+	*link = flow.chain;
+
+	if (flow.older)
+		{ mFlows[flow.older].newer = flow.newer; }
+	else
+		{ mOldest = flow.newer; }
+	if (flow.newer)
+		{ mFlows[flow.newer].older = flow.older; }
+	else
+		{ mNewest = flow.older; }
+
+	const size_t capacity = flow.data.capacity();
+	::std::vector<u_char>().swap( flow.data );
+	account( flow, capacity );
+
+	flow.chain = mFree;
+	mFree = index;
+}
+/* ------------------------------------------------------------------------- */
+void TcpReassembler::touch( unsigned index )
+{
+	if (index == mNewest)
+		{ return; }
+	Flow &flow = mFlows[index];
+
+	/* unlink, not the newest one so there is a newer one */
+	mFlows[flow.newer].older = flow.older;
+	if (flow.older)
+		{ mFlows[flow.older].newer = flow.newer; }
+	else
+		{ mOldest = flow.newer; }
+
+	flow.older = mNewest;
+	flow.newer = 0;
+	mFlows[mNewest].newer = index;
+	mNewest = index;
+}
+/* ------------------------------------------------------------------------- */
+void TcpReassembler::account( Flow &flow, size_t capacity )
+{
+	mBuffered += flow.data.capacity();
+	mBuffered -= capacity;
+}
+/* ------------------------------------------------------------------------- */
+size_t TcpReassembler::extract( const u_char *data, size_t size )
+{
+	size_t used = 0;
+	while (size - used >= 2) {
+		const size_t length = read16( data + used );
+		if (size - used - 2 < length)
+			{ break; }
+		if (length) {
+			const Message message = { data + used + 2, length };
+			mMessages.push_back( message );
+		}
+		used += 2 + length;
+	}
+	return used;
+}
+/* ------------------------------------------------------------------------- */
+uint32_t TcpReassembler::hash( const unsigned char *key )
+{
+	/* FNV-1a */
+	uint32_t hash = 2166136261u;
+	for (unsigned i = 0; i < KEY_SIZE; ++i)
+		{ hash = (hash ^ key[i]) * 16777619u; }
+	return hash;
+}
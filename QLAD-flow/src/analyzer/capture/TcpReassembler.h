@@ -0,0 +1,171 @@
+/*
+ * This file is part of the DNS traffic analyser project.
+ *
+ * Copyright (C) 2011 CZ.NIC, z.s.p.o.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+#include "LinkDecoder.h"
+#include "policies/MessageRecord.h"
+
+/*!
+ * @class TcpReassembler TcpReassembler.h "capture/TcpReassembler.h"
+ * @brief Reassembles DNS messages sent over TCP.
+ *
+ * Every direction of a connection to or from port 53 is a flow. The
+ * segments of a flow are appended in sequence order and the messages,
+ * each preceded by its 2-byte length, are cut out of the stream; one
+ * segment may complete several messages. Messages complete within a
+ * segment are not copied.
+ *
+ * The flows are kept in a table of a fixed size, the least recently used
+ * flow is evicted when a new one does not fit or when the buffered data
+ * exceed the memory limit, so a flood of connections cannot exhaust the
+ * memory. Segments out of order are not held: a gap drops the buffered
+ * data and the flow continues from the new segment, as does a flow whose
+ * start was not captured.
+ */
+class TcpReassembler
+{
+public:
+	/*! @brief A reassembled DNS message. */
+	struct Message {
+		const u_char *data;  /*!< @brief The message, no length. */
+		size_t size;         /*!< @brief Its size. */
+	};
+
+	/*!
+	 * @brief Creates empty flow table.
+	 * @param memory Upper bound on the memory taken by the flows, in
+	 * bytes
+	 */
+	explicit TcpReassembler( size_t memory );
+
+	/*!
+	 * @brief Checks whether the packet is a DNS over TCP segment.
+	 * @param ip The IP packet.
+	 * @param meta Its layout.
+	 * @return true for unfragmented TCP from or to port 53.
+	 */
+	static bool accepts( const u_char *ip, const PacketMeta &meta );
+
+	/*!
+	 * @brief Adds a segment to its flow.
+	 * @param ip The IP packet, accepted by accepts().
+	 * @param meta Its layout.
+	 * @param record Receives the addresses of the messages.
+	 * @return Number of messages completed by the segment.
+	 *
+	 * The messages are valid until the next call.
+	 */
+	unsigned add( const u_char *ip, const PacketMeta &meta,
+	  MessageRecord &record );
+
+	/*!
+	 * @brief Message completed by the last add().
+	 * @param index Less than the count returned by add().
+	 */
+	const Message & message( unsigned index ) const
+		{ return mMessages[index]; }
+
+	/*! @brief Number of flows evicted with an incomplete message. */
+	unsigned long evicted() const
+		{ return mEvicted; }
+
+	/*! @brief Number of gaps in the flows, lost or reordered segments. */
+	unsigned long gaps() const
+		{ return mGaps; }
+
+protected:
+	enum {
+		KEY_SIZE = 1 + 2 * MessageRecord::ADDRESS_SIZE + 4,
+		                      /*!< @brief Family, addresses, ports. */
+		FLOW_SHARE = 1024,    /*!< @brief Memory per flow of the table
+		                          size, in bytes. */
+		MIN_FLOWS = 16        /*!< @brief Smallest table. */
+	};
+
+	/*! @brief One direction of a connection. */
+	struct Flow {
+		unsigned char key[KEY_SIZE];  /*!< @brief Flow identity. */
+		uint32_t next;                /*!< @brief Expected sequence
+		                                  number. */
+		::std::vector<u_char> data;   /*!< @brief Incomplete stream. */
+		size_t start;                 /*!< @brief Consumed part of
+		                                  data. */
+		unsigned chain;               /*!< @brief Next flow of the
+		                                  bucket or free flow. */
+		unsigned older;               /*!< @brief LRU neighbour. */
+		unsigned newer;               /*!< @brief LRU neighbour. */
+	};
+
+	/*! @brief Flow of the key, 0 if none. */
+	unsigned find( const unsigned char *key, uint32_t hash ) const;
+
+	/*! @brief Starts a flow, evicts the oldest one if the table is full. */
+	unsigned create( const unsigned char *key, uint32_t hash );
+
+	/*! @brief Releases the flow. */
+	void remove( unsigned index );
+
+	/*! @brief Makes the flow the most recently used one. */
+	void touch( unsigned index );
+
+	/*! @brief Counts the change of the flow buffer capacity. */
+	void account( Flow &flow, size_t capacity );
+
+	/*!
+	 * @brief Cuts complete messages out of a stream.
+	 * @return Bytes of the complete messages.
+	 */
+	size_t extract( const u_char *data, size_t size );
+
+	/*! @brief Hash of a flow key. */
+	static uint32_t hash( const unsigned char *key );
+
+	/*!
+	 * @brief Flows, the first one is a sentinel so that index 0 stands
+	 * for none.
+	 */
+	::std::vector<Flow> mFlows;
+	::std::vector<unsigned> mBuckets;  /*!< @brief Hash chains. */
+	unsigned mFree;                    /*!< @brief Unused flows. */
+	unsigned mOldest;                  /*!< @brief LRU end. */
+	unsigned mNewest;                  /*!< @brief MRU end. */
+	unsigned mClosing;                 /*!< @brief Flow ended by the last
+	                                       segment, removed later. */
+	size_t mBuffered;                  /*!< @brief Memory of buffers. */
+	size_t mBudget;                    /*!< @brief Limit of mBuffered. */
+	::std::vector<Message> mMessages;  /*!< @brief Of the last add(). */
+	unsigned long mEvicted;            /*!< @brief Flows lost. */
+	unsigned long mGaps;               /*!< @brief Gaps in flows. */
+
+private:
+	/*! @brief Copy-constructor, FORBIDDEN */
+	TcpReassembler( const TcpReassembler & );
+
+	/*! @brief FORBIDDEN operator */
+	TcpReassembler & operator = ( const TcpReassembler & );
+};
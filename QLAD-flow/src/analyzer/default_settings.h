@@ -52,3 +52,29 @@
 
 #define ANALYSIS_POLICY srcIP
 #define ANALYSIS_POLICY_NAME_STR "srcIP"
+
+#define MAX_OPEN_FILES_MIN 1
+#define MAX_OPEN_FILES_DEFAULT 64
+
+#define PARSER_THREADS_DEFAULT 0
+#define PARSER_THREADS_MAX 64
+
+/* milliseconds */
+#define REORDER_WINDOW_DEFAULT 0
+
+#define REORDER_PACKETS_MIN 1
+#define REORDER_PACKETS_DEFAULT 1000000
+
+/* MiB */
+#define TCP_MEMORY_DEFAULT 64
+#define FRAGMENT_MEMORY_DEFAULT 16
+
+/* labels of a query name identifier, the public suffix counted as one */
+#define QNAME_LABELS_MIN 1
+#define QNAME_LABELS_DEFAULT 2
+
+/* fields of the composite policy key */
+#define COMPOSITE_KEY_DEFAULT "src/24/48,qname,qtype"
+
+/* malformed DNS packets written per second */
+#define BAD_PACKET_RATE_DEFAULT 10
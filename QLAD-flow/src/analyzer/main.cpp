@@ -21,44 +21,88 @@
 #endif
 
 #include <cassert>
-#include <list>
+#include <csignal>
+#include <cstring>
+#include <string>
+#include <vector>
 
 #include <pcap.h>
 
+#include "Analysis.h"
 #include "CaptureSession.h"
-#include "Detector.h"
-#include "policies/IPPolicy.h"
-#include "policies/QueryNamePolicy.h"
-#include "policies/QueryNamePolicy.h"
+#include "capture/FailureSampler.h"
+#include "capture/PacketSource.h"
+#include "proc/Pipeline.h"
+#include "proc/Thread.h"
 #include "proc/ThreadPool.h"
 #include "Settings.h"
-#include "Storage.h"
 #include "log/Log.h"
+#include "policies/CompositePolicy.h"
+#include "policies/QueryNamePolicy.h"
 
-
-#ifndef NDEBUG
-//template class Detector<POLICY>;
-//template class Storage<POLICY>;
-#endif
+/*!
+ * @brief One input stream with its own capture.
+ *
+ * Streams are analysed on threads of their own. They share the global
+ * ThreadPool for detection and the hash functions.
+ */
+struct StreamAnalysis {
+	const Settings *opt;             /*!< @brief Options. */
+	const Settings::Stream *stream;  /*!< @brief The input. */
+	FailureSampler *sampler;         /*!< @brief Shared, or NULL. */
+	CaptureSession session;          /*!< @brief Capture of the input. */
+};
 
 /*!
- * @brief Analyses the data within the capture session using source IP policy.
+ * @brief Opens the capture of a stream.
+ * @param session Closed session to open
+ * @param stream The input to capture
  * @param opt Options
+ * @return true on success, false on failure
  */
-void analyseWithSrcIPPolicy( const Settings &opt );
+static bool open_stream( CaptureSession &session,
+  const Settings::Stream &stream, const Settings &opt );
 
 /*!
- * @brief Analyses the data within the capture session using
- *        destination IP policy.
+ * @brief Analyses the data within the capture session.
  * @param opt Options
+ * @param session Opened capture of the stream
+ * @param name Name of the stream, labels the output
+ * @param sampler Sampler of malformed packets, NULL for none
+ *
+ * All the policies requested by opt are fed from a single pass over the
+ * captured data. With opt.parser_threads set, packets are parsed by a
+ * Pipeline in parallel with the capture.
  */
-void analyseWithDstIPPolicy( const Settings &opt );
+void analyse( const Settings &opt, CaptureSession &session,
+  const ::std::string &name, FailureSampler *sampler );
 
 /*!
- * @brief Analyses the data within the capture session using query name policy.
- * @param opt Options
+ * @brief Thread body analysing one of several streams.
+ * @param analysis The stream to analyse
+ * @return NOT USED
  */
-void analyseWithQueryNamePolicy( const Settings &opt );
+static void * analyse_stream( StreamAnalysis *analysis );
+
+/*!
+ * @brief Captures one window and makes sure it is completely stored.
+ * @param session Capture to read
+ * @param input Storage or pipeline to capture into
+ * @param pipeline The pipeline, NULL when capturing directly
+ * @param interval Time span of the communication to capture
+ */
+static void capture( CaptureSession &session, IStorage *input,
+  Pipeline *pipeline, unsigned interval );
+
+/*!
+ * @brief Signal handler that ends live capture.
+ * @param signum Signal number, unused
+ */
+static void stop_capture( int signum )
+{
+	(void) signum;
+	PacketSource::stop();
+}
 
 /*!
  * @brief The main function for the analyser sub-project.
@@ -78,6 +122,21 @@ int main( int argc, char *argv[] )
 		return 1;
 	}
 
+	/* the names are reduced alike in all the streams */
+	QueryNamePolicy::reducer.setLabels( opt.qname_labels );
+	if ( opt.suffix_list
+	  && !QueryNamePolicy::reducer.loadSuffixes( opt.suffix_list ) )
+		return 1;
+	if ( opt.usesPolicy( composite )
+	  && !CompositePolicy::configure( opt.composite_key ) )
+		return 1;
+
+	/* shared by the streams, closed after them */
+	FailureSampler sampler;
+	if ( opt.bad_packets
+	  && !sampler.open( opt.bad_packets, opt.bad_packet_rate ) )
+		return 1;
+
 	/* initialize logger */
 	int fileid = GlobalLog.openFile("run.log", "w");
 	/* runtime log file */
@@ -86,246 +145,114 @@ int main( int argc, char *argv[] )
 	GlobalLog.levelsSet( Log::LOGF_STDERR, Log::LOGS_ANALYZER,
 	                     LOG_UPTO(LOG_WARNING) );
 
-	if (!CaptureSession::instance().openOffline( opt.file, opt.filter ))
-		{ return 1; }
-
-	/* Create global therad pool containing opt.thread_count threads. */
-	ThreadPool::globalInstance(opt.thread_count).run();
-
-	switch ( opt.policy ) {
-		case srcIP :
-			analyseWithSrcIPPolicy( opt );
-			break;
-		case dstIP :
-			analyseWithDstIPPolicy( opt );
-			break;
-		case queryName :
-			analyseWithQueryNamePolicy( opt );
-			break;
-		default :
-			break;
+	::std::vector<StreamAnalysis *> streams;
+	bool live = false;
+	bool opened = true;
+	for (size_t i = 0; opened && i < opt.streams.size(); ++i) {
+		StreamAnalysis *analysis = new StreamAnalysis;
+		analysis->opt = &opt;
+		analysis->stream = &opt.streams[i];
+		analysis->sampler = opt.bad_packets ? &sampler : NULL;
+		streams.push_back( analysis );
+		opened = open_stream( analysis->session, opt.streams[i], opt );
+		live = live || opt.streams[i].live();
 	}
 
-	CaptureSession::instance().close();
-
-	return 0;
-}
-/* ------------------------------------------------------------------------- */
-void analyseWithSrcIPPolicy( const Settings &opt )
-{
-
-#define POLICY SrcIPPolicy
-	typedef Storage<POLICY> TStorage;
-	typedef Detector<POLICY> TDetector;
-#undef POLICY
-
-	::std::list<TDetector *> detectors;
-	TStorage storage( opt.window_size );
-
-	if ( CaptureSession::instance().canCapture() ) {
-		/* Capture enough packets to fill the analysis window. */
-		CaptureSession::instance().startCapture(
-		  &storage, opt.window_size );
-
-		/* Analyse stored data. - Creates and runs all the Engines. */
-		TDetector *detector = new TDetector(
-		  storage, opt.hash_count, opt.sketch_count,
-		  opt.aggregation_count, opt.detection_threshold,
-		  opt.aggregate, opt.analysed_parameter,
-		  opt.gnuplot_anomalies_dir,
-#ifdef GNUPLOT_INTERMED
-		  opt.gnuplot_intermediate_dir
-#else
-		  NULL
-#endif
-		);
-
-		/* Collects result from the Engines. */
-		ThreadPool::globalInstance().addJob( detector );
-		detectors.push_back( detector );
+	if (opened && live) {
+		struct sigaction action;
+		memset( &action, 0, sizeof( action ) );
+		action.sa_handler = stop_capture;
+		sigaction( SIGINT, &action, NULL );
+		sigaction( SIGHUP, &action, NULL );
+		sigaction( SIGTERM, &action, NULL );
 	}
 
-	while ( CaptureSession::instance().canCapture() ) {
-		/* Capture packets to next analyzing point */
-		CaptureSession::instance().startCapture(
-		  &storage, opt.detection_interval );
-		/* Make sure there is only relevant data. */
-		storage.sync();
-
-		/* Analyse stored data. */
-		TDetector *detector = new TDetector(
-		  storage, opt.hash_count, opt.sketch_count,
-		  opt.aggregation_count, opt.detection_threshold,
-		  opt.aggregate, opt.analysed_parameter,
-		  opt.gnuplot_anomalies_dir,
-#ifdef GNUPLOT_INTERMED
-		  opt.gnuplot_intermediate_dir
-#else
-		  NULL
-#endif
-		);
-
-		ThreadPool::globalInstance().addJob( detector );
-		detectors.push_back( detector );
+	if (opened) {
+		/* Create global therad pool containing opt.thread_count
+		 * threads. */
+		ThreadPool::globalInstance(opt.thread_count).run();
+	}
 
-		/* Remove finished detectors. */
-		while (!detectors.empty() && detectors.front()->done()) {
-			delete detectors.front();
-			detectors.pop_front();
+	if (opened && streams.size() == 1) {
+		analyse( opt, streams.front()->session,
+		  streams.front()->stream->name, streams.front()->sampler );
+	} else if (opened) {
+		::std::vector<Thread *> threads;
+		for (size_t i = 0; i < streams.size(); ++i) {
+			threads.push_back(
+			  new Thread( analyse_stream, streams[i], true ) );
+		}
+		for (size_t i = 0; i < threads.size(); ++i) {
+			threads[i]->join();
+			delete threads[i];
 		}
 	}
 
-	/* Wait for ongoing analysis before exiting. */
-	while ( !detectors.empty() ) {
-		detectors.front()->waitForDone();
-		delete detectors.front();
-		detectors.pop_front();
-	}
+	/* closes the sessions */
+	for (size_t i = 0; i < streams.size(); ++i)
+		{ delete streams[i]; }
 
+	return opened ? 0 : 1;
 }
 /* ------------------------------------------------------------------------- */
-void analyseWithDstIPPolicy( const Settings &opt )
+static bool open_stream( CaptureSession &session,
+  const Settings::Stream &stream, const Settings &opt )
 {
-
-#define POLICY DstIPPolicy
-	typedef Storage<POLICY> TStorage;
-	typedef Detector<POLICY> TDetector;
-#undef POLICY
-
-	::std::list<TDetector *> detectors;
-	TStorage storage( opt.window_size );
-
-	if ( CaptureSession::instance().canCapture() ) {
-		/* Capture enough packets to fill the analysis window. */
-		CaptureSession::instance().startCapture(
-		  &storage, opt.window_size );
-
-		/* Analyse stored data. - Creates and runs all the Engines. */
-		TDetector *detector = new TDetector(
-		  storage, opt.hash_count, opt.sketch_count,
-		  opt.aggregation_count, opt.detection_threshold,
-		  opt.aggregate, opt.analysed_parameter,
-		  opt.gnuplot_anomalies_dir,
-#ifdef GNUPLOT_INTERMED
-		  opt.gnuplot_intermediate_dir
-#else
-		  NULL
-#endif
-		);
-
-		/* Collects result from the Engines. */
-		ThreadPool::globalInstance().addJob( detector );
-		detectors.push_back( detector );
-	}
-
-	while ( CaptureSession::instance().canCapture() ) {
-		/* Capture packets to next analyzing point */
-		CaptureSession::instance().startCapture(
-		  &storage, opt.detection_interval );
-		/* Make sure there is only relevant data. */
-		storage.sync();
-
-		/* Analyse stored data. */
-		TDetector *detector = new TDetector(
-		  storage, opt.hash_count, opt.sketch_count,
-		  opt.aggregation_count, opt.detection_threshold,
-		  opt.aggregate, opt.analysed_parameter,
-		  opt.gnuplot_anomalies_dir,
-#ifdef GNUPLOT_INTERMED
-		  opt.gnuplot_intermediate_dir
-#else
-		  NULL
-#endif
-		);
-
-		ThreadPool::globalInstance().addJob( detector );
-		detectors.push_back( detector );
-
-		/* Remove finished detectors. */
-		while (!detectors.empty() && detectors.front()->done()) {
-			delete detectors.front();
-			detectors.pop_front();
-		}
-	}
-
-	/* Wait for ongoing analysis before exiting. */
-	while ( !detectors.empty() ) {
-		detectors.front()->waitForDone();
-		delete detectors.front();
-		detectors.pop_front();
-	}
-
+	session.setReorder( opt.reorder_window, opt.reorder_packets );
+	session.setTcpMemory( (size_t) opt.tcp_memory << 20 );
+	session.setFragmentMemory( (size_t) opt.fragment_memory << 20 );
+
+	if (stream.interface)
+		{ return session.openLive( stream.interface, opt.filter ); }
+	if (stream.ring)
+		{ return session.openRing( stream.ring, opt.filter ); }
+	if (stream.dnstap_socket)
+		{ return session.openDnstap( stream.dnstap_socket, opt.filter ); }
+	return session.openOffline( stream.files, opt.filter,
+	  opt.max_open_files );
 }
 /* ------------------------------------------------------------------------- */
-void analyseWithQueryNamePolicy( const Settings &opt )
+void analyse( const Settings &opt, CaptureSession &session,
+  const ::std::string &name, FailureSampler *sampler )
 {
-
-#define POLICY QueryNamePolicy
-	typedef Storage<POLICY> TStorage;
-	typedef Detector<POLICY> TDetector;
-#undef POLICY
-
-	::std::list<TDetector *> detectors;
-	TStorage storage( opt.window_size );
-
-	if ( CaptureSession::instance().canCapture() ) {
+	AnalysisSet analyses( opt, name );
+	analyses.setSampler( sampler );
+	Pipeline *pipeline = opt.parser_threads
+	  ? new Pipeline( analyses, opt.parser_threads ) : NULL;
+	IStorage *input = pipeline ? static_cast<IStorage *>( pipeline )
+	  : &analyses;
+
+	if ( session.canCapture() ) {
 		/* Capture enough packets to fill the analysis window. */
-		CaptureSession::instance().startCapture(
-		  &storage, opt.window_size );
-
-		/* Analyse stored data. - Creates and runs all the Engines. */
-		TDetector *detector = new TDetector(
-		  storage, opt.hash_count, opt.sketch_count,
-		  opt.aggregation_count, opt.detection_threshold,
-		  opt.aggregate, opt.analysed_parameter,
-		  opt.gnuplot_anomalies_dir,
-#ifdef GNUPLOT_INTERMED
-		  opt.gnuplot_intermediate_dir
-#else
-		  NULL
-#endif
-		);
-
-		/* Collects result from the Engines. */
-		ThreadPool::globalInstance().addJob( detector );
-		detectors.push_back( detector );
+		capture( session, input, pipeline, opt.window_size );
+		analyses.detect();
 	}
 
-	while ( CaptureSession::instance().canCapture() ) {
+	while ( session.canCapture() ) {
 		/* Capture packets to next analyzing point */
-		CaptureSession::instance().startCapture(
-		  &storage, opt.detection_interval );
-		/* Make sure there is only relevant data. */
-		storage.sync();
-
-		/* Analyse stored data. */
-		TDetector *detector = new TDetector(
-		  storage, opt.hash_count, opt.sketch_count,
-		  opt.aggregation_count, opt.detection_threshold,
-		  opt.aggregate, opt.analysed_parameter,
-		  opt.gnuplot_anomalies_dir,
-#ifdef GNUPLOT_INTERMED
-		  opt.gnuplot_intermediate_dir
-#else
-		  NULL
-#endif
-		);
-
-		ThreadPool::globalInstance().addJob( detector );
-		detectors.push_back( detector );
-
-		/* Remove finished detectors. */
-		while (!detectors.empty() && detectors.front()->done()) {
-			delete detectors.front();
-			detectors.pop_front();
-		}
+		capture( session, input, pipeline, opt.detection_interval );
+		analyses.detect();
 	}
 
-	/* Wait for ongoing analysis before exiting. */
-	while ( !detectors.empty() ) {
-		detectors.front()->waitForDone();
-		delete detectors.front();
-		detectors.pop_front();
-	}
+	delete pipeline;
 
+	/* Wait for ongoing analysis before exiting. */
+	analyses.finish();
+}
+/* ------------------------------------------------------------------------- */
+static void * analyse_stream( StreamAnalysis *analysis )
+{
+	assert( analysis );
+	analyse( *analysis->opt, analysis->session, analysis->stream->name,
+	  analysis->sampler );
+	return NULL;
+}
+/* ------------------------------------------------------------------------- */
+static void capture( CaptureSession &session, IStorage *input,
+  Pipeline *pipeline, unsigned interval )
+{
+	session.startCapture( input, interval );
+	/* The analyses need all the window stored. */
+	if ( pipeline )
+		pipeline->drain();
 }
@@ -0,0 +1,316 @@
+/*
+ * This file is part of the DNS traffic analyser project.
+ *
+ * Copyright (C) 2011 CZ.NIC, z.s.p.o.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <arpa/inet.h>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+#include "CompositePolicy.h"
+#include "QueryNamePolicy.h"
+#include "dns/PacketParser.h"
+#include "hash/UniversalHashSystem.h"
+#include "sync/Mutex.h"
+#include "sync/MutexLocker.h"
+
+const char *CompositePolicy::NAME = "Composite Policy";
+unsigned CompositePolicy::sFields =
+  FIELD_SOURCE | FIELD_QNAME | FIELD_QTYPE;
+uint64_t CompositePolicy::sIPv4Mask = ~(uint64_t) 0 << 40;
+uint64_t CompositePolicy::sIPv6Mask = ~(uint64_t) 0 << 16;
+unsigned CompositePolicy::sIPv4Prefix = 24;
+unsigned CompositePolicy::sIPv6Prefix = 48;
+
+enum {
+	NAME_BITS = 1 << 20,     /*!< @brief Bits of the filter of names. */
+	NAMES_MAX = 1 << 17,     /*!< @brief Names kept before a restart. */
+	DESCRIBED_MAX = 1 << 16  /*!< @brief Printed keys kept. */
+};
+
+/*!
+ * @brief Filter of the names in #names, a bit per fingerprint.
+ *
+ * Small enough to stay in the cache, so a name seen before costs a
+ * single test. A bit shared by two names keeps the later one out.
+ */
+static uint64_t seen[NAME_BITS / 64];
+
+/*! @brief Names by fingerprint. */
+typedef ::std::map<uint64_t, ::std::string> Names;
+static Names names;
+static Mutex namesGuard;
+
+/*! @brief Keys printed so far and their text. */
+typedef ::std::map<CompositeKey, ::std::string> Described;
+static Described described;
+static Mutex describedGuard;
+
+/*!
+ * @brief Keeps the text of a name not seen before.
+ * @param name Fingerprint of the name.
+ * @param text The name.
+ * @param length Characters of the name.
+ *
+ * The name is skipped if another thread is adding one, it is kept when
+ * seen again. All the names are dropped when there are too many.
+ */
+static void remember( uint64_t name, const char *text, size_t length )
+{
+	const unsigned bit = (name >> 16) & (NAME_BITS - 1);
+	const uint64_t mask = (uint64_t) 1 << bit % 64;
+	if (__atomic_load_n( &seen[bit / 64], __ATOMIC_RELAXED ) & mask)
+		{ return; }
+
+	/* nonzero if busy */
+	if (namesGuard.trylock())
+		{ return; }
+	if (names.size() >= NAMES_MAX) {
+		names.clear();
+		for (unsigned i = 0; i < NAME_BITS / 64; ++i)
+			{ __atomic_store_n( &seen[i], 0, __ATOMIC_RELAXED ); }
+	}
+	names[name].assign( text, length );
+	__atomic_fetch_or( &seen[bit / 64], mask, __ATOMIC_RELAXED );
+	namesGuard.unlock();
+}
+
+/*!
+ * @brief Looks a name up.
+ * @param name Fingerprint of the name.
+ * @param text Receives the name.
+ * @return False if the name is not kept.
+ */
+static bool recall( uint64_t name, ::std::string &text )
+{
+	MutexLocker lock( namesGuard );
+	const Names::const_iterator found = names.find( name );
+	if (found == names.end())
+		{ return false; }
+	text = found->second;
+	return true;
+}
+
+/*! @brief Mnemonic of the common query types, RFC 3597 for others. */
+static void print_qtype( ::std::ostream &stream, unsigned qtype )
+{
+	static const struct { unsigned type; const char *name; } types[] = {
+		{ 1, "A" }, { 2, "NS" }, { 5, "CNAME" }, { 6, "SOA" },
+		{ 12, "PTR" }, { 15, "MX" }, { 16, "TXT" }, { 28, "AAAA" },
+		{ 33, "SRV" }, { 35, "NAPTR" }, { 43, "DS" }, { 46, "RRSIG" },
+		{ 47, "NSEC" }, { 48, "DNSKEY" }, { 50, "NSEC3" },
+		{ 64, "SVCB" }, { 65, "HTTPS" }, { 252, "AXFR" },
+		{ 255, "ANY" }, { 257, "CAA" }
+	};
+	for (size_t i = 0; i < sizeof( types ) / sizeof( types[0] ); ++i) {
+		if (types[i].type == qtype) {
+			stream << types[i].name;
+			return;
+		}
+	}
+	stream << "TYPE" << qtype;
+}
+/* ------------------------------------------------------------------------- */
+::std::ostream & operator << ( ::std::ostream &stream,
+  const CompositeKey &key )
+{
+	return stream << CompositePolicy::describe( key );
+}
+/* ------------------------------------------------------------------------- */
+/*!
+ * @brief Parses a prefix length following an address field.
+ * @param text Rest of the field, past the slash.
+ * @param max Longest prefix allowed.
+ * @param prefix Receives the length.
+ * @return Position past the length, NULL if it is not valid.
+ */
+static const char * parse_prefix( const char *text, unsigned max,
+  unsigned &prefix )
+{
+	char *end;
+	const unsigned long length = strtoul( text, &end, 10 );
+	if (end == text || length > max)
+		{ return NULL; }
+	prefix = length;
+	return end;
+}
+/* ------------------------------------------------------------------------- */
+bool CompositePolicy::configure( const char *fields )
+{
+	unsigned used = 0;
+	unsigned ipv4 = sIPv4Prefix, ipv6 = sIPv6Prefix;
+
+	::std::string list( fields );
+	size_t begin = 0;
+	bool ok = !list.empty();
+	while (ok && begin <= list.size()) {
+		size_t end = list.find( ',', begin );
+		if (end == ::std::string::npos)
+			{ end = list.size(); }
+		const ::std::string field = list.substr( begin, end - begin );
+		begin = end + 1;
+
+		const size_t slash = field.find( '/' );
+		const ::std::string name = field.substr( 0, slash );
+		unsigned flag = 0;
+		if (name == "src")
+			{ flag = FIELD_SOURCE; }
+		else if (name == "dst")
+			{ flag = FIELD_DESTINATION; }
+		else if (name == "qname")
+			{ flag = FIELD_QNAME; }
+		else if (name == "qtype")
+			{ flag = FIELD_QTYPE; }
+		ok = flag && !(used & flag);
+		used |= flag;
+
+		/* prefix lengths of the addresses: /<IPv4>[/<IPv6>] */
+		if (!ok || slash == ::std::string::npos)
+			{ continue; }
+		const char *rest = field.c_str() + slash + 1;
+		ok = (flag & (FIELD_SOURCE | FIELD_DESTINATION))
+		  && (rest = parse_prefix( rest, IPV4_PREFIX_MAX, ipv4 ));
+		if (ok && *rest == '/') {
+			rest = parse_prefix( rest + 1, IPV6_PREFIX_MAX, ipv6 );
+			ok = rest;
+		}
+		ok = ok && *rest == '\0';
+	}
+	/* a single address is kept */
+	ok = ok && (used & (FIELD_SOURCE | FIELD_DESTINATION))
+	  != (FIELD_SOURCE | FIELD_DESTINATION);
+
+	if (!ok) {
+		::std::cerr << "Invalid composite key " << fields << ::std::endl;
+		return false;
+	}
+
+	sFields = used;
+	sIPv4Prefix = ipv4;
+	sIPv6Prefix = ipv6;
+	sIPv4Mask = ipv4 ? ~(uint64_t) 0 << (64 - ipv4) : 0;
+	sIPv6Mask = ipv6 ? ~(uint64_t) 0 << (64 - ipv6) : 0;
+	return true;
+}
+/* ------------------------------------------------------------------------- */
+CompositePolicy::id_t CompositePolicy::parseIdentifier(
+  const PacketRecord &record, const char *data )
+{
+	const id_t invalid = { 0, 0 };
+	id_t key = { CompositeKey::VALID, 0 };
+
+	if (sFields & (FIELD_SOURCE | FIELD_DESTINATION)) {
+		const unsigned char *address = sFields & FIELD_SOURCE
+		  ? record.source : record.destination;
+		uint64_t bits;
+		if (record.family == 4) {
+			uint32_t ipv4;
+			memcpy( &ipv4, address, sizeof( ipv4 ) );
+			bits = (uint64_t) ntohl( ipv4 ) << 32 & sIPv4Mask;
+		} else if (record.family == 6) {
+			uint32_t half[2];
+			memcpy( half, address, sizeof( half ) );
+			bits = ((uint64_t) ntohl( half[0] ) << 32
+			  | ntohl( half[1] )) & sIPv6Mask;
+		} else {
+			return invalid;
+		}
+		key.address |= bits | record.family;
+	}
+
+	if (!(sFields & (FIELD_QNAME | FIELD_QTYPE)))
+		{ return key; }
+	if (!record.isQuery() || !record.has( PacketRecord::HAS_QUESTION ))
+		{ return invalid; }
+	if (sFields & FIELD_QTYPE)
+		{ key.query = record.qtype; }
+	if (sFields & FIELD_QNAME) {
+		char buffer[PacketParser::MAXDNAME];
+		const PacketParser::NameView domain = PacketParser::name(
+		  data, record, buffer, QueryNamePolicy::reducer );
+		if (!domain.length)
+			{ return invalid; }
+		uint64_t name = domain.hash & ~(uint64_t) 0xffff;
+		/* 0 stands for no name */
+		if (!name)
+			{ name = 0x10000; }
+		key.query |= name;
+		remember( name, domain.data, domain.length );
+	}
+	return key;
+}
+/* ------------------------------------------------------------------------- */
+unsigned CompositePolicy::hash( const unsigned index, const id_t &id )
+{
+	static UniversalHashSystem<CompositeKey, unsigned> hasher;
+	return hasher( index, id );
+}
+/* ------------------------------------------------------------------------- */
+::std::string CompositePolicy::describe( const id_t &id )
+{
+	MutexLocker lock( describedGuard );
+	const Described::const_iterator known = described.find( id );
+	if (known != described.end())
+		{ return known->second; }
+
+	::std::ostringstream text;
+	const char *separator = "";
+	bool complete = true;
+	if (id.family()) {
+		/* the prefix bits back in network order */
+		unsigned char address[PacketRecord::ADDRESS_SIZE] = { 0 };
+		const uint64_t bits = id.address & ~(uint64_t) 0xff;
+		for (unsigned i = 0; i < 8; ++i)
+			{ address[i] = bits >> (56 - 8 * i); }
+		const int family = id.family() == 4 ? AF_INET : AF_INET6;
+		char printed[INET6_ADDRSTRLEN];
+		inet_ntop( family, address, printed, sizeof( printed ) );
+		text << printed << "/"
+		  << (id.family() == 4 ? sIPv4Prefix : sIPv6Prefix);
+		separator = " ";
+	}
+	if (sFields & FIELD_QNAME) {
+		::std::string name;
+		complete = recall( id.name(), name );
+		text << separator;
+		if (complete) {
+			text << name;
+		} else {
+			text << "#" << ::std::hex << (id.name() >> 16)
+			  << ::std::dec;
+		}
+		separator = " ";
+	}
+	if (sFields & FIELD_QTYPE) {
+		text << separator;
+		print_qtype( text, id.qtype() );
+	}
+
+	/* a name may still turn up while the key is reported */
+	if (complete) {
+		if (described.size() >= DESCRIBED_MAX)
+			{ described.clear(); }
+		described[id] = text.str();
+	}
+	return text.str();
+}
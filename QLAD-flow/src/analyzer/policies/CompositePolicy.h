@@ -0,0 +1,177 @@
+/*
+ * This file is part of the DNS traffic analyser project.
+ *
+ * Copyright (C) 2011 CZ.NIC, z.s.p.o.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <ostream>
+#include <stdint.h>
+#include <string>
+
+#include "policies/PacketRecord.h"
+
+/*!
+ * @struct CompositeKey CompositePolicy.h "policies/CompositePolicy.h"
+ * @brief Fixed-width identifier of several packet fields.
+ *
+ * The address prefix is kept as it is, left-aligned in #address with
+ * the IP version in the low byte. The query name is kept as the top 48
+ * bits of its hash next to the query type in #query. Fields not used by
+ * the policy are zero.
+ */
+struct CompositeKey
+{
+	enum {
+		VALID = 0x80,       /*!< @brief Set in #address if identified. */
+		FAMILY_MASK = 0x0f  /*!< @brief IP version in #address. */
+	};
+
+	uint64_t address;  /*!< @brief Prefix bits, VALID and IP version. */
+	uint64_t query;    /*!< @brief Name fingerprint and query type. */
+
+	/*! @brief Order of the flows, integer comparisons only. */
+	bool operator < ( const CompositeKey &other ) const
+	{
+		return address < other.address
+		  || (address == other.address && query < other.query);
+	}
+
+	bool operator == ( const CompositeKey &other ) const
+		{ return address == other.address && query == other.query; }
+
+	bool operator != ( const CompositeKey &other ) const
+		{ return !(*this == other); }
+
+	/*! @brief IP version of the prefix, 0 if none is kept. */
+	unsigned family() const
+		{ return address & FAMILY_MASK; }
+
+	/*! @brief Fingerprint of the query name, 0 if none is kept. */
+	uint64_t name() const
+		{ return query & ~(uint64_t) 0xffff; }
+
+	/*! @brief Query type. */
+	unsigned qtype() const
+		{ return query & 0xffff; }
+};
+
+/*!
+ * @brief ::std::ostream operator for formatted output.
+ * @param stream Output stream
+ * @param key Key to print
+ * @return ::std::ostream used
+ *
+ * Outputs the used fields separated by spaces, e.g.
+ * "192.0.2.0/24 example.com. A", see CompositePolicy::describe().
+ */
+::std::ostream & operator << ( ::std::ostream &stream,
+  const CompositeKey &key );
+
+/*!
+ * @struct CompositePolicy CompositePolicy.h "policies/CompositePolicy.h"
+ * @brief Policy class around a tuple of packet fields.
+ *
+ * Identifies the packets by any of the prefix of the source or
+ * destination address, the query name kept by QueryNamePolicy::reducer
+ * and the query type, e.g. to tell a resolver that suddenly floods a
+ * domain. The tuple is reduced to a CompositeKey, so the flows are
+ * stored, hashed and compared as two integers.
+ *
+ * The names cannot be recovered from the key. The parser keeps the text
+ * of every name once, behind a bit filter tested per packet, and drops
+ * them all when there are too many. Only the keys that are printed,
+ * i.e. the anomalous ones, get their text copied into a dictionary of
+ * their own. A name missing from both is printed as its fingerprint.
+ */
+struct CompositePolicy
+{
+	static const char *NAME; /*!< @brief Human readable name of the policy */
+	typedef CompositeKey id_t; /*!< @brief Identified by a fingerprint */
+	/*! @brief Addresses of any packet, names and types of queries. */
+	static const unsigned NEED =
+	  PacketRecord::NEED_ADDRESSES | PacketRecord::NEED_QUERIES;
+
+	/*! @brief Fields of the key. */
+	enum Field {
+		FIELD_SOURCE = 1,       /*!< @brief Source address prefix. */
+		FIELD_DESTINATION = 2,  /*!< @brief Destination prefix. */
+		FIELD_QNAME = 4,        /*!< @brief Reduced query name. */
+		FIELD_QTYPE = 8         /*!< @brief Query type. */
+	};
+
+	enum {
+		IPV4_PREFIX_MAX = 32, /*!< @brief Longest IPv4 prefix. */
+		IPV6_PREFIX_MAX = 56  /*!< @brief Longest IPv6 prefix kept. */
+	};
+
+	/*!
+	 * @brief Selects the fields of the key, before the capture.
+	 * @param fields Comma separated list of src, dst, qname and qtype.
+	 * An address may be followed by its IPv4 and IPv6 prefix lengths,
+	 * e.g. "src/24/48,qname,qtype".
+	 * @return False if the list is not valid.
+	 */
+	static bool configure( const char *fields );
+
+	/*!
+	 * @brief Takes the key of a packet.
+	 * @param record Record decoded from the packet
+	 * @param data Packet data holding the name
+	 * @return Key of the fields selected by configure(), invalid if a
+	 * name or type is used and the packet is not a query or the name
+	 * has no identifier.
+	 */
+	static id_t parseIdentifier( const PacketRecord &record,
+	  const char *data );
+
+	/*!
+	 * @brief Various hash functions that use the key
+	 * @param index Hash function to use
+	 * @param identifier Key that will be hashed.
+	 * @return Hashed value of the key, table lookups only
+	 */
+	static unsigned hash( const unsigned index, const id_t &identifier );
+
+	/*!
+	 * @brief Tests identifier for validity.
+	 * @param identifier Key.
+	 * @return True for the keys of identified packets.
+	 */
+	static bool isValid( const id_t &identifier )
+		{ return identifier.address & CompositeKey::VALID; }
+
+	/*!
+	 * @brief Text of a key.
+	 * @param identifier Key to describe.
+	 * @return The used fields separated by spaces.
+	 *
+	 * Copies the name of the key into the dictionary of printed keys,
+	 * so it is kept for as long as the key is reported.
+	 */
+	static ::std::string describe( const id_t &identifier );
+
+private:
+	static unsigned sFields;      /*!< @brief Field values or-ed. */
+	static uint64_t sIPv4Mask;    /*!< @brief Left-aligned IPv4 mask. */
+	static uint64_t sIPv6Mask;    /*!< @brief Left-aligned IPv6 mask. */
+	static unsigned sIPv4Prefix;  /*!< @brief IPv4 prefix length. */
+	static unsigned sIPv6Prefix;  /*!< @brief IPv6 prefix length. */
+};
@@ -22,6 +22,8 @@
 #include "config.h"
 #endif
 
+#include "policies/PacketRecord.h"
+
 #ifdef NO_IPV6
 #include "ip/IPv4Address.h"
 typedef IPv4Address IPAddress;   /*!< @brief IPv4 address type */
@@ -35,7 +37,7 @@ typedef IPv4Address IPAddress;   /*!< @brief IPv4 address type */
  *
  * Provides:
  *  - id_t type that stores IP address
- *  - parsing function parseIdentifier that creates id_t from packet data
+ *  - parseIdentifier that takes id_t out of a PacketRecord
  *  - hash functions for IP address
  *  - validity check for parsed identifiers
  */
@@ -43,14 +45,17 @@ struct SrcIPPolicy
 {
 	static const char *NAME; /*!< @brief Human readable name of the policy */
 	typedef IPAddress id_t;  /*!< @brief Identified by IP address          */
+	/*! @brief Any IP packet counts. */
+	static const unsigned NEED = PacketRecord::NEED_ADDRESSES;
 
 	/*!
-	 * @brief Parses packet for IPv4 or IPv6 source address.
-	 * @param data Packet data
-	 * @param size Packet size
+	 * @brief Takes the IPv4 or IPv6 source address of a packet.
+	 * @param record Record decoded from the packet
+	 * @param data Packet data, not needed
 	 * @return Source IP address of the packet
 	 */
-	static id_t parseIdentifier( const char *data, const size_t size );
+	static id_t parseIdentifier( const PacketRecord &record,
+	  const char *data );
 
 	/*!
 	 * @brief Various hash functions that use IP address
@@ -71,7 +76,7 @@ struct SrcIPPolicy
  *
  * Provides:
  *  - id_t type that stores IP address
- *  - parsing function parseIdentifier that creates id_t from packet data
+ *  - parseIdentifier that takes id_t out of a PacketRecord
  *  - hash functions for IP address
  *  - validity check for parsed identifiers
  */
@@ -79,14 +84,17 @@ struct DstIPPolicy
 {
 	static const char *NAME;   /*!< @brief Human readable name of the policy */
 	typedef IPAddress id_t;    /*!< @brief Identified by IP address          */
+	/*! @brief Any IP packet counts. */
+	static const unsigned NEED = PacketRecord::NEED_ADDRESSES;
 
 	/*!
-	 * @brief Parses packet for IPv4 or IPv6 destination address.
-	 * @param data Packet data
-	 * @param size Packet size
+	 * @brief Takes the IPv4 or IPv6 destination address of a packet.
+	 * @param record Record decoded from the packet
+	 * @param data Packet data, not needed
 	 * @return Destination IP address of the packet
 	 */
-	static id_t parseIdentifier( const char *data, const size_t size );
+	static id_t parseIdentifier( const PacketRecord &record,
+	  const char *data );
 
 	/*!
 	 * @brief Various hash functions that use IP address
@@ -16,43 +16,31 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+
+#pragma once
+
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
 
-#include <pcap.h>
-
 /*!
- * @brief Link header length table.
+ * @struct MessageRecord MessageRecord.h "policies/MessageRecord.h"
+ * @brief Addresses of a DNS message received without its packet.
  *
- * See pcap manpage about link types.
+ * Precedes the DNS message in the data of IStorage::DNS_MESSAGE packet
+ * views. Made of bytes only, so the message following it keeps the
+ * alignment of the record.
  */
-const unsigned char IPOffsetTable[] =
+struct MessageRecord
 {
-	[DLT_LOOP] = 4,
-	[DLT_NULL] = 4,    /* BSD LoopBack       */
-	[DLT_EN10MB] = 14, /* EthernetII, I hope */
-	[DLT_RAW] = 0,     /* RAW IP             */
-	[DLT_PFLOG] = 28,  /* BSD pflog          */
-/*  NOT YET SUPPORTED
-	[DLT_IEEE802] =
-	[DLT_ARCNET] =
-	[DLT_SLIP] =
-	[DLT_PPP] =
-	[DLT_FDDI] =
-	[DLT_ATM_RFC1483] =
-	[DLT_PPP_SERIAL] =
-	[DLT_PPP_ETHER] =
-	[DLT_C_HDLC] =
-	[DLT_IEEE802_11] =
-	[DLT_FRELAY] =
-	[DLT_LINUX_SLL] =
-	[DLT_LTALK] =
-	[DLT_PRISM_HEADER] =
-	[DLT_IP_OVER_FC] =
-	[DLT_SUNATM] =
-	[DLT_IEEE802_11_RADIO] =
-	[DLT_ARCNET_LINUX] =
-	[DLT_LINUX_IRDA] =
-*/
+	enum {
+		ADDRESS_SIZE = 16  /*!< @brief Room for an IPv6 address. */
+	};
+
+	unsigned char family;   /*!< @brief IP version, 4 or 6. */
+	unsigned char reserved; /*!< @brief Keeps the message aligned. */
+	/*! @brief Address of the sender, network byte order. */
+	unsigned char source[ADDRESS_SIZE];
+	/*! @brief Address of the receiver, network byte order. */
+	unsigned char destination[ADDRESS_SIZE];
 };
@@ -0,0 +1,177 @@
+/*
+ * This file is part of the DNS traffic analyser project.
+ *
+ * Copyright (C) 2011 CZ.NIC, z.s.p.o.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+
+/*!
+ * @struct PacketRecord PacketRecord.h "policies/PacketRecord.h"
+ * @brief Fields of a DNS packet, decoded once for all the policies.
+ *
+ * Filled by PacketParser from a packet or a DNS message received without
+ * its packet. The policies only project their identifier out of it. The
+ * query name stays in the packet data, the record holds its position.
+ * Fits into a cache line.
+ */
+struct PacketRecord
+{
+	enum {
+		ADDRESS_SIZE = 16  /*!< @brief Room for an IPv6 address. */
+	};
+
+	/*!
+	 * @brief What a policy takes out of the records, or-ed together
+	 * for several policies.
+	 */
+	enum Need {
+		NEED_ADDRESSES = 1,  /*!< @brief Addresses of every packet. */
+		NEED_QUERIES = 2,    /*!< @brief DNS queries. */
+		NEED_DNS = 4         /*!< @brief Any DNS message. */
+	};
+
+	/*!
+	 * @brief Why the packet could not be decoded, PacketParser stops
+	 * at the first reason. The reasons from FAIL_MALFORMED on are
+	 * those of packets to or from port 53 that are not valid DNS.
+	 */
+	enum Failure {
+		FAIL_NONE = 0,          /*!< @brief Decoded as far as needed. */
+		FAIL_SKIPPED,           /*!< @brief Not needed by any policy. */
+		FAIL_NOT_QUERY,         /*!< @brief DNS response. */
+		FAIL_QUERY_FLAGS,       /*!< @brief Query with an odd opcode,
+		                            flag or response code. */
+		FAIL_MESSAGE_TRUNCATED, /*!< @brief MessageRecord cut off. */
+		FAIL_FRAGMENT,          /*!< @brief IP fragment. */
+		FAIL_NOT_UDP,           /*!< @brief Other transport. */
+		FAIL_UDP_TRUNCATED,     /*!< @brief UDP header cut off. */
+		FAIL_NOT_DNS,           /*!< @brief Neither port is 53. */
+		FAIL_DNS_TRUNCATED,     /*!< @brief DNS header cut off. */
+		FAIL_NO_QUESTION,       /*!< @brief QDCOUNT is 0. */
+		FAIL_NAME_TRUNCATED,    /*!< @brief Query name cut off. */
+		FAIL_NAME_COMPRESSED,   /*!< @brief Pointer or bit label. */
+		FAIL_NAME_TOO_LONG,     /*!< @brief Over MAXDNAME. */
+		FAILURE_COUNT,
+		FAIL_MALFORMED = FAIL_DNS_TRUNCATED
+	};
+
+	/*! @brief Parts of the packet that were decoded. */
+	enum Status {
+		HAS_DNS = 1,       /*!< @brief DNS header, dns_flags are set. */
+		HAS_QUESTION = 2   /*!< @brief Valid query name. */
+	};
+
+	/*! @brief Address of the sender, network byte order. */
+	unsigned char source[ADDRESS_SIZE];
+	/*! @brief Address of the receiver, network byte order. */
+	unsigned char destination[ADDRESS_SIZE];
+	uint16_t length;           /*!< @brief IP packet or message size. */
+	uint16_t source_port;      /*!< @brief UDP source port. */
+	uint16_t destination_port; /*!< @brief UDP destination port. */
+	uint16_t dns_flags;        /*!< @brief Second word of the DNS
+	                               header, host byte order. */
+	uint16_t qtype;            /*!< @brief Type of the first question. */
+	uint16_t qclass;           /*!< @brief Class of the first question. */
+	uint16_t name_offset;      /*!< @brief Query name in wire format,
+	                               offset into the packet data. */
+	uint16_t name_length;      /*!< @brief Bytes of the query name, the
+	                               root label included. */
+	uint8_t family;            /*!< @brief IP version, 4 or 6. */
+	uint8_t protocol;          /*!< @brief IPPROTO_* of the transport. */
+	uint8_t status;            /*!< @brief Status flags. */
+	uint8_t failure;           /*!< @brief Failure, FAIL_NONE if the
+	                               packet was decoded. */
+
+	/*! @brief Tests the status flag. */
+	bool has( Status flag ) const
+		{ return status & flag; }
+
+	/*! @brief Response code of the DNS message. */
+	unsigned rcode() const
+		{ return dns_flags & 0x000f; }
+
+	/*!
+	 * @brief Tests for a plain query: no response, standard opcode and
+	 * none of the AA, TC, RA, Z flags or a response code.
+	 */
+	bool isQuery() const
+		{ return has( HAS_DNS ) && !(dns_flags & 0xfecf); }
+
+	/*!
+	 * @brief Reason a policy took no identifier from the packet. A DNS
+	 * message decoded without failure that is not a plain query is
+	 * told apart by its QR flag.
+	 */
+	unsigned discardReason() const
+	{
+		if (failure != FAIL_NONE || !has( HAS_DNS ) || isQuery())
+			return failure;
+		return (dns_flags & 0x8000) ? FAIL_NOT_QUERY : FAIL_QUERY_FLAGS;
+	}
+};
+
+/*!
+ * @struct FailureCounts PacketRecord.h "policies/PacketRecord.h"
+ * @brief Packets a policy took no identifier from, by their
+ * PacketRecord::Failure.
+ *
+ * Packets decoded without a failure but still without an identifier
+ * are counted under PacketRecord::discardReason(), e.g. responses for a
+ * query policy under FAIL_NOT_QUERY.
+ */
+struct FailureCounts
+{
+	uint64_t packets;  /*!< @brief All the packets seen. */
+	/*! @brief Packets discarded for each reason. */
+	uint64_t discarded[PacketRecord::FAILURE_COUNT];
+
+	/*! @brief Creates zero counts. */
+	FailureCounts()
+		{ clear(); }
+
+	/*! @brief Resets the counts. */
+	void clear()
+	{
+		packets = 0;
+		for (unsigned i = 0; i < PacketRecord::FAILURE_COUNT; ++i)
+			{ discarded[i] = 0; }
+	}
+
+	/*! @brief Adds the counts of another. */
+	FailureCounts & operator += ( const FailureCounts &other )
+	{
+		packets += other.packets;
+		for (unsigned i = 0; i < PacketRecord::FAILURE_COUNT; ++i)
+			{ discarded[i] += other.discarded[i]; }
+		return *this;
+	}
+
+	/*! @brief Sum of all the discarded packets. */
+	uint64_t total() const
+	{
+		uint64_t sum = 0;
+		for (unsigned i = 0; i < PacketRecord::FAILURE_COUNT; ++i)
+			{ sum += discarded[i]; }
+		return sum;
+	}
+};
@@ -20,18 +20,25 @@
 #include "config.h"
 #endif
 
-#include <cassert>
-
 #include "QueryNamePolicy.h"
 #include "dns/PacketParser.h"
 #include "hash/UniversalVectorHash.h"
 
 const char *QueryNamePolicy::NAME = "Query Name Policy";
+NameReducer QueryNamePolicy::reducer;
 
 QueryNamePolicy::id_t
-QueryNamePolicy::parseIdentifier( const char *data, const size_t length )
+QueryNamePolicy::parseIdentifier( const PacketRecord &record,
+  const char *data )
 {
-	return PacketParser()( (const u_char *) data, length );
+	if ( !record.isQuery() || !record.has( PacketRecord::HAS_QUESTION ) )
+		return id_t();
+
+	/* short domains fit into the string without an allocation */
+	char buffer[PacketParser::MAXDNAME];
+	const PacketParser::NameView domain =
+	  PacketParser::name( data, record, buffer, reducer );
+	return id_t( domain.data, domain.length );
 }
 
 unsigned QueryNamePolicy::hash( const unsigned index, const id_t &id )
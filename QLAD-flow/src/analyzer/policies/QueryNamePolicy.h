@@ -28,28 +28,38 @@
 
 #include <string>
 
+#include "policies/PacketRecord.h"
+#include "policies/dns/NameReducer.h"
+
 /*!
  * @struct QueryNamePolicy QueryNamePolicy.h "QueryNamePolicy.h"
  * @brief Policy class around DNS query name.
  *
  * Provides:
  *  - id_t type that stores a query name
- *  - parsing function parseIdentifier that creates id_t from packet data
+ *  - parseIdentifier that takes id_t out of a PacketRecord
  *  - hash functions for query names
  */
 struct QueryNamePolicy
 {
 	static const char *NAME; /*!< @brief Human readable name of the policy */
 	typedef ::std::string id_t; /*!< @brief Identified by a query name */
+	/*! @brief Only queries have an identifier. */
+	static const unsigned NEED = PacketRecord::NEED_QUERIES;
+
+	/*! @brief Labels of the names kept, set up before the capture. */
+	static NameReducer reducer;
 
 	/*!
-	 * @brief Parses packet for a query name.
-	 * @param data Packet data
-	 * @param size Packet size
-	 * @return SLD of the first query name present in the packet, empty string if
-	 * none can be parsed.
+	 * @brief Takes the query name of a packet.
+	 * @param record Record decoded from the packet
+	 * @param data Packet data holding the name
+	 * @return Labels of the first query name present in the packet kept by
+	 * the reducer, the SLD by default; empty string if none can be parsed,
+	 * the name is too short or the packet is not a query.
 	 */
-	static id_t parseIdentifier( const char *data, const size_t size );
+	static id_t parseIdentifier( const PacketRecord &record,
+	  const char *data );
 
 	/*!
 	 * @brief Various hash functions that use a query name
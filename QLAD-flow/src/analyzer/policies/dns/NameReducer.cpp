@@ -0,0 +1,297 @@
+/*
+ * This file is part of the DNS traffic analyser project.
+ *
+ * Copyright (C) 2011 CZ.NIC, z.s.p.o.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+
+#include "NameReducer.h"
+
+/*! @brief ASCII lower case, other bytes unchanged. */
+static inline char lower( unsigned char c )
+{
+	return c >= 'A' && c <= 'Z' ? c + ( 'a' - 'A' ) : c;
+}
+
+/*!
+ * @brief Order of the labels among their siblings: shorter first, most
+ * of them are told apart by the length alone.
+ */
+static inline int compare( const char *a, size_t a_length, const char *b,
+  size_t b_length )
+{
+	if (a_length != b_length)
+		{ return a_length < b_length ? -1 : 1; }
+	return memcmp( a, b, a_length );
+}
+
+/*! @brief The order of compare() for the maps of labels. */
+struct LabelOrder {
+	bool operator ()( const ::std::string &a, const ::std::string &b ) const
+		{ return compare( a.data(), a.size(), b.data(), b.size() ) < 0; }
+};
+
+/*! @brief Trie node while the list is loaded. */
+struct Builder {
+	/*! @brief Indexes of the children by their labels. */
+	typedef ::std::map< ::std::string, size_t, LabelOrder > Children;
+
+	Children children; /*!< @brief Children of the node. */
+	uint8_t flags;     /*!< @brief NameReducer::Flags of the node. */
+
+	Builder(): flags( 0 ) {}
+};
+
+/* ------------------------------------------------------------------------- */
+/*! @brief Bias adaptation of RFC 3492. */
+static unsigned adapt( unsigned delta, unsigned points, bool first )
+{
+	delta = first ? delta / 700 : delta / 2;
+	delta += delta / points;
+	unsigned k = 0;
+	for (; delta > ((36 - 1) * 26) / 2; k += 36)
+		{ delta /= 36 - 1; }
+	return k + (36 - 1 + 1) * delta / (delta + 38);
+}
+/* ------------------------------------------------------------------------- */
+/*! @brief Punycode digit. */
+static inline char digit( unsigned d )
+{
+	return d < 26 ? 'a' + d : '0' + d - 26;
+}
+/* ------------------------------------------------------------------------- */
+bool NameReducer::toAscii( const ::std::string &label, ::std::string &ascii )
+{
+	ascii.clear();
+	::std::vector<uint32_t> points;
+	for (size_t i = 0; i < label.size();) {
+		const unsigned char c = label[i];
+		unsigned length = c < 0x80 ? 1 : c >> 5 == 6 ? 2
+		  : c >> 4 == 14 ? 3 : c >> 3 == 30 ? 4 : 0;
+		if (length == 0 || i + length > label.size())
+			{ return false; }
+		uint32_t point = length == 1 ? c : c & ( 0x7f >> length );
+		for (unsigned j = 1; j < length; ++j) {
+			const unsigned char next = label[i + j];
+			if (next >> 6 != 2)
+				{ return false; }
+			point = point << 6 | ( next & 0x3f );
+		}
+		points.push_back( length == 1 ? lower( point ) : point );
+		i += length;
+	}
+
+	/* the basic code points first, then the others encoded as deltas
+	 * (RFC 3492) */
+	for (size_t i = 0; i < points.size(); ++i) {
+		if (points[i] < 0x80)
+			{ ascii.push_back( (char) points[i] ); }
+	}
+	const unsigned basic = ascii.size();
+	if (basic == points.size())
+		{ return true; }
+	if (basic)
+		{ ascii.push_back( '-' ); }
+
+	uint32_t n = 0x80;
+	unsigned delta = 0, bias = 72;
+	for (unsigned handled = basic; handled < points.size(); ++delta, ++n) {
+		uint32_t next = UINT32_MAX;
+		for (size_t i = 0; i < points.size(); ++i) {
+			if (points[i] >= n)
+				{ next = ::std::min( next, points[i] ); }
+		}
+		delta += ( next - n ) * ( handled + 1 );
+		n = next;
+
+		for (size_t i = 0; i < points.size(); ++i) {
+			if (points[i] < n)
+				{ ++delta; }
+			if (points[i] != n)
+				{ continue; }
+			unsigned q = delta;
+			for (unsigned k = 36;; k += 36) {
+				const unsigned t = k <= bias ? 1
+				  : k >= bias + 26 ? 26 : k - bias;
+				if (q < t)
+					{ break; }
+				ascii.push_back( digit( t + ( q - t ) % ( 36 - t ) ) );
+				q = ( q - t ) / ( 36 - t );
+			}
+			ascii.push_back( digit( q ) );
+			bias = adapt( delta, handled + 1, handled == basic );
+			delta = 0;
+			++handled;
+		}
+	}
+	ascii.insert( 0, "xn--" );
+	return true;
+}
+/* ------------------------------------------------------------------------- */
+bool NameReducer::loadSuffixes( const char *path )
+{
+	assert( path );
+
+	::std::ifstream file( path );
+	if (!file) {
+		::std::cerr << "Cannot read public suffix list " << path
+		  << ::std::endl;
+		return false;
+	}
+
+	/* the trie is grown in maps first, then laid out level by level */
+	::std::vector<Builder> tree( 1 );
+	size_t rules = 0;
+
+	::std::string line;
+	while (::std::getline( file, line )) {
+		/* the rule is the first word, comments start by // */
+		const size_t begin = line.find_first_not_of( " \t\r" );
+		if (begin == ::std::string::npos
+		  || line.compare( begin, 2, "//" ) == 0)
+			{ continue; }
+		const size_t end = line.find_first_of( " \t\r", begin );
+		::std::string rule = line.substr( begin, end - begin );
+		uint8_t flag = RULE;
+		if (rule[0] == '!')
+			{ flag = EXCEPTION; rule.erase( 0, 1 ); }
+
+		size_t node = 0;
+		size_t right = rule.size();
+		bool valid = !rule.empty();
+		while (valid && right != 0) {
+			const size_t dot = rule.rfind( '.', right - 1 );
+			const size_t left = dot == ::std::string::npos ? 0 : dot + 1;
+			const ::std::string label = rule.substr( left, right - left );
+			right = dot == ::std::string::npos ? 0 : dot;
+
+			if (label == "*" && right == 0) {
+				flag = WILDCARD;
+				break;
+			}
+			::std::string ascii;
+			valid = toAscii( label, ascii ) && !ascii.empty()
+			  && ascii.size() < 64;
+			if (!valid)
+				{ break; }
+
+			const Builder::Children::iterator child =
+			  tree[node].children.find( ascii );
+			if (child == tree[node].children.end()) {
+				tree[node].children[ascii] = tree.size();
+				tree.push_back( Builder() );
+				node = tree.size() - 1;
+			} else {
+				node = child->second;
+			}
+		}
+		if (valid) {
+			tree[node].flags |= flag;
+			++rules;
+		}
+	}
+
+	if (!rules) {
+		::std::cerr << "No rules in public suffix list " << path
+		  << ::std::endl;
+		return false;
+	}
+
+	mNodes.assign( 1, Node() );
+	mText.clear();
+	::std::vector<size_t> order( 1, 0 );
+	for (size_t i = 0; i < order.size(); ++i) {
+		const Builder &builder = tree[order[i]];
+		assert( builder.children.size() <= UINT16_MAX );
+		mNodes[i].flags = builder.flags;
+		mNodes[i].first = mNodes.size();
+		mNodes[i].children = builder.children.size();
+
+		for (Builder::Children::const_iterator child =
+		  builder.children.begin(); child != builder.children.end();
+		  ++child) {
+			Node node = Node();
+			node.label = mText.size();
+			node.length = child->first.size();
+			mText += child->first;
+			mNodes.push_back( node );
+			order.push_back( child->second );
+		}
+	}
+	return true;
+}
+/* ------------------------------------------------------------------------- */
+unsigned NameReducer::keep( const unsigned char *wire,
+  const uint8_t *labels, unsigned count ) const
+{
+	if (count == 0)
+		{ return 0; }
+
+	/* the rule with most labels prevails, an exception over all, and
+	 * the last label is a suffix without a rule */
+	unsigned suffix = 1;
+	const Node *node = mNodes.empty() ? NULL : &mNodes[0];
+	for (unsigned depth = 1; node && depth <= count; ++depth) {
+		if (node->flags & WILDCARD)
+			{ suffix = depth; }
+
+		const unsigned char *label = wire + labels[count - depth];
+		char text[64];
+		for (unsigned i = 0; i < label[0]; ++i)
+			{ text[i] = lower( label[i + 1] ); }
+
+		node = find( *node, text, label[0] );
+		if (node && node->flags & EXCEPTION) {
+			suffix = depth - 1;
+			break;
+		}
+		if (node && node->flags & RULE)
+			{ suffix = depth; }
+	}
+
+	const unsigned below = mLabels ? mLabels - 1 : 0;
+	if (below && count <= suffix)
+		{ return 0; }
+	return ::std::min( count, suffix + below );
+}
+/* ------------------------------------------------------------------------- */
+const NameReducer::Node * NameReducer::find( const Node &node,
+  const char *label, size_t length ) const
+{
+	const Node *first = &mNodes[node.first];
+	const Node *last = first + node.children;
+	while (first < last) {
+		const Node *middle = first + ( last - first ) / 2;
+		const int order =
+		  compare( &mText[middle->label], middle->length, label, length );
+		if (order == 0)
+			{ return middle; }
+		if (order < 0)
+			{ first = middle + 1; }
+		else
+			{ last = middle; }
+	}
+	return NULL;
+}
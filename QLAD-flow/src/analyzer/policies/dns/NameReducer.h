@@ -0,0 +1,128 @@
+/*
+ * This file is part of the DNS traffic analyser project.
+ *
+ * Copyright (C) 2011 CZ.NIC, z.s.p.o.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <cstddef>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*!
+ * @class NameReducer NameReducer.h "NameReducer.h"
+ * @brief Cuts query names down to the labels that identify them.
+ *
+ * The identifier is the public suffix of the name and a given number of
+ * labels below it. Without a public suffix list the suffix is the last
+ * label, so the default of 2 labels keeps the second level domain. With
+ * the list (https://publicsuffix.org/list/) loaded, it keeps the
+ * registrable domain, e.g. "example.co.uk." rather than "co.uk.".
+ *
+ * The list is compiled into a trie of sorted arrays when loaded. Looking
+ * up a name walks its labels from the right in the wire format, before
+ * the name is converted to text, and allocates nothing.
+ */
+class NameReducer
+{
+public:
+	enum {
+		MAXLABELS = 128 /*!< @brief Labels of the longest name. */
+	};
+
+	/*!
+	 * @brief Creates reducer without a public suffix list.
+	 * @param labels Labels to keep, the suffix counted as one.
+	 */
+	explicit NameReducer( unsigned labels = 2 ): mLabels( labels ) {}
+
+	/*! @brief Sets the labels to keep, the suffix counted as one. */
+	void setLabels( unsigned labels )
+		{ mLabels = labels; }
+
+	/*!
+	 * @brief Loads and compiles a public suffix list.
+	 * @param path File in the format of publicsuffix.org.
+	 * @return False if the file cannot be read or holds no rule.
+	 *
+	 * Rules in UTF-8 are converted to the ASCII form (punycode) found
+	 * in queries. A wildcard is only recognised as the leftmost label.
+	 */
+	bool loadSuffixes( const char *path );
+
+	/*!
+	 * @brief Number of labels the identifier of a name has.
+	 * @param wire Name in wire format.
+	 * @param labels Offsets of the labels in wire, left to right.
+	 * @param count Number of labels, the root not counted.
+	 * @return Labels to keep from the right, 0 if the name is a
+	 * public suffix itself and has no identifier.
+	 */
+	unsigned keep( const unsigned char *wire, const uint8_t *labels,
+	  unsigned count ) const;
+
+	/*!
+	 * @brief Converts a label of a rule to the form found in queries.
+	 * @param label Label in UTF-8.
+	 * @param ascii Receives the lower-case ASCII label.
+	 * @return False for labels of invalid UTF-8.
+	 */
+	static bool toAscii( const ::std::string &label, ::std::string &ascii );
+
+private:
+	/*! @brief Flags of a trie node. */
+	enum Flags {
+		RULE = 1,      /*!< @brief A rule ends at the node. */
+		EXCEPTION = 2, /*!< @brief An exception rule ends there. */
+		WILDCARD = 4   /*!< @brief A wildcard rule is below it. */
+	};
+
+	/*!
+	 * @struct Node
+	 * @brief Label of a rule, the children stored side by side.
+	 */
+	struct Node {
+		uint32_t label;    /*!< @brief Offset of the label in mText. */
+		uint32_t first;    /*!< @brief Index of the first child. */
+		uint16_t children; /*!< @brief Number of children. */
+		uint8_t length;    /*!< @brief Length of the label. */
+		uint8_t flags;     /*!< @brief Flags of the node. */
+	};
+
+	/*!
+	 * @brief Finds a child of a node.
+	 * @param node The parent.
+	 * @param label Lower-case label.
+	 * @param length Length of the label.
+	 * @return The child, NULL if there is none.
+	 */
+	const Node *find( const Node &node, const char *label,
+	  size_t length ) const;
+
+	/*! @brief Labels to keep, the suffix counted as one. */
+	unsigned mLabels;
+
+	/*! @brief Trie nodes, the root first, empty without a list. */
+	::std::vector<Node> mNodes;
+
+	/*! @brief Labels of the nodes back to back. */
+	::std::string mText;
+};
@@ -34,13 +34,14 @@
 #include <algorithm>
 #include <stdint.h>
 #include <arpa/inet.h>
-
-/* IPv4/6 headers */
-#include <netinet/ip.h>
-#ifndef NO_IPV6
-# include <netinet/ip6.h>
+#if defined( __AVX2__ )
+#include <immintrin.h>
+#elif defined( __SSE2__ )
+#include <emmintrin.h>
 #endif
 
+#include <netinet/in.h>
+
 /* UDP headers */
 #include <netinet/udp.h>
 /* This may be useful for BSD compatibility later. */
@@ -54,6 +55,8 @@
 /* DNS headers */
 #include "nameser.h"
 
+#include "policies/MessageRecord.h"
+
 
 /*
  * True if "l" bytes of "var" were captured.
@@ -66,17 +69,19 @@
 #define TTEST2(var, l) (mSnapend - (l) <= mSnapend && \
 			(const unsigned char *)&(var) <= mSnapend - (l))
 
-/* Fail if "l" bytes of "var" were not captured. */
-#define TCHECK2( var, l, str ) \
-	do { if ( !TTEST2( var, l ) ) { fail( str ); return; } } while (0)
+/* Fail for the reason if "l" bytes of "var" were not captured. */
+#define TCHECK2( var, l, reason ) \
+	do { if ( !TTEST2( var, l ) ) \
+		{ fail( PacketRecord::reason ); return; } } while (0)
 
-/* Fail if "var" was not captured. */
-#define TCHECK( var, str ) \
-	do { if ( !TTEST2( var, sizeof( var ) ) ) { fail( str ); return; } } while (0)
+/* Fail for the reason if "var" was not captured. */
+#define TCHECK( var, reason ) \
+	do { if ( !TTEST2( var, sizeof( var ) ) ) \
+		{ fail( PacketRecord::reason ); return; } } while (0)
 
-/* Fail if test is true. */
-#define FAIL_IF( test, str ) \
-	do { if ( test ) { fail( str ); return; } } while (0)
+/* Fail for the reason if test is true. */
+#define FAIL_IF( test, reason ) \
+	do { if ( test ) { fail( PacketRecord::reason ); return; } } while (0)
 
 #define BYTEOFF(type, ptr, off) ((type) ((char *) (ptr) + (off)))
 
@@ -85,111 +90,472 @@
 int PacketParser::seq = 0;
 #endif
 
-/*
- * print an IP datagram.
+const char * const PacketParser::FAILURES[PacketRecord::FAILURE_COUNT] = {
+	"no identifier",
+	"not decoded",
+	"not a query",
+	"weird query flags",
+	"message record truncated",
+	"IP fragment not reassembled",
+	"not a UDP packet",
+	"UDP header truncated",
+	"not a DNS packet",
+	"dns header truncated",
+	"no question",
+	"query name truncated",
+	"query name compression / EDNS bitlabel",
+	"query name too long"
+};
+
+/*! @brief Odd multiplier of PacketParser::hashName(), 2^64 / phi. */
+#define NAME_HASH_PRIME 0x9e3779b97f4a7c15ull
+
+/*! @brief Every byte of a 64-bit word set to b. */
+#define BYTES( b ) ( 0x0101010101010101ull * (b) )
+
+/*! @brief Lower-case ASCII letter of the byte. */
+static inline char lower1( unsigned char c )
+	{ return c + ( (unsigned) ( c - 'A' ) < 26 ) * ( 'a' - 'A' ); }
+
+/*! @brief Lower-cases the ASCII letters of 8 bytes at once. */
+static inline uint64_t lower8( uint64_t word )
+{
+	/* the top bit of each byte tells the result, no carries between
+	 * the bytes as they are 7-bit when added */
+	const uint64_t low = word & BYTES( 0x7f );
+	const uint64_t aboveZ = low + BYTES( 0x7f - 'Z' );
+	const uint64_t fromA = low + BYTES( 0x80 - 'A' );
+	const uint64_t upper = ( fromA ^ aboveZ ) & ~word & BYTES( 0x80 );
+	return word | upper >> 2;
+}
+
+#if defined( __SSE2__ )
+/*! @brief Lower-cases the ASCII letters of 16 bytes at once. */
+static inline __m128i lower16( __m128i bytes )
+{
+	/* 'A' to 'Z' are moved to the lowest signed values */
+	const __m128i moved = _mm_add_epi8( bytes,
+	  _mm_set1_epi8( (char) ( 0x80 - 'A' ) ) );
+	const __m128i upper = _mm_cmplt_epi8( moved,
+	  _mm_set1_epi8( (char) ( 0x80 + 26 ) ) );
+	return _mm_add_epi8( bytes,
+	  _mm_and_si128( upper, _mm_set1_epi8( 'a' - 'A' ) ) );
+}
+#endif
+
+#if defined( __AVX2__ )
+/*! @brief Lower-cases the ASCII letters of 32 bytes at once. */
+static inline __m256i lower32( __m256i bytes )
+{
+	const __m256i moved = _mm256_add_epi8( bytes,
+	  _mm256_set1_epi8( (char) ( 0x80 - 'A' ) ) );
+	const __m256i upper = _mm256_cmpgt_epi8(
+	  _mm256_set1_epi8( (char) ( 0x80 + 26 ) ), moved );
+	return _mm256_add_epi8( bytes,
+	  _mm256_and_si256( upper, _mm256_set1_epi8( 'a' - 'A' ) ) );
+}
+#endif
+
+/*! @brief Shift of the byte at the offset of a word read by memcpy(). */
+static inline unsigned byteShift( size_t offset )
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	return 56 - 8 * offset;
+#else
+	return 8 * offset;
+#endif
+}
+
+/*! @brief One step of PacketParser::hashName() over a word. */
+static inline uint64_t mixName( uint64_t hash, uint64_t word )
+{
+	hash = ( hash ^ word ) * NAME_HASH_PRIME;
+	return hash ^ hash >> 29;
+}
+
+/*!
+ * @brief Puts the dots in place of the label lengths of a word of the
+ * text.
+ * @param word Lower-cased bytes of the text from at on.
+ * @param at Offset of the word in the text.
+ * @param end Offset past the word, or past the text if sooner.
+ * @param src The text as it is in the wire format.
+ * @param dot Offset of the next dot, moved past the word.
  */
-void PacketParser::parseIp( const struct ip *ip )
+static inline uint64_t dots( uint64_t word, size_t at, size_t end,
+  const unsigned char *src, size_t &dot )
 {
-	TCHECK( *ip, "IP header truncated" );
+	for ( ; dot < end; dot += src[dot] + 1 ) {
+		word &= ~( (uint64_t) 0xff << byteShift( dot - at ) );
+		word |= (uint64_t) '.' << byteShift( dot - at );
+	}
+	return word;
+}
 
-	/* Is this an IPv4 or IPv6 packet? */
-	switch ( ip->ip_v ) {
-	case 4:
-		break;
-#ifndef NO_IPV6
-	case 6:
-		parseIp6( (const struct ip6_hdr *) ip);
-		return;
+/*!
+ * @brief Converts a name from the wire format to lower-case text and
+ * hashes it in the same pass.
+ * @param dst Receives the text.
+ * @param wire Length byte of the first label, the labels checked by
+ * parseDnsName().
+ * @param length Characters of the text, the final dot included.
+ * @return PacketParser::hashName() of the text.
+ *
+ * The widest step the build allows lower-cases the bytes, each of its
+ * words then gets its dots and is stored and hashed while still in a
+ * register. The last partial word is gathered byte by byte, padded with
+ * zeros as the hash wants it.
+ */
+static inline uint64_t convert( char *dst, const unsigned char *wire,
+  size_t length )
+{
+	const unsigned char *src = wire + 1;
+	size_t dot = wire[0];
+	uint64_t hash = length * NAME_HASH_PRIME;
+	size_t i = 0;
+#if defined( __AVX2__ )
+	for ( ; i + 32 <= length; i += 32 ) {
+		uint64_t words[4];
+		_mm256_storeu_si256( (__m256i *) words, lower32(
+		  _mm256_loadu_si256( (const __m256i *) ( src + i ) ) ) );
+		for ( unsigned w = 0; w < 4; ++w ) {
+			const size_t at = i + 8 * w;
+			const uint64_t word =
+			  dots( words[w], at, at + 8, src, dot );
+			memcpy( dst + at, &word, 8 );
+			hash = mixName( hash, word );
+		}
+	}
+#endif
+#if defined( __SSE2__ )
+	for ( ; i + 16 <= length; i += 16 ) {
+		uint64_t words[2];
+		_mm_storeu_si128( (__m128i *) words, lower16(
+		  _mm_loadu_si128( (const __m128i *) ( src + i ) ) ) );
+		for ( unsigned w = 0; w < 2; ++w ) {
+			const size_t at = i + 8 * w;
+			const uint64_t word =
+			  dots( words[w], at, at + 8, src, dot );
+			memcpy( dst + at, &word, 8 );
+			hash = mixName( hash, word );
+		}
+	}
+#endif
+	for ( ; i + 8 <= length; i += 8 ) {
+		uint64_t word;
+		memcpy( &word, src + i, 8 );
+		word = dots( lower8( word ), i, i + 8, src, dot );
+		memcpy( dst + i, &word, 8 );
+		hash = mixName( hash, word );
+	}
+	if ( i < length ) {
+		uint64_t word = 0;
+		if ( length >= 8 ) {
+			/* the last word read whole, its new bytes moved down */
+			memcpy( &word, src + length - 8, 8 );
+			word = lower8( word );
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+			word <<= 8 * ( 8 - ( length - i ) );
+#else
+			word >>= 8 * ( 8 - ( length - i ) );
+#endif
+		} else {
+			for ( size_t j = i; j < length; ++j )
+				word |= (uint64_t) (unsigned char) lower1( src[j] )
+				  << byteShift( j - i );
+		}
+		word = dots( word, i, length, src, dot );
+		memcpy( dst + i, &word, length - i );
+		hash = mixName( hash, word );
+	}
+	return hash;
+}
+
+void PacketParser::operator ()( const IStorage::PacketView *packets,
+  size_t count, PacketRecord *records, unsigned need )
+{
+	const bool addresses = need & PacketRecord::NEED_ADDRESSES;
+	const bool messages =
+	  need & ( PacketRecord::NEED_QUERIES | PacketRecord::NEED_DNS );
+
+	for ( size_t i = 0; i < count; i += BLOCK ) {
+		const size_t block = ::std::min<size_t>( count - i, BLOCK );
+		unsigned responses = 0, opcodes = 0;
+		const unsigned dns = messages ?
+		  classify( packets + i, block, need, responses, opcodes ) : 0;
+		for ( size_t j = 0; j < block; ++j ) {
+			if ( dns >> j & 1 || addresses )
+				parse( packets[i + j], records[i + j], dns >> j & 1 );
+			else {
+				memset( &records[i + j], 0, sizeof( PacketRecord ) );
+				records[i + j].failure = PacketRecord::FAIL_SKIPPED;
+			}
+			if ( responses >> j & 1 )
+				records[i + j].failure = PacketRecord::FAIL_NOT_QUERY;
+			else if ( opcodes >> j & 1 )
+				records[i + j].failure = PacketRecord::FAIL_QUERY_FLAGS;
+		}
+	}
+}
+
+unsigned PacketParser::classify( const IStorage::PacketView *packets,
+  size_t count, unsigned need, unsigned &responses, unsigned &opcodes )
+{
+	assert( count <= BLOCK );
+
+	/* the fields side by side, unknown ones fail the compares */
+	uint8_t protocol[BLOCK];
+	uint16_t sport[BLOCK], dport[BLOCK], flags[BLOCK];
+	for ( size_t i = 0; i < BLOCK; ++i ) {
+		protocol[i] = 0;
+		sport[i] = dport[i] = flags[i] = 0;
+		if ( i >= count )
+			continue;
+
+		const IStorage::PacketView &packet = packets[i];
+		const unsigned char *bp = (const unsigned char *) packet.data;
+		if ( packet.format == IStorage::DNS_MESSAGE ) {
+			protocol[i] = IPPROTO_UDP;
+			sport[i] = dport[i] = NAMESERVER_PORT;
+			/* a truncated one is left to the parser to fail */
+			if ( packet.size >= sizeof( MessageRecord ) + 4 ) {
+				const unsigned char *np =
+				  bp + sizeof( MessageRecord );
+				flags[i] = np[2] << 8 | np[3];
+			}
+			continue;
+		}
+
+		/* the transport header is only in the first fragment */
+		const PacketMeta &meta = packet.meta;
+		if ( meta.fragment )
+			continue;
+		protocol[i] = meta.protocol;
+		const unsigned char *up = bp + meta.transport;
+		if ( meta.length >= meta.transport + 4u ) {
+			sport[i] = up[0] << 8 | up[1];
+			dport[i] = up[2] << 8 | up[3];
+		}
+		if ( meta.length >= meta.transport + 8u + 4u )
+			flags[i] = up[10] << 8 | up[11];
+	}
+
+	/* QR and opcode */
+	const uint16_t mask = need & PacketRecord::NEED_DNS ? 0 : 0xf800;
+
+#if defined( __SSE2__ )
+	const __m128i port = _mm_set1_epi16( NAMESERVER_PORT );
+	const __m128i zero = _mm_setzero_si128();
+	__m128i halves[2], held[2], qr[2];
+	for ( unsigned h = 0; h < 2; ++h ) {
+		const __m128i s = _mm_loadu_si128( (const __m128i *) sport + h );
+		const __m128i d = _mm_loadu_si128( (const __m128i *) dport + h );
+		const __m128i f = _mm_loadu_si128( (const __m128i *) flags + h );
+		const __m128i dns = _mm_or_si128( _mm_cmpeq_epi16( s, port ),
+		  _mm_cmpeq_epi16( d, port ) );
+		const __m128i clear = _mm_cmpeq_epi16(
+		  _mm_and_si128( f, _mm_set1_epi16( mask ) ), zero );
+		halves[h] = _mm_and_si128( dns, clear );
+		held[h] = _mm_andnot_si128( clear, dns );
+		qr[h] = _mm_cmpeq_epi16(
+		  _mm_and_si128( f, _mm_set1_epi16( (short) 0x8000 ) ), zero );
+	}
+	const __m128i udp = _mm_cmpeq_epi8(
+	  _mm_loadu_si128( (const __m128i *) protocol ),
+	  _mm_set1_epi8( IPPROTO_UDP ) );
+	/* the 16-bit results are all ones or zeros, packing keeps them */
+	const unsigned result = _mm_movemask_epi8( _mm_and_si128( udp,
+	  _mm_packs_epi16( halves[0], halves[1] ) ) );
+	const unsigned back = _mm_movemask_epi8( _mm_and_si128( udp,
+	  _mm_packs_epi16( held[0], held[1] ) ) );
+	const unsigned queries = _mm_movemask_epi8(
+	  _mm_packs_epi16( qr[0], qr[1] ) );
+	responses = back & ~queries;
+	opcodes = back & queries;
+#else
+	unsigned result = 0;
+	responses = opcodes = 0;
+	for ( unsigned i = 0; i < BLOCK; ++i ) {
+		const bool dns = protocol[i] == IPPROTO_UDP
+		  && ( sport[i] == NAMESERVER_PORT
+		    || dport[i] == NAMESERVER_PORT );
+		const bool pass = dns && !( flags[i] & mask );
+		const bool back = dns && ( flags[i] & mask );
+		result |= pass << i;
+		responses |= ( back && ( flags[i] & 0x8000 ) ) << i;
+		opcodes |= ( back && !( flags[i] & 0x8000 ) ) << i;
+	}
 #endif
-	default:
-		FAIL_IF( true, "unknown ip version (not an IP header?)" );
+	/* the lanes past the count have protocol 0 */
+	return result;
+}
+
+void PacketParser::parse( const IStorage::PacketView &packet,
+  PacketRecord &record, bool dns )
+{
+#ifdef PACKET_DEBUG
+	++seq;
+#endif
+
+	const unsigned char *bp = (const unsigned char *) packet.data;
+	/* bp should be aligned */
+	assert( (intptr_t) bp % 2 == 0 );
+
+	memset( &record, 0, sizeof( record ) );
+	record.length = ::std::min<size_t>( packet.size, 0xffff );
+	mRecord = &record;
+	mBase = bp;
+	mDns = dns;
+
+	if ( packet.format == IStorage::DNS_MESSAGE ) {
+		mSnapend = bp + packet.size;
+		parseMessage( bp );
+	} else {
+		/* The snapshot ends with the IP payload. */
+		mSnapend = bp + packet.meta.length;
+		parseIp( bp, packet.meta );
 	}
 
-	/* Read and check header and packet length. */
-	unsigned hlen = ip->ip_hl * 4,
-		 len = ntohs( ip->ip_len );
-	FAIL_IF( hlen < sizeof( *ip ) || len < hlen, "bad headerlen" );
+#ifdef PACKET_DEBUG
+	if ( record.failure ) {
+		/* seq number the same as in wireshark */
+		::std::cerr << seq << ": " << FAILURES[record.failure]
+		  << ::std::endl;
+	}
+#endif
+}
 
-	TCHECK2( *ip, len, "packet truncated" );
+PacketParser::NameView PacketParser::name( const char *data,
+  const PacketRecord &record, char *buffer )
+{
+	assert( record.has( PacketRecord::HAS_QUESTION ) );
 
-	/* Cut off the snapshot length to the end of the IP payload. */
-	mSnapend = ::std::min( mSnapend, BYTEOFF( const unsigned char *, ip, len ) );
+	const unsigned char *wire =
+	  (const unsigned char *) data + record.name_offset;
+	/* the text is the wire form without the first length byte */
+	size_t length = record.name_length - 1;
 
-	unsigned off = ntohs( ip->ip_off );
-	FAIL_IF( (off & IP_OFFMASK) || (off & IP_MF), "fragmentation not supported" );
+	if ( length == 0 ) {
+		buffer[0] = '.';
+		const NameView root = { buffer, 1, hashName( buffer, 1 ) };
+		return root;
+	}
 
-	FAIL_IF( ip->ip_p != IPPROTO_UDP, "not a UDP packet" );
+	const NameView view = { buffer, length,
+	  convert( buffer, wire, length ) };
+	return view;
+}
 
-	parseUdp( BYTEOFF( const struct udphdr *, ip, hlen ) );
+PacketParser::NameView PacketParser::name( const char *data,
+  const PacketRecord &record, char *buffer, const NameReducer &reducer )
+{
+	assert( record.has( PacketRecord::HAS_QUESTION ) );
+
+	const unsigned char *wire =
+	  (const unsigned char *) data + record.name_offset;
+	uint8_t labels[NameReducer::MAXLABELS];
+	unsigned count = 0;
+	for ( size_t i = 0; wire[i]; i += wire[i] + 1 )
+		labels[count++] = i;
+
+	const unsigned keep = reducer.keep( wire, labels, count );
+	if ( keep == 0 ) {
+		const NameView empty = { buffer, 0, hashName( NULL, 0 ) };
+		return empty;
+	}
+
+	/* the text starts past the length byte of the first label kept */
+	const size_t start = labels[count - keep];
+	const size_t length = record.name_length - start - 1;
+	const NameView view = { buffer, length,
+	  convert( buffer, wire + start, length ) };
+	return view;
+}
+
+uint64_t PacketParser::hashName( const char *text, size_t length )
+{
+	/* multiplicative over 64-bit words, the tail zero-padded */
+	uint64_t hash = length * NAME_HASH_PRIME;
+	size_t i = 0;
+	for ( ; i + 8 <= length; i += 8 ) {
+		uint64_t word;
+		memcpy( &word, text + i, 8 );
+		hash = mixName( hash, word );
+	}
+	if ( i < length ) {
+		uint64_t word = 0;
+		memcpy( &word, text + i, length - i );
+		hash = mixName( hash, word );
+	}
+	return hash;
 }
 
-#ifndef NO_IPV6
 /*
- * print an IP6 datagram.
+ * Take the addresses of a IP datagram decoded by LinkDecoder and find its
+ * UDP header.
  */
-void PacketParser::parseIp6( const struct ip6_hdr *ip6 )
-{
-	TCHECK( *ip6, "IPv6 header truncated" );
-
-	/* Read and check payload length. */
-	unsigned len = ntohs( ip6->ip6_plen ) + sizeof( *ip6 );
-	TCHECK2( *ip6, len, "packet truncated" );
-
-	/* Cut off the snapshot length to the end of the IP payload. */
-	mSnapend = ::std::min( mSnapend, BYTEOFF( const unsigned char *, ip6, len ) );
-
-	/* Find the UDP payload. */
-	const struct ip6_ext *eh = (const struct ip6_ext *) (ip6 + 1);
-	int nh = ip6->ip6_nxt;
-	for ( ;; ) {
-		switch (nh) {
-		case IPPROTO_HOPOPTS:
-		case IPPROTO_DSTOPTS:
-		case IPPROTO_ROUTING:
-		case IPPROTO_AH:
-		/* IPPROTO_MOB* not defined in netinet/in.h */
-		//case IPPROTO_MOBILITY_OLD:
-		//case IPPROTO_MOBILITY:
-			TCHECK( *eh, "exthdr truncated/corrupted" );
-
-			nh = eh->ip6e_nxt;
-			eh = BYTEOFF( const struct ip6_ext *, eh,
-					((unsigned) eh->ip6e_len + 1) * 8 );
-			break;
-		case IPPROTO_FRAGMENT:
-			FAIL_IF( true, "fragmentation not supported" );
-		case IPPROTO_UDP:
-			return parseUdp( (const struct udphdr *) eh );
-		default:
-			FAIL_IF( true, "not a UDP packet or unrecognized IPv6 header" );
-		}
+void PacketParser::parseIp( const unsigned char *bp, const PacketMeta &meta )
+{
+	/* the decoder checked the header length */
+	mRecord->family = meta.version;
+	mRecord->protocol = meta.protocol;
+	if ( meta.version == 4 ) {
+		memcpy( mRecord->source, bp + 12, 4 );
+		memcpy( mRecord->destination, bp + 16, 4 );
+	} else {
+		memcpy( mRecord->source, bp + 8, PacketRecord::ADDRESS_SIZE );
+		memcpy( mRecord->destination, bp + 24,
+		  PacketRecord::ADDRESS_SIZE );
 	}
 
-	// not reached
+	FAIL_IF( meta.fragment, FAIL_FRAGMENT );
+	FAIL_IF( meta.protocol != IPPROTO_UDP, FAIL_NOT_UDP );
+
+	parseUdp( BYTEOFF( const struct udphdr *, bp, meta.transport ) );
+}
+
+void PacketParser::parseMessage( const unsigned char *bp )
+{
+	TCHECK2( *bp, sizeof( MessageRecord ), FAIL_MESSAGE_TRUNCATED );
+
+	const MessageRecord *message = (const MessageRecord *) bp;
+	mRecord->family = message->family;
+	memcpy( mRecord->source, message->source,
+	  PacketRecord::ADDRESS_SIZE );
+	memcpy( mRecord->destination, message->destination,
+	  PacketRecord::ADDRESS_SIZE );
+	if ( !mDns )
+		return;
+
+	parseDns( (const struct ns_header *) (message + 1) );
 }
-#endif
 
 void PacketParser::parseUdp( const struct udphdr *up )
 {
-	TCHECK( *up, "UDP header truncated" );
+	TCHECK( *up, FAIL_UDP_TRUNCATED );
 
 	uint16_t sport = ntohs( up->uh_sport ),
 		 dport = ntohs( up->uh_dport );
+	mRecord->source_port = sport;
+	mRecord->destination_port = dport;
 	FAIL_IF( dport != NAMESERVER_PORT && sport != NAMESERVER_PORT,
-			"not a DNS packet" );
+			FAIL_NOT_DNS );
+	/* not needed by any policy */
+	if ( !mDns )
+		return;
 
 	parseDns( (const struct ns_header *) (up + 1) );
 }
 
 void PacketParser::parseDns( const struct ns_header *np )
 {
-	TCHECK( *np, "dns header truncated" );
+	TCHECK( *np, FAIL_DNS_TRUNCATED );
+
+	mRecord->dns_flags = ntohs( ((uint16_t *) np)[1] );
+	mRecord->status |= PacketRecord::HAS_DNS;
 
 	uint16_t qdcount = ntohs( np->qdcount );
-	FAIL_IF( DNS_QR( np ) || DNS_OPCODE( np ) != QUERY || qdcount == 0,
-			"not a query" );
-	FAIL_IF( ntohs( ((uint16_t *) np)[1] ) & 0x6cf,
-			"weird query flags" );
+	FAIL_IF( qdcount == 0, FAIL_NO_QUESTION );
 
 	/* Extract first query name. See git history for the code dealing with
 	 * extracting all questions, if that is ever needed. */
@@ -205,31 +571,31 @@ void PacketParser::parseDns( const struct ns_header *np )
 
 void PacketParser::parseDnsName( const unsigned char *cp )
 {
-	/* Avoid unnecessary allocations. */
-	mName.reserve( MAXDNAME );
+	const unsigned char *name = cp;
 
+	/* only the labels are walked, name() copies the characters */
 	unsigned l;
 	do {
-		TCHECK( *cp, "query name truncated" );
+		TCHECK( *cp, FAIL_NAME_TRUNCATED );
 		l = *cp++;
 
-		FAIL_IF( l & INDIR_MASK, "query name compression / EDNS bitlabel" );
-
-		TCHECK2( *cp, l, "query name truncated" );
-		::std::transform( cp, cp + l, ::std::back_inserter( mName ),
-				/* Unambiguously select the one and only
-				 * tolower function from ctype.h so that there
-				 * is absolutely no chance that some other
-				 * tolower from some strange namespace is
-				 * selected at the most inconvenient moment.
-				 */
-				static_cast< int(*)(int) >( ::std::tolower ) );
-		cp += l;
+		FAIL_IF( l & INDIR_MASK, FAIL_NAME_COMPRESSED );
 
-		/* Don't append a final dot if there already is one. */
-		if ( !( l == 0 && mName.size() ) )
-			mName.push_back( '.' );
+		TCHECK2( *cp, l, FAIL_NAME_TRUNCATED );
+		cp += l;
 	} while ( l );
 
-	FAIL_IF( mName.length() > MAXDNAME, "query name too long" );
+	/* The text form has a dot for every label but the root one. */
+	const unsigned length = cp - name;
+	FAIL_IF( length > MAXDNAME + 1, FAIL_NAME_TOO_LONG );
+
+	mRecord->name_offset = name - mBase;
+	mRecord->name_length = length;
+	mRecord->status |= PacketRecord::HAS_QUESTION;
+
+	/* the type and class may be cut off by the snapshot length */
+	if ( TTEST2( *cp, 4 ) ) {
+		mRecord->qtype = cp[0] << 8 | cp[1];
+		mRecord->qclass = cp[2] << 8 | cp[3];
+	}
 }
@@ -35,111 +35,150 @@
 #include <string>
 #include <vector>
 #include <cassert>
+#include <stdint.h>
+
+#include "IStorage.h"
+#include "policies/PacketRecord.h"
+#include "policies/dns/NameReducer.h"
 
 /*!
  * @headerfile PacketParser.h "policies/dns/PacketParser.h"
- * @brief A functor that parses DNS query names out of an IP packet.
+ * @brief A functor that decodes the DNS fields of IP packets into
+ * PacketRecords.
  *
  * Note: The sole reason for this being a functor instead of a function is the
- * syntactic sugar for bounds checking and error reporting. Also, it may be
- * somewhat easier for the compiler to perform Return Value Optimization,
- * although I'm afraid it's not that smart.
+ * syntactic sugar for bounds checking and error reporting. One instance
+ * may decode any number of packets, one after another.
  */
 class PacketParser {
 public:
 	PacketParser() {}
 
 	/*!
-	 * @brief Parse a packet.
-	 * @param bp Packet data (aligned to at least 2 bytes).
-	 * @param length Packet size.
-	 * @return DNS query name or an empty string for invalid packets.
+	 * @brief Decode a packet.
+	 * @param packet Packet of either IStorage::Format, the data aligned
+	 * to at least 2 bytes.
+	 * @param record Receives the decoded fields, HAS_QUESTION is set
+	 * only for a valid query name.
 	 */
-	::std::string operator ()( const unsigned char *bp, unsigned length )
-	{
-#ifdef PACKET_DEBUG
-		++seq;
-#endif
-
-		/* bp should be aligned */
-		assert( (intptr_t) bp % 2 == 0 );
+	void operator ()( const IStorage::PacketView &packet,
+	  PacketRecord &record )
+		{ parse( packet, record, true ); }
 
-		mSnapend = bp + length;
-		mName.clear();
-		mFailed = false;
-		parseIp( (const struct ip *) bp );
+	/*!
+	 * @brief Decode a batch of packets as far as needed.
+	 * @param packets Packets as for a single one.
+	 * @param count Number of packets.
+	 * @param records Receive the decoded fields of every packet.
+	 * @param need PacketRecord::Need flags of the policies.
+	 *
+	 * The packets are classified by classify() in blocks, only those
+	 * that may be needed are passed to the DNS parser. The others get
+	 * their addresses, protocol and UDP ports if NEED_ADDRESSES is set,
+	 * an empty record otherwise. Those held back by the QR bit or the
+	 * opcode fail as FAIL_NOT_QUERY or FAIL_QUERY_FLAGS.
+	 */
+	void operator ()( const IStorage::PacketView *packets, size_t count,
+	  PacketRecord *records, unsigned need );
 
-		if ( mFailed || mName.size() == 0 ) {
-#ifdef PACKET_DEBUG
-			/* seq number the same as in wireshark */
-			::std::cerr << seq << ": " << mError.str();
-			if ( mError.tellp() == 0 )
-				::std::cerr << ::std::endl;
-#endif
-			mName.clear();
-		}
+	enum {
+		BLOCK = 16  /*!< @brief Packets classified at once. */
+	};
 
-		return getSLD(mName);
-	}
+	/*!
+	 * @brief Picks the packets that may be needed from a block.
+	 * @param packets The block.
+	 * @param count Packets in the block, BLOCK at most.
+	 * @param need PacketRecord::Need flags, NEED_QUERIES or NEED_DNS
+	 * among them.
+	 * @param responses Receives the bit mask of the packets held back
+	 * by their QR bit.
+	 * @param opcodes Receives the bit mask of the queries held back by
+	 * their opcode.
+	 * @return Bit mask of the packets to decode fully: UDP with port
+	 * 53 on either side and unless NEED_DNS is set the QR bit and opcode
+	 * clear. DNS messages without a packet always pass the port test.
+	 *
+	 * The fields at fixed offsets are gathered side by side and
+	 * compared at once with SSE2 if the build has it.
+	 */
+	static unsigned classify( const IStorage::PacketView *packets,
+	  size_t count, unsigned need, unsigned &responses,
+	  unsigned &opcodes );
 
 	enum {
 		MAXDNAME = 256 /*!< @brief Max name length (RFC 883) */
 	};
 
-  ::std::string getSLD(::std::string mName) {
-    std::string hostName = mName;
-    std::string serverDomainStr;
-    int cpos = hostName.rfind(".");
-    if(cpos != std::string::npos) {
-      serverDomainStr = hostName.substr(0, cpos);
-    } else {
-      serverDomainStr = hostName.substr(0);
-    }
-
-    int pcpos = serverDomainStr.rfind(".");
-    if(pcpos != std::string::npos) {
-      serverDomainStr = hostName.substr(0, pcpos);
-    } else {
-      serverDomainStr = hostName.substr(0);
-    }
-
-    int ppcpos = serverDomainStr.rfind(".");
-    if(ppcpos != std::string::npos) {
-      serverDomainStr = hostName.substr(0, ppcpos);
-    } else {
-      serverDomainStr = hostName.substr(0);
-    }
-
-    hostName = hostName.substr(ppcpos+1);
-    return hostName;
-  }
+	/*!
+	 * @struct NameView
+	 * @brief Query name in text form, held by a buffer of the caller.
+	 */
+	struct NameView {
+		const char *data;  /*!< @brief Lower-case name, final dot. */
+		size_t length;     /*!< @brief Characters of the name. */
+		uint64_t hash;     /*!< @brief hashName() of the name. */
+	};
+
+	/*!
+	 * @brief Query name of a record in text form.
+	 * @param data Packet data the record was decoded from.
+	 * @param record Record with HAS_QUESTION.
+	 * @param buffer Receives the name, MAXDNAME bytes.
+	 * @return The lower-case name with the final dot, "." for the root.
+	 *
+	 * Lower-cases 32, 16 or 8 bytes at once with AVX2, SSE2 or plain
+	 * 64-bit arithmetic, whichever the build allows, and hashes each
+	 * word as it is stored, in the same pass. Allocates nothing.
+	 */
+	static NameView name( const char *data, const PacketRecord &record,
+	  char *buffer );
+
+	/*!
+	 * @brief Identifying part of the query name of a record.
+	 * @param data Packet data the record was decoded from.
+	 * @param record Record with HAS_QUESTION.
+	 * @param buffer Receives the name, MAXDNAME bytes.
+	 * @param reducer Tells the labels to keep.
+	 * @return The kept labels as name() returns them, empty if none.
+	 *
+	 * The labels are counted in the wire format and only those kept
+	 * are converted, so long random prefixes cost a walk over their
+	 * length bytes.
+	 */
+	static NameView name( const char *data, const PacketRecord &record,
+	  char *buffer, const NameReducer &reducer );
+
+	/*! @brief Hash of a name in text form, for the NameView. */
+	static uint64_t hashName( const char *text, size_t length );
+
+	/*! @brief Explanations of the PacketRecord::Failure values. */
+	static const char * const FAILURES[PacketRecord::FAILURE_COUNT];
 
 private:
+	const unsigned char *mBase;    /*!< @brief Start of packet data. */
 	const unsigned char *mSnapend; /*!< @brief Ptr to end of packet. */
-	::std::string mName;          /*!< @brief Buffer for query name. */
-	bool mFailed;                 /*!< @brief Failed flag. */
+	PacketRecord *mRecord;         /*!< @brief Record being filled. */
+	bool mDns;                     /*!< @brief Decode past UDP. */
 #ifdef PACKET_DEBUG
 	static int seq; /*!< @brief Packet number (same as in wireshark). */
-	::std::ostringstream mError; /*!< @brief Parse error explanation. */
 #endif
 
 	/*!
-	 * @brief Set the failed flag and append an error explanation.
-	 * @param err Error explanation.
+	 * @brief Records why the packet could not be decoded.
+	 * @param reason The failure.
 	 */
-	void fail( const ::std::string &err = "" ) {
-		mFailed = 1;
-#ifdef PACKET_DEBUG
-		mError << err << ::std::endl;
-#else
-		(void) err; /* get rid of warning: unused parameter `err' */
-#endif
-	}
+	void fail( PacketRecord::Failure reason )
+		{ mRecord->failure = reason; }
 
-	void parseIp( const struct ip *ip );          /*!< @brief Parse IP packet. */
-#ifndef NO_IPV6
-	void parseIp6( const struct ip6_hdr *ip6 );   /*!< @brief Parse IPv6 packet. */
-#endif
+	/*! @brief Decode a packet, the DNS part only if dns is set. */
+	void parse( const IStorage::PacketView &packet, PacketRecord &record,
+	  bool dns );
+
+	/*! @brief Parse IP packet. */
+	void parseIp( const unsigned char *bp, const PacketMeta &meta );
+	/*! @brief Take the addresses of a DNS message without its packet. */
+	void parseMessage( const unsigned char *bp );
 	void parseUdp( const struct udphdr *up );     /*!< @brief Parse UDP payload. */
 	void parseDns( const struct ns_header *np );  /*!< @brief Parse DNS payload. */
 	void parseDnsName( const unsigned char *cp ); /*!< @brief Parse query name. */
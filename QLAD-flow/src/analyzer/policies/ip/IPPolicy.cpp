@@ -21,21 +21,14 @@
 #endif
 
 #include <cassert>
-#include <netinet/ip.h>
-#include <netinet/ip6.h>
+#include <arpa/inet.h>
 #include <stdint.h>
-#include <cstdlib>
-#include <iostream>
+#include <cstring>
 
 #include "policies/IPPolicy.h"
 #include "IPv4Address.h"
 #include "iphash.h"
 
-/*! @brief Convenience typedef from netinet/ip.h */
-typedef struct iphdr ip4_header;
-/*! @brief Convenience typedef from netinet/ip6.h */
-typedef struct ip6_hdr ip6_header;
-
 const char *SrcIPPolicy::NAME = "Source IP Policy";
 const char *DstIPPolicy::NAME = "Destination IP Policy";
 
@@ -48,53 +41,34 @@ inline unsigned hash_wrapper <IPv4Address> (
   const unsigned index, const IPv4Address &id )
 	{ return Hash::hashIPv4Address( index, id ); }
 /* -------------------------------------------------------------------------- */
-SrcIPPolicy::id_t SrcIPPolicy::parseIdentifier( const char *data, const size_t length )
+/*!
+ * @brief Converts address of a PacketRecord.
+ * @param family IP version of the address
+ * @param address Address bytes in network order
+ * @return The address
+ */
+static IPAddress record_address( unsigned family, const unsigned char *address )
 {
-	assert( length > sizeof(ip4_header) ); (void) length;
-
-	const ip4_header *header = reinterpret_cast<const ip4_header *>( data );
-
-	switch( header->version)
-	{
-		case 4:
-			return ntohl( header->saddr );
 #ifndef NO_IPV6
-		case 6:
-			assert( length > sizeof(ip6_header) );
-			return reinterpret_cast<const ip6_header *>( data )
-			  ->ip6_src.s6_addr;
+	if ( family == 6 )
+		return address;
 #endif
-		default:
-			assert( !"Invalid IP Protocol version" );
-			std::cerr << "Invalid IP Protocol version\n";
-			exit(1);
-	}
+	assert( family == 4 ); (void) family;
+	uint32_t ipv4;
+	memcpy( &ipv4, address, sizeof( ipv4 ) );
+	return ntohl( ipv4 );
 }
 /* -------------------------------------------------------------------------- */
+SrcIPPolicy::id_t SrcIPPolicy::parseIdentifier( const PacketRecord &record,
+  const char * )
+	{ return record_address( record.family, record.source ); }
+/* -------------------------------------------------------------------------- */
 unsigned SrcIPPolicy::hash( const unsigned index, const id_t &id )
 	{ return hash_wrapper( index, id ); }
 /* -------------------------------------------------------------------------- */
-DstIPPolicy::id_t DstIPPolicy::parseIdentifier( const char *data, const size_t length )
-{
-	assert( length > sizeof(ip4_header) ); (void) length;
-
-	const ip4_header *header = reinterpret_cast<const ip4_header *>( data );
-
-	switch( header->version) {
-		case 4:
-			return ntohl( header->daddr );
-#ifndef NO_IPV6
-		case 6:
-			assert( length > sizeof(ip6_header) );
-			return reinterpret_cast<const ip6_header *>( data )
-			  ->ip6_dst.s6_addr;
-#endif
-		default:
-			assert( !"Invalid IP Protocol version" );
-			std::cerr << "Invalid IP Protocol version\n";
-			exit(1);
-	}
-}
+DstIPPolicy::id_t DstIPPolicy::parseIdentifier( const PacketRecord &record,
+  const char * )
+	{ return record_address( record.family, record.destination ); }
 /* -------------------------------------------------------------------------- */
 unsigned DstIPPolicy::hash( const unsigned index, const id_t &id )
 	{ return hash_wrapper( index, id ); }
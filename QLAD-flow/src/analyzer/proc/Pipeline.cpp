@@ -0,0 +1,173 @@
+/*
+ * This file is part of the DNS traffic analyser project.
+ *
+ * Copyright (C) 2011 CZ.NIC, z.s.p.o.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <cassert>
+#include <cstring>
+
+#include "Pipeline.h"
+#include "sync/MutexLocker.h"
+
+Pipeline::Pipeline( IStagedStorage &target, unsigned parsers )
+: mTarget( target ), mBatches( parsers * BATCHES_PER_PARSER + 2 ),
+  mFree( mBatches.size() ), mParse( mBatches.size() ),
+  mStorers( target.shardCount() ), mCurrent( NULL ),
+  mSubmitted( 0 ), mStored( 0 )
+{
+	assert( parsers > 0 );
+
+	for (unsigned i = 0; i < mBatches.size(); ++i) {
+		Batch *batch = new Batch;
+		batch->data.resize( BATCH_BYTES );
+		batch->packets.reserve( BATCH_PACKETS );
+		batch->records = target.createRecords();
+		mBatches[i] = batch;
+		mFree.push( batch );
+	}
+
+	for (unsigned i = 0; i < parsers; ++i) {
+		mParsers.push_back( new Thread( parse, this ) );
+		mParsers.back()->run();
+	}
+	for (unsigned i = 0; i < mStorers.size(); ++i) {
+		Storer &storer = mStorers[i];
+		storer.pipeline = this;
+		storer.shard = i;
+		storer.queue = new BoundedQueue<Batch *>( mBatches.size() );
+		storer.thread = new Thread( store, &storer );
+		storer.thread->run();
+	}
+}
+/* ------------------------------------------------------------------------- */
+Pipeline::~Pipeline()
+{
+	drain();
+
+	mFree.close();
+	mParse.close();
+	for (unsigned i = 0; i < mParsers.size(); ++i) {
+		mParsers[i]->join();
+		delete mParsers[i];
+	}
+	for (unsigned i = 0; i < mStorers.size(); ++i) {
+		mStorers[i].queue->close();
+		mStorers[i].thread->join();
+		delete mStorers[i].thread;
+		delete mStorers[i].queue;
+	}
+
+	for (unsigned i = 0; i < mBatches.size(); ++i) {
+		delete mBatches[i]->records;
+		delete mBatches[i];
+	}
+}
+/* ------------------------------------------------------------------------- */
+void Pipeline::addPackets( const PacketView *packets, size_t count )
+{
+	for (size_t i = 0; i < count; ++i) {
+		const PacketView &packet = packets[i];
+		/* keep the copies aligned to 2 bytes for the parsers */
+		const size_t size = (packet.size + 1) & ~(size_t)1;
+
+		if (mCurrent && (mCurrent->packets.size() == BATCH_PACKETS
+		  || mCurrent->used + size > mCurrent->data.size()))
+			{ submit(); }
+
+		if (!mCurrent) {
+			mFree.pop( mCurrent );
+			mCurrent->used = 0;
+			mCurrent->packets.clear();
+			/* no views into the data exist yet */
+			if (size > mCurrent->data.size())
+				{ mCurrent->data.resize( size ); }
+		}
+
+		char *copy = &mCurrent->data[mCurrent->used];
+		memcpy( copy, packet.data, packet.size );
+		mCurrent->used += size;
+
+		PacketView view = packet;
+		view.data = copy;
+		mCurrent->packets.push_back( view );
+	}
+}
+/* ------------------------------------------------------------------------- */
+void Pipeline::drain()
+{
+	if (mCurrent)
+		{ submit(); }
+
+	MutexLocker m( mGuard );
+	while (mStored < mSubmitted)
+		{ mDrained.wait( mGuard ); }
+}
+/* ------------------------------------------------------------------------- */
+void Pipeline::submit()
+{
+	assert( mCurrent );
+
+	{
+		MutexLocker m( mGuard );
+		++mSubmitted;
+		mCurrent->pending = mStorers.size();
+	}
+	/* The store queues keep the order, parsers may finish in any. */
+	for (unsigned i = 0; i < mStorers.size(); ++i)
+		{ mStorers[i].queue->push( mCurrent ); }
+	mParse.push( mCurrent );
+	mCurrent = NULL;
+}
+/* ------------------------------------------------------------------------- */
+void * Pipeline::parse( Pipeline *pipeline )
+{
+	assert( pipeline );
+
+	Batch *batch;
+	while (pipeline->mParse.pop( batch )) {
+		pipeline->mTarget.parse( &batch->packets[0],
+		  batch->packets.size(), *batch->records );
+		for (unsigned i = 0; i < pipeline->mStorers.size(); ++i)
+			{ batch->parsed.up(); }
+	}
+	return NULL;
+}
+/* ------------------------------------------------------------------------- */
+void * Pipeline::store( Storer *storer )
+{
+	assert( storer );
+	Pipeline *pipeline = storer->pipeline;
+
+	Batch *batch;
+	while (storer->queue->pop( batch )) {
+		batch->parsed.down();
+		pipeline->mTarget.store( *batch->records, storer->shard );
+
+		MutexLocker m( pipeline->mGuard );
+		if (--batch->pending == 0) {
+			/* the last shard recycles the batch */
+			pipeline->mFree.push( batch );
+			++pipeline->mStored;
+			pipeline->mDrained.broadcast();
+		}
+	}
+	return NULL;
+}
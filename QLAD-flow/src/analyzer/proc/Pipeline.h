@@ -0,0 +1,135 @@
+/*
+ * This file is part of the DNS traffic analyser project.
+ *
+ * Copyright (C) 2011 CZ.NIC, z.s.p.o.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <vector>
+
+#include "IStorage.h"
+#include "proc/Thread.h"
+#include "struct/BoundedQueue.h"
+#include "sync/Mutex.h"
+#include "sync/Semaphore.h"
+#include "sync/WaitCondition.h"
+
+/*!
+ * @class Pipeline Pipeline.h "proc/Pipeline.h"
+ * @brief Parses packets on worker threads, overlapping with the capture.
+ *
+ * Packets added to the pipeline are copied into batches. Full batches are
+ * parsed by a number of parser threads and then stored into the target
+ * storage by one store thread per storage shard, each walking the batches
+ * in the order they were added. The stages are connected by bounded
+ * queues over a fixed pool of batches, so the capture blocks when the
+ * parsers or the store threads cannot keep up.
+ *
+ * The target storage must not be touched by anyone else until drain()
+ * returns, e.g. at the end of a capture window.
+ */
+class Pipeline: public IStorage
+{
+public:
+	/*!
+	 * @brief Starts the threads.
+	 * @param target Storage to parse for and store into.
+	 * @param parsers Number of parser threads, at least 1.
+	 */
+	Pipeline( IStagedStorage &target, unsigned parsers );
+
+	/*! @brief Stores what was added and stops the threads. */
+	~Pipeline();
+
+	/*! @brief Copies the packet into the current batch. */
+	void addPacket( const PacketView &packet )
+		{ addPackets( &packet, 1 ); }
+
+	/*! @brief Copies the packets into batches. */
+	void addPackets( const PacketView *packets, size_t count );
+
+	/*! @brief Blocks until all the packets added so far are stored. */
+	void drain();
+
+protected:
+	enum {
+		BATCH_PACKETS = 1024,         /*!< @brief Packets per batch. */
+		BATCH_BYTES = 256 * 1024,     /*!< @brief Data per batch. */
+		BATCHES_PER_PARSER = 2        /*!< @brief Pool size factor. */
+	};
+
+	/*! @brief Copied packets and their parsed records. */
+	struct Batch {
+		::std::vector<char> data;          /*!< @brief Packet data. */
+		size_t used;                       /*!< @brief Used data. */
+		::std::vector<PacketView> packets; /*!< @brief Into data. */
+		IStagedStorage::Records *records;  /*!< @brief Parse result. */
+		Semaphore parsed;                  /*!< @brief Raised by parser
+		                                       once per shard. */
+		unsigned pending;                  /*!< @brief Shards to store,
+		                                       guarded by mGuard. */
+	};
+
+	/*! @brief Hands the current batch over to the parsers. */
+	void submit();
+
+	/*!
+	 * @brief Parser thread body.
+	 * @param pipeline The instance to work for.
+	 * @return NOT USED
+	 */
+	static void * parse( Pipeline *pipeline );
+
+	/*! @brief Store thread argument. */
+	struct Storer {
+		Pipeline *pipeline;            /*!< @brief The instance. */
+		unsigned shard;                /*!< @brief Shard to store. */
+		BoundedQueue<Batch *> *queue;  /*!< @brief Batches in order. */
+		Thread *thread;                /*!< @brief The thread. */
+	};
+
+	/*!
+	 * @brief Store thread body, stores one shard of batches in order.
+	 * @param storer The shard to store and the instance.
+	 * @return NOT USED
+	 */
+	static void * store( Storer *storer );
+
+	IStagedStorage &mTarget;           /*!< @brief Destination. */
+	::std::vector<Batch *> mBatches;   /*!< @brief All the batches. */
+	BoundedQueue<Batch *> mFree;       /*!< @brief Batches to fill. */
+	BoundedQueue<Batch *> mParse;      /*!< @brief Batches to parse. */
+	::std::vector<Thread *> mParsers;  /*!< @brief Parser threads. */
+	::std::vector<Storer> mStorers;    /*!< @brief Store threads. */
+	Batch *mCurrent;                   /*!< @brief Batch being filled. */
+
+	Mutex mGuard;                 /*!< @brief Guards the counters. */
+	WaitCondition mDrained;       /*!< @brief Signalled on store. */
+	unsigned long mSubmitted;     /*!< @brief Batches submitted. */
+	unsigned long mStored;        /*!< @brief Batches stored. */
+
+private:
+	/*! @brief DO NOT COPY! */
+	Pipeline( const Pipeline & );
+
+	/*! @brief DO NOT COPY! */
+	Pipeline & operator = ( const Pipeline & );
+};
@@ -0,0 +1,121 @@
+/*
+ * This file is part of the DNS traffic analyser project.
+ *
+ * Copyright (C) 2011 CZ.NIC, z.s.p.o.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <cassert>
+#include <deque>
+
+#include "sync/Mutex.h"
+#include "sync/MutexLocker.h"
+#include "sync/WaitCondition.h"
+
+/*!
+ * @class BoundedQueue BoundedQueue.h "struct/BoundedQueue.h"
+ * @brief Blocking FIFO of limited capacity connecting two threads.
+ * @tparam T Element type, expected to be cheap to copy (pointers).
+ *
+ * push() blocks while the queue is full, pop() blocks while it is empty.
+ * After close() both return false instead of blocking, pop() still
+ * returns the elements queued before.
+ */
+template<typename T>
+class BoundedQueue
+{
+public:
+	/*!
+	 * @brief Creates an empty queue.
+	 * @param capacity Maximum number of queued elements.
+	 */
+	BoundedQueue( unsigned capacity )
+	: mCapacity( capacity ), mClosed( false )
+		{ assert( capacity > 0 ); }
+
+	/*!
+	 * @brief Adds element, blocks while the queue is full.
+	 * @param element This will be added.
+	 * @return false if the queue was closed, element is not added then.
+	 */
+	bool push( const T &element )
+	{
+		MutexLocker m( mGuard );
+		while (!mClosed && mQueue.size() >= mCapacity)
+			{ mNotFull.wait( mGuard ); }
+		if (mClosed)
+			{ return false; }
+		mQueue.push_back( element );
+		mNotEmpty.signal();
+		return true;
+	}
+
+	/*!
+	 * @brief Takes the oldest element, blocks while the queue is empty.
+	 * @param element Receives the element.
+	 * @return false if the queue is closed and empty.
+	 */
+	bool pop( T &element )
+	{
+		MutexLocker m( mGuard );
+		while (!mClosed && mQueue.empty())
+			{ mNotEmpty.wait( mGuard ); }
+		if (mQueue.empty())
+			{ return false; }
+		element = mQueue.front();
+		mQueue.pop_front();
+		mNotFull.signal();
+		return true;
+	}
+
+	/*! @brief Wakes all waiting threads and stops accepting elements. */
+	void close()
+	{
+		MutexLocker m( mGuard );
+		mClosed = true;
+		mNotEmpty.broadcast();
+		mNotFull.broadcast();
+	}
+
+	/*!
+	 * @brief Get element count.
+	 * @return Number of elements in the queue.
+	 */
+	unsigned size()
+	{
+		MutexLocker m( mGuard );
+		return mQueue.size();
+	}
+
+protected:
+	const unsigned mCapacity; /*!< @brief Maximum number of elements. */
+	bool mClosed;             /*!< @brief No more pushes accepted. */
+	::std::deque<T> mQueue;   /*!< @brief Storage place for elements. */
+	Mutex mGuard;             /*!< @brief Guards all members. */
+	WaitCondition mNotEmpty;  /*!< @brief Signalled on push. */
+	WaitCondition mNotFull;   /*!< @brief Signalled on pop. */
+
+private:
+	/*! @brief DO NOT COPY! */
+	BoundedQueue( const BoundedQueue & );
+
+	/*! @brief DO NOT COPY! */
+	BoundedQueue & operator = ( const BoundedQueue & );
+};
@@ -20,20 +20,31 @@
 #include "config.h"
 #endif
 
+#include <algorithm>
+
 #include "SparseFlow.h"
 
 
 void SparseFlow::addPoint( const time_t point )
 {
-    // ignore out-of-order packets
-    if ( !mSeries.empty() && mSeries.back().first > point ) return;
+    ++mCount;
+
+    /* an out-of-order point is put in its place */
+    if ( !mSeries.empty() && mSeries.back().first > point ) {
+            const TimeSeries::iterator i = ::std::lower_bound(
+                    mSeries.begin(), mSeries.end(),
+                    ::std::make_pair( point, (uint32_t) 0 ) );
+            if ( i->first == point )
+                    ++i->second;
+            else
+                    mSeries.insert( i, ::std::make_pair( point, 1 ) );
+            return;
+    }
 
     if ( mSeries.empty() || mSeries.back().first != point )
             mSeries.push_back( ::std::make_pair( point, 1 ) );
     else
             ++mSeries.back().second;
-
-    ++mCount;
 }
 
 void SparseFlow::deleteBefore( const time_t time ) {
@@ -57,6 +68,32 @@ void SparseFlow::clear() {
     mCount = 0;
 }
 
+void SparseFlow::merge( const SparseFlow &other ) {
+    TimeSeries merged;
+    merged.reserve( mSeries.size() + other.mSeries.size() );
+
+    TimeSeries::const_iterator a = mSeries.begin(), b = other.mSeries.begin();
+    while ( a != mSeries.end() || b != other.mSeries.end() ) {
+            if ( b == other.mSeries.end()
+                 || ( a != mSeries.end() && a->first < b->first ) )
+                    merged.push_back( *a++ );
+            else if ( a == mSeries.end() || b->first < a->first )
+                    merged.push_back( *b++ );
+            else {
+                    /* the same second in both, the key is read before
+                     * the iterators move on */
+                    const time_t time = a->first;
+                    merged.push_back( ::std::make_pair( time,
+                                      a->second + b->second ) );
+                    ++a;
+                    ++b;
+            }
+    }
+
+    mSeries.swap( merged );
+    mCount += other.mCount;
+}
+
 void SparseFlow::plot( ::std::ostream &stream ) const
 {
     TimeSeries::const_iterator it = mSeries.begin();
@@ -51,9 +51,9 @@ public:
 	 * @brief Adds a point to the Flow.
 	 * @param point Time position of the point to add.
 	 *
-	 * If this isn't the first time a point is inserted, its time has to
-	 * be later or equal to the last point stored. If this can't be
-	 * guaranteed, sparse vector will no longer be faster.
+	 * Points are expected in time order. A point earlier than the last
+	 * one stored is inserted in its place, at the cost of a search and
+	 * of moving the later points.
 	 */
 	void addPoint( const time_t point );
 
@@ -69,6 +69,12 @@ public:
 	/*! @brief Clears all stored data. */
 	void clear();
 
+	/*!
+	 * @brief Adds all points of another Flow.
+	 * @param other Flow to add, may overlap this one in time.
+	 */
+	void merge( const SparseFlow &other );
+
 	/*! @brief Number of points stored. */
 	unsigned count() const
 		{ return mCount; }
@@ -22,6 +22,7 @@
 #include "config.h"
 #endif
 
+#include <cerrno>
 #include <semaphore.h>
 
 /*!
@@ -49,9 +50,13 @@ public:
 	void up()
 		{ sem_post( &mGuard ); }
 
-	/*! @brief Decrements the value of the semaphore, blocks on zero. */
+	/*!
+	 * @brief Decrements the value of the semaphore, blocks on zero.
+	 *
+	 * The wait goes on when a signal handler interrupts it.
+	 */
 	void down()
-		{ sem_wait( &mGuard ); }
+		{ while (sem_wait( &mGuard ) && errno == EINTR) {} }
 
 	/*!
 	 * @brief Reads the value of the semaphore.
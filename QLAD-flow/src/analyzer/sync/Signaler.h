@@ -78,7 +78,7 @@ protected:
 /* -------------------------------------------------------------------------- */
 /* IMPLEMENTATION */
 /* -------------------------------------------------------------------------- */
-Signaler & Signaler::operator = ( bool status )
+inline Signaler & Signaler::operator = ( bool status )
 {
 	MutexLocker lock( mGuard );
 	if ((mStatus = status))
@@ -20,16 +20,45 @@
 #include "config.h"
 #endif
 
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <linux/if_packet.h>
 #include <pcap.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <signal.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "test.h"
+#include "packet_ring.h"
 #include "pcap_defines.h"
+#include "writer.h"
 
 #define WRONG_PARAM_COUNT \
-	"%s needs to be run with one parameter, the interface name.\n"
+	"usage: %s [-t threads] [-w file] [-G seconds] [-C MiB] [-z gzip|zstd]\n" \
+	"          [-B MiB] [-R ring] [-S MiB] <interface>\n" \
+	"  -t threads  capture sockets joined in a PACKET_FANOUT group, default 1\n" \
+	"  -w file     pcap file to write, default stdout; with several threads\n" \
+	"              each thread writes file.<thread>\n" \
+	"  -G seconds  start a new file every this many seconds, the file name\n" \
+	"              is a strftime() pattern of the start time\n" \
+	"  -C MiB      start a new file once this much pcap data is written,\n" \
+	"              a sequence number is appended to the file name\n" \
+	"  -z method   compress the output by gzip or zstd\n" \
+	"  -B MiB      kernel buffer size of each capture socket\n" \
+	"  -R ring     publish packets into the shared memory ring of this name\n" \
+	"              (e.g. " PACKET_RING_DEFAULT_NAME ") instead of writing pcap,\n" \
+	"              needs a single thread\n" \
+	"  -S MiB      size of the ring data area, default %lu\n"
+
+/*! @brief Upper bound on the number of capture threads. */
+#define MAX_THREADS 64
 
 /*!
  * @struct capture_options
@@ -42,6 +71,7 @@ struct capture_options {
 	int snaplen;      /*!< @brief Number of bytes to capture from each packet. */
 	int promisc_flag; /*!< @brief 1 if device should be set to promisc mode */
 	int timeout;      /*!< @brief Miliseconds to wait for packets */
+	int buffer_size;  /*!< @brief Kernel buffer size in bytes, 0 for default */
 };
 
 /*! @brief Struct capture_options initializer. */
@@ -50,9 +80,25 @@ struct capture_options {
 	NULL,  /*no default interface*/ \
 	65535, /*eneough to capture most of the packets*/ \
 	0,     /*no promisc*/ \
-	10     /*10ms timeout*/ \
+	10,    /*10ms timeout*/ \
+	0      /*libpcap default buffer*/ \
 }
 /* -------------------------------------------------------------------------- */
+/*!
+ * @struct capture_thread
+ * @brief One capture socket with its own writer and counters.
+ *
+ * The counters are only written by the thread running the capture.
+ */
+struct capture_thread {
+	pcap_t *interface;               /*!< @brief pcap interface to capture on. */
+	struct writer *writer;           /*!< @brief pcap file writer.             */
+	struct packet_ring_header *ring; /*!< @brief Shared ring, replaces writer. */
+	pthread_t thread;                /*!< @brief Thread running the capture.   */
+	unsigned long long packets;      /*!< @brief Packets captured.             */
+	unsigned long long bytes;        /*!< @brief Wire bytes captured.          */
+};
+/* -------------------------------------------------------------------------- */
 /*!
  * @struct capture_session
  * @brief Parameters needed by pcap_loop.
@@ -63,9 +109,16 @@ struct capture_options {
 struct capture_session {
 	struct capture_options options; /*!< @brief Used options.                 */
 	char *outfile;                  /*!< @brief Name of the file to dump to.  */
+	unsigned rotate_seconds;        /*!< @brief File duration, 0 unlimited.   */
+	unsigned long rotate_bytes;     /*!< @brief File size, 0 unlimited.       */
+	enum writer_compression compression; /*!< @brief Output compression.     */
 	int count;                      /*!< @brief Number of packets to capture. */
-	pcap_t *interface;              /*!< @brief pcap interface to capture on. */
-} current_session = { DEFAULT_OPTIONS, PCAP_STDOUT, PCAP_INFINITE_COUNT, NULL };
+	char *ring_name;                /*!< @brief Shared ring to publish to.    */
+	unsigned long ring_size;        /*!< @brief Ring data area size, bytes.   */
+	unsigned thread_count;          /*!< @brief Number of capture threads.    */
+	struct capture_thread *threads; /*!< @brief The capture threads.          */
+} current_session = { DEFAULT_OPTIONS, PCAP_STDOUT, 0, 0, WRITER_PLAIN,
+	PCAP_INFINITE_COUNT, NULL, PACKET_RING_DEFAULT_SIZE, 1, NULL };
 /* -------------------------------------------------------------------------- */
 /*!
  * @brief Singal handler that stops capture.
@@ -74,44 +127,236 @@ struct capture_session {
 void stop_loop(int signum)
 {
 	(void) signum;
-	if (current_session.interface)
-		pcap_breakloop( current_session.interface );
+	for (unsigned i = 0; i < current_session.thread_count; ++i)
+		if (current_session.threads[i].interface)
+			pcap_breakloop( current_session.threads[i].interface );
 }
 /* -------------------------------------------------------------------------- */
 /*!
- * @brief The main function.
- * @param argc Argument count
- * @param argv Argument vector
+ * @brief Creates the shared memory ring.
+ * @param name Name of the shared memory object
+ * @param size Requested data area size, rounded up to a power of two
+ * @param datalink Link type of the packets
+ * @param snaplen Maximum captured length
+ * @return The mapped ring, NULL on failure
  *
- * Setups capture and uses stdout as dump file.
+ * Replaces an object of the same name left by a previous run.
  */
-int main( int argc, char **argv )
+static struct packet_ring_header *ring_create( const char *name,
+	unsigned long size, int datalink, int snaplen )
 {
-	if (argc != 2)
-		return fprintf(stderr, WRONG_PARAM_COUNT, *argv ), 1;
+	uint64_t area = 4096;
+	while (area < size)
+		area <<= 1;
+
+	shm_unlink( name );
+	const int fd = shm_open( name, O_CREAT | O_EXCL | O_RDWR, 0600 );
+	if (fd < 0)
+		return NULL;
+	const size_t total = sizeof(struct packet_ring_header) + area;
+	void *map = ftruncate( fd, total ) == 0 ? mmap( NULL, total,
+		PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 ) : MAP_FAILED;
+	close( fd );
+	if (map == MAP_FAILED) {
+		shm_unlink( name );
+		return NULL;
+	}
 
+	struct packet_ring_header *ring = map;
+	memset( ring, 0, sizeof(*ring) );
+	ring->version = PACKET_RING_VERSION;
+	ring->datalink = datalink;
+	ring->size = area;
+	ring->snaplen = snaplen;
+	/* consumers check the magic before anything else */
+	__atomic_store_n( &ring->magic, PACKET_RING_MAGIC, __ATOMIC_RELEASE );
+	return ring;
+}
+/* -------------------------------------------------------------------------- */
+/*!
+ * @brief Closes the ring and reports its counters.
+ * @param ring Ring created by ring_create()
+ * @param name Name of the shared memory object
+ *
+ * An attached consumer reads the rest of the ring and ends.
+ */
+static void ring_close( struct packet_ring_header *ring, const char *name )
+{
+	__atomic_store_n( &ring->closed, 1, __ATOMIC_RELEASE );
+	fprintf( stderr, "Published %llu packets, dropped %llu\n",
+		(unsigned long long) ring->published,
+		(unsigned long long) ring->dropped );
+	munmap( ring, sizeof(*ring) + ring->size );
+	shm_unlink( name );
+}
+/* -------------------------------------------------------------------------- */
+/*!
+ * @brief pcap_loop callback queueing packets for the thread's writer.
+ * @param user The capture_thread
+ * @param header Packet header
+ * @param bytes Packet data
+ */
+static void thread_dump( u_char *user, const struct pcap_pkthdr *header,
+	const u_char *bytes )
+{
+	struct capture_thread *thread = (struct capture_thread *) user;
+	++thread->packets;
+	thread->bytes += header->len;
+	writer_packet( thread->writer, header, bytes );
+}
+/* -------------------------------------------------------------------------- */
+/*!
+ * @brief pcap_loop callback publishing packets into the ring.
+ * @param user The capture_thread
+ * @param header Packet header
+ * @param bytes Packet data
+ */
+static void thread_publish( u_char *user, const struct pcap_pkthdr *header,
+	const u_char *bytes )
+{
+	struct capture_thread *thread = (struct capture_thread *) user;
+	++thread->packets;
+	thread->bytes += header->len;
+	packet_ring_put( thread->ring, header->ts.tv_sec, header->ts.tv_usec,
+		bytes, header->caplen, header->len );
+}
+/* -------------------------------------------------------------------------- */
+/*!
+ * @brief Runs the capture of one thread until it is stopped.
+ * @param arg The capture_thread
+ * @return NULL
+ */
+static void *thread_run( void *arg )
+{
+	struct capture_thread *thread = arg;
+	/* returns at least every read timeout to let the writer rotate */
+	while (pcap_dispatch( thread->interface, current_session.count,
+	  thread->ring ? thread_publish : thread_dump, (u_char *) thread ) >= 0)
+		if (thread->writer)
+			writer_tick( thread->writer, time( NULL ) );
+	return NULL;
+}
+/* -------------------------------------------------------------------------- */
+/*!
+ * @brief Opens the capture socket and the writer of one thread.
+ * @param thread Zeroed capture_thread
+ * @param index Index of the thread
+ * @return 0 on success, 1 on failure
+ *
+ * With more threads the sockets join one PACKET_FANOUT group in hash mode,
+ * the kernel then delivers all packets of a flow to the same socket.
+ * Fragments are reassembled for hashing so they follow their flow.
+ */
+static int thread_open( struct capture_thread *thread, unsigned index )
+{
 	char errbuff[PCAP_ERRBUF_SIZE];
 	const struct capture_options *options = &(current_session.options);
 
-	current_session.options.interface = argv[1];
+	thread->interface = pcap_create( options->interface, errbuff );
+	TEST_NOT_NULL(thread->interface, "Opening interface", errbuff );
 
-	current_session.interface =
-		pcap_open_live( options->interface, options->snaplen, options->promisc_flag,
-			options->timeout, errbuff );
-	TEST_NOT_NULL(current_session.interface, "Opening interface", errbuff );
+	pcap_set_snaplen( thread->interface, options->snaplen );
+	pcap_set_promisc( thread->interface, options->promisc_flag );
+	pcap_set_timeout( thread->interface, options->timeout );
+	if (options->buffer_size)
+		pcap_set_buffer_size( thread->interface, options->buffer_size );
+	int res = pcap_activate( thread->interface );
+	if (res > 0) {
+		fprintf( stderr, "Activating interface: %s\n",
+			pcap_geterr( thread->interface ) );
+		res = 0;
+	}
+	TEST_ERROR(res, "Activating interface", pcap_geterr( thread->interface ));
 
-	pcap_dumper_t* dumper =
-		pcap_dump_open( current_session.interface, current_session.outfile );
-	TEST_NOT_NULL(dumper, "Opening dumpfile", errbuff );
+	if (current_session.thread_count > 1) {
+		/* all sockets of this process share the group id */
+		const int fanout = (getpid() & 0xffff) |
+			(PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16;
+		res = setsockopt( pcap_fileno( thread->interface ), SOL_PACKET,
+			PACKET_FANOUT, &fanout, sizeof(fanout) );
+		TEST_ERROR(res, "Joining fanout group", strerror( errno ));
+	}
 
 	struct bpf_program filter;
-	int res =
-		pcap_compile( current_session.interface, &filter,
+	res =
+		pcap_compile( thread->interface, &filter,
 			PCAP_FILTER_DNS_QUERY, PCAP_FILTER_OPTIMIZE, PCAP_NETMASK_UNKNOWN );
-	TEST_ERROR(res, "Compiling filter", errbuff);
+	TEST_ERROR(res, "Compiling filter", pcap_geterr( thread->interface ));
+
+	res = pcap_setfilter( thread->interface, &filter );
+	pcap_freecode( &filter );
+	TEST_ERROR(res, "Setting filter", pcap_geterr( thread->interface ));
 
-	res = pcap_setfilter( current_session.interface, &filter );
-	TEST_ERROR(res, "Setting filter", errbuff);
+	if (current_session.ring_name) {
+		thread->ring = ring_create( current_session.ring_name,
+			current_session.ring_size,
+			pcap_datalink( thread->interface ), options->snaplen );
+		TEST_NOT_NULL(thread->ring, "Creating ring", strerror( errno ) );
+		return 0;
+	}
+
+	const struct writer_options output = {
+		current_session.outfile,
+		current_session.thread_count > 1 ? (int) index : -1,
+		current_session.rotate_seconds,
+		current_session.rotate_bytes,
+		current_session.compression,
+		pcap_datalink( thread->interface ),
+		options->snaplen
+	};
+	thread->writer = writer_open( &output );
+	TEST_NOT_NULL(thread->writer, "Opening dumpfile", strerror( errno ) );
+	return 0;
+}
+/* -------------------------------------------------------------------------- */
+/*!
+ * @brief Reports the counters of one thread.
+ * @param thread The capture_thread
+ * @param index Index of the thread
+ * @param seconds Duration of the capture
+ */
+static void thread_report( struct capture_thread *thread, unsigned index,
+	double seconds )
+{
+	struct pcap_stat stats;
+	memset( &stats, 0, sizeof(stats) );
+	pcap_stats( thread->interface, &stats );
+	if (seconds <= 0)
+		seconds = 1;
+	fprintf( stderr, "Thread %u: captured %llu packets (%.0f packets/s, "
+		"%.2f Mbit/s), dropped %u by kernel, %u by interface, "
+		"%llu by writer\n", index,
+		thread->packets, thread->packets / seconds,
+		thread->bytes * 8 / seconds / 1e6, stats.ps_drop, stats.ps_ifdrop,
+		thread->writer ? writer_dropped( thread->writer ) : 0ULL );
+}
+/* -------------------------------------------------------------------------- */
+/*!
+ * @brief Closes the writer and the socket of one thread.
+ * @param thread The capture_thread
+ */
+static void thread_close( struct capture_thread *thread )
+{
+	if (thread->ring)
+		ring_close( thread->ring, current_session.ring_name );
+	if (thread->writer)
+		writer_close( thread->writer );
+	if (thread->interface)
+		pcap_close( thread->interface );
+}
+/* -------------------------------------------------------------------------- */
+/*!
+ * @brief Opens the capture threads and runs them until stopped.
+ * @return 0 on success, 1 if a thread failed to open
+ *
+ * The first thread runs the capture in the calling thread.
+ */
+static int capture( void )
+{
+	unsigned opened = 0;
+	int res = 0;
+	for (; res == 0 && opened < current_session.thread_count; ++opened)
+		res = thread_open( &current_session.threads[opened], opened );
 
 	struct sigaction action;
 	memset( &action, 0, sizeof(struct sigaction) );
@@ -121,10 +366,115 @@ int main( int argc, char **argv )
 	sigaction( SIGHUP, &action, NULL );
 	sigaction( SIGTERM, &action, NULL );
 
-	pcap_loop( current_session.interface, current_session.count,
-		pcap_dump, (u_char *) dumper );
+	struct timespec start, end;
+	clock_gettime( CLOCK_MONOTONIC, &start );
+	unsigned started = res == 0 ? 1 : 0;
+	for (; res == 0 && started < current_session.thread_count; ++started) {
+		res = pthread_create( &current_session.threads[started].thread,
+			NULL, thread_run, &current_session.threads[started] );
+		if (res) {
+			fprintf( stderr, NO_CAN_DO_ERR, "Starting thread", res,
+				strerror( res ) );
+			stop_loop( 0 );
+		}
+	}
+	if (started)
+		thread_run( &current_session.threads[0] );
+	for (unsigned i = 1; i < started; ++i)
+		pthread_join( current_session.threads[i].thread, NULL );
+	clock_gettime( CLOCK_MONOTONIC, &end );
+
+	const double seconds = (end.tv_sec - start.tv_sec) +
+		(end.tv_nsec - start.tv_nsec) / 1e9;
+	for (unsigned i = 0; i < started; ++i)
+		thread_report( &current_session.threads[i], i, seconds );
+	for (unsigned i = 0; i < opened; ++i)
+		thread_close( &current_session.threads[i] );
+	return res ? 1 : 0;
+}
+/* -------------------------------------------------------------------------- */
+/*!
+ * @brief The main function.
+ * @param argc Argument count
+ * @param argv Argument vector
+ *
+ * Setups capture and uses stdout as dump file, or the shared memory ring.
+ */
+int main( int argc, char **argv )
+{
+	int opt;
+	while ((opt = getopt( argc, argv, "t:w:G:C:z:B:R:S:" )) != -1) {
+		switch (opt) {
+		case 't':
+			current_session.thread_count = strtoul( optarg, NULL, 10 );
+			if (current_session.thread_count
+			  && current_session.thread_count <= MAX_THREADS)
+				break;
+			goto usage;
+		case 'w':
+			current_session.outfile = optarg;
+			break;
+		case 'G':
+			current_session.rotate_seconds = strtoul( optarg, NULL, 10 );
+			if (current_session.rotate_seconds)
+				break;
+			goto usage;
+		case 'C':
+			current_session.rotate_bytes = strtoul( optarg, NULL, 10 ) << 20;
+			if (current_session.rotate_bytes)
+				break;
+			goto usage;
+		case 'z':
+#ifdef HAVE_LIBZ
+			if (strcmp( optarg, "gzip" ) == 0) {
+				current_session.compression = WRITER_GZIP;
+				break;
+			}
+#endif
+#ifdef HAVE_LIBZSTD
+			if (strcmp( optarg, "zstd" ) == 0) {
+				current_session.compression = WRITER_ZSTD;
+				break;
+			}
+#endif
+			goto usage;
+		case 'B':
+			current_session.options.buffer_size =
+				strtoul( optarg, NULL, 10 ) << 20;
+			if (current_session.options.buffer_size > 0)
+				break;
+			goto usage;
+		case 'R':
+			current_session.ring_name = optarg;
+			break;
+		case 'S':
+			current_session.ring_size = strtoul( optarg, NULL, 10 ) << 20;
+			if (current_session.ring_size)
+				break;
+			/* fall through */
+		default:
+			goto usage;
+		}
+	}
+	/* a ring has a single producer, stdout a single writer */
+	const int to_stdout = strcmp( current_session.outfile, PCAP_STDOUT ) == 0;
+	const int rotating =
+		current_session.rotate_seconds || current_session.rotate_bytes;
+	if (argc - optind != 1 || (current_session.thread_count > 1
+	  && (current_session.ring_name || to_stdout))
+	  || (rotating && (current_session.ring_name || to_stdout))
+	  || (current_session.compression && current_session.ring_name))
+		goto usage;
+
+	current_session.options.interface = argv[optind];
+	current_session.threads = calloc( current_session.thread_count,
+		sizeof(struct capture_thread) );
+	TEST_NOT_NULL(current_session.threads, "Allocating threads",
+		strerror( errno ) );
 
-	pcap_dump_close( dumper );
+	return capture();
 
-	return 0;
+usage:
+	return fprintf(stderr, WRONG_PARAM_COUNT, *argv,
+		PACKET_RING_DEFAULT_SIZE >> 20 ), 1;
 }
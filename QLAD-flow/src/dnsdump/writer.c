@@ -0,0 +1,576 @@
+/*
+ * This file is part of the DNS traffic analyser project.
+ *
+ * Copyright (C) 2011 CZ.NIC, z.s.p.o.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+#endif
+
+#include "pcap_defines.h"
+#include "writer.h"
+
+/*! @brief Size of a block handed to the writer thread. */
+#define WRITER_BLOCK_SIZE (4UL << 20)
+/*! @brief Number of blocks, one is filled while the other is written. */
+#define WRITER_BLOCKS 2
+/*! @brief Longest time packets wait in a partially filled block. */
+#define WRITER_FLUSH_SECONDS 1
+/*! @brief Compressed output chunk of gzip. */
+#define WRITER_GZIP_CHUNK (256UL << 10)
+
+/*! @brief pcap file header. */
+struct pcap_file_header_ {
+	uint32_t magic;
+	uint16_t version_major;
+	uint16_t version_minor;
+	int32_t thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t linktype;
+};
+
+/*! @brief pcap record header, the in-memory pcap_pkthdr is wider. */
+struct pcap_record_header_ {
+	uint32_t sec;
+	uint32_t usec;
+	uint32_t caplen;
+	uint32_t len;
+};
+
+/*!
+ * @struct writer_block
+ * @brief Packets of one file waiting to be written.
+ */
+struct writer_block {
+	unsigned char *data;     /*!< @brief WRITER_BLOCK_SIZE bytes.       */
+	size_t used;             /*!< @brief Bytes filled.                  */
+	unsigned long long file; /*!< @brief Sequence number of the file.   */
+	time_t start;            /*!< @brief Start time of the file.        */
+};
+
+/*!
+ * @struct writer
+ * @brief State shared by the capture thread and the writer thread.
+ *
+ * Blocks are filled and written in a cycle. The blocks between written
+ * and submitted belong to the writer thread, the rest to the capture.
+ */
+struct writer {
+	struct writer_options options;              /*!< @brief Parameters. */
+	struct writer_block blocks[WRITER_BLOCKS];  /*!< @brief The blocks. */
+	pthread_t thread;        /*!< @brief The writer thread.             */
+	pthread_mutex_t mutex;   /*!< @brief Guards the counters below.     */
+	pthread_cond_t ready;    /*!< @brief Signals a submitted block.     */
+	unsigned submitted;      /*!< @brief Blocks handed to the thread.   */
+	unsigned written;        /*!< @brief Blocks written by the thread.  */
+	int closing;             /*!< @brief No more blocks will come.      */
+
+	/* capture thread */
+	struct writer_block *current; /*!< @brief Block filled, NULL if none. */
+	time_t current_time;     /*!< @brief First data in the block.       */
+	unsigned long long file; /*!< @brief Sequence number of the file.   */
+	time_t file_start;       /*!< @brief Start time of the file.        */
+	time_t file_end;         /*!< @brief Time to rotate the file.       */
+	unsigned long file_bytes;/*!< @brief pcap bytes of the file.        */
+	int header_due;          /*!< @brief File header not queued yet.    */
+	unsigned long long dropped; /*!< @brief Packets without a block.    */
+
+	/* writer thread */
+	int fd;                  /*!< @brief Output, -1 if none.            */
+	unsigned long long fd_file; /*!< @brief Sequence number of fd.      */
+	char name[PATH_MAX];     /*!< @brief Final name of the file.        */
+	char temp[PATH_MAX];     /*!< @brief Name while being written.      */
+	unsigned char *output;   /*!< @brief Compressed data.               */
+	size_t output_size;      /*!< @brief Size of output.                */
+#ifdef HAVE_LIBZ
+	z_stream gzip;           /*!< @brief gzip stream of the file.       */
+#endif
+#ifdef HAVE_LIBZSTD
+	ZSTD_CCtx *zstd;         /*!< @brief zstd context.                  */
+#endif
+};
+/* -------------------------------------------------------------------------- */
+/*!
+ * @brief Builds the final and the temporary name of a file.
+ * @param writer The writer
+ * @param file Sequence number of the file
+ * @param start Start time of the file
+ * @return 0 on success, -1 if the names are too long
+ */
+static int file_names( struct writer *writer, unsigned long long file,
+	time_t start )
+{
+	const struct writer_options *options = &(writer->options);
+	size_t len = 0;
+	if (options->rotate_seconds || options->rotate_bytes) {
+		struct tm tm;
+		localtime_r( &start, &tm );
+		len = strftime( writer->name, sizeof(writer->name), options->pattern,
+			&tm );
+	}
+	if (len == 0)
+		len = snprintf( writer->name, sizeof(writer->name), "%s",
+			options->pattern );
+	if (options->index >= 0 && len < sizeof(writer->name))
+		len += snprintf( writer->name + len, sizeof(writer->name) - len, ".%d",
+			options->index );
+	if (options->rotate_bytes && len < sizeof(writer->name))
+		len += snprintf( writer->name + len, sizeof(writer->name) - len,
+			".%llu", file );
+	if (len < sizeof(writer->name))
+		len += snprintf( writer->name + len, sizeof(writer->name) - len, "%s",
+			options->compression == WRITER_GZIP ? ".gz" :
+			options->compression == WRITER_ZSTD ? ".zst" : "" );
+
+	/* hidden in the same directory, rename() stays atomic */
+	const char *base = strrchr( writer->name, '/' );
+	base = base ? base + 1 : writer->name;
+	if (len >= sizeof(writer->name) || snprintf( writer->temp,
+	  sizeof(writer->temp), "%.*s.%s.part", (int) (base - writer->name),
+	  writer->name, base ) >= (int) sizeof(writer->temp)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	return 0;
+}
+/* -------------------------------------------------------------------------- */
+/*!
+ * @brief Opens a file for the writer thread.
+ * @param writer The writer
+ * @param file Sequence number of the file
+ * @param start Start time of the file
+ * @return 0 on success, -1 on failure with errno set
+ */
+static int file_open( struct writer *writer, unsigned long long file,
+	time_t start )
+{
+	writer->fd_file = file;
+	if (strcmp( writer->options.pattern, PCAP_STDOUT ) == 0) {
+		writer->fd = STDOUT_FILENO;
+		snprintf( writer->name, sizeof(writer->name), "stdout" );
+		writer->temp[0] = '\0';
+	} else {
+		if (file_names( writer, file, start ) != 0)
+			return -1;
+		writer->fd = open( writer->temp, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+		if (writer->fd < 0)
+			return -1;
+	}
+
+#ifdef HAVE_LIBZ
+	if (writer->options.compression == WRITER_GZIP) {
+		memset( &writer->gzip, 0, sizeof(writer->gzip) );
+		/* 16 selects the gzip format */
+		if (deflateInit2( &writer->gzip, Z_BEST_SPEED, Z_DEFLATED,
+		  MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY ) != Z_OK) {
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+#endif
+	return 0;
+}
+/* -------------------------------------------------------------------------- */
+/*!
+ * @brief Writes data to the current file.
+ * @param writer The writer
+ * @param data Data to write
+ * @param size Number of bytes
+ *
+ * On failure the rest of the file is discarded.
+ */
+static void file_write( struct writer *writer, const unsigned char *data,
+	size_t size )
+{
+	while (size && writer->fd >= 0) {
+		const ssize_t done = write( writer->fd, data, size );
+		if (done < 0 && errno == EINTR)
+			continue;
+		if (done < 0) {
+			fprintf( stderr, "Writing %s failed: %s\n", writer->name,
+				strerror( errno ) );
+			if (writer->fd != STDOUT_FILENO)
+				close( writer->fd );
+			writer->fd = -1;
+			return;
+		}
+		data += done;
+		size -= done;
+	}
+}
+/* -------------------------------------------------------------------------- */
+/*!
+ * @brief Finishes the current file and publishes it under its final name.
+ * @param writer The writer
+ */
+static void file_close( struct writer *writer )
+{
+#ifdef HAVE_LIBZ
+	if (writer->options.compression == WRITER_GZIP && writer->fd >= 0) {
+		int res;
+		do {
+			writer->gzip.next_out = writer->output;
+			writer->gzip.avail_out = writer->output_size;
+			res = deflate( &writer->gzip, Z_FINISH );
+			file_write( writer, writer->output,
+				writer->output_size - writer->gzip.avail_out );
+		} while (res == Z_OK);
+	}
+	if (writer->options.compression == WRITER_GZIP)
+		deflateEnd( &writer->gzip );
+#endif
+	if (writer->fd < 0 || writer->fd == STDOUT_FILENO) {
+		writer->fd = -1;
+		return;
+	}
+	if (close( writer->fd ) != 0 || rename( writer->temp, writer->name ) != 0)
+		fprintf( stderr, "Finishing %s failed: %s\n", writer->name,
+			strerror( errno ) );
+	writer->fd = -1;
+}
+/* -------------------------------------------------------------------------- */
+/*!
+ * @brief Compresses and writes one block.
+ * @param writer The writer
+ * @param block The block
+ */
+static void block_write( struct writer *writer, struct writer_block *block )
+{
+	switch (writer->options.compression) {
+#ifdef HAVE_LIBZ
+	case WRITER_GZIP:
+		writer->gzip.next_in = block->data;
+		writer->gzip.avail_in = block->used;
+		do {
+			writer->gzip.next_out = writer->output;
+			writer->gzip.avail_out = writer->output_size;
+			/* a readable prefix even while the file is being written */
+			deflate( &writer->gzip, Z_SYNC_FLUSH );
+			file_write( writer, writer->output,
+				writer->output_size - writer->gzip.avail_out );
+		} while (writer->gzip.avail_out == 0);
+		break;
+#endif
+#ifdef HAVE_LIBZSTD
+	case WRITER_ZSTD: {
+		/* a frame per block, the analyser decompresses them in parallel */
+		const size_t size = ZSTD_compressCCtx( writer->zstd, writer->output,
+			writer->output_size, block->data, block->used,
+			ZSTD_CLEVEL_DEFAULT );
+		if (ZSTD_isError( size ))
+			fprintf( stderr, "Compressing %s failed: %s\n", writer->name,
+				ZSTD_getErrorName( size ) );
+		else
+			file_write( writer, writer->output, size );
+		break;
+	}
+#endif
+	default:
+		file_write( writer, block->data, block->used );
+		break;
+	}
+}
+/* -------------------------------------------------------------------------- */
+/*!
+ * @brief The writer thread, writes the submitted blocks in order.
+ * @param arg The writer
+ * @return NULL
+ */
+static void *writer_run( void *arg )
+{
+	struct writer *writer = arg;
+	for (;;) {
+		pthread_mutex_lock( &writer->mutex );
+		while (writer->written == writer->submitted && !writer->closing)
+			pthread_cond_wait( &writer->ready, &writer->mutex );
+		const int idle = writer->written == writer->submitted;
+		pthread_mutex_unlock( &writer->mutex );
+		if (idle)
+			break;
+
+		struct writer_block *block =
+			&writer->blocks[writer->written % WRITER_BLOCKS];
+		if (block->file != writer->fd_file) {
+			file_close( writer );
+			if (file_open( writer, block->file, block->start ) != 0)
+				fprintf( stderr, "Opening %s failed: %s\n", writer->temp,
+					strerror( errno ) );
+		}
+		if (writer->fd >= 0)
+			block_write( writer, block );
+		block->used = 0;
+
+		pthread_mutex_lock( &writer->mutex );
+		++writer->written;
+		pthread_mutex_unlock( &writer->mutex );
+	}
+	file_close( writer );
+	return NULL;
+}
+/* -------------------------------------------------------------------------- */
+/*!
+ * @brief Takes the next block for the capture if it is free.
+ * @param writer The writer
+ * @return 1 if there is a current block, 0 otherwise
+ */
+static int block_take( struct writer *writer )
+{
+	pthread_mutex_lock( &writer->mutex );
+	if (writer->submitted - writer->written < WRITER_BLOCKS)
+		writer->current = &writer->blocks[writer->submitted % WRITER_BLOCKS];
+	pthread_mutex_unlock( &writer->mutex );
+	return writer->current != NULL;
+}
+/* -------------------------------------------------------------------------- */
+/*!
+ * @brief Hands the current block to the writer thread.
+ * @param writer The writer
+ */
+static void block_submit( struct writer *writer )
+{
+	if (!writer->current || !writer->current->used)
+		return;
+	pthread_mutex_lock( &writer->mutex );
+	++writer->submitted;
+	pthread_cond_signal( &writer->ready );
+	pthread_mutex_unlock( &writer->mutex );
+	writer->current = NULL;
+}
+/* -------------------------------------------------------------------------- */
+/*!
+ * @brief Reserves space in the current block.
+ * @param writer The writer
+ * @param size Number of bytes
+ * @param now Time of the data
+ * @return Space for the data, NULL if no block is free
+ */
+static unsigned char *block_reserve( struct writer *writer, size_t size,
+	time_t now )
+{
+	if (writer->current && writer->current->used + size > WRITER_BLOCK_SIZE)
+		block_submit( writer );
+	if (!writer->current && !block_take( writer ))
+		return NULL;
+
+	struct writer_block *block = writer->current;
+	if (block->used == 0) {
+		block->file = writer->file;
+		block->start = writer->file_start;
+		writer->current_time = now;
+	}
+	block->used += size;
+	writer->file_bytes += size;
+	return block->data + block->used - size;
+}
+/* -------------------------------------------------------------------------- */
+/*!
+ * @brief Queues the pcap file header if it is due.
+ * @param writer The writer
+ * @param now Current time
+ * @return 1 if the header is queued, 0 if no block is free
+ */
+static int header_queue( struct writer *writer, time_t now )
+{
+	if (!writer->header_due)
+		return 1;
+	struct pcap_file_header_ *header = (struct pcap_file_header_ *)
+		block_reserve( writer, sizeof(*header), now );
+	if (!header)
+		return 0;
+	header->magic = 0xa1b2c3d4;
+	header->version_major = 2;
+	header->version_minor = 4;
+	header->thiszone = 0;
+	header->sigfigs = 0;
+	header->snaplen = writer->options.snaplen;
+	header->linktype = writer->options.datalink;
+	writer->header_due = 0;
+	return 1;
+}
+/* -------------------------------------------------------------------------- */
+/*!
+ * @brief Starts a new file.
+ * @param writer The writer
+ * @param now Time of the first packet
+ */
+static void file_start( struct writer *writer, time_t now )
+{
+	const unsigned seconds = writer->options.rotate_seconds;
+	block_submit( writer );
+	++writer->file;
+	writer->file_start = seconds ? now - now % seconds : now;
+	writer->file_end = writer->file_start + seconds;
+	writer->file_bytes = 0;
+	writer->header_due = 1;
+	header_queue( writer, now );
+}
+/* -------------------------------------------------------------------------- */
+struct writer *writer_open( const struct writer_options *options )
+{
+#ifndef HAVE_LIBZ
+	if (options->compression == WRITER_GZIP) {
+		errno = ENOTSUP;
+		return NULL;
+	}
+#endif
+#ifndef HAVE_LIBZSTD
+	if (options->compression == WRITER_ZSTD) {
+		errno = ENOTSUP;
+		return NULL;
+	}
+#endif
+
+	struct writer *writer = calloc( 1, sizeof(*writer) );
+	if (!writer)
+		return NULL;
+	writer->options = *options;
+	writer->fd = -1;
+	for (unsigned i = 0; i < WRITER_BLOCKS; ++i)
+		if (!(writer->blocks[i].data = malloc( WRITER_BLOCK_SIZE )))
+			goto fail;
+
+#ifdef HAVE_LIBZ
+	if (options->compression == WRITER_GZIP)
+		writer->output_size = WRITER_GZIP_CHUNK;
+#endif
+#ifdef HAVE_LIBZSTD
+	if (options->compression == WRITER_ZSTD) {
+		writer->output_size = ZSTD_compressBound( WRITER_BLOCK_SIZE );
+		if (!(writer->zstd = ZSTD_createCCtx()))
+			goto fail;
+	}
+#endif
+	if (writer->output_size && !(writer->output = malloc( writer->output_size )))
+		goto fail;
+
+	/* the first file is opened here to report errors right away */
+	const time_t now = time( NULL );
+	const unsigned seconds = options->rotate_seconds;
+	writer->file_start = seconds ? now - now % seconds : now;
+	writer->file_end = writer->file_start + seconds;
+	writer->header_due = 1;
+	if (file_open( writer, 0, writer->file_start ) != 0)
+		goto fail;
+	header_queue( writer, now );
+
+	pthread_mutex_init( &writer->mutex, NULL );
+	pthread_cond_init( &writer->ready, NULL );
+	const int res = pthread_create( &writer->thread, NULL, writer_run, writer );
+	if (res == 0)
+		return writer;
+	pthread_cond_destroy( &writer->ready );
+	pthread_mutex_destroy( &writer->mutex );
+	errno = res;
+
+fail: {
+	const int error = errno;
+	if (writer->fd >= 0 && writer->fd != STDOUT_FILENO) {
+		close( writer->fd );
+		unlink( writer->temp );
+	}
+#ifdef HAVE_LIBZ
+	if (options->compression == WRITER_GZIP)
+		deflateEnd( &writer->gzip );
+#endif
+#ifdef HAVE_LIBZSTD
+	ZSTD_freeCCtx( writer->zstd );
+#endif
+	for (unsigned i = 0; i < WRITER_BLOCKS; ++i)
+		free( writer->blocks[i].data );
+	free( writer->output );
+	free( writer );
+	errno = error;
+	return NULL;
+	}
+}
+/* -------------------------------------------------------------------------- */
+int writer_packet( struct writer *writer, const struct pcap_pkthdr *header,
+	const u_char *bytes )
+{
+	const time_t now = header->ts.tv_sec;
+	const size_t size = sizeof(struct pcap_record_header_) + header->caplen;
+	const struct writer_options *options = &(writer->options);
+	if ((options->rotate_seconds && now >= writer->file_end)
+	  || (options->rotate_bytes && writer->file_bytes > sizeof(
+	    struct pcap_file_header_) && writer->file_bytes + size >
+	    options->rotate_bytes))
+		file_start( writer, now );
+
+	unsigned char *data = header_queue( writer, now )
+		? block_reserve( writer, size, now ) : NULL;
+	if (!data) {
+		++writer->dropped;
+		return 0;
+	}
+	struct pcap_record_header_ record = { header->ts.tv_sec,
+		header->ts.tv_usec, header->caplen, header->len };
+	memcpy( data, &record, sizeof(record) );
+	memcpy( data + sizeof(record), bytes, header->caplen );
+	return 1;
+}
+/* -------------------------------------------------------------------------- */
+void writer_tick( struct writer *writer, time_t now )
+{
+	if (writer->options.rotate_seconds && now >= writer->file_end)
+		file_start( writer, now );
+	else if (writer->current && writer->current->used
+	  && now - writer->current_time >= WRITER_FLUSH_SECONDS)
+		block_submit( writer );
+}
+/* -------------------------------------------------------------------------- */
+unsigned long long writer_dropped( const struct writer *writer )
+{
+	return writer->dropped;
+}
+/* -------------------------------------------------------------------------- */
+void writer_close( struct writer *writer )
+{
+	block_submit( writer );
+	pthread_mutex_lock( &writer->mutex );
+	writer->closing = 1;
+	pthread_cond_signal( &writer->ready );
+	pthread_mutex_unlock( &writer->mutex );
+	pthread_join( writer->thread, NULL );
+
+	pthread_cond_destroy( &writer->ready );
+	pthread_mutex_destroy( &writer->mutex );
+#ifdef HAVE_LIBZSTD
+	ZSTD_freeCCtx( writer->zstd );
+#endif
+	for (unsigned i = 0; i < WRITER_BLOCKS; ++i)
+		free( writer->blocks[i].data );
+	free( writer->output );
+	free( writer );
+}
@@ -0,0 +1,106 @@
+/*
+ * This file is part of the DNS traffic analyser project.
+ *
+ * Copyright (C) 2011 CZ.NIC, z.s.p.o.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _WRITER_H_
+#define _WRITER_H_
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <pcap.h>
+#include <time.h>
+
+/*
+ * Asynchronous pcap file writer.
+ *
+ * The capture thread copies packets into large blocks, a writer thread
+ * compresses the full blocks and writes them out, so the capture never
+ * waits for the disk or for a stalled pipe. When no block is free the
+ * packet is dropped and counted instead.
+ *
+ * Files are rotated by time and by size. A file is written under a hidden
+ * temporary name in the target directory and renamed once complete, so a
+ * finished file appears atomically.
+ */
+
+/*! @brief Compression of the written files. */
+enum writer_compression {
+	WRITER_PLAIN, /*!< @brief Uncompressed pcap. */
+	WRITER_GZIP,  /*!< @brief gzip, suffix ".gz". */
+	WRITER_ZSTD   /*!< @brief zstd, suffix ".zst", a frame per block. */
+};
+
+/*!
+ * @struct writer_options
+ * @brief Parameters of a writer.
+ */
+struct writer_options {
+	const char *pattern;        /*!< @brief File name, "-" for stdout.     */
+	int index;                  /*!< @brief Appended to names, -1 for none. */
+	unsigned rotate_seconds;    /*!< @brief File duration, 0 for no limit. */
+	unsigned long rotate_bytes; /*!< @brief File pcap size, 0 for no limit. */
+	enum writer_compression compression; /*!< @brief Output compression. */
+	int datalink;               /*!< @brief pcap DLT_* of the packets.     */
+	int snaplen;                /*!< @brief Maximum captured length.       */
+};
+
+struct writer;
+
+/*!
+ * @brief Opens the first file and starts the writer thread.
+ * @param options Writer parameters, the pattern must outlive the writer
+ * @return The writer, NULL on failure with errno set
+ *
+ * When rotating, the pattern is passed through strftime() with the start
+ * time of each file, rotation by size appends a sequence number. The thread
+ * index and the compression suffix follow.
+ */
+struct writer *writer_open( const struct writer_options *options );
+
+/*!
+ * @brief Queues a packet, called by the capture thread only.
+ * @param writer The writer
+ * @param header Packet header
+ * @param bytes Packet data
+ * @return 1 if queued, 0 if dropped for lack of free blocks
+ */
+int writer_packet( struct writer *writer, const struct pcap_pkthdr *header,
+	const u_char *bytes );
+
+/*!
+ * @brief Hands over stale data and rotates idle files.
+ * @param writer The writer
+ * @param now Current time
+ *
+ * Called by the capture thread between packet batches, so that quiet
+ * periods neither hold packets back nor keep a file open past its time.
+ */
+void writer_tick( struct writer *writer, time_t now );
+
+/*! @brief Number of packets dropped for lack of free blocks. */
+unsigned long long writer_dropped( const struct writer *writer );
+
+/*!
+ * @brief Writes the queued data, finishes the last file, stops the thread.
+ * @param writer The writer, freed
+ */
+void writer_close( struct writer *writer );
+
+#endif /* _WRITER_H_ */
@@ -17,138 +17,544 @@
 // modified 2018-08-02 by Pieter Robberechts in context of implementing QLAD system at DNS Belgium
 // to support continuous anomaly detection fr om S3 bucket
 
+#include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <errno.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
 
 #include <pcap/pcap.h>
 
-unsigned int n;
-pcap_dumper_t *writer;
+/*
+ * The inputs are merged in time-stamp order by a k-way merge over a heap
+ * of readers. Every opened input is decompressed by its own child process
+ * and parsed ahead by its own thread into a few fixed chunks, so the
+ * inputs are decompressed in parallel and each takes bounded memory.
+ *
+ * Inputs are opened in the order of their first packet, only once the
+ * merge reaches it, and never more than max_open at once. Consecutive
+ * captures thus need one or two open files, overlapping captures (e.g.
+ * from several anycast nodes) as many as overlap. The first max_open
+ * inputs stay open after their first packet was probed and are handed to
+ * their reader, the others are decompressed once more when due.
+ */
 
-void process_pcapfile(char *out, char *filename) {
-    char errbuf[PCAP_ERRBUF_SIZE];
-    unsigned char buf[16];
-    char cmd[256];
-    FILE *fd;
-    int ret;
+#define DEFAULT_MAX_OPEN 64
+#define CHUNK_COUNT 3                /* double buffering + one */
+#define CHUNK_SIZE (256 * 1024)
+#define ALIGN(size) (((size) + 7) & ~(size_t) 7)
+
+struct chunk {
+    unsigned char *buffer;
+    size_t size;
+    size_t used;
+};
+
+struct stream {
     pcap_t *p;
+    FILE *pipe;                     /* the decompressor, or NULL */
+};
+
+struct input {
+    char *filename;
+    struct timeval first;           /* time-stamp of the first packet */
+    struct stream kept;             /* left open by probe(), or none */
+    struct pcap_pkthdr header;      /* the first packet of kept */
+    unsigned char *packet;
+};
+
+struct reader {
+    unsigned index;                 /* breaks ties of equal time-stamps */
+    struct stream in;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct chunk chunks[CHUNK_COUNT];
+    unsigned filled;                /* chunks filled by the thread */
+    unsigned consumed;              /* chunks walked by the merge */
+    int done;                       /* the thread reached the end */
+    int stop;                       /* the merge does not need more */
+
+    /* merge side */
+    struct chunk *current;
+    size_t position;
+    size_t record;
+    struct pcap_pkthdr header;
+    const unsigned char *data;
+};
+
+struct input *inputs;
+unsigned input_count, next_input;
+struct reader **heap;
+unsigned heap_size, open_count, kept_count, max_open = DEFAULT_MAX_OPEN;
+unsigned long late;
+
+/*
+ * Opens the file, decompressing it by a child process if needed. Sets
+ * piped for the output of a child, which pclose() has to reap.
+ */
+FILE *open_input(char *filename, int *piped) {
+    unsigned char buf[4];
+    const char *tool = NULL;
+    char *cmd, *c;
+    FILE *fd;
 
-    /*
-     * Open the file, determine if its zipped, and then
-     * reopen with the proper method.
-     */
+    *piped = 0;
     fd = fopen(filename, "r");
     if (fd == NULL) {
       fprintf(stderr, "error reading file %s: %s\n", filename, strerror(errno));
-      exit(1);
-    }
-    ret = fread(buf, 1, 16, fd);
-    if (ret != 16) {
-      if (ferror(fd)) {
-        fprintf(stderr, "error reading dump file: %s", strerror(errno));
-      } else {
-        fprintf(stderr, "truncated input file; tried to read %u bytes, only got %u", 16, ret);
-      }
-      exit(1);
-    }
-    if (((buf[0] == 0x1F) && ((buf[1] == 0x8B) ||
-          (buf[1] == 0x9D))) ||
-          ((buf[0] == 'B') && (buf[1] == 'Z') && (buf[2] == 'h'))) {
-      bzero(cmd, 256);
-      fclose(fd);
-
-      if (buf[0] == 'B') {
-        strncpy(cmd, "bzip2 -dc ", 11);
-      } else {
-        if (buf[1] == 0x8B)
-          strncpy(cmd, "gzip -dc ", 10);
-        else
-          strncpy(cmd, "zcat ", 6);
-      }
+      return NULL;
+    }
+    if (fread(buf, 1, 4, fd) == 4) {
+      if (buf[0] == 0x1F && buf[1] == 0x8B)
+        tool = "gzip -dc ";
+      else if (buf[0] == 0x1F && buf[1] == 0x9D)
+        tool = "zcat ";
+      else if (buf[0] == 'B' && buf[1] == 'Z' && buf[2] == 'h')
+        tool = "bzip2 -dc ";
+      else if (buf[0] == 0x28 && buf[1] == 0xB5 && buf[2] == 0x2F && buf[3] == 0xFD)
+        tool = "zstd -dcq ";
+    }
+    if (tool == NULL) {
+      rewind(fd);
+      return fd;
+    }
+    fclose(fd);
 
-      strncat(cmd, filename, (256 - strlen(cmd)));
+    /* single-quote the name, every ' becomes '\'' */
+    cmd = malloc(strlen(tool) + 4 * strlen(filename) + 3);
+    if (cmd == NULL)
+      return NULL;
+    c = cmd + sprintf(cmd, "%s'", tool);
+    for (; *filename; ++filename) {
+      if (*filename == '\'')
+        c += sprintf(c, "'\\''");
+      else
+        *c++ = *filename;
+    }
+    strcpy(c, "'");
 
-      fd = popen(cmd, "r");
-      if (fd == NULL) {
-        fprintf(stderr, "%s: %s", filename, strerror(errno));
-        exit(1);
-      }
-    } else {
-      /* Cheap mans fseek */
-      fclose(fd);
-      fd = fopen(filename, "r");
-      if (fd == NULL) {
-        fprintf(stderr, "%s: %s", filename, strerror(errno));
-        exit(1);
-      }
+    fd = popen(cmd, "r");
+    if (fd == NULL)
+      fprintf(stderr, "%s: %s\n", cmd, strerror(errno));
+    free(cmd);
+    *piped = fd != NULL;
+    return fd;
+}
+
+/*
+ * Opens the file for pcap. pcap_close() closes the stream it is given by
+ * fclose(), so a decompressor gets a duplicate of the pipe and the pipe
+ * itself stays in the stream for stream_close() to reap the child.
+ * Returns 1 if open, 0 if it is not a pcap file, -1 if it cannot be read.
+ */
+int stream_open(struct stream *s, char *filename) {
+    char errbuf[PCAP_ERRBUF_SIZE];
+    FILE *fd;
+    int piped;
+    int copy;
+
+    s->p = NULL;
+    s->pipe = NULL;
+    fd = open_input(filename, &piped);
+    if (fd == NULL)
+        return -1;
+    if (piped) {
+        s->pipe = fd;
+        copy = dup(fileno(s->pipe));
+        fd = copy == -1 ? NULL : fdopen(copy, "r");
+        if (fd == NULL) {
+            fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+            if (copy != -1)
+                close(copy);
+            pclose(s->pipe);
+            s->pipe = NULL;
+            return -1;
+        }
+    }
+    s->p = pcap_fopen_offline(fd, errbuf);
+    if (! s->p) {
+        fprintf(stderr, "pcap_open_offline(%s) failed: %s\n", filename, errbuf);
+        fclose(fd);
+        if (s->pipe)
+            pclose(s->pipe);
+        s->pipe = NULL;
+        return 0;
     }
+    return 1;
+}
 
-    p = pcap_fopen_offline(fd, errbuf);
-    if (! p) {
-        fprintf(stderr, "pcap_open_offline(%s) failed: %s", filename, errbuf);
-        return;
+/*
+ * Closes the stream and waits for its decompressor.
+ */
+void stream_close(struct stream *s) {
+    pcap_close(s->p);
+    if (s->pipe)
+        pclose(s->pipe);
+    s->p = NULL;
+    s->pipe = NULL;
+}
+
+/*
+ * Reads the first packet of the file, the first max_open files are kept
+ * open for their reader with a copy of the packet.
+ * Returns 1 if found, 0 for no packets, -1 if the file cannot be read.
+ */
+int probe(struct input *input, int *datalink) {
+    struct pcap_pkthdr *h;
+    const unsigned char *data;
+    struct stream s;
+    int found;
+    int ret;
+
+    input->kept.p = NULL;
+    input->kept.pipe = NULL;
+    input->packet = NULL;
+    ret = stream_open(&s, input->filename);
+    if (ret != 1)
+        return ret;
+
+    found = pcap_next_ex(s.p, &h, &data) == 1;
+    *datalink = pcap_datalink(s.p);
+    if (found) {
+        input->first = h->ts;
+        if (kept_count < max_open && (input->packet = malloc(h->caplen ? h->caplen : 1))) {
+            input->header = *h;
+            memcpy(input->packet, data, h->caplen);
+            input->kept = s;
+            kept_count++;
+            return found;
+        }
     }
+    stream_close(&s);
+    return found;
+}
 
-    if (n++ == 0) {
-        writer = pcap_dump_open(p, out);
-        if (! writer) {
-            fprintf(stderr, "pcap_dump_open(%s) failed: %s", filename, pcap_geterr(p));
-            exit(1);
+/*
+ * Reader thread, copies packets into free chunks until the end of file.
+ */
+void *read_ahead(void *arg) {
+    struct reader *r = arg;
+    struct input *input = &inputs[r->index];
+    struct pcap_pkthdr *h = &input->header;
+    const unsigned char *data = input->packet;
+    int pending = data != NULL;   /* the packet read by probe() */
+    int more = 1;
+
+    while (more) {
+        struct chunk *chunk;
+
+        pthread_mutex_lock(&r->lock);
+        while (r->filled - r->consumed == CHUNK_COUNT && !r->stop)
+            pthread_cond_wait(&r->cond, &r->lock);
+        pthread_mutex_unlock(&r->lock);
+        if (r->stop)
+            break;
+
+        chunk = &r->chunks[r->filled % CHUNK_COUNT];
+        chunk->used = 0;
+        for (;;) {
+            size_t size;
+            int ret;
+
+            if (! pending) {
+                ret = pcap_next_ex(r->in.p, &h, &data);
+                if (ret == -1)
+                    fprintf(stderr, "error while reading packet: %s\n", pcap_geterr(r->in.p));
+                if (ret != 1) {
+                    more = 0;
+                    break;
+                }
+            }
+            pending = 0;
+
+            size = ALIGN(sizeof(struct pcap_pkthdr)) + ALIGN(h->caplen);
+            if (chunk->used + size > chunk->size) {
+                if (chunk->used) {
+                    /* keep for the next chunk */
+                    pending = 1;
+                    break;
+                }
+                /* huge packet, make room */
+                chunk->buffer = realloc(chunk->buffer, size);
+                if (chunk->buffer == NULL) {
+                    fprintf(stderr, "out of memory\n");
+                    exit(1);
+                }
+                chunk->size = size;
+            }
+            memcpy(chunk->buffer + chunk->used, h, sizeof(struct pcap_pkthdr));
+            memcpy(chunk->buffer + chunk->used + ALIGN(sizeof(struct pcap_pkthdr)),
+                   data, h->caplen);
+            chunk->used += size;
         }
+
+        pthread_mutex_lock(&r->lock);
+        if (chunk->used)
+            r->filled++;
+        r->done = ! more;
+        pthread_cond_signal(&r->cond);
+        pthread_mutex_unlock(&r->lock);
+    }
+    return NULL;
+}
+
+/*
+ * Moves the reader to its next packet, waiting for the thread if needed.
+ * Returns 0 at the end of file.
+ */
+int advance(struct reader *r) {
+    r->position += r->record;
+    if (r->current && r->position >= r->current->used) {
+        pthread_mutex_lock(&r->lock);
+        r->consumed++;
+        pthread_cond_signal(&r->cond);
+        pthread_mutex_unlock(&r->lock);
+        r->current = NULL;
+    }
+    if (r->current == NULL) {
+        pthread_mutex_lock(&r->lock);
+        while (r->filled == r->consumed && ! r->done)
+            pthread_cond_wait(&r->cond, &r->lock);
+        if (r->filled != r->consumed)
+            r->current = &r->chunks[r->consumed % CHUNK_COUNT];
+        pthread_mutex_unlock(&r->lock);
+        if (r->current == NULL)
+            return 0;
+        r->position = 0;
     }
 
-    while (1) {
-        struct pcap_pkthdr *h;
-        unsigned char *data;
-        int ret;
+    memcpy(&r->header, r->current->buffer + r->position, sizeof(struct pcap_pkthdr));
+    r->data = r->current->buffer + r->position + ALIGN(sizeof(struct pcap_pkthdr));
+    r->record = ALIGN(sizeof(struct pcap_pkthdr)) + ALIGN(r->header.caplen);
+    return 1;
+}
 
-        ret = pcap_next_ex(p, &h, (const unsigned char **)&data);
+/*
+ * Opens the input and starts its reader thread.
+ */
+struct reader *reader_open(unsigned index) {
+    struct input *input = &inputs[index];
+    struct reader *r;
+    unsigned i;
 
-        switch (ret) {
-            case 1:
-                // ok
-                pcap_dump((unsigned char *)writer, h, data);
-                break;
-            case 0:
-                // timeout expired
-                fprintf(stderr, "timeout");
-                break;
-            case -1:
-                // error while reading packet
-                fprintf(stderr, "error while reading packet");
-                break;
-            case -2:
-                // no more packet
-                // fprintf(stderr, "no more packet");
-                goto close_pcap;
-            default:
-                // unkown error
-                fprintf(stderr, "unkown error %d", ret);
-                break;
+    r = calloc(1, sizeof(*r));
+    if (r == NULL)
+        return NULL;
+    r->index = index;
+    if (input->kept.p) {
+        /* probed, its first packet goes first */
+        r->in = input->kept;
+        input->kept.p = NULL;
+        input->kept.pipe = NULL;
+    } else if (stream_open(&r->in, input->filename) != 1) {
+        free(r);
+        return NULL;
+    }
+    for (i = 0; i < CHUNK_COUNT; i++) {
+        r->chunks[i].size = CHUNK_SIZE;
+        r->chunks[i].buffer = malloc(CHUNK_SIZE);
+        if (r->chunks[i].buffer == NULL) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
         }
+    }
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->cond, NULL);
+    if (pthread_create(&r->thread, NULL, read_ahead, r)) {
+        fprintf(stderr, "cannot start reader of %s\n", inputs[index].filename);
+        exit(1);
+    }
+    open_count++;
+    return r;
+}
+
+/*
+ * Stops the reader thread, closes the input.
+ */
+void reader_close(struct reader *r) {
+    unsigned i;
+
+    pthread_mutex_lock(&r->lock);
+    r->stop = 1;
+    pthread_cond_signal(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+    pthread_join(r->thread, NULL);
+
+    stream_close(&r->in);
+    free(inputs[r->index].packet);
+    inputs[r->index].packet = NULL;
+    for (i = 0; i < CHUNK_COUNT; i++)
+        free(r->chunks[i].buffer);
+    pthread_cond_destroy(&r->cond);
+    pthread_mutex_destroy(&r->lock);
+    free(r);
+    open_count--;
+}
+
+/*
+ * Heap ordering, the earliest packet on the top.
+ */
+int earlier(const struct reader *a, const struct reader *b) {
+    if (a->header.ts.tv_sec != b->header.ts.tv_sec)
+        return a->header.ts.tv_sec < b->header.ts.tv_sec;
+    if (a->header.ts.tv_usec != b->header.ts.tv_usec)
+        return a->header.ts.tv_usec < b->header.ts.tv_usec;
+    return a->index < b->index;
+}
 
+void heap_push(struct reader *r) {
+    unsigned i = heap_size++;
+
+    while (i > 0 && earlier(r, heap[(i - 1) / 2])) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
     }
+    heap[i] = r;
+}
 
-close_pcap:
-    pcap_close(p);
+struct reader *heap_pop(void) {
+    struct reader *top = heap[0];
+    struct reader *last = heap[--heap_size];
+    unsigned i = 0;
+
+    for (;;) {
+        unsigned child = 2 * i + 1;
+        if (child >= heap_size)
+            break;
+        if (child + 1 < heap_size && earlier(heap[child + 1], heap[child]))
+            child++;
+        if (! earlier(heap[child], last))
+            break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    if (heap_size)
+        heap[i] = last;
+    return top;
+}
+
+/*
+ * Opens the inputs whose first packet is due.
+ */
+void open_due(void) {
+    static int warned;
+
+    while (next_input < input_count) {
+        struct reader *r;
+
+        /* not needed before the currently earliest packet */
+        if (heap_size && timercmp(&heap[0]->header.ts, &inputs[next_input].first, <))
+            return;
+        if (open_count >= max_open) {
+            if (! warned)
+                fprintf(stderr, "more than %u input files overlap in time, postponing %s\n",
+                        max_open, inputs[next_input].filename);
+            warned = 1;
+            return;
+        }
+
+        r = reader_open(next_input++);
+        if (r == NULL)
+            continue;
+        if (advance(r))
+            heap_push(r);
+        else
+            reader_close(r);
+    }
 }
 
 int main(int argc, char *argv[]) {
-    unsigned int i;
+    struct timeval last;
+    pcap_dumper_t *writer;
+    pcap_t *dead;
+    int datalink = -1;
+    unsigned i;
+    int opt;
 
-    if (argc < 3) {
-        fprintf(stderr, "usage: %s outfile infile1 infile2 infile3 ...\n", argv[0]);
+    while ((opt = getopt(argc, argv, "m:")) != -1) {
+        if (opt != 'm' || (max_open = strtoul(optarg, NULL, 10)) == 0)
+            argc = 0;
+    }
+    if (argc - optind < 2) {
+        fprintf(stderr, "usage: %s [-m max_open] outfile infile1 infile2 infile3 ...\n"
+                "  -m max_open  input files open at once at most, default %u\n",
+                argv[0], DEFAULT_MAX_OPEN);
         return 1;
     }
 
-    for (i = 2; i < argc; i++) {
-        fprintf(stderr, "reading %s... ", argv[i]);
-        process_pcapfile(argv[1], argv[i]);
-        fprintf(stderr, "done.\n");
+    inputs = calloc(argc - optind - 1, sizeof(struct input));
+    heap = calloc(max_open, sizeof(struct reader *));
+    if (inputs == NULL || heap == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    /* order the inputs by their first packet, equal ones as given */
+    for (i = optind + 1; i < (unsigned) argc; i++) {
+        struct input input;
+        unsigned pos;
+        int link;
+
+        input.filename = argv[i];
+        switch (probe(&input, &link)) {
+            case -1:
+                return 1;
+            case 0:
+                continue;
+        }
+        if (datalink != -1 && link != datalink) {
+            fprintf(stderr, "%s uses link type %d instead of %d\n", argv[i], link, datalink);
+            return 1;
+        }
+        datalink = link;
+
+        for (pos = input_count; pos > 0 && timercmp(&input.first, &inputs[pos - 1].first, <); pos--)
+            inputs[pos] = inputs[pos - 1];
+        inputs[pos] = input;
+        input_count++;
+    }
+    if (input_count == 0) {
+        fprintf(stderr, "no packets in the input files\n");
+        return 1;
+    }
+
+    dead = pcap_open_dead(datalink, 65535);
+    writer = pcap_dump_open(dead, argv[optind]);
+    if (! writer) {
+        fprintf(stderr, "pcap_dump_open(%s) failed: %s\n", argv[optind], pcap_geterr(dead));
+        return 1;
+    }
+    fprintf(stderr, "merging %u files... ", input_count);
+
+    timerclear(&last);
+    for (;;) {
+        struct reader *r;
+
+        open_due();
+        if (heap_size == 0)
+            break;
+
+        r = heap_pop();
+        if (timercmp(&r->header.ts, &last, <))
+            late++;
+        else
+            last = r->header.ts;
+        pcap_dump((unsigned char *)writer, &r->header, r->data);
+
+        if (advance(r))
+            heap_push(r);
+        else
+            reader_close(r);
     }
 
     pcap_dump_close(writer);
+    pcap_close(dead);
+    fprintf(stderr, "done.\n");
+    if (late)
+        fprintf(stderr, "%lu packets merged out of order, consider raising -m\n", late);
     fprintf(stderr, "kthx bye!\n");
 
     return 0;
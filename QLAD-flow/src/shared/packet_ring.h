@@ -0,0 +1,158 @@
+/*
+ * This file is part of the DNS traffic analyser project.
+ *
+ * Copyright (C) 2011 CZ.NIC, z.s.p.o.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _PACKET_RING_H_
+#define _PACKET_RING_H_
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Single-producer/single-consumer packet ring in shared memory.
+ *
+ * dnsdump creates a POSIX shared memory object holding a header followed
+ * by a power of two sized data area, and publishes every captured packet
+ * there as a record. dnsanalyzer maps the same object and consumes the
+ * records. Head and tail are byte counters that only grow, each written
+ * by one side only, so no locks are needed: the producer publishes a
+ * record by a release store of the head, the consumer frees space by a
+ * release store of the tail. A packet that does not fit is dropped by the
+ * producer and counted instead of waiting for the consumer.
+ */
+
+/*! @brief Magic number of the ring header, "QLADRING". */
+#define PACKET_RING_MAGIC 0x474e4952444c4151ULL
+/*! @brief Layout version of the ring. */
+#define PACKET_RING_VERSION 1
+/*! @brief Default shared memory object name. */
+#define PACKET_RING_DEFAULT_NAME "/dnsdump"
+/*! @brief Default data area size, bytes. */
+#define PACKET_RING_DEFAULT_SIZE (64UL << 20)
+/*! @brief Record size flag marking unused space at the end of the area. */
+#define PACKET_RING_PADDING 0x80000000U
+
+/*! @brief Aligns record sizes. */
+#define PACKET_RING_ALIGN(size) (((size) + 7) & ~(uint64_t) 7)
+
+/*!
+ * @struct packet_ring_header
+ * @brief Start of the shared memory object.
+ *
+ * The producer and consumer fields live on separate cache lines.
+ */
+struct packet_ring_header {
+	uint64_t magic;     /*!< @brief PACKET_RING_MAGIC once initialized. */
+	uint32_t version;   /*!< @brief PACKET_RING_VERSION. */
+	int32_t datalink;   /*!< @brief pcap DLT_* of the packets. */
+	uint64_t size;      /*!< @brief Data area size, power of two. */
+	uint32_t snaplen;   /*!< @brief Maximum captured packet length. */
+
+	/*! @brief Bytes ever published, written by the producer. */
+	uint64_t head __attribute__(( aligned( 64 ) ));
+	/*! @brief Packets published, written by the producer. */
+	uint64_t published;
+	/*! @brief Packets dropped for lack of space, by the producer. */
+	uint64_t dropped;
+	/*! @brief Set by the producer when it stops publishing. */
+	uint32_t closed;
+
+	/*! @brief Bytes ever consumed, written by the consumer. */
+	uint64_t tail __attribute__(( aligned( 64 ) ));
+	/*! @brief Process id of the attached consumer, 0 if none. */
+	int32_t consumer;
+} __attribute__(( aligned( 64 ) ));
+
+/*!
+ * @struct packet_ring_record
+ * @brief Header of one packet in the data area, data follows.
+ *
+ * Records are 8-byte aligned and never wrap around the end of the area,
+ * the rest of the area is skipped by a record with PACKET_RING_PADDING
+ * set in size instead.
+ */
+struct packet_ring_record {
+	uint32_t size;      /*!< @brief Record size, header included. */
+	uint32_t caplen;    /*!< @brief Captured bytes. */
+	uint32_t len;       /*!< @brief Length on the wire. */
+	uint32_t usec;      /*!< @brief Time-stamp microseconds. */
+	int64_t sec;        /*!< @brief Time-stamp seconds. */
+};
+
+/*! @brief Data area of the ring. */
+static inline unsigned char * packet_ring_data( struct packet_ring_header *ring )
+{
+	return (unsigned char *) ring + sizeof( *ring );
+}
+
+/*!
+ * @brief Publishes one packet, called by the producer only.
+ * @param ring Initialized ring
+ * @param sec Time-stamp seconds
+ * @param usec Time-stamp microseconds
+ * @param data Captured bytes
+ * @param caplen Number of captured bytes
+ * @param len Length on the wire
+ * @return 1 if published, 0 if dropped for lack of space
+ */
+static inline int packet_ring_put( struct packet_ring_header *ring,
+	int64_t sec, uint32_t usec, const unsigned char *data,
+	uint32_t caplen, uint32_t len )
+{
+	const uint64_t need =
+		PACKET_RING_ALIGN( sizeof( struct packet_ring_record ) + caplen );
+	const uint64_t head = ring->head;
+	const uint64_t tail = __atomic_load_n( &ring->tail, __ATOMIC_ACQUIRE );
+	const uint64_t offset = head & (ring->size - 1);
+	const uint64_t room = ring->size - offset;
+	/* a record does not wrap, skip the rest of the area if needed */
+	const uint64_t skip = room < need ? room : 0;
+
+	if (need > ring->size || ring->size - (head - tail) < skip + need) {
+		__atomic_store_n( &ring->dropped, ring->dropped + 1,
+			__ATOMIC_RELAXED );
+		return 0;
+	}
+
+	unsigned char *area = packet_ring_data( ring );
+	if (skip) {
+		/* only the size of the padding record is read */
+		const uint32_t padding = PACKET_RING_PADDING | (uint32_t) skip;
+		memcpy( area + offset, &padding, sizeof( padding ) );
+	}
+
+	struct packet_ring_record *record = (struct packet_ring_record *)
+		(area + ((head + skip) & (ring->size - 1)));
+	record->size = need;
+	record->caplen = caplen;
+	record->len = len;
+	record->usec = usec;
+	record->sec = sec;
+	memcpy( record + 1, data, caplen );
+
+	__atomic_store_n( &ring->published, ring->published + 1,
+		__ATOMIC_RELAXED );
+	__atomic_store_n( &ring->head, head + skip + need, __ATOMIC_RELEASE );
+	return 1;
+}
+
+#endif /* _PACKET_RING_H_ */
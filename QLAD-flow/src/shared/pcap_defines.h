@@ -24,7 +24,12 @@
 #define PCAP_STDOUT "-"
 #define PCAP_STDIN "-"
 
-#define PCAP_FILTER_DNS_RESPONSE "udp src port 53"
-#define PCAP_FILTER_DNS_QUERY "udp dst port 53 and udp[10:2] & 0x8000 = 0"
+/* the ports are not known from fragments but the first one */
+#define PCAP_FILTER_FRAGMENTS "ip[6:2] & 0x1fff != 0 or ip6[6] = 44"
+#define PCAP_FILTER_DNS_RESPONSE \
+  "udp src port 53 or tcp src port 53 or " PCAP_FILTER_FRAGMENTS
+#define PCAP_FILTER_DNS_QUERY \
+  "(udp dst port 53 and udp[10:2] & 0x8000 = 0) or tcp dst port 53 or " \
+  PCAP_FILTER_FRAGMENTS
 #define PCAP_FILTER_NONE ""
 #define PCAP_FILTER_OPTIMIZE 1
@@ -0,0 +1,168 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <iostream>
+#include <iomanip>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+#include "packets.h"
+#include "capture/MappedPcapSource.h"
+#include "capture/PcapSource.h"
+#include "capture/Decompressor.cpp"
+#include "capture/LinkDecoder.cpp"
+#include "capture/MappedPcapSource.cpp"
+#include "capture/PcapSource.cpp"
+
+using namespace ::std;
+
+enum { PACKETS = 2000000, SOURCES = 50000, NAMES = 20000, DURATION = 300,
+       BATCH = 256, ROUNDS = 3 };
+
+/*!
+ * @brief Write the packets as an Ethernet pcap file.
+ * @param packets Packets to write.
+ * @param file Path of the file.
+ */
+static void write_pcap( const SyntheticPackets &packets, const char *file )
+{
+	FILE *out = fopen( file, "wb" );
+	if ( !out ) {
+		perror( file );
+		exit( 1 );
+	}
+
+	const uint32_t header[6] = { 0xa1b2c3d4, 0x00040002, 0, 0, 65535, 1 };
+	fwrite( header, sizeof( header ), 1, out );
+
+	/* destination, source, IPv4 */
+	const char ethernet[14] = { 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 6,
+	                            0x08, 0x00 };
+	const SyntheticPackets::Entries &e = packets.entries();
+	for ( SyntheticPackets::Entries::const_iterator i = e.begin();
+	      i != e.end(); ++i ) {
+		const uint32_t size = sizeof( ethernet ) + i->size;
+		const uint32_t record[4] = { (uint32_t) i->time, 0, size, size };
+		fwrite( record, sizeof( record ), 1, out );
+		fwrite( ethernet, sizeof( ethernet ), 1, out );
+		fwrite( packets.data( *i ), i->size, 1, out );
+	}
+	fclose( out );
+}
+
+/*!
+ * @brief Write the packets as a pcapng file with one Ethernet interface
+ * and nanosecond time stamps.
+ * @param packets Packets to write.
+ * @param file Path of the file.
+ */
+static void write_pcapng( const SyntheticPackets &packets, const char *file )
+{
+	FILE *out = fopen( file, "wb" );
+	if ( !out ) {
+		perror( file );
+		exit( 1 );
+	}
+
+	/* section header, interface description with if_tsresol = 9 */
+	const uint32_t section[7] = { 0x0a0d0d0a, 28, 0x1a2b3c4d, 1,
+	                              0xffffffff, 0xffffffff, 28 };
+	const uint32_t iface[8] = { 1, 32, 1, 65535, 0x00010009, 9, 0, 32 };
+	fwrite( section, sizeof( section ), 1, out );
+	fwrite( iface, sizeof( iface ), 1, out );
+
+	const char ethernet[14] = { 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 6,
+	                            0x08, 0x00 };
+	const char padding[4] = { 0, 0, 0, 0 };
+	const SyntheticPackets::Entries &e = packets.entries();
+	for ( SyntheticPackets::Entries::const_iterator i = e.begin();
+	      i != e.end(); ++i ) {
+		const uint32_t size = sizeof( ethernet ) + i->size;
+		const uint32_t pad = -size & 3;
+		const uint32_t length = 32 + size + pad;
+		const uint64_t time = (uint64_t) i->time * 1000000000;
+		const uint32_t block[7] = { 6, length, 0, (uint32_t)( time >> 32 ),
+		                            (uint32_t) time, size, size };
+		fwrite( block, sizeof( block ), 1, out );
+		fwrite( ethernet, sizeof( ethernet ), 1, out );
+		fwrite( packets.data( *i ), i->size, 1, out );
+		fwrite( padding, pad, 1, out );
+		fwrite( &length, sizeof( length ), 1, out );
+	}
+	fclose( out );
+}
+
+/*!
+ * @brief Read all records, touching the EtherType of each.
+ * @return Records per second.
+ */
+template < typename SOURCE >
+static double run( const char *file, unsigned batch, size_t expected )
+{
+	SOURCE source;
+	if ( !source.open( file, "" ) )
+		exit( 1 );
+
+	PacketSource::Packet packets[BATCH];
+	size_t count = 0;
+	unsigned sum = 0;
+	const double start = wall_time();
+	for ( unsigned got; ( got = source.nextBatch( packets, batch ) ); ) {
+		for ( unsigned i = 0; i < got; ++i )
+			sum += packets[i].data[12];
+		count += got;
+	}
+	const double elapsed = wall_time() - start;
+	source.close();
+
+	if ( count != expected || sum == 0 ) {
+		cerr << "read " << count << " of " << expected << " records\n";
+		exit( 1 );
+	}
+	return count / elapsed;
+}
+
+/*! @brief Best of several rounds, the first one warms the page cache. */
+template < typename SOURCE >
+static double best( const char *file, unsigned batch, size_t expected )
+{
+	double result = 0;
+	for ( unsigned i = 0; i < ROUNDS; ++i )
+		result = max( result, run< SOURCE >( file, batch, expected ) );
+	return result;
+}
+
+int main( int argc, char** argv )
+{
+	::std::cout << "---------- " << *argv << " start ----------\n";
+
+	const unsigned count = argc > 1 ? atoi( argv[1] ) : PACKETS;
+	const SyntheticPackets packets( count, SOURCES, NAMES, DURATION );
+
+	char file[] = "/tmp/capture_benchmark.XXXXXX";
+	const int fd = mkstemp( file );
+	if ( fd < 0 ) {
+		perror( file );
+		return 1;
+	}
+	close( fd );
+	write_pcap( packets, file );
+
+	const double pcap = best< PcapSource >( file, 1, count );
+	const double single = best< MappedPcapSource >( file, 1, count );
+	const double batch = best< MappedPcapSource >( file, BATCH, count );
+	write_pcapng( packets, file );
+	const double ng = best< MappedPcapSource >( file, BATCH, count );
+	unlink( file );
+
+	cout << fixed << setprecision( 0 )
+	     << setw( 12 ) << pcap << " rps (libpcap) "
+	     << setw( 12 ) << single << " rps (mmap) "
+	     << setw( 12 ) << batch << " rps (mmap, batch) "
+	     << setw( 12 ) << ng << " rps (mmap, pcapng, batch) "
+	     << setprecision( 2 ) << batch / pcap << "x" << endl;
+
+	return 0;
+}
@@ -0,0 +1,238 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <iostream>
+#include <string>
+#include <arpa/inet.h>
+#include "test.h"
+using namespace ::std;
+
+#include "policies/CompositePolicy.h"
+#include "policies/CompositePolicy.cpp"
+#include "policies/QueryNamePolicy.cpp"
+#include "policies/dns/PacketParser.cpp"
+#include "policies/dns/NameReducer.cpp"
+
+/*! @brief A query and the packet data holding its name. */
+struct Query {
+	string data;          /*!< @brief The name behind a DNS header. */
+	PacketRecord record;  /*!< @brief The decoded fields. */
+};
+
+/*!
+ * @brief A query for the name and type between the addresses.
+ * @param name Text with the final dot.
+ * @param flags Second word of the DNS header.
+ */
+static Query query( const char *source, const char *destination,
+                    const string &name, unsigned qtype,
+                    unsigned flags = 0x0100 )
+{
+	Query q;
+	q.record = PacketRecord();
+	const bool v6 = strchr( source, ':' );
+	q.record.family = v6 ? 6 : 4;
+	inet_pton( v6 ? AF_INET6 : AF_INET, source, q.record.source );
+	inet_pton( v6 ? AF_INET6 : AF_INET, destination,
+	  q.record.destination );
+	q.record.protocol = IPPROTO_UDP;
+	q.record.dns_flags = flags;
+	q.record.qtype = qtype;
+	q.record.qclass = 1;
+	q.record.status = PacketRecord::HAS_DNS | PacketRecord::HAS_QUESTION;
+
+	q.data.assign( 12, '\0' );
+	q.record.name_offset = 12;
+	size_t start = 0;
+	while ( start < name.size() ) {
+		const size_t dot = name.find( '.', start );
+		q.data.push_back( (char) ( dot - start ) );
+		q.data.append( name, start, dot - start );
+		start = dot + 1;
+	}
+	q.data.push_back( '\0' );
+	q.record.name_length = q.data.size() - 12;
+	return q;
+}
+
+/*! @brief The key of a query. */
+static CompositeKey key( const Query &q )
+{
+	return CompositePolicy::parseIdentifier( q.record, q.data.data() );
+}
+
+/*! @brief Report a key that differs from the expected one. */
+static int expect( const char *what, const CompositeKey &k,
+                   uint64_t address, uint64_t query )
+{
+	if ( k.address == address && k.query == query )
+		return 0;
+
+	cerr << hex << "FAIL: " << what << " key " << k.address << " "
+		<< k.query << ", " << address << " " << query << " expected"
+		<< dec << endl;
+	return -1;
+}
+
+/*! @brief Compare the text of a key with the expected one. */
+static int describes( const CompositeKey &k, const string &expected )
+{
+	const string text = CompositePolicy::describe( k );
+	if ( text == expected )
+		return 0;
+
+	cerr << "FAIL: '" << text << "', '" << expected << "' expected"
+		<< endl;
+	return -1;
+}
+
+/*! @brief Valid and invalid lists of fields. */
+static int test_configure()
+{
+	const char * const valid[] = {
+		"src/24/48,qname,qtype", "src", "dst/16", "qname", "qtype",
+		"qtype,qname", "src/0/0", "dst/32/56,qtype"
+	};
+	const char * const invalid[] = {
+		"src,dst", "dst/8,src", "qname/8", "qtype/16", "src,", ",src",
+		"src,,qname", "", "src,src", "qname,qname", "src/33",
+		"src/24/57", "src/24x", "src/", "src/24/", "src/-1", "sport",
+		"SRC"
+	};
+
+	int ret = 0;
+	for ( size_t i = 0; i < sizeof( valid ) / sizeof( *valid ); ++i ) {
+		if ( !CompositePolicy::configure( valid[i] ) ) {
+			cerr << "FAIL: '" << valid[i] << "' rejected" << endl;
+			ret = -1;
+		}
+	}
+	/* the last valid one is kept */
+	const Query q = query( "192.0.2.1", "198.51.100.53", "example.com.", 1 );
+	const uint64_t destination = 0xc6336435ull << 32
+		| CompositeKey::VALID | 4;
+	for ( size_t i = 0; i < sizeof( invalid ) / sizeof( *invalid ); ++i ) {
+		if ( CompositePolicy::configure( invalid[i] ) ) {
+			cerr << "FAIL: '" << invalid[i] << "' accepted" << endl;
+			ret = -1;
+		}
+		ret |= expect( invalid[i], key( q ), destination, 1 );
+	}
+	return ret;
+}
+
+/*! @brief Prefixes of IPv4 addresses, of either side. */
+static int test_ipv4()
+{
+	const Query q = query( "192.0.2.77", "198.51.100.53", "example.com.", 1 );
+	const uint64_t v4 = CompositeKey::VALID | 4;
+	int ret = 0;
+
+	CompositePolicy::configure( "src/24/48" );
+	ret |= expect( "src/24", key( q ), 0xc0000200ull << 32 | v4, 0 )
+		| describes( key( q ), "192.0.2.0/24" );
+	CompositePolicy::configure( "src/32" );
+	ret |= expect( "src/32", key( q ), 0xc000024dull << 32 | v4, 0 )
+		| describes( key( q ), "192.0.2.77/32" );
+	CompositePolicy::configure( "src/0" );
+	ret |= expect( "src/0", key( q ), v4, 0 );
+	CompositePolicy::configure( "dst/12" );
+	ret |= expect( "dst/12", key( q ), 0xc6300000ull << 32 | v4, 0 )
+		| describes( key( q ), "198.48.0.0/12" );
+	return ret;
+}
+
+/*! @brief Prefixes of IPv6 addresses, 56 bits at most. */
+static int test_ipv6()
+{
+	const Query q = query( "2001:db8:1234:5678:9abc::1", "2001:db8::53",
+	  "example.com.", 1 );
+	const uint64_t v6 = CompositeKey::VALID | 6;
+	int ret = 0;
+
+	CompositePolicy::configure( "src/24/48" );
+	ret |= expect( "src/48", key( q ), 0x20010db812340000ull | v6, 0 )
+		| describes( key( q ), "2001:db8:1234::/48" );
+	CompositePolicy::configure( "src/24/56" );
+	ret |= expect( "src/56", key( q ), 0x20010db812345600ull | v6, 0 )
+		| describes( key( q ), "2001:db8:1234:5600::/56" );
+	CompositePolicy::configure( "src/24/20" );
+	ret |= expect( "src/20", key( q ), 0x2001000000000000ull | v6, 0 )
+		| describes( key( q ), "2001::/20" );
+	CompositePolicy::configure( "dst/24/32" );
+	ret |= expect( "dst/32", key( q ), 0x20010db800000000ull | v6, 0 );
+	return ret;
+}
+
+/*! @brief Names and types in the key and back in the text. */
+static int test_describe()
+{
+	const Query aaaa = query( "192.0.2.1", "198.51.100.53",
+	  "www.Example.com.", 28 );
+	const Query https = query( "2001:db8:4321::1", "2001:db8::53",
+	  "a.b.example.org.", 65 );
+	const Query other = query( "192.0.2.1", "198.51.100.53",
+	  "example.net.", 999 );
+	int ret = 0;
+
+	CompositePolicy::configure( "src/24/48,qname,qtype" );
+	ret |= describes( key( aaaa ), "192.0.2.0/24 example.com. AAAA" )
+		| describes( key( https ), "2001:db8:4321::/48 example.org. HTTPS" )
+		| describes( key( other ), "192.0.2.0/24 example.net. TYPE999" );
+	/* the same name in any case and below gives the same key */
+	ret |= expect( "names below", key( query( "192.0.2.9", "198.51.100.53",
+	  "EXAMPLE.com.", 28 ) ), key( aaaa ).address, key( aaaa ).query );
+
+	CompositePolicy::configure( "qname" );
+	ret |= describes( key( other ), "example.net." );
+	if ( key( other ).qtype() || key( other ).family() ) {
+		cerr << "FAIL: fields not used are set" << endl;
+		ret = -1;
+	}
+	CompositePolicy::configure( "dst/8/32,qtype" );
+	ret |= describes( key( other ), "198.0.0.0/8 TYPE999" );
+
+	/* a name not seen is shown by its fingerprint */
+	CompositePolicy::configure( "qname,qtype" );
+	const CompositeKey unknown = { CompositeKey::VALID,
+	  0xfedcba9876540000ull | 1 };
+	return ret | describes( unknown, "#fedcba987654 A" );
+}
+
+/*! @brief Packets without the fields of the key. */
+static int test_invalid()
+{
+	const Query response = query( "192.0.2.1", "198.51.100.53",
+	  "example.com.", 1, 0x8180 );
+	const Query tld = query( "192.0.2.1", "198.51.100.53", "be.", 1 );
+	Query unknown = query( "192.0.2.1", "198.51.100.53", "example.com.", 1 );
+	unknown.record.family = 0;
+	int ret = 0;
+
+	CompositePolicy::configure( "src/24/48,qname,qtype" );
+	if ( CompositePolicy::isValid( key( response ) )
+			|| CompositePolicy::isValid( key( tld ) )
+			|| CompositePolicy::isValid( key( unknown ) ) ) {
+		cerr << "FAIL: key of a packet without the fields" << endl;
+		ret = -1;
+	}
+	/* the addresses alone are taken from any packet */
+	CompositePolicy::configure( "src" );
+	if ( !CompositePolicy::isValid( key( response ) ) ) {
+		cerr << "FAIL: no key of the addresses" << endl;
+		ret = -1;
+	}
+	return ret;
+}
+
+static FunTest t0( test_configure, "CompositePolicy configure" );
+static FunTest t1( test_ipv4, "CompositePolicy IPv4 prefixes" );
+static FunTest t2( test_ipv6, "CompositePolicy IPv6 prefixes" );
+static FunTest t3( test_describe, "CompositePolicy describe" );
+static FunTest t4( test_invalid, "CompositePolicy invalid packets" );
+
+int main()
+{
+	return TestRunner::instance().runAll( cout );
+}
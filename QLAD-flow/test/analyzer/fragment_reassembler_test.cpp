@@ -0,0 +1,332 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <netinet/in.h>
+#include "test.h"
+using namespace ::std;
+
+#include "capture/FragmentReassembler.h"
+#include "capture/FragmentReassembler.cpp"
+#include "hash/RNG.h"
+
+enum { TEST_RUNS = 500, PAYLOAD_MAX = 3000, START = 1000 };
+
+static RNG rnd;
+
+/*! @brief The reassembler with its bookkeeping in sight. */
+class Probe: public FragmentReassembler
+{
+public:
+	explicit Probe( size_t memory ): FragmentReassembler( memory ) {}
+
+	/*! @brief Memory of the fragment buffers. */
+	size_t buffered() const
+		{ return mBuffered; }
+
+	/*! @brief Limit of the fragment buffers. */
+	size_t budget() const
+		{ return mBudget; }
+};
+
+/*! @brief A fragment as the decoder leaves it. */
+struct Fragment {
+	vector< u_char > ip;  /*!< @brief The IP packet. */
+	PacketMeta meta;      /*!< @brief Its layout. */
+};
+
+/*! @brief Part of a UDP payload, from begin to end, as a fragment. */
+static Fragment fragment( unsigned version, uint32_t id,
+                          const string &payload, size_t begin, size_t end,
+                          bool more )
+{
+	Fragment f;
+	const size_t size = end - begin;
+	const size_t header = version == 4 ? 20 : 48;
+	f.ip.assign( header, 0 );
+	f.ip.insert( f.ip.end(), payload.begin() + begin,
+	             payload.begin() + end );
+	if ( version == 4 ) {
+		f.ip[0] = 0x45;
+		f.ip[2] = ( header + size ) >> 8; f.ip[3] = header + size;
+		f.ip[4] = id >> 8; f.ip[5] = id;
+		const unsigned field = begin / 8 | ( more ? 0x2000 : 0 );
+		f.ip[6] = field >> 8; f.ip[7] = field;
+		f.ip[9] = IPPROTO_UDP;
+		f.ip[12] = 192; f.ip[13] = 0; f.ip[14] = 2; f.ip[15] = 1;
+		f.ip[16] = 198; f.ip[17] = 51; f.ip[18] = 100; f.ip[19] = 53;
+	} else {
+		f.ip[0] = 0x60;
+		f.ip[4] = ( 8 + size ) >> 8; f.ip[5] = 8 + size;
+		f.ip[6] = 44;
+		f.ip[8] = 0x20; f.ip[9] = 0x01; f.ip[10] = 0x0d; f.ip[11] = 0xb8;
+		f.ip[23] = 1;
+		f.ip[24] = 0x20; f.ip[25] = 0x01; f.ip[26] = 0x0d; f.ip[27] = 0xb8;
+		f.ip[39] = 53;
+		u_char *extension = &f.ip[40];
+		extension[0] = IPPROTO_UDP;
+		const unsigned field = begin | ( more ? 1 : 0 );
+		extension[2] = field >> 8; extension[3] = field;
+		extension[4] = id >> 24; extension[5] = id >> 16;
+		extension[6] = id >> 8; extension[7] = id;
+	}
+
+	f.meta.length = f.ip.size();
+	f.meta.transport = header;
+	f.meta.version = version;
+	f.meta.protocol = IPPROTO_UDP;
+	f.meta.fragment = 1;
+	return f;
+}
+
+/*! @brief A UDP header and random bytes. */
+static string random_payload( size_t size )
+{
+	string payload( size, '\0' );
+	payload[1] = 53;
+	payload[3] = 53;
+	for ( size_t i = 8; i < size; ++i )
+		payload[i] = rnd.gen_u32();
+	return payload;
+}
+
+/*! @brief Adds the fragment, the meta of the datagram is returned. */
+static const u_char * add( FragmentReassembler &fragments,
+                           const Fragment &f, time_t now,
+                           PacketMeta &meta )
+{
+	meta = f.meta;
+	return fragments.add( &f.ip[0], meta, now );
+}
+
+/*! @brief Adds the fragment, which completes no datagram. */
+static int add_part( FragmentReassembler &fragments, const Fragment &f,
+                     time_t now )
+{
+	PacketMeta meta;
+	if ( !add( fragments, f, now, meta ) )
+		return 0;
+
+	cerr << "FAIL: a datagram completed too early" << endl;
+	return -1;
+}
+
+/*! @brief Adds the fragment, which completes the datagram. */
+static int add_last( FragmentReassembler &fragments, const Fragment &f,
+                     time_t now, const string &payload )
+{
+	PacketMeta meta;
+	const u_char *ip = add( fragments, f, now, meta );
+	if ( !ip ) {
+		cerr << "FAIL: the datagram did not complete" << endl;
+		return -1;
+	}
+
+	const size_t header = f.meta.version == 4 ? 20 : 48;
+	const size_t length = f.meta.version == 4
+		? header + payload.size() : 8 + payload.size();
+	const unsigned field = f.meta.version == 4
+		? ip[2] << 8 | ip[3] : ip[4] << 8 | ip[5];
+	if ( meta.fragment || meta.transport != header
+			|| meta.length != header + payload.size()
+			|| field != length
+			|| ( f.meta.version == 4 && ( ip[6] || ip[7] ) )
+			|| string( (const char *) ip + header, payload.size() )
+				!= payload ) {
+		cerr << "FAIL: datagram of " << meta.length << " bytes, "
+			<< header + payload.size() << " expected" << endl;
+		return -1;
+	}
+	return 0;
+}
+
+/*! @brief Report a count that differs from the expected one. */
+static int expect( const char *what, unsigned long value,
+                   unsigned long expected )
+{
+	if ( value == expected )
+		return 0;
+
+	cerr << "FAIL: " << what << " " << value << ", " << expected
+		<< " expected" << endl;
+	return -1;
+}
+
+/*! @brief Fragments in random sizes and order, some sent twice. */
+static int shuffled( unsigned version )
+{
+	FragmentReassembler fragments( 1 << 20 );
+	const string payload =
+		random_payload( 16 + rnd.gen_u32() % PAYLOAD_MAX );
+	const uint32_t id = rnd.gen_u32();
+
+	/* cut at multiples of 8, at least two pieces */
+	vector< Fragment > pieces;
+	size_t begin = 0;
+	while ( begin < payload.size() ) {
+		size_t end = begin + 8 * ( 1 + rnd.gen_u32() % 64 );
+		if ( pieces.empty() && end >= payload.size() )
+			end = begin + 8;
+		if ( end >= payload.size()
+				|| pieces.size() + 1 == FragmentReassembler::MAX_FRAGMENTS )
+			end = payload.size();
+		pieces.push_back( fragment( version, id, payload, begin, end,
+		                            end < payload.size() ) );
+		begin = end;
+	}
+	for ( size_t i = pieces.size() - 1; i > 0; --i )
+		swap( pieces[i], pieces[rnd.gen_u32() % ( i + 1 )] );
+
+	int ret = 0;
+	for ( size_t i = 0; i + 1 < pieces.size(); ++i ) {
+		ret |= add_part( fragments, pieces[i], START );
+		/* exact duplicates are accepted */
+		if ( rnd.gen_u32() % 4 == 0 )
+			ret |= add_part( fragments, pieces[i], START );
+	}
+	ret |= add_last( fragments, pieces.back(), START, payload );
+	return ret | expect( "reassembled", fragments.reassembled(), 1 )
+		| expect( "invalid", fragments.invalid(), 0 );
+}
+
+/*! @brief IPv4 fragments in random sizes and order. */
+static int test_ipv4()
+	{ return shuffled( 4 ); }
+
+/*! @brief IPv6 fragments in random sizes and order. */
+static int test_ipv6()
+	{ return shuffled( 6 ); }
+
+/*! @brief Overlapping fragments drop the datagram. */
+static int test_overlap()
+{
+	FragmentReassembler fragments( 1 << 20 );
+	const string payload = random_payload( 40 );
+	int ret = add_part( fragments,
+	  fragment( 4, 1, payload, 0, 16, true ), START );
+	ret |= add_part( fragments,
+	  fragment( 4, 1, payload, 8, 24, true ), START );
+	ret |= expect( "invalid", fragments.invalid(), 1 );
+
+	/* what comes later starts anew, the first piece is gone */
+	ret |= add_part( fragments,
+	  fragment( 4, 1, payload, 16, 40, false ), START );
+	/* a last fragment ending before a piece */
+	ret |= add_part( fragments,
+	  fragment( 6, 2, payload, 16, 32, true ), START );
+	ret |= add_part( fragments,
+	  fragment( 6, 2, payload, 0, 8, false ), START );
+	return ret | expect( "invalid", fragments.invalid(), 2 )
+		| expect( "reassembled", fragments.reassembled(), 0 );
+}
+
+/*! @brief A datagram in more than MAX_FRAGMENTS pieces is dropped. */
+static int test_max_fragments()
+{
+	FragmentReassembler fragments( 1 << 20 );
+	enum { MAX = FragmentReassembler::MAX_FRAGMENTS };
+	const string fits = random_payload( 8 * MAX ),
+		over = random_payload( 8 * ( MAX + 1 ) );
+
+	int ret = 0;
+	for ( unsigned i = 0; i + 1 < MAX; ++i )
+		ret |= add_part( fragments,
+		  fragment( 4, 1, fits, 8 * i, 8 * i + 8, true ), START );
+	ret |= add_last( fragments,
+	  fragment( 4, 1, fits, 8 * MAX - 8, 8 * MAX, false ), START, fits );
+
+	for ( unsigned i = 0; i <= MAX; ++i )
+		ret |= add_part( fragments, fragment( 4, 2, over, 8 * i,
+		  8 * i + 8, i < MAX ), START );
+	return ret | expect( "invalid", fragments.invalid(), 1 )
+		| expect( "reassembled", fragments.reassembled(), 1 );
+}
+
+/*! @brief A datagram is dropped TIMEOUT seconds after its start. */
+static int test_expiry()
+{
+	FragmentReassembler fragments( 1 << 20 );
+	const time_t timeout = FragmentReassembler::TIMEOUT;
+	const string payload = random_payload( 32 );
+
+	int ret = add_part( fragments,
+	  fragment( 4, 1, payload, 0, 16, true ), START );
+	ret |= add_part( fragments,
+	  fragment( 4, 2, payload, 0, 16, true ), START );
+	/* one second before the deadline */
+	ret |= add_last( fragments, fragment( 4, 1, payload, 16, 32, false ),
+	  START + timeout - 1, payload );
+	ret |= expect( "expired early", fragments.expired(), 0 );
+
+	ret |= add_part( fragments, fragment( 4, 2, payload, 16, 32, false ),
+	  START + timeout );
+	ret |= expect( "expired", fragments.expired(), 1 );
+
+	/* far ahead, the whole wheel at once */
+	ret |= add_part( fragments,
+	  fragment( 6, 3, payload, 0, 16, true ), START + 10 * timeout );
+	ret |= expect( "expired far ahead", fragments.expired(), 2 );
+	return ret | expect( "reassembled", fragments.reassembled(), 1 );
+}
+
+/*! @brief Datagrams closest to expiry go when the memory is full. */
+static int test_memory()
+{
+	Probe fragments( 64 * 1024 );
+	const size_t piece = fragments.budget() / 4 / 8 * 8;
+	const string payload = random_payload( piece + 8 );
+
+	/* a second apart, the first one expires first */
+	int ret = 0;
+	for ( unsigned id = 1; id <= 4; ++id )
+		ret |= add_part( fragments,
+		  fragment( 4, id, payload, 0, piece, true ), START + id );
+	ret |= expect( "evicted", fragments.evicted(), 1 );
+	if ( fragments.buffered() > fragments.budget() ) {
+		cerr << "FAIL: " << fragments.buffered() << " bytes buffered over "
+			<< fragments.budget() << endl;
+		ret = -1;
+	}
+
+	ret |= add_part( fragments, fragment( 4, 1, payload, piece,
+	  piece + 8, false ), START + 4 );
+	ret |= add_last( fragments, fragment( 4, 4, payload, piece,
+	  piece + 8, false ), START + 4, payload );
+	return ret | expect( "reassembled", fragments.reassembled(), 1 );
+}
+
+/*! @brief A datagram is evicted when the table is full. */
+static int test_table()
+{
+	/* the smallest table, room for the buffers */
+	FragmentReassembler fragments( 64 * 1024 );
+	const string payload = random_payload( 16 );
+	enum { SIZE = 16 };
+
+	int ret = 0;
+	for ( unsigned id = 0; id <= SIZE; ++id )
+		ret |= add_part( fragments,
+		  fragment( 6, id, payload, 0, 8, true ), START + id );
+	ret |= expect( "evicted", fragments.evicted(), 1 );
+	ret |= add_part( fragments,
+	  fragment( 6, 0, payload, 8, 16, false ), START + SIZE );
+	ret |= add_last( fragments, fragment( 6, SIZE, payload, 8, 16, false ),
+	  START + SIZE, payload );
+	return ret | expect( "reassembled", fragments.reassembled(), 1 );
+}
+
+static FunTest t0( test_ipv4, "FragmentReassembler IPv4", TEST_RUNS );
+static FunTest t1( test_ipv6, "FragmentReassembler IPv6", TEST_RUNS );
+static FunTest t2( test_overlap, "FragmentReassembler overlap" );
+static FunTest t3( test_max_fragments, "FragmentReassembler MAX_FRAGMENTS" );
+static FunTest t4( test_expiry, "FragmentReassembler expiry" );
+static FunTest t5( test_memory, "FragmentReassembler memory eviction" );
+static FunTest t6( test_table, "FragmentReassembler table eviction" );
+
+int main()
+{
+	return TestRunner::instance().runAll( cout );
+}
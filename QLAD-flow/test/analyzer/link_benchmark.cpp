@@ -0,0 +1,197 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <netinet/in.h>
+
+#include "packets.h"
+#include "capture/LinkDecoder.h"
+
+#include "capture/LinkDecoder.cpp"
+
+using namespace ::std;
+
+enum { PACKETS = 1000000, SOURCES = 50000, NAMES = 20000, DURATION = 300,
+       ROUNDS = 5, PAIRED_ROUNDS = 15 };
+
+/*! @brief Frames of one encapsulation stored back to back. */
+struct Frames {
+	string buffer;           //!< @brief All frames.
+	vector< size_t > starts; //!< @brief Frame offsets, one past the last.
+};
+
+/*!
+ * @brief Wrap every packet in the same headers.
+ * @param packets Raw IPv4 packets.
+ * @param header Headers put in front of each packet.
+ */
+static Frames wrap( const SyntheticPackets &packets, const string &header )
+{
+	Frames frames;
+	const SyntheticPackets::Entries &e = packets.entries();
+	for ( SyntheticPackets::Entries::const_iterator i = e.begin();
+	      i != e.end(); ++i ) {
+		frames.starts.push_back( frames.buffer.size() );
+		frames.buffer.append( header );
+		frames.buffer.append( packets.data( *i ), i->size );
+		if ( frames.buffer.size() % 2 )
+			frames.buffer.push_back( '\0' );
+	}
+	frames.starts.push_back( frames.buffer.size() );
+	return frames;
+}
+
+/*! @brief Header bytes from a string of hex digits. */
+static string hex( const char *digits )
+{
+	string result;
+	for ( ; digits[0] && digits[1]; digits += 2 )
+		result.push_back( (char) strtoul( string( digits, 2 ).c_str(),
+		                                  NULL, 16 ) );
+	return result;
+}
+
+/*!
+ * @brief What the capture did before LinkDecoder: link header length from
+ * a table, then the IPv4 header checks of PacketParser.
+ */
+static bool table( const u_char *data, size_t caplen, size_t &offset,
+                   PacketMeta &meta )
+{
+	static const unsigned char offsets[] = { 4, 14 };
+
+	offset = offsets[DLT_EN10MB];
+	if ( caplen < offset + 20 )
+		return false;
+	const u_char *ip = data + offset;
+	if ( ip[0] >> 4 != 4 )
+		return false;
+	const unsigned hlen = ( ip[0] & 0x0f ) * 4;
+	const unsigned len = ip[2] << 8 | ip[3];
+	if ( hlen < 20 || len < hlen || caplen - offset < len )
+		return false;
+	if ( ( ip[6] << 8 | ip[7] ) & 0x3fff )
+		return false;
+	meta.length = len;
+	meta.transport = hlen;
+	meta.version = 4;
+	meta.protocol = ip[9];
+	meta.fragment = 0;
+	return true;
+}
+
+/*! @brief Decoder of Ethernet frames, kept as the capture keeps it. */
+static const LinkDecoder ethernet_link( DLT_EN10MB );
+
+/*! @brief LinkDecoder on Ethernet frames. */
+static bool decoder( const u_char *data, size_t caplen, size_t &offset,
+                     PacketMeta &meta )
+{
+	return ethernet_link.decode( data, caplen, offset, meta );
+}
+
+typedef bool ( *Decode )( const u_char *, size_t, size_t &, PacketMeta & );
+
+/*!
+ * @brief Decode all frames once, the decoder inlined as in the capture.
+ * @return Frames per second.
+ */
+template < Decode decode >
+static double once( const Frames &frames )
+{
+	const u_char *data = (const u_char *) frames.buffer.data();
+	const size_t count = frames.starts.size() - 1;
+	size_t sum = 0, decoded = 0;
+
+	const double start = wall_time();
+	for ( size_t i = 0; i < count; ++i ) {
+		size_t offset;
+		PacketMeta meta;
+		const size_t begin = frames.starts[i];
+		if ( decode( data + begin, frames.starts[i + 1] - begin,
+		             offset, meta ) ) {
+			sum += offset + meta.transport + meta.protocol;
+			++decoded;
+		}
+	}
+	const double elapsed = wall_time() - start;
+
+	if ( decoded != count || sum == 0 ) {
+		cerr << "decoded " << decoded << " of " << count << " frames\n";
+		exit( 1 );
+	}
+	return count / elapsed;
+}
+
+/*!
+ * @brief Decode all frames, best of several rounds.
+ * @return Frames per second.
+ */
+template < Decode decode >
+static double run( const Frames &frames )
+{
+	double result = 0;
+	for ( unsigned round = 0; round < ROUNDS; ++round )
+		result = max( result, once< decode >( frames ) );
+	return result;
+}
+
+static void report( const char *name, double rate, double reference )
+{
+	cout << setw( 24 ) << left << name << right << fixed
+	     << setprecision( 0 ) << setw( 12 ) << rate << " fps "
+	     << setprecision( 2 ) << rate / reference << "x" << endl;
+}
+
+int main( int argc, char** argv )
+{
+	::std::cout << "---------- " << *argv << " start ----------\n";
+
+	const unsigned count = argc > 1 ? atoi( argv[1] ) : PACKETS;
+	const SyntheticPackets packets( count, SOURCES, NAMES, DURATION );
+
+	const string mac = hex( "000102030405000102030406" );
+	const Frames ethernet = wrap( packets, mac + hex( "0800" ) );
+	/* rounds taken in turns, so both see the same machine load */
+	double reference = 0, untagged = 0;
+	for ( unsigned round = 0; round < PAIRED_ROUNDS; ++round ) {
+		reference = max( reference, once< table >( ethernet ) );
+		untagged = max( untagged, once< decoder >( ethernet ) );
+	}
+	report( "table (Ethernet)", reference, reference );
+	report( "decoder (Ethernet)", untagged, reference );
+
+	report( "decoder (VLAN)",
+	        run< decoder >( wrap( packets, mac + hex( "810000640800" ) ) ),
+	        reference );
+	report( "decoder (QinQ)",
+	        run< decoder >( wrap( packets,
+	                              mac + hex( "88a8006481000064" "0800" ) ) ),
+	        reference );
+	report( "decoder (MPLS)",
+	        run< decoder >( wrap( packets,
+	                              mac + hex( "8847" "00064040" "00065140" ) ) ),
+	        reference );
+
+	/* outer IPv4 header carrying GRE, total length patched per frame */
+	const string outer = mac + hex( "0800" "4500000000000000402f0000"
+	                                "0a0000010a000002" );
+	Frames erspan = wrap( packets, outer + hex( "100088be00000001"
+	                                            "1000000100000000" )
+	                               + mac + hex( "0800" ) );
+	for ( size_t i = 0; i + 1 < erspan.starts.size(); ++i ) {
+		const size_t begin = erspan.starts[i] + mac.size() + 2;
+		const size_t end = erspan.starts[i] + outer.size() + 16
+		                   + mac.size() + 2 + packets.entries()[i].size;
+		erspan.buffer[begin + 2] = (char) ( ( end - begin ) >> 8 );
+		erspan.buffer[begin + 3] = (char) ( end - begin );
+	}
+	report( "decoder (GRE, ERSPAN II)", run< decoder >( erspan ), reference );
+
+	return 0;
+}
@@ -0,0 +1,361 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <iostream>
+#include <vector>
+#include <netinet/in.h>
+#include "test.h"
+using namespace ::std;
+
+#include "capture/LinkDecoder.h"
+#include "capture/LinkDecoder.cpp"
+#include "hash/RNG.h"
+
+enum { TEST_RUNS = 10000, PAYLOAD = 30 };
+
+static RNG rnd;
+
+typedef vector< u_char > Bytes;
+
+/*! @brief The decoder with the complete walk in sight. */
+class Probe: public LinkDecoder
+{
+public:
+	explicit Probe( int datalink ): LinkDecoder( datalink ) {}
+
+	/*! @brief The walk decode() takes unless the fast path does. */
+	bool slow( const u_char *data, size_t caplen, size_t &offset,
+	  PacketMeta &meta ) const
+		{ return walk( data, caplen, offset, meta ); }
+};
+
+/*! @brief The layout decode() should find. */
+struct Layout {
+	size_t offset;       /*!< @brief Of the IP header. */
+	unsigned length;     /*!< @brief PacketMeta::length. */
+	unsigned transport;  /*!< @brief PacketMeta::transport. */
+	unsigned version;    /*!< @brief PacketMeta::version. */
+	unsigned protocol;   /*!< @brief PacketMeta::protocol. */
+	unsigned fragment;   /*!< @brief PacketMeta::fragment. */
+};
+
+/*! @brief IPv4 packet of the protocol with options and payload. */
+static Bytes ipv4( unsigned protocol, unsigned options = 0,
+                   size_t payload = PAYLOAD )
+{
+	const size_t header = 20 + 4 * options;
+	Bytes ip( header + payload, 0 );
+	ip[0] = 0x40 | header / 4;
+	ip[2] = ip.size() >> 8;
+	ip[3] = ip.size() & 0xff;
+	ip[8] = 64;
+	ip[9] = protocol;
+	return ip;
+}
+
+/*! @brief IPv6 packet of the protocol with payload. */
+static Bytes ipv6( unsigned protocol, size_t payload = PAYLOAD )
+{
+	Bytes ip( 40 + payload, 0 );
+	ip[0] = 0x60;
+	ip[4] = payload >> 8;
+	ip[5] = payload & 0xff;
+	ip[6] = protocol;
+	ip[7] = 64;
+	return ip;
+}
+
+/*! @brief The link header in front of the packet. */
+static Bytes frame( const Bytes &link, const Bytes &ip )
+{
+	Bytes f = link;
+	f.insert( f.end(), ip.begin(), ip.end() );
+	return f;
+}
+
+/*! @brief Ethernet header, the EtherTypes of the tags and the last. */
+static Bytes ethernet( unsigned type, unsigned inner = 0,
+                       unsigned innermost = 0 )
+{
+	Bytes header( 12, 0x02 );
+	const unsigned types[] = { type, inner, innermost };
+	for ( unsigned i = 0; i < 3 && types[i]; ++i ) {
+		if ( i ) {
+			/* the tag control information, VLAN 100 + i */
+			header.push_back( 0 );
+			header.push_back( 100 + i );
+		}
+		header.push_back( types[i] >> 8 );
+		header.push_back( types[i] & 0xff );
+	}
+	return header;
+}
+
+/*! @brief Layout of a packet of the frame, all of it captured. */
+static Layout layout( size_t offset, const Bytes &ip, unsigned transport,
+                      unsigned protocol, unsigned fragment = 0 )
+{
+	const Layout l = { offset, (unsigned) ip.size(), transport,
+	  (unsigned) ip[0] >> 4, protocol, fragment };
+	return l;
+}
+
+/*! @brief Offset of the Layout of a frame without a packet. */
+static const size_t NONE = (size_t) -1;
+
+/*!
+ * @brief Decode a frame by decode() and by the complete walk.
+ * @return Nonzero if they do not agree.
+ */
+static int decode( const Probe &decoder, const Bytes &f, size_t caplen,
+                   size_t &offset, PacketMeta &meta )
+{
+	/* the frame ends the buffer, so reading past it shows */
+	const Bytes data( f.begin(), f.begin() + caplen );
+	const u_char *bytes = data.empty() ? NULL : &data[0];
+	size_t slow_offset = NONE;
+	PacketMeta slow_meta = PacketMeta();
+	offset = NONE;
+	meta = PacketMeta();
+	const bool found = decoder.decode( bytes, caplen, offset, meta );
+	const bool slow_found =
+	  decoder.slow( bytes, caplen, slow_offset, slow_meta );
+	if ( !found )
+		offset = NONE;
+	if ( !slow_found )
+		slow_offset = NONE;
+
+	if ( found == slow_found && ( !found || ( offset == slow_offset
+			&& meta.length == slow_meta.length
+			&& meta.transport == slow_meta.transport
+			&& meta.version == slow_meta.version
+			&& meta.protocol == slow_meta.protocol
+			&& meta.fragment == slow_meta.fragment ) ) )
+		return 0;
+
+	cerr << "FAIL: " << caplen << " bytes, the fast path differs from"
+		<< " the walk" << endl;
+	return -1;
+}
+
+/*! @brief Decode the frame as captured and compare with the layout. */
+static int check( const Probe &decoder, const Bytes &f, size_t caplen,
+                  const Layout &expected, const char *what )
+{
+	size_t offset;
+	PacketMeta meta;
+	if ( decode( decoder, f, caplen, offset, meta ) ) {
+		cerr << "\tof " << what << endl;
+		return -1;
+	}
+	if ( offset == expected.offset && ( offset == NONE
+			|| ( meta.length == expected.length
+			&& meta.transport == expected.transport
+			&& meta.version == expected.version
+			&& meta.protocol == expected.protocol
+			&& meta.fragment == expected.fragment ) ) )
+		return 0;
+
+	cerr << "FAIL: " << what << ", " << caplen << " bytes: ";
+	if ( offset != NONE )
+		cerr << "offset " << offset << " length " << meta.length
+			<< " transport " << meta.transport << " version "
+			<< (unsigned) meta.version << " protocol "
+			<< (unsigned) meta.protocol << " fragment "
+			<< (unsigned) meta.fragment;
+	else
+		cerr << "no packet";
+	cerr << ", offset " << expected.offset << " length "
+		<< expected.length << " transport " << expected.transport
+		<< " expected" << endl;
+	return -1;
+}
+
+/*! @brief The frame decoded whole. */
+static int check( const Probe &decoder, const Bytes &f,
+                  const Layout &expected, const char *what )
+{
+	return check( decoder, f, f.size(), expected, what );
+}
+
+/*!
+ * @brief Cut the frame at every length: nothing is found without a
+ * complete IP header, the captured part of the packet otherwise.
+ * @param header End of the IP header in the frame.
+ */
+static int check_cuts( const Probe &decoder, const Bytes &f,
+                       const Layout &whole, size_t header,
+                       const char *what )
+{
+	int ret = 0;
+	for ( size_t caplen = 0; caplen < f.size(); ++caplen ) {
+		Layout expected = whole;
+		if ( caplen < header )
+			expected.offset = NONE;
+		else if ( caplen - whole.offset < whole.length )
+			expected.length = caplen - whole.offset;
+		ret |= check( decoder, f, caplen, expected, what );
+	}
+	return ret;
+}
+
+/*! @brief Untagged Ethernet, taken by the fast path. */
+static int test_ethernet()
+{
+	const Probe decoder( DLT_EN10MB );
+	const Bytes udp = ipv4( IPPROTO_UDP ), tcp = ipv6( IPPROTO_TCP ),
+		options = ipv4( IPPROTO_TCP, 3 );
+	Bytes fragment = ipv4( IPPROTO_UDP );
+	fragment[6] = 0x20; /* more fragments */
+	Bytes padded = frame( ethernet( 0x0800 ), udp );
+	padded.resize( padded.size() + 6 );
+
+	return check( decoder, frame( ethernet( 0x0800 ), udp ),
+		  layout( 14, udp, 20, IPPROTO_UDP ), "IPv4 UDP" )
+		| check( decoder, frame( ethernet( 0x86dd ), tcp ),
+		  layout( 14, tcp, 40, IPPROTO_TCP ), "IPv6 TCP" )
+		| check( decoder, frame( ethernet( 0x0800 ), options ),
+		  layout( 14, options, 32, IPPROTO_TCP ), "IPv4 options" )
+		| check( decoder, frame( ethernet( 0x0800 ), fragment ),
+		  layout( 14, fragment, 20, IPPROTO_UDP, 1 ), "IPv4 fragment" )
+		/* a trailer behind the packet */
+		| check( decoder, padded, layout( 14, udp, 20, IPPROTO_UDP ),
+		  "padded" );
+}
+
+/*! @brief Headers the fast path leaves to the walk. */
+static int test_walk()
+{
+	const Probe decoder( DLT_EN10MB );
+	const Bytes icmp = ipv4( IPPROTO_ICMP );
+	Bytes extension = ipv6( IPPROTO_DSTOPTS, 8 + PAYLOAD );
+	extension[40] = IPPROTO_UDP;
+	Bytes fragment = ipv6( IPPROTO_FRAGMENT, 8 + PAYLOAD );
+	fragment[40] = IPPROTO_UDP;
+	const Bytes tunnel = ipv4( IPPROTO_IPIP, 0, 20 + PAYLOAD );
+	Bytes inner = ipv4( IPPROTO_UDP );
+	Bytes ipip = tunnel;
+	copy( inner.begin(), inner.end(), ipip.begin() + 20 );
+
+	return check( decoder, frame( ethernet( 0x0800 ), icmp ),
+		  layout( 14, icmp, 20, IPPROTO_ICMP ), "ICMP" )
+		| check( decoder, frame( ethernet( 0x86dd ), extension ),
+		  layout( 14, extension, 48, IPPROTO_UDP ), "IPv6 options" )
+		| check( decoder, frame( ethernet( 0x86dd ), fragment ),
+		  layout( 14, fragment, 48, IPPROTO_UDP, 1 ), "IPv6 fragment" )
+		| check( decoder, frame( ethernet( 0x0800 ), ipip ),
+		  layout( 34, inner, 20, IPPROTO_UDP ), "IP in IP" )
+		| check( decoder, frame( ethernet( 0x0806 ), icmp ),
+		  layout( NONE, icmp, 0, 0 ), "ARP" );
+}
+
+/*! @brief 802.1Q tags, stacked for QinQ. */
+static int test_vlan()
+{
+	const Probe decoder( DLT_EN10MB );
+	const Bytes udp = ipv4( IPPROTO_UDP ), tcp = ipv6( IPPROTO_TCP );
+
+	return check( decoder, frame( ethernet( 0x8100, 0x0800 ), udp ),
+		  layout( 18, udp, 20, IPPROTO_UDP ), "802.1Q" )
+		| check( decoder, frame( ethernet( 0x88a8, 0x8100, 0x86dd ),
+		  tcp ), layout( 22, tcp, 40, IPPROTO_TCP ), "802.1ad" )
+		| check( decoder, frame( ethernet( 0x9100, 0x8100, 0x0800 ),
+		  udp ), layout( 22, udp, 20, IPPROTO_UDP ), "old QinQ" );
+}
+
+/*! @brief Linux cooked captures, both versions. */
+static int test_sll()
+{
+	const Bytes udp = ipv4( IPPROTO_UDP ), tcp = ipv6( IPPROTO_TCP );
+	Bytes sll( 16, 0 );
+	sll[14] = 0x86; sll[15] = 0xdd;
+	Bytes sll2( 20, 0 );
+	sll2[0] = 0x08;
+	Bytes tagged = sll;
+	tagged[14] = 0x81; tagged[15] = 0x00;
+	tagged.push_back( 0 ); tagged.push_back( 7 );
+	tagged.push_back( 0x08 ); tagged.push_back( 0x00 );
+
+	return check( Probe( DLT_LINUX_SLL ), frame( sll, tcp ),
+		  layout( 16, tcp, 40, IPPROTO_TCP ), "SLL" )
+		| check( Probe( DLT_LINUX_SLL ), frame( tagged, udp ),
+		  layout( 20, udp, 20, IPPROTO_UDP ), "SLL 802.1Q" )
+		| check( Probe( DLT_LINUX_SLL2 ), frame( sll2, udp ),
+		  layout( 20, udp, 20, IPPROTO_UDP ), "SLL2" );
+}
+
+/*! @brief Raw IP and the loopback address family header. */
+static int test_raw()
+{
+	const Bytes udp = ipv4( IPPROTO_UDP ), tcp = ipv6( IPPROTO_TCP );
+	const Bytes family( 4, 0 );
+
+	return check( Probe( DLT_RAW ), udp,
+		  layout( 0, udp, 20, IPPROTO_UDP ), "raw IPv4" )
+		| check( Probe( DLT_RAW ), tcp,
+		  layout( 0, tcp, 40, IPPROTO_TCP ), "raw IPv6" )
+		| check( Probe( DLT_IPV6 ), tcp,
+		  layout( 0, tcp, 40, IPPROTO_TCP ), "DLT_IPV6" )
+		| check( Probe( DLT_NULL ), frame( family, udp ),
+		  layout( 4, udp, 20, IPPROTO_UDP ), "loopback IPv4" )
+		| check( Probe( DLT_LOOP ), frame( family, tcp ),
+		  layout( 4, tcp, 40, IPPROTO_TCP ), "OpenBSD loopback IPv6" );
+}
+
+/*! @brief Frames cut short anywhere, the IP headers among others. */
+static int test_truncated()
+{
+	const Bytes udp = ipv4( IPPROTO_UDP ), tcp = ipv6( IPPROTO_TCP ),
+		options = ipv4( IPPROTO_UDP, 2 );
+	Bytes sll( 16, 0 );
+	sll[14] = 0x08;
+
+	return check_cuts( Probe( DLT_EN10MB ),
+		  frame( ethernet( 0x0800 ), udp ),
+		  layout( 14, udp, 20, IPPROTO_UDP ), 34, "IPv4" )
+		| check_cuts( Probe( DLT_EN10MB ),
+		  frame( ethernet( 0x0800 ), options ),
+		  layout( 14, options, 28, IPPROTO_UDP ), 42, "IPv4 options" )
+		| check_cuts( Probe( DLT_EN10MB ),
+		  frame( ethernet( 0x88a8, 0x8100, 0x86dd ), tcp ),
+		  layout( 22, tcp, 40, IPPROTO_TCP ), 62, "QinQ IPv6" )
+		| check_cuts( Probe( DLT_LINUX_SLL ), frame( sll, udp ),
+		  layout( 16, udp, 20, IPPROTO_UDP ), 36, "SLL" )
+		| check_cuts( Probe( DLT_RAW ), tcp,
+		  layout( 0, tcp, 40, IPPROTO_TCP ), 40, "raw IPv6" )
+		| check_cuts( Probe( DLT_NULL ), frame( Bytes( 4, 0 ), udp ),
+		  layout( 4, udp, 20, IPPROTO_UDP ), 24, "loopback" );
+}
+
+/*! @brief Damaged frames, the fast path must agree with the walk. */
+static int test_damaged()
+{
+	const Probe decoder( DLT_EN10MB );
+	Bytes f = rnd.gen_u32() % 2
+		? frame( ethernet( 0x0800 ), ipv4( IPPROTO_UDP ) )
+		: frame( ethernet( 0x86dd ), ipv6( IPPROTO_TCP ) );
+	/* the EtherType and the fields the fast path reads */
+	for ( unsigned i = rnd.gen_u32() % 3; i < 3; ++i ) {
+		const size_t at = 12 + rnd.gen_u32() % 12;
+		f[at] ^= 1 << rnd.gen_u32() % 8;
+	}
+	const size_t caplen = rnd.gen_u32() % ( f.size() + 1 );
+
+	size_t offset;
+	PacketMeta meta;
+	return decode( decoder, f, caplen, offset, meta );
+}
+
+static FunTest t0( test_ethernet, "LinkDecoder Ethernet" );
+static FunTest t1( test_walk, "LinkDecoder beyond the fast path" );
+static FunTest t2( test_vlan, "LinkDecoder VLAN and QinQ" );
+static FunTest t3( test_sll, "LinkDecoder Linux cooked capture" );
+static FunTest t4( test_raw, "LinkDecoder raw and loopback" );
+static FunTest t5( test_truncated, "LinkDecoder truncated frames" );
+static FunTest t6( test_damaged, "LinkDecoder damaged frames", TEST_RUNS );
+
+int main()
+{
+	return TestRunner::instance().runAll( cout );
+}
@@ -0,0 +1,248 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <cctype>
+#include <cstdlib>
+
+#include "packets.h"
+
+#include "policies/dns/PacketParser.h"
+
+#include "policies/dns/PacketParser.cpp"
+#include "policies/dns/NameReducer.cpp"
+
+using namespace ::std;
+
+enum { NAMES = 1000000, DOMAINS = 20000, ROUNDS = 5 };
+
+/*! @brief Query names in wire format stored back to back. */
+struct Names {
+	string buffer;                  //!< @brief All names, 2-aligned.
+	vector< size_t > starts;        //!< @brief Packet data of each name.
+	vector< PacketRecord > records; //!< @brief Names in their data.
+};
+
+/*! @brief Random characters of a host name label. */
+static string random_label( RNG &rnd, unsigned length )
+{
+	static const char chars[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+	string label;
+	for ( unsigned i = 0; i < length; ++i )
+		label.push_back( chars[rnd.gen_u32() % ( sizeof( chars ) - 1 )] );
+	return label;
+}
+
+/*!
+ * @brief Name as seen by a TLD server: mostly short names of registered
+ * domains, some in random case (0x20 encoding), random subdomains of an
+ * attacked domain and long reverse names.
+ */
+static string realistic_name( RNG &rnd )
+{
+	const unsigned kind = rnd.gen_u32() % 100;
+	const unsigned domain = rnd.gen_u32() % DOMAINS;
+	string name;
+	if ( kind < 40 ) {
+		name = SyntheticPackets::qname( domain );
+	} else if ( kind < 60 ) {
+		name = SyntheticPackets::qname( domain ).substr(
+		  SyntheticPackets::qname( domain ).find( '.' ) + 1 );
+	} else if ( kind < 75 ) {
+		name = SyntheticPackets::qname( domain );
+		for ( size_t i = 0; i < name.size(); ++i )
+			if ( rnd.gen_u32() % 2 )
+				name[i] = toupper( name[i] );
+	} else if ( kind < 90 ) {
+		name = random_label( rnd, 12 + rnd.gen_u32() % 30 )
+		       + ".victim" + random_label( rnd, 2 ) + ".be";
+	} else {
+		for ( unsigned i = 0; i < 32; ++i )
+			name += random_label( rnd, 1 ) + ".";
+		name += "ip6.arpa";
+	}
+	return name;
+}
+
+/*! @brief Store the name in wire format and its record. */
+static void append( Names &names, const string &name )
+{
+	/* behind a DNS header, as in a message */
+	PacketRecord record = PacketRecord();
+	names.starts.push_back( names.buffer.size() );
+	names.buffer.append( 12, '\0' );
+	record.name_offset = 12;
+	size_t start = 0;
+	while ( start <= name.size() ) {
+		size_t dot = name.find( '.', start );
+		if ( dot == string::npos )
+			dot = name.size();
+		names.buffer.push_back( (char) ( dot - start ) );
+		names.buffer.append( name, start, dot - start );
+		start = dot + 1;
+	}
+	names.buffer.push_back( '\0' );
+	record.name_length =
+	  names.buffer.size() - names.starts.back() - record.name_offset;
+	record.status = PacketRecord::HAS_QUESTION;
+	if ( names.buffer.size() % 2 )
+		names.buffer.push_back( '\0' );
+	names.records.push_back( record );
+}
+
+/*!
+ * @brief What the parser did before: the name grown in a string a
+ * character at a time, then the SLD cut out by searching it.
+ */
+static string reference( const char *data, const PacketRecord &record )
+{
+	const unsigned char *cp =
+	  (const unsigned char *) data + record.name_offset;
+	string name;
+	name.reserve( PacketParser::MAXDNAME );
+	unsigned l;
+	do {
+		l = *cp++;
+		transform( cp, cp + l, back_inserter( name ),
+		           static_cast< int(*)(int) >( tolower ) );
+		cp += l;
+		if ( !( l == 0 && name.size() ) )
+			name.push_back( '.' );
+	} while ( l );
+
+	string hostName = name;
+	string serverDomainStr;
+	int cpos = hostName.rfind( "." );
+	serverDomainStr = cpos != (int) string::npos
+	                  ? hostName.substr( 0, cpos ) : hostName.substr( 0 );
+	int pcpos = serverDomainStr.rfind( "." );
+	serverDomainStr = pcpos != (int) string::npos
+	                  ? hostName.substr( 0, pcpos ) : hostName.substr( 0 );
+	int ppcpos = serverDomainStr.rfind( "." );
+	serverDomainStr = ppcpos != (int) string::npos
+	                  ? hostName.substr( 0, ppcpos ) : hostName.substr( 0 );
+	return hostName.substr( ppcpos + 1 );
+}
+
+/*! @brief Reducer of the identifiers, the last two labels by default. */
+static NameReducer reducer;
+
+/*! @brief The query name policy identifier, as it is taken now. */
+static string identifier( const char *data, const PacketRecord &record )
+{
+	char buffer[PacketParser::MAXDNAME];
+	const PacketParser::NameView domain =
+	  PacketParser::name( data, record, buffer, reducer );
+	return string( domain.data, domain.length );
+}
+
+/*! @brief The name alone, nothing allocated. */
+static size_t view( const char *data, const PacketRecord &record )
+{
+	char buffer[PacketParser::MAXDNAME];
+	const PacketParser::NameView name =
+	  PacketParser::name( data, record, buffer );
+	return name.length + (size_t) name.hash;
+}
+
+/*! @brief Length of the reference name, for the same amount of work. */
+static size_t reference_length( const char *data,
+                                const PacketRecord &record )
+{
+	return reference( data, record ).size();
+}
+
+/*! @brief Length of the identifier. */
+static size_t identifier_length( const char *data,
+                                 const PacketRecord &record )
+{
+	return identifier( data, record ).size();
+}
+
+typedef size_t ( *Extract )( const char *, const PacketRecord & );
+
+/*!
+ * @brief Extract all names, best of several rounds.
+ * @return Names per second.
+ */
+static double run( const Names &names, Extract extract )
+{
+	const char *data = names.buffer.data();
+	double result = 0;
+
+	for ( unsigned round = 0; round < ROUNDS; ++round ) {
+		size_t sum = 0;
+		const double start = wall_time();
+		for ( size_t i = 0; i < names.records.size(); ++i )
+			sum += extract( data + names.starts[i],
+			                names.records[i] );
+		const double elapsed = wall_time() - start;
+
+		if ( sum == 0 ) {
+			cerr << "nothing extracted\n";
+			exit( 1 );
+		}
+		result = max( result, names.records.size() / elapsed );
+	}
+	return result;
+}
+
+static void report( const char *name, double rate, double reference )
+{
+	cout << setw( 28 ) << left << name << right << fixed
+	     << setprecision( 0 ) << setw( 12 ) << rate << " names/s "
+	     << setprecision( 2 ) << rate / reference << "x" << endl;
+}
+
+int main( int argc, char** argv )
+{
+	::std::cout << "---------- " << *argv << " start ----------\n";
+	/* usage: name_benchmark [names] [public suffix list] */
+
+	const unsigned count = argc > 1 ? atoi( argv[1] ) : NAMES;
+	RNG rnd( 42 );
+	Names names;
+	size_t characters = 0;
+	for ( unsigned i = 0; i < count; ++i ) {
+		const string name = realistic_name( rnd );
+		characters += name.size();
+		append( names, name );
+	}
+	/* the root name and a single label */
+	append( names, "" );
+	append( names, "be" );
+
+	for ( size_t i = 0; i < names.records.size(); ++i ) {
+		const char *data = names.buffer.data() + names.starts[i];
+		if ( reference( data, names.records[i] )
+		     != identifier( data, names.records[i] ) ) {
+			cerr << "name " << i << " differs: "
+			     << reference( data, names.records[i] ) << " "
+			     << identifier( data, names.records[i] ) << "\n";
+			return 1;
+		}
+	}
+	cout << "mean name length " << characters / count << endl;
+
+	const double base = run( names, reference_length );
+	report( "string and search", base, base );
+	report( "view and hash", run( names, view ), base );
+	report( "identifier from labels", run( names, identifier_length ),
+	        base );
+
+	/* e.g. /usr/share/publicsuffix/public_suffix_list.dat */
+	if ( argc > 2 ) {
+		if ( !reducer.loadSuffixes( argv[2] ) )
+			return 1;
+		report( "registrable domain", run( names, identifier_length ),
+		        base );
+	}
+
+	return 0;
+}
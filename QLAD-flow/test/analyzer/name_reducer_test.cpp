@@ -0,0 +1,304 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "test.h"
+using namespace ::std;
+
+#include "policies/dns/PacketParser.h"
+#include "policies/dns/PacketParser.cpp"
+#include "policies/dns/NameReducer.cpp"
+
+/*! @brief A small public suffix list, a rule in UTF-8 among them. */
+static const char SUFFIXES[] =
+	"// comments and empty lines are skipped\n"
+	"\n"
+	"com\n"
+	"uk\n"
+	"co.uk\n"
+	"ck\n"
+	"*.ck\n"
+	"!www.ck\n"
+	"cn\n"
+	"\xe5\x85\xac\xe5\x8f\xb8.cn  trailing words are ignored\n";
+
+/*! @brief Loads the list text through a temporary file. */
+static bool load( NameReducer &reducer, const char *text )
+{
+	char path[] = "/tmp/name_reducer_testXXXXXX";
+	const int fd = mkstemp( path );
+	if ( fd == -1 )
+		return false;
+	FILE *file = fdopen( fd, "w" );
+	fputs( text, file );
+	fclose( file );
+	const bool loaded = reducer.loadSuffixes( path );
+	unlink( path );
+	return loaded;
+}
+
+/*! @brief The name in wire format behind a DNS header, and its record. */
+static string wire_name( const string &name, PacketRecord &record )
+{
+	string data( 12, '\0' );
+	size_t start = 0;
+	while ( start < name.size() ) {
+		const size_t dot = name.find( '.', start );
+		data.push_back( (char) ( dot - start ) );
+		data.append( name, start, dot - start );
+		start = dot + 1;
+	}
+	data.push_back( '\0' );
+	record = PacketRecord();
+	record.name_offset = 12;
+	record.name_length = data.size() - 12;
+	record.status = PacketRecord::HAS_QUESTION;
+	return data;
+}
+
+/*!
+ * @brief Compare the identifier of a name with the expected one.
+ * @param name Text with the final dot, "" for the root.
+ * @param expected The identifier, "" for none.
+ */
+static int check( const NameReducer &reducer, const string &name,
+                  const string &expected )
+{
+	PacketRecord record;
+	const string data = wire_name( name, record );
+	char buffer[PacketParser::MAXDNAME];
+	const PacketParser::NameView view =
+	  PacketParser::name( data.data(), record, buffer, reducer );
+	const string identifier( view.data, view.length );
+
+	if ( identifier == expected && view.hash
+			== PacketParser::hashName( expected.data(), expected.size() ) )
+		return 0;
+
+	cerr << "FAIL: '" << name << "' gives '" << identifier << "', '"
+		<< expected << "' expected" << endl;
+	return -1;
+}
+
+/*! @brief The last labels without a list. */
+static int test_labels()
+{
+	NameReducer reducer;
+	int ret = check( reducer, "www.Example.COM.", "example.com." )
+		| check( reducer, "example.com.", "example.com." )
+		| check( reducer, "be.", "" )
+		| check( reducer, "", "" );
+
+	reducer.setLabels( 1 );
+	ret |= check( reducer, "www.example.com.", "com." )
+		| check( reducer, "be.", "be." )
+		| check( reducer, "", "" );
+
+	reducer.setLabels( 3 );
+	return ret | check( reducer, "a.b.c.d.", "b.c.d." )
+		| check( reducer, "c.d.", "c.d." )
+		| check( reducer, "d.", "" );
+}
+
+/*! @brief The registrable domain by the list, wildcard and exception. */
+static int test_suffixes()
+{
+	NameReducer reducer;
+	if ( !load( reducer, SUFFIXES ) ) {
+		cerr << "FAIL: list not loaded" << endl;
+		return -1;
+	}
+
+	return check( reducer, "www.example.co.uk.", "example.co.uk." )
+		| check( reducer, "EXAMPLE.Co.Uk.", "example.co.uk." )
+		| check( reducer, "co.uk.", "" )
+		| check( reducer, "uk.", "" )
+		/* every label below ck is a suffix but www */
+		| check( reducer, "a.b.ck.", "a.b.ck." )
+		| check( reducer, "x.a.b.ck.", "a.b.ck." )
+		| check( reducer, "b.ck.", "" )
+		| check( reducer, "ck.", "" )
+		| check( reducer, "www.ck.", "www.ck." )
+		| check( reducer, "a.www.ck.", "www.ck." )
+		/* the rule was in UTF-8, queries have its punycode */
+		| check( reducer, "www.shop.xn--55qx5d.cn.", "shop.xn--55qx5d.cn." )
+		| check( reducer, "xn--55qx5d.cn.", "" )
+		/* a label no rule knows is a suffix on its own */
+		| check( reducer, "a.b.example.", "b.example." )
+		| check( reducer, "example.", "" )
+		| check( reducer, "", "" );
+}
+
+/*! @brief The list with fewer and more labels kept. */
+static int test_depths()
+{
+	NameReducer reducer( 1 );
+	if ( !load( reducer, SUFFIXES ) ) {
+		cerr << "FAIL: list not loaded" << endl;
+		return -1;
+	}
+
+	/* the public suffix alone, names that are one kept too */
+	int ret = check( reducer, "www.example.co.uk.", "co.uk." )
+		| check( reducer, "co.uk.", "co.uk." )
+		| check( reducer, "x.a.b.ck.", "b.ck." )
+		| check( reducer, "a.www.ck.", "ck." )
+		| check( reducer, "ck.", "ck." )
+		| check( reducer, "example.", "example." );
+
+	reducer.setLabels( 3 );
+	return ret | check( reducer, "a.b.example.co.uk.", "b.example.co.uk." )
+		| check( reducer, "example.co.uk.", "example.co.uk." )
+		| check( reducer, "co.uk.", "" )
+		| check( reducer, "y.x.a.b.ck.", "x.a.b.ck." )
+		| check( reducer, "b.a.www.ck.", "a.www.ck." )
+		| check( reducer, "a.b.c.", "a.b.c." )
+		| check( reducer, "c.", "" );
+}
+
+/*! @brief Code points in UTF-8. */
+static string utf8( const uint32_t *points, size_t count )
+{
+	string text;
+	for ( size_t i = 0; i < count; ++i ) {
+		const uint32_t p = points[i];
+		if ( p < 0x80 ) {
+			text.push_back( p );
+		} else if ( p < 0x800 ) {
+			text.push_back( 0xc0 | p >> 6 );
+			text.push_back( 0x80 | ( p & 0x3f ) );
+		} else {
+			text.push_back( 0xe0 | p >> 12 );
+			text.push_back( 0x80 | ( p >> 6 & 0x3f ) );
+			text.push_back( 0x80 | ( p & 0x3f ) );
+		}
+	}
+	return text;
+}
+
+/*! @brief Compare the ASCII form of a label with the expected one. */
+static int check_ascii( const string &label, const string &expected )
+{
+	string ascii;
+	if ( NameReducer::toAscii( label, ascii ) && ascii == expected )
+		return 0;
+
+	cerr << "FAIL: '" << ascii << "', '" << expected << "' expected"
+		<< endl;
+	return -1;
+}
+
+/*! @brief A sample string of RFC 3492, 7.1. */
+struct Sample {
+	uint32_t points[32];  /*!< @brief Code points, 0 ends them. */
+	const char *punycode; /*!< @brief The encoding, lower case. */
+};
+
+/*! @brief The samples of RFC 3492 but the long Hindi and Korean ones. */
+static const Sample SAMPLES[] = {
+	{ { 0x644, 0x64a, 0x647, 0x645, 0x627, 0x628, 0x62a, 0x643, 0x644,
+	    0x645, 0x648, 0x634, 0x639, 0x631, 0x628, 0x64a, 0x61f },
+	  "egbpdaj6bu4bxfgehfvwxn" },
+	{ { 0x4ed6, 0x4eec, 0x4e3a, 0x4ec0, 0x4e48, 0x4e0d, 0x8bf4, 0x4e2d,
+	    0x6587 },
+	  "ihqwcrb4cv8a8dqg056pqjye" },
+	{ { 0x4ed6, 0x5011, 0x7232, 0x4ec0, 0x9ebd, 0x4e0d, 0x8aaa, 0x4e2d,
+	    0x6587 },
+	  "ihqwctvzc91f659drss3x8bo0yb" },
+	{ { 'P', 'r', 'o', 0x10d, 'p', 'r', 'o', 's', 't', 0x11b, 'n', 'e',
+	    'm', 'l', 'u', 'v', 0xed, 0x10d, 'e', 's', 'k', 'y' },
+	  "proprostnemluvesky-uyb24dma41a" },
+	{ { 0x5dc, 0x5de, 0x5d4, 0x5d4, 0x5dd, 0x5e4, 0x5e9, 0x5d5, 0x5d8,
+	    0x5dc, 0x5d0, 0x5de, 0x5d3, 0x5d1, 0x5e8, 0x5d9, 0x5dd, 0x5e2,
+	    0x5d1, 0x5e8, 0x5d9, 0x5ea },
+	  "4dbcagdahymbxekheh6e0a7fei0b" },
+	{ { 0x306a, 0x305c, 0x307f, 0x3093, 0x306a, 0x65e5, 0x672c, 0x8a9e,
+	    0x3092, 0x8a71, 0x3057, 0x3066, 0x304f, 0x308c, 0x306a, 0x3044,
+	    0x306e, 0x304b },
+	  "n8jok5ay5dzabd5bym9f0cm5685rrjetr6pdxa" },
+	{ { '3', 0x5e74, 'B', 0x7d44, 0x91d1, 0x516b, 0x5148, 0x751f },
+	  "3b-ww4c5e180e575a65lsy2b" },
+	{ { 0x5b89, 0x5ba4, 0x5948, 0x7f8e, 0x6075, '-', 'w', 'i', 't', 'h',
+	    '-', 'S', 'U', 'P', 'E', 'R', '-', 'M', 'O', 'N', 'K', 'E', 'Y',
+	    'S' },
+	  "-with-super-monkeys-pc58ag80a8qai00g7n9n" },
+	{ { 'H', 'e', 'l', 'l', 'o', '-', 'A', 'n', 'o', 't', 'h', 'e', 'r',
+	    '-', 'W', 'a', 'y', '-', 0x305d, 0x308c, 0x305e, 0x308c, 0x306e,
+	    0x5834, 0x6240 },
+	  "hello-another-way--fc4qua05auwb3674vfr0b" },
+	{ { 0x3072, 0x3068, 0x3064, 0x5c4b, 0x6839, 0x306e, 0x4e0b, '2' },
+	  "2-u9tlzr9756bt3uc0v" },
+	{ { 'M', 'a', 'j', 'i', 0x3067, 'K', 'o', 'i', 0x3059, 0x308b, '5',
+	    0x79d2, 0x524d },
+	  "majikoi5-783gue6qz075azm5e" },
+	{ { 0x30d1, 0x30d5, 0x30a3, 0x30fc, 'd', 'e', 0x30eb, 0x30f3,
+	    0x30d0 },
+	  "de-jg4avhby1noc0d" },
+	{ { 0x305d, 0x306e, 0x30b9, 0x30d4, 0x30fc, 0x30c9, 0x3067 },
+	  "d9juau41awczczp" },
+};
+
+/*! @brief The samples of RFC 3492 and labels of ASCII alone. */
+static int test_punycode()
+{
+	int ret = 0;
+	for ( size_t i = 0; i < sizeof( SAMPLES ) / sizeof( *SAMPLES ); ++i ) {
+		size_t count = 0;
+		while ( count < 32 && SAMPLES[i].points[count] )
+			++count;
+		ret |= check_ascii( utf8( SAMPLES[i].points, count ),
+		  string( "xn--" ) + SAMPLES[i].punycode );
+	}
+	/* the last sample, ASCII only, is kept as it is */
+	return ret | check_ascii( "-> $1.00 <-", "-> $1.00 <-" )
+		| check_ascii( "Example", "example" );
+}
+
+/*! @brief Invalid UTF-8 and lists without rules. */
+static int test_invalid()
+{
+	const char * const invalid[] = {
+		"\xc3",          /* cut short */
+		"a\x80",         /* continuation alone */
+		"\xc3\x28",      /* continuation missing */
+		"\xf8\x88\x80\x80\x80" /* five bytes */
+	};
+	int ret = 0;
+	for ( size_t i = 0; i < sizeof( invalid ) / sizeof( *invalid ); ++i ) {
+		string ascii;
+		if ( NameReducer::toAscii( invalid[i], ascii ) ) {
+			cerr << "FAIL: invalid label " << i << " taken" << endl;
+			ret = -1;
+		}
+	}
+
+	NameReducer reducer;
+	if ( load( reducer, "// nothing but comments\n\n" )
+			|| load( reducer, "\xc3.com\n" ) ) {
+		cerr << "FAIL: list without rules loaded" << endl;
+		ret = -1;
+	}
+	if ( reducer.loadSuffixes( "/nonexistent/public_suffix_list.dat" ) ) {
+		cerr << "FAIL: missing list loaded" << endl;
+		ret = -1;
+	}
+	/* the failed loads keep the reducer as it was */
+	return ret | check( reducer, "www.example.co.uk.", "co.uk." );
+}
+
+static FunTest t0( test_labels, "NameReducer labels without a list" );
+static FunTest t1( test_suffixes, "NameReducer public suffixes" );
+static FunTest t2( test_depths, "NameReducer label depths" );
+static FunTest t3( test_punycode, "NameReducer punycode" );
+static FunTest t4( test_invalid, "NameReducer invalid input" );
+
+int main()
+{
+	return TestRunner::instance().runAll( cout );
+}
@@ -0,0 +1,185 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cctype>
+#include "test.h"
+using namespace ::std;
+
+#include "policies/dns/PacketParser.h"
+#include "policies/dns/PacketParser.cpp"
+#include "policies/dns/NameReducer.cpp"
+#include "hash/RNG.h"
+
+enum { TEST_RUNS = 20, MAXLABEL = 63, GUARD = 0x55 };
+
+static RNG rnd;
+
+/*! @brief A query name in wire format ending its packet data. */
+struct Name {
+	vector< char > data;  /*!< @brief Nothing after the name. */
+	PacketRecord record;  /*!< @brief Where the name is. */
+};
+
+/*! @brief The labels in wire format, behind the offset. */
+static Name wire_name( const vector< string > &labels, size_t offset )
+{
+	Name name;
+	name.data.assign( offset, '\0' );
+	for ( size_t i = 0; i < labels.size(); ++i ) {
+		name.data.push_back( (char) labels[i].size() );
+		name.data.insert( name.data.end(), labels[i].begin(),
+		  labels[i].end() );
+	}
+	name.data.push_back( '\0' );
+	name.record = PacketRecord();
+	name.record.name_offset = offset;
+	name.record.name_length = name.data.size() - offset;
+	name.record.status = PacketRecord::HAS_QUESTION;
+	return name;
+}
+
+/*! @brief The text of the labels as a scalar tolower() makes it. */
+static string reference( const vector< string > &labels )
+{
+	if ( labels.empty() )
+		return ".";
+
+	string text;
+	for ( size_t i = 0; i < labels.size(); ++i ) {
+		for ( size_t j = 0; j < labels[i].size(); ++j )
+			text.push_back( tolower( (unsigned char) labels[i][j] ) );
+		text.push_back( '.' );
+	}
+	return text;
+}
+
+/*! @brief Letters of either case, bytes above ASCII or any byte. */
+static char random_byte()
+{
+	switch ( rnd.gen_u32() % 4 ) {
+	case 0:
+		return 'A' + rnd.gen_u32() % 26;
+	case 1:
+		return 'a' + rnd.gen_u32() % 26;
+	case 2:
+		return 0x80 + rnd.gen_u32() % 0x80;
+	default:
+		return rnd.gen_u32() % 0x100;
+	}
+}
+
+/*! @brief Random labels taking the length in wire format, 3 at least. */
+static vector< string > random_labels( size_t length )
+{
+	vector< string > labels;
+	/* the bytes left for the labels and their length bytes */
+	size_t left = length - 1;
+	while ( left ) {
+		size_t size = 1 + rnd.gen_u32() % MAXLABEL;
+		if ( size + 1 > left )
+			size = left - 1;
+		/* a single byte left would not make a label */
+		if ( left - size - 1 == 1 )
+			size += size < MAXLABEL ? 1 : -1;
+		string label;
+		for ( size_t i = 0; i < size; ++i )
+			label.push_back( random_byte() );
+		labels.push_back( label );
+		left -= size + 1;
+	}
+	return labels;
+}
+
+/*! @brief Compare name() of the labels with the reference. */
+static int check( const vector< string > &labels, size_t offset )
+{
+	const Name name = wire_name( labels, offset );
+	const string expected = reference( labels );
+	char buffer[PacketParser::MAXDNAME + 1];
+	memset( buffer, GUARD, sizeof( buffer ) );
+
+	const PacketParser::NameView view =
+	  PacketParser::name( &name.data[0], name.record, buffer );
+	int ret = 0;
+	if ( string( view.data, view.length ) != expected ) {
+		cerr << "FAIL: text of " << view.length << " characters differs"
+			<< " from the " << expected.size() << " expected" << endl;
+		ret = -1;
+	}
+	if ( view.hash != PacketParser::hashName( expected.data(),
+			expected.size() ) ) {
+		cerr << "FAIL: hash of " << expected.size() << " characters"
+			<< endl;
+		ret = -1;
+	}
+	if ( buffer[expected.size()] != (char) GUARD ) {
+		cerr << "FAIL: written past " << expected.size() << " characters"
+			<< endl;
+		ret = -1;
+	}
+	return ret;
+}
+
+/*! @brief The root name alone. */
+static int test_root()
+{
+	return check( vector< string >(), 12 );
+}
+
+/*! @brief Random names of every length a name may have. */
+static int test_lengths()
+{
+	int ret = check( vector< string >(), 12 );
+	for ( size_t length = 3; length < PacketParser::MAXDNAME; ++length )
+		/* the name at any alignment of the words read */
+		ret |= check( random_labels( length ), 12 + rnd.gen_u32() % 8 );
+	return ret;
+}
+
+/*! @brief Every byte value, in the longest labels. */
+static int test_bytes()
+{
+	int ret = 0;
+	for ( unsigned first = 0; first < 0x100; first += 0x80 ) {
+		vector< string > labels;
+		string label;
+		for ( unsigned c = first; c < first + 0x80; ++c ) {
+			label.push_back( c );
+			if ( label.size() == MAXLABEL ) {
+				labels.push_back( label );
+				label.clear();
+			}
+		}
+		labels.push_back( label );
+		ret |= check( labels, 12 );
+	}
+	return ret;
+}
+
+/*! @brief Labels of one letter in random case, the shortest words. */
+static int test_short()
+{
+	vector< string > labels;
+	int ret = 0;
+	for ( unsigned i = 0; i < 40; ++i ) {
+		labels.push_back( string( 1, 'A' + rnd.gen_u32() % 58 ) );
+		ret |= check( labels, 12 + i % 8 );
+	}
+	return ret;
+}
+
+static FunTest t0( test_root, "PacketParser::name root" );
+static FunTest t1( test_lengths, "PacketParser::name all lengths",
+  TEST_RUNS );
+static FunTest t2( test_bytes, "PacketParser::name all bytes" );
+static FunTest t3( test_short, "PacketParser::name short labels",
+  TEST_RUNS );
+
+int main()
+{
+	return TestRunner::instance().runAll( cout );
+}
@@ -0,0 +1,261 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <netinet/in.h>
+#include "test.h"
+using namespace ::std;
+
+#include "policies/dns/PacketParser.h"
+#include "policies/dns/PacketParser.cpp"
+#include "policies/dns/NameReducer.cpp"
+#include "hash/RNG.h"
+
+enum { TEST_RUNS = 10000, BLOCK = PacketParser::BLOCK, BATCH = 40 };
+
+static RNG rnd;
+
+/*! @brief A packet of the tests, its data 2-aligned. */
+struct Packet {
+	vector< uint16_t > storage;  /*!< @brief The data. */
+	IStorage::PacketView view;   /*!< @brief The view of the data. */
+};
+
+/*! @brief DNS message of the flags asking for "a.be. A". */
+static string message( unsigned flags )
+{
+	string dns( 12, '\0' );
+	dns[0] = 0x12; dns[1] = 0x34;
+	dns[2] = flags >> 8; dns[3] = flags & 0xff;
+	dns[5] = 1;
+	return dns + string( "\x01" "a\x02" "be\x00\x00\x01\x00\x01", 10 );
+}
+
+/*! @brief Keeps the bytes in the packet and sets its view. */
+static void store( Packet &p, const string &bytes,
+                   IStorage::Format format )
+{
+	p.storage.assign( bytes.size() / 2 + 1, 0 );
+	memcpy( &p.storage[0], bytes.data(), bytes.size() );
+	p.view = IStorage::PacketView();
+	p.view.data = (const char *) &p.storage[0];
+	p.view.size = bytes.size();
+	p.view.format = format;
+}
+
+/*!
+ * @brief A random packet: queries, responses and odd opcodes over UDP
+ * or TCP on any ports, fragments, truncated ones and DNS messages
+ * without a packet.
+ */
+static void random_packet( Packet &p )
+{
+	unsigned flags = rnd.gen_u32() & 0x07ff;
+	switch ( rnd.gen_u32() % 4 ) {
+	case 0:
+		flags = rnd.gen_u32() & 0xffff;
+		break;
+	case 1:
+		flags |= 0x8000;
+		break;
+	case 2:
+		flags |= ( 1 + rnd.gen_u32() % 15 ) << 11;
+		break;
+	}
+	unsigned sport = 1024 + rnd.gen_u32() % 60000, dport = 53;
+	switch ( rnd.gen_u32() % 4 ) {
+	case 0:
+		swap( sport, dport );
+		break;
+	case 1:
+		dport = 5353;
+		break;
+	}
+	const string dns = message( flags );
+
+	const unsigned kind = rnd.gen_u32() % 8;
+	if ( kind < 2 ) {
+		string bytes( sizeof( MessageRecord ), '\0' );
+		bytes[0] = 4;
+		bytes += dns;
+		/* a truncated one has no flags */
+		if ( kind == 1 )
+			bytes.resize( rnd.gen_u32() % ( sizeof( MessageRecord ) + 4 ) );
+		store( p, bytes, IStorage::DNS_MESSAGE );
+		return;
+	}
+
+	const bool v6 = kind == 2;
+	const size_t transport = v6 ? 40 : 20;
+	string bytes( transport, '\0' );
+	bytes[0] = v6 ? 0x60 : 0x45;
+	string udp( 8, '\0' );
+	udp[0] = sport >> 8; udp[1] = sport & 0xff;
+	udp[2] = dport >> 8; udp[3] = dport & 0xff;
+	udp[4] = ( 8 + dns.size() ) >> 8; udp[5] = ( 8 + dns.size() ) & 0xff;
+	bytes += udp + dns;
+	/* cut anywhere in the UDP and DNS headers */
+	if ( kind == 3 )
+		bytes.resize( transport + rnd.gen_u32() % 22 );
+
+	PacketMeta meta = PacketMeta();
+	meta.length = bytes.size();
+	meta.transport = transport;
+	meta.version = v6 ? 6 : 4;
+	meta.protocol = kind == 4 ? IPPROTO_TCP : IPPROTO_UDP;
+	meta.fragment = kind == 5;
+	if ( v6 ) {
+		bytes[4] = ( meta.length - 40 ) >> 8;
+		bytes[5] = ( meta.length - 40 ) & 0xff;
+		bytes[6] = meta.protocol;
+	} else {
+		bytes[2] = meta.length >> 8;
+		bytes[3] = meta.length & 0xff;
+		bytes[9] = meta.protocol;
+	}
+	store( p, bytes, IStorage::IP_PACKET );
+	p.view.meta = meta;
+}
+
+/*!
+ * @brief What classify() should tell of a packet, taken field by field.
+ * @param response Set for a response held back.
+ * @param opcode Set for a query held back by its opcode.
+ * @return True for a packet to decode fully.
+ */
+static bool reference( const IStorage::PacketView &packet, unsigned need,
+                       bool &response, bool &opcode )
+{
+	const unsigned char *bp = (const unsigned char *) packet.data;
+	bool dns;
+	unsigned flags = 0;
+	if ( packet.format == IStorage::DNS_MESSAGE ) {
+		dns = true;
+		if ( packet.size >= sizeof( MessageRecord ) + 4 )
+			flags = bp[sizeof( MessageRecord ) + 2] << 8
+				| bp[sizeof( MessageRecord ) + 3];
+	} else {
+		const PacketMeta &meta = packet.meta;
+		const unsigned char *up = bp + meta.transport;
+		dns = !meta.fragment && meta.protocol == IPPROTO_UDP
+			&& meta.length >= meta.transport + 4u
+			&& ( ( up[0] << 8 | up[1] ) == 53
+			  || ( up[2] << 8 | up[3] ) == 53 );
+		if ( dns && meta.length >= meta.transport + 12u )
+			flags = up[10] << 8 | up[11];
+	}
+
+	const bool held = dns && !( need & PacketRecord::NEED_DNS )
+		&& ( flags & 0xf800 );
+	response = held && ( flags & 0x8000 );
+	opcode = held && !( flags & 0x8000 );
+	return dns && !held;
+}
+
+/*! @brief The needs of the DNS policies, with and without addresses. */
+static unsigned random_need()
+{
+	static const unsigned needs[] = {
+		PacketRecord::NEED_QUERIES,
+		PacketRecord::NEED_DNS,
+		PacketRecord::NEED_QUERIES | PacketRecord::NEED_DNS,
+		PacketRecord::NEED_QUERIES | PacketRecord::NEED_ADDRESSES
+	};
+	return needs[rnd.gen_u32() % 4];
+}
+
+/*! @brief A random block, full or not, against the reference. */
+static int test_classify()
+{
+	Packet packets[BLOCK];
+	IStorage::PacketView views[BLOCK];
+	for ( unsigned i = 0; i < BLOCK; ++i ) {
+		random_packet( packets[i] );
+		views[i] = packets[i].view;
+	}
+	const size_t count = rnd.gen_u32() % 2 ? (size_t) BLOCK
+		: 1 + rnd.gen_u32() % BLOCK;
+	const unsigned need = random_need();
+
+	unsigned responses = ~0u, opcodes = ~0u;
+	const unsigned dns =
+	  PacketParser::classify( views, count, need, responses, opcodes );
+	unsigned expected = 0, expected_responses = 0, expected_opcodes = 0;
+	for ( size_t i = 0; i < count; ++i ) {
+		bool response, opcode;
+		expected |= reference( views[i], need, response, opcode ) << i;
+		expected_responses |= response << i;
+		expected_opcodes |= opcode << i;
+	}
+	if ( dns == expected && responses == expected_responses
+			&& opcodes == expected_opcodes )
+		return 0;
+
+	cerr << hex << "FAIL: " << count << " packets, need " << need
+		<< ": dns " << dns << ", responses " << responses
+		<< ", opcodes " << opcodes << "; " << expected << ", "
+		<< expected_responses << ", " << expected_opcodes
+		<< " expected" << dec << endl;
+	return -1;
+}
+
+/*!
+ * @brief A batch of several blocks decoded at once against one packet
+ * at a time.
+ */
+static int test_batch()
+{
+	vector< Packet > packets( BATCH );
+	vector< IStorage::PacketView > views( BATCH );
+	for ( unsigned i = 0; i < BATCH; ++i ) {
+		random_packet( packets[i] );
+		views[i] = packets[i].view;
+	}
+	const size_t count = BLOCK + rnd.gen_u32() % ( BATCH - BLOCK + 1 );
+	const unsigned need = random_need();
+
+	PacketParser parser;
+	vector< PacketRecord > records( BATCH );
+	parser( &views[0], count, &records[0], need );
+	int ret = 0;
+	for ( size_t i = 0; i < count; ++i ) {
+		bool response, opcode;
+		const bool dns = reference( views[i], need, response, opcode );
+		PacketRecord expected;
+		if ( dns ) {
+			/* decoded as on its own */
+			parser( views[i], expected );
+		} else if ( response || opcode ) {
+			/* the DNS header is not decoded, the reason is known */
+			expected = records[i];
+			expected.failure = response ? PacketRecord::FAIL_NOT_QUERY
+				: PacketRecord::FAIL_QUERY_FLAGS;
+		} else if ( !( need & PacketRecord::NEED_ADDRESSES ) ) {
+			memset( &expected, 0, sizeof( expected ) );
+			expected.failure = PacketRecord::FAIL_SKIPPED;
+		} else {
+			/* the addresses only, the parser stops before DNS */
+			continue;
+		}
+		if ( memcmp( &records[i], &expected, sizeof( expected ) ) ) {
+			cerr << "FAIL: packet " << i << " of " << count
+				<< ", need " << need << ": failure "
+				<< (unsigned) records[i].failure << ", "
+				<< (unsigned) expected.failure << " expected" << endl;
+			ret = -1;
+		}
+	}
+	return ret;
+}
+
+static FunTest t0( test_classify, "PacketParser::classify blocks",
+  TEST_RUNS );
+static FunTest t1( test_batch, "PacketParser batches", TEST_RUNS / 10 );
+
+int main()
+{
+	return TestRunner::instance().runAll( cout );
+}
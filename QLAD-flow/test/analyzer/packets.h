@@ -0,0 +1,130 @@
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <stdint.h>
+#include <arpa/inet.h>
+#include <sys/time.h>
+
+#include "hash/RNG.h"
+
+/*!
+ * @brief Synthetic DNS query packets for tests and benchmarks.
+ *
+ * Packets are raw IPv4/UDP/DNS (no link header) stored back to back in one
+ * buffer, each one starting at an even offset like in a capture buffer.
+ */
+class SyntheticPackets {
+public:
+	/*! @brief Packet position in the buffer. */
+	struct Entry {
+		size_t offset; //!< @brief Offset of the IP header.
+		size_t size;   //!< @brief Packet size.
+		time_t time;   //!< @brief Arrival time.
+	};
+
+	typedef ::std::vector< Entry > Entries;
+
+	/*!
+	 * @brief Generate queries.
+	 * @param count Number of packets.
+	 * @param sources Number of distinct source addresses.
+	 * @param names Number of distinct query names.
+	 * @param duration Seconds the packets are spread over.
+	 */
+	SyntheticPackets( unsigned count, unsigned sources, unsigned names,
+	                  unsigned duration, uint64_t seed = 42 )
+	{
+		RNG rnd( seed );
+		const time_t start = 1500000000;
+
+		for ( unsigned i = 0; i < count; ++i ) {
+			Entry e;
+			e.offset = mBuffer.size();
+			e.time = start + (time_t) i * duration / count;
+			append( 0x0a000000 | rnd.gen_u32() % sources,
+			        0xc0000201, qname( rnd.gen_u32() % names ) );
+			e.size = mBuffer.size() - e.offset;
+			if ( mBuffer.size() % 2 )
+				mBuffer.push_back( '\0' );
+			mEntries.push_back( e );
+		}
+	}
+
+	const Entries & entries() const
+		{ return mEntries; }
+
+	const char * data( const Entry &e ) const
+		{ return mBuffer.data() + e.offset; }
+
+	/*!
+	 * @brief Query name with a realistic label layout.
+	 * @param n Name number.
+	 */
+	static ::std::string qname( unsigned n )
+	{
+		static const char *labels[] = { "www", "mail", "ns1", "api" };
+		char buf[64];
+		snprintf( buf, sizeof( buf ), "%s.domain%u.be",
+		          labels[n % 4], n );
+		return buf;
+	}
+
+private:
+	::std::string mBuffer;
+	Entries mEntries;
+
+	void put16( uint16_t v )
+		{ v = htons( v ); mBuffer.append( (const char *) &v, 2 ); }
+
+	void put32( uint32_t v )
+		{ v = htonl( v ); mBuffer.append( (const char *) &v, 4 ); }
+
+	void append( uint32_t src, uint32_t dst, const ::std::string &name )
+	{
+		/* DNS question in wire format */
+		::std::string q;
+		size_t start = 0;
+		while ( start <= name.size() ) {
+			size_t dot = name.find( '.', start );
+			if ( dot == ::std::string::npos )
+				dot = name.size();
+			q.push_back( (char) ( dot - start ) );
+			q.append( name, start, dot - start );
+			start = dot + 1;
+		}
+		q.push_back( '\0' );
+		q.append( "\0\1\0\1", 4 );
+
+		const uint16_t udp_len = 8 + 12 + q.size();
+		/* IPv4 header */
+		mBuffer.push_back( 0x45 );
+		mBuffer.push_back( 0 );
+		put16( 20 + udp_len );
+		put16( 0 ); put16( 0 );
+		mBuffer.push_back( 64 );
+		mBuffer.push_back( 17 );
+		put16( 0 );
+		put32( src ); put32( dst );
+		/* UDP header */
+		put16( 1024 + src % 60000 ); put16( 53 );
+		put16( udp_len ); put16( 0 );
+		/* DNS header, standard query with RD */
+		put16( src & 0xffff ); put16( 0x0100 );
+		put16( 1 ); put16( 0 ); put16( 0 ); put16( 0 );
+		mBuffer.append( q );
+	}
+};
+
+/*! @brief Wall clock in seconds, for throughput measurements. */
+inline double wall_time()
+{
+	struct timeval t;
+	gettimeofday( &t, NULL );
+	return t.tv_sec + t.tv_usec / 1e6;
+}
@@ -0,0 +1,137 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include "test.h"
+using namespace ::std;
+
+#include "struct/SparseFlow.h"
+#include "struct/SparseFlow.cpp"
+#include "hash/RNG.h"
+
+enum { TEST_RUNS = 1000, POINTS_MAX = 200, SPREAD = 60 };
+
+static RNG rnd;
+
+/*! @brief A flow of the given points, in order. */
+static SparseFlow flow_of( const time_t *points, size_t count )
+{
+	SparseFlow flow;
+	for ( size_t i = 0; i < count; ++i )
+		flow.addPoint( points[i] );
+	return flow;
+}
+
+/*! @brief The points of a flow as "time count" lines. */
+static string text_of( const SparseFlow &flow )
+{
+	ostringstream text;
+	flow.plot( text );
+	return text.str();
+}
+
+/*! @brief Compare a merged flow with the expected one. */
+static int check( const SparseFlow &merged, const SparseFlow &expected )
+{
+	if ( merged.count() == expected.count()
+			&& text_of( merged ) == text_of( expected ) )
+		return 0;
+
+	cerr << "FAIL:" << endl;
+	cerr << "\tmerged (" << merged.count() << "):" << endl
+		<< text_of( merged );
+	cerr << "\texpected (" << expected.count() << "):" << endl
+		<< text_of( expected );
+	return -1;
+}
+
+/*! @brief Add points out of time order. */
+static int test_late()
+{
+	const time_t points[] = { 10, 12, 12, 11, 12, 9, 10 };
+	const time_t ordered[] = { 9, 10, 10, 11, 12, 12, 12 };
+
+	return check( flow_of( points, 7 ), flow_of( ordered, 7 ) );
+}
+
+/*! @brief Merge series sharing some seconds. */
+static int test_overlapping()
+{
+	const time_t a_points[] = { 10, 11 };
+	const time_t b_points[] = { 10, 12, 12 };
+	const time_t all_points[] = { 10, 10, 11, 12, 12 };
+
+	SparseFlow a = flow_of( a_points, 2 );
+	a.merge( flow_of( b_points, 3 ) );
+	return check( a, flow_of( all_points, 5 ) );
+}
+
+/*! @brief Merge series with no second in common, either way round. */
+static int test_disjoint()
+{
+	const time_t a_points[] = { 1, 2, 2 };
+	const time_t b_points[] = { 5, 7 };
+	const time_t all_points[] = { 1, 2, 2, 5, 7 };
+
+	SparseFlow a = flow_of( a_points, 3 ), b = flow_of( b_points, 2 );
+	const SparseFlow all = flow_of( all_points, 5 );
+	SparseFlow ab = a, ba = b;
+	ab.merge( b );
+	ba.merge( a );
+	return check( ab, all ) | check( ba, all );
+}
+
+/*! @brief Merge with an empty series on either side. */
+static int test_empty()
+{
+	const time_t points[] = { 3, 3, 4 };
+	const SparseFlow a = flow_of( points, 3 );
+
+	SparseFlow merged = a, empty;
+	merged.merge( SparseFlow() );
+	empty.merge( a );
+	return check( merged, a ) | check( empty, a );
+}
+
+/*! @brief Merge random series against counting their points apart. */
+static int test_random()
+{
+	SparseFlow a, b, all;
+	map< time_t, unsigned > counts;
+	time_t a_time = rnd.gen_u32() % SPREAD, b_time = rnd.gen_u32() % SPREAD;
+	const unsigned count = rnd.gen_u32() % POINTS_MAX;
+
+	for ( unsigned i = 0; i < count; ++i ) {
+		if ( rnd.gen_u32() % 2 ) {
+			a.addPoint( a_time );
+			++counts[a_time];
+			a_time += rnd.gen_u32() % 3;
+		} else {
+			b.addPoint( b_time );
+			++counts[b_time];
+			b_time += rnd.gen_u32() % 3;
+		}
+	}
+	for ( map< time_t, unsigned >::const_iterator i = counts.begin();
+			i != counts.end(); ++i )
+		for ( unsigned j = 0; j < i->second; ++j )
+			all.addPoint( i->first );
+
+	a.merge( b );
+	return check( a, all );
+}
+
+static FunTest t0( test_late, "SparseFlow late points" );
+static FunTest t1( test_overlapping, "SparseFlow merge overlapping" );
+static FunTest t2( test_disjoint, "SparseFlow merge disjoint" );
+static FunTest t3( test_empty, "SparseFlow merge empty" );
+static FunTest t4( test_random, "SparseFlow merge random", TEST_RUNS );
+
+int main()
+{
+	return TestRunner::instance().runAll( cout );
+}
@@ -0,0 +1,332 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+
+#include "packets.h"
+
+#include "Storage.h"
+#include "policies/CompositePolicy.h"
+#include "policies/IPPolicy.h"
+#include "policies/QueryNamePolicy.h"
+
+#include "capture/LinkDecoder.cpp"
+#include "policies/CompositePolicy.cpp"
+#include "policies/dns/NameReducer.cpp"
+#include "policies/dns/PacketParser.cpp"
+#include "policies/ip/IPAddress.cpp"
+#include "policies/ip/IPPolicy.cpp"
+#include "policies/ip/iphash.cpp"
+#include "policies/QueryNamePolicy.cpp"
+#include "struct/SparseFlow.cpp"
+
+using namespace ::std;
+
+enum { PACKETS = 2000000, SOURCES = 50000, NAMES = 20000, DURATION = 300,
+       TUPLE_SOURCES = 64, TUPLE_NAMES = 64 };
+
+/*!
+ * @brief Feed all packets to a fresh storage.
+ * @param copy Copy every packet into a std::string first, the way
+ *             CaptureSession::capture used to.
+ * @return Packets per second.
+ */
+template < typename POLICY >
+static double run( const SyntheticPackets &packets, bool copy )
+{
+	Storage< POLICY > storage( DURATION );
+	const SyntheticPackets::Entries &e = packets.entries();
+	const LinkDecoder decoder( DLT_RAW );
+
+	const double start = wall_time();
+	for ( SyntheticPackets::Entries::const_iterator i = e.begin();
+	      i != e.end(); ++i ) {
+		IStorage::PacketView view =
+		  { packets.data( *i ), i->size, i->time,
+		    IStorage::IP_PACKET, PacketMeta() };
+		size_t offset;
+		decoder.decode( (const u_char *) view.data, view.size,
+		                offset, view.meta );
+		if ( copy ) {
+			const string data( view.data, view.size );
+			view.data = data.data();
+			storage.addPacket( view );
+		} else {
+			storage.addPacket( view );
+		}
+	}
+	const double elapsed = wall_time() - start;
+
+	if ( storage.allTraffic().count() != e.size() ) {
+		cerr << POLICY::NAME << ": stored "
+		     << storage.allTraffic().count() << " of " << e.size()
+		     << " packets\n";
+		exit( 1 );
+	}
+
+	return e.size() / elapsed;
+}
+
+template < typename POLICY >
+static void compare( const SyntheticPackets &packets )
+{
+	const double before = run< POLICY >( packets, true );
+	const double after = run< POLICY >( packets, false );
+
+	cout << setw( 24 ) << left << POLICY::NAME << right << fixed
+	     << setprecision( 0 )
+	     << setw( 12 ) << before << " pps (copy) "
+	     << setw( 12 ) << after << " pps (view) "
+	     << setprecision( 2 ) << after / before << "x" << endl;
+}
+
+/*!
+ * @brief Feed all packets to one storage of every policy.
+ * @param shared Decode every packet once for all storages, the way
+ *               AnalysisSet does, instead of once per storage.
+ * @return Packets per second.
+ */
+static double run_all( const SyntheticPackets &packets, bool shared )
+{
+	Storage< SrcIPPolicy > source( DURATION );
+	Storage< DstIPPolicy > destination( DURATION );
+	Storage< QueryNamePolicy > name( DURATION );
+	const SyntheticPackets::Entries &e = packets.entries();
+	const LinkDecoder decoder( DLT_RAW );
+	PacketParser parser;
+
+	const double start = wall_time();
+	for ( SyntheticPackets::Entries::const_iterator i = e.begin();
+	      i != e.end(); ++i ) {
+		IStorage::PacketView view =
+		  { packets.data( *i ), i->size, i->time,
+		    IStorage::IP_PACKET, PacketMeta() };
+		size_t offset;
+		decoder.decode( (const u_char *) view.data, view.size,
+		                offset, view.meta );
+		if ( shared ) {
+			PacketRecord record;
+			parser( view, record );
+			source.addRecords( &view, &record, 1 );
+			destination.addRecords( &view, &record, 1 );
+			name.addRecords( &view, &record, 1 );
+		} else {
+			source.addPacket( view );
+			destination.addPacket( view );
+			name.addPacket( view );
+		}
+	}
+	const double elapsed = wall_time() - start;
+
+	if ( name.allTraffic().count() != e.size() ) {
+		cerr << "all policies: stored " << name.allTraffic().count()
+		     << " of " << e.size() << " packets\n";
+		exit( 1 );
+	}
+
+	return e.size() / elapsed;
+}
+
+/*!
+ * @brief Source address and query name as a pair of objects, the way a
+ * tuple would be kept without CompositePolicy.
+ */
+struct PairPolicy
+{
+	static const char *NAME;
+	typedef pair< IPAddress, string > id_t;
+	static const unsigned NEED =
+	  PacketRecord::NEED_ADDRESSES | PacketRecord::NEED_QUERIES;
+
+	static id_t parseIdentifier( const PacketRecord &record,
+	                             const char *data )
+	{
+		return id_t( SrcIPPolicy::parseIdentifier( record, data ),
+		             QueryNamePolicy::parseIdentifier( record, data ) );
+	}
+
+	static unsigned hash( unsigned index, const id_t &id )
+	{
+		return SrcIPPolicy::hash( index, id.first )
+		       ^ QueryNamePolicy::hash( index, id.second );
+	}
+
+	static bool isValid( const id_t &id )
+		{ return !id.second.empty(); }
+};
+
+const char *PairPolicy::NAME = "Pair Policy";
+
+/*!
+ * @brief Store decoded packets keyed by their source and query name.
+ * @param views Packets.
+ * @param records Record decoded from every packet.
+ * @param flows Receives the number of flows stored.
+ * @return Packets per second, best of several rounds.
+ */
+template < typename POLICY >
+static double run_tuples( const vector< IStorage::PacketView > &views,
+                          const vector< PacketRecord > &records,
+                          size_t &flows )
+{
+	double result = 0;
+	for ( unsigned round = 0; round < 3; ++round ) {
+		Storage< POLICY > storage( DURATION );
+		const double start = wall_time();
+		storage.addRecords( &views[0], &records[0], views.size() );
+		result = max( result, views.size() / ( wall_time() - start ) );
+		flows = storage.size();
+	}
+	return result;
+}
+
+/*!
+ * @brief Decode traffic of a mirror port: a quarter queries, the rest
+ * other UDP, TCP and DNS responses, in batches as the capture does.
+ * @param classify Pass the batches through PacketParser::classify(),
+ *                 otherwise parse every packet fully.
+ * @param queries Receives the number of query names found.
+ * @return Packets per second.
+ */
+static double run_mixed( const SyntheticPackets &packets, bool classify,
+                         size_t &queries )
+{
+	enum { BATCH = 256 };
+	const SyntheticPackets::Entries &e = packets.entries();
+	const LinkDecoder decoder( DLT_RAW );
+
+	/* the packets are IPv4 without options */
+	string buffer;
+	vector< IStorage::PacketView > views;
+	vector< size_t > offsets;
+	for ( size_t i = 0; i < e.size(); ++i ) {
+		offsets.push_back( buffer.size() );
+		buffer.append( packets.data( e[i] ), e[i].size );
+		char *ip = &buffer[offsets.back()];
+		switch ( i % 4 ) {
+		case 1: /* QUIC */
+			ip[22] = (char) ( 443 >> 8 ); ip[23] = (char) 443;
+			break;
+		case 2: /* HTTPS */
+			ip[9] = IPPROTO_TCP;
+			ip[22] = (char) ( 443 >> 8 ); ip[23] = (char) 443;
+			break;
+		case 3: /* response */
+			ip[30] |= 0x80;
+			break;
+		}
+		if ( buffer.size() % 2 )
+			buffer.push_back( '\0' );
+	}
+	for ( size_t i = 0; i < e.size(); ++i ) {
+		IStorage::PacketView view = { buffer.data() + offsets[i],
+		  e[i].size, e[i].time, IStorage::IP_PACKET, PacketMeta() };
+		size_t offset;
+		decoder.decode( (const u_char *) view.data, view.size,
+		                offset, view.meta );
+		views.push_back( view );
+	}
+
+	vector< PacketRecord > records( BATCH );
+	PacketParser parser;
+	double result = 0;
+	/* best of several rounds, the work is short */
+	for ( unsigned round = 0; round < 5; ++round ) {
+		queries = 0;
+		const double start = wall_time();
+		for ( size_t i = 0; i < views.size(); i += BATCH ) {
+			const size_t count =
+			  min< size_t >( BATCH, views.size() - i );
+			if ( classify ) {
+				parser( &views[i], count, &records[0],
+				        PacketRecord::NEED_QUERIES );
+			} else {
+				for ( size_t j = 0; j < count; ++j )
+					parser( views[i + j], records[j] );
+			}
+			for ( size_t j = 0; j < count; ++j )
+				queries += records[j].isQuery() && records[j].has(
+				  PacketRecord::HAS_QUESTION );
+		}
+		result = max( result, e.size() / ( wall_time() - start ) );
+	}
+	return result;
+}
+
+int main( int argc, char** argv )
+{
+	::std::cout << "---------- " << *argv << " start ----------\n";
+
+	const unsigned count = argc > 1 ? atoi( argv[1] ) : PACKETS;
+	const SyntheticPackets packets( count, SOURCES, NAMES, DURATION );
+
+	compare< SrcIPPolicy >( packets );
+	compare< DstIPPolicy >( packets );
+	compare< QueryNamePolicy >( packets );
+
+	const double each = run_all( packets, false );
+	const double once = run_all( packets, true );
+	cout << setw( 24 ) << left << "All policies" << right << fixed
+	     << setprecision( 0 )
+	     << setw( 12 ) << each << " pps (each) "
+	     << setw( 12 ) << once << " pps (once) "
+	     << setprecision( 2 ) << once / each << "x" << endl;
+
+	/* the same tuples as objects and as fingerprints, a few hundred
+	 * packets each */
+	const SyntheticPackets tuples( count, TUPLE_SOURCES, TUPLE_NAMES,
+	                               DURATION );
+	vector< IStorage::PacketView > views;
+	vector< PacketRecord > records( tuples.entries().size() );
+	const LinkDecoder decoder( DLT_RAW );
+	PacketParser parser;
+	const SyntheticPackets::Entries &e = tuples.entries();
+	for ( size_t i = 0; i < e.size(); ++i ) {
+		IStorage::PacketView view =
+		  { tuples.data( e[i] ), e[i].size, e[i].time,
+		    IStorage::IP_PACKET, PacketMeta() };
+		size_t offset;
+		decoder.decode( (const u_char *) view.data, view.size,
+		                offset, view.meta );
+		parser( view, records[i] );
+		views.push_back( view );
+	}
+	CompositePolicy::configure( "src/32,qname" );
+	size_t pair_flows, composite_flows;
+	const double pairs = run_tuples< PairPolicy >( views, records,
+	                                               pair_flows );
+	const double composites = run_tuples< CompositePolicy >(
+	  views, records, composite_flows );
+	if ( pair_flows != composite_flows ) {
+		cerr << "stored " << composite_flows << " composite keys for "
+		     << pair_flows << " pairs\n";
+		return 1;
+	}
+	cout << setw( 24 ) << left << "Source and name" << right << fixed
+	     << setprecision( 0 )
+	     << setw( 12 ) << pairs << " pps (pair) "
+	     << setw( 12 ) << composites << " pps (composite) "
+	     << setprecision( 2 ) << composites / pairs << "x" << endl;
+
+	size_t full_queries, classified_queries;
+	const double full = run_mixed( packets, false, full_queries );
+	const double classified = run_mixed( packets, true, classified_queries );
+	if ( full_queries != classified_queries ) {
+		cerr << "classified " << classified_queries << " of "
+		     << full_queries << " queries\n";
+		return 1;
+	}
+	cout << setw( 24 ) << left << "Mixed traffic" << right << fixed
+	     << setprecision( 0 )
+	     << setw( 12 ) << full << " pps (full) "
+	     << setw( 12 ) << classified << " pps (classified) "
+	     << setprecision( 2 ) << classified / full << "x" << endl;
+
+	return 0;
+}
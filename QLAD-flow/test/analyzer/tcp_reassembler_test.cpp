@@ -0,0 +1,289 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <netinet/in.h>
+#include "test.h"
+using namespace ::std;
+
+#include "capture/TcpReassembler.h"
+#include "capture/TcpReassembler.cpp"
+
+/* TCP flags of the segments */
+enum { FIN = 0x01, SYN = 0x02, RST = 0x04, ACK = 0x10 };
+
+/*! @brief The reassembler with its bookkeeping in sight. */
+class Probe: public TcpReassembler
+{
+public:
+	explicit Probe( size_t memory ): TcpReassembler( memory ) {}
+
+	/*! @brief Flows in the table. */
+	unsigned flows() const
+	{
+		unsigned count = 0;
+		for ( unsigned i = mOldest; i; i = mFlows[i].newer )
+			++count;
+		return count;
+	}
+
+	/*! @brief Memory of the flow buffers. */
+	size_t buffered() const
+		{ return mBuffered; }
+
+	/*! @brief Limit of the flow buffers. */
+	size_t budget() const
+		{ return mBudget; }
+};
+
+/*! @brief An IPv4 TCP segment of a client to the name server. */
+struct Segment {
+	vector< u_char > ip;  /*!< @brief The IP packet. */
+	PacketMeta meta;      /*!< @brief Its layout. */
+};
+
+/*! @brief Segment of the client port with the flags and payload. */
+static Segment segment( unsigned client, uint32_t sequence, unsigned flags,
+                        const string &payload )
+{
+	Segment s;
+	s.ip.assign( 40, 0 );
+	s.ip.insert( s.ip.end(), payload.begin(), payload.end() );
+	s.ip[0] = 0x45;
+	s.ip[9] = IPPROTO_TCP;
+	s.ip[12] = 192; s.ip[13] = 0; s.ip[14] = 2; s.ip[15] = 1;
+	s.ip[16] = 198; s.ip[17] = 51; s.ip[18] = 100; s.ip[19] = 53;
+	u_char *tcp = &s.ip[20];
+	tcp[0] = ( 1024 + client ) >> 8; tcp[1] = ( 1024 + client ) & 0xff;
+	tcp[3] = 53;
+	tcp[4] = sequence >> 24; tcp[5] = sequence >> 16;
+	tcp[6] = sequence >> 8; tcp[7] = sequence;
+	tcp[12] = 5 << 4;
+	tcp[13] = flags;
+
+	s.meta.length = s.ip.size();
+	s.meta.transport = 20;
+	s.meta.version = 4;
+	s.meta.protocol = IPPROTO_TCP;
+	s.meta.fragment = 0;
+	return s;
+}
+
+/*! @brief A message of the size with its 2-byte length in front. */
+static string framed( size_t size, char fill )
+{
+	string message( 2, '\0' );
+	message[0] = size >> 8;
+	message[1] = size & 0xff;
+	return message + string( size, fill );
+}
+
+/*! @brief Adds the segment, the message count is returned. */
+static unsigned add( TcpReassembler &tcp, const Segment &s )
+{
+	MessageRecord record;
+	return tcp.add( &s.ip[0], s.meta, record );
+}
+
+/*! @brief Compare a reassembled message with the expected one. */
+static int check( const TcpReassembler &tcp, unsigned index,
+                  size_t size, char fill )
+{
+	const TcpReassembler::Message &m = tcp.message( index );
+	if ( string( (const char *) m.data, m.size ) == string( size, fill ) )
+		return 0;
+
+	cerr << "FAIL: message " << index << " of " << m.size << " bytes, "
+		<< size << " of '" << fill << "' expected" << endl;
+	return -1;
+}
+
+/*! @brief Report a count that differs from the expected one. */
+static int expect( const char *what, unsigned long value,
+                   unsigned long expected )
+{
+	if ( value == expected )
+		return 0;
+
+	cerr << "FAIL: " << what << " " << value << ", " << expected
+		<< " expected" << endl;
+	return -1;
+}
+
+/*! @brief A message split over three segments. */
+static int test_split()
+{
+	TcpReassembler tcp( 1 << 20 );
+	const string stream = framed( 30, 'a' );
+	int ret = expect( "SYN", add( tcp, segment( 1, 99, SYN, "" ) ), 0 );
+	ret |= expect( "first part",
+	  add( tcp, segment( 1, 100, ACK, stream.substr( 0, 1 ) ) ), 0 );
+	ret |= expect( "second part",
+	  add( tcp, segment( 1, 101, ACK, stream.substr( 1, 20 ) ) ), 0 );
+	ret |= expect( "last part",
+	  add( tcp, segment( 1, 121, ACK, stream.substr( 21 ) ) ), 1 );
+	return ret || check( tcp, 0, 30, 'a' )
+		|| expect( "gaps", tcp.gaps(), 0 );
+}
+
+/*! @brief Messages sharing a segment and one across two segments. */
+static int test_coalesced()
+{
+	TcpReassembler tcp( 1 << 20 );
+	const string stream = framed( 10, 'a' ) + framed( 20, 'b' )
+		+ framed( 5, 'c' ) + framed( 7, 'd' );
+	const Segment whole = segment( 1, 1, ACK, stream.substr( 0, 39 ) );
+
+	/* the first two are complete in the segment and not copied */
+	int ret = expect( "first segment", add( tcp, whole ), 2 );
+	if ( ret )
+		return ret;
+	ret |= check( tcp, 0, 10, 'a' ) | check( tcp, 1, 20, 'b' );
+	const u_char *end = &whole.ip[0] + whole.ip.size();
+	if ( tcp.message( 0 ).data < &whole.ip[0]
+			|| tcp.message( 1 ).data + 20 > end ) {
+		cerr << "FAIL: complete messages copied" << endl;
+		ret = -1;
+	}
+
+	ret |= expect( "second segment",
+	  add( tcp, segment( 1, 40, ACK, stream.substr( 39 ) ) ), 2 );
+	return ret || check( tcp, 0, 5, 'c' ) || check( tcp, 1, 7, 'd' );
+}
+
+/*! @brief Retransmitted data is trimmed, not delivered twice. */
+static int test_retransmission()
+{
+	TcpReassembler tcp( 1 << 20 );
+	const string stream = framed( 30, 'a' ) + framed( 4, 'b' );
+	const string first = stream.substr( 0, 12 );
+	int ret = expect( "first",
+	  add( tcp, segment( 1, 1000, ACK, first ) ), 0 );
+	ret |= expect( "repeated",
+	  add( tcp, segment( 1, 1000, ACK, first ) ), 0 );
+	ret |= expect( "repeated part",
+	  add( tcp, segment( 1, 1004, ACK, stream.substr( 4, 6 ) ) ), 0 );
+	/* overlaps the data seen and completes both messages */
+	ret |= expect( "overlapping",
+	  add( tcp, segment( 1, 1006, ACK, stream.substr( 6 ) ) ), 2 );
+	if ( ret )
+		return ret;
+	ret |= check( tcp, 0, 30, 'a' ) | check( tcp, 1, 4, 'b' );
+	ret |= expect( "after the end",
+	  add( tcp, segment( 1, 1000, ACK, stream ) ), 0 );
+	return ret | expect( "gaps", tcp.gaps(), 0 );
+}
+
+/*! @brief A lost segment drops the buffered data, the flow goes on. */
+static int test_gap()
+{
+	TcpReassembler tcp( 1 << 20 );
+	const string lost = framed( 30, 'a' );
+	int ret = expect( "before the gap",
+	  add( tcp, segment( 1, 1, ACK, lost.substr( 0, 10 ) ) ), 0 );
+	/* the rest of the first message never comes */
+	ret |= expect( "behind the gap", add( tcp,
+	  segment( 1, 1 + lost.size(), ACK, framed( 8, 'b' ) ) ), 1 );
+	if ( ret )
+		return ret;
+	ret |= check( tcp, 0, 8, 'b' );
+	return ret | expect( "gaps", tcp.gaps(), 1 )
+		| expect( "evicted", tcp.evicted(), 0 );
+}
+
+/*! @brief The least recently used flow goes when the buffers are full. */
+static int test_memory()
+{
+	Probe tcp( 16 * 1024 );
+	const size_t big = tcp.budget() * 6 / 10;
+	const string a = framed( 20, 'a' ), b = framed( big, 'b' ),
+		c = framed( big, 'c' );
+
+	int ret = expect( "a",
+	  add( tcp, segment( 1, 1, ACK, a.substr( 0, 5 ) ) ), 0 );
+	ret |= expect( "b",
+	  add( tcp, segment( 2, 1, ACK, b.substr( 0, big ) ) ), 0 );
+	/* a is used again, b becomes the oldest */
+	ret |= expect( "a again",
+	  add( tcp, segment( 1, 6, ACK, a.substr( 5, 5 ) ) ), 0 );
+	ret |= expect( "c",
+	  add( tcp, segment( 3, 1, ACK, c.substr( 0, big ) ) ), 0 );
+	ret |= expect( "evicted", tcp.evicted(), 1 );
+	if ( tcp.buffered() > tcp.budget() ) {
+		cerr << "FAIL: " << tcp.buffered() << " bytes buffered over "
+			<< tcp.budget() << endl;
+		ret = -1;
+	}
+
+	/* the rest of b starts a new flow that finds no message */
+	ret |= expect( "rest of b",
+	  add( tcp, segment( 2, 1 + big, ACK, b.substr( big ) ) ), 0 );
+	ret |= expect( "rest of a",
+	  add( tcp, segment( 1, 11, ACK, a.substr( 10 ) ) ), 1 );
+	return ret || check( tcp, 0, 20, 'a' );
+}
+
+/*! @brief The oldest flow goes when the table is full. */
+static int test_table()
+{
+	/* the smallest table, room for the buffers */
+	Probe tcp( 16 * 1024 );
+	const unsigned size = 16;
+	/* the first flow holds part of a message, the others are idle */
+	int ret = expect( "partial",
+	  add( tcp, segment( 0, 1, ACK, framed( 10, 'a' ).substr( 0, 4 ) ) ), 0 );
+	for ( unsigned i = 1; i < size; ++i )
+		add( tcp, segment( i, 1, SYN, "" ) );
+	ret |= expect( "flows", tcp.flows(), size );
+	ret |= expect( "evicted when full", tcp.evicted(), 0 );
+
+	add( tcp, segment( size, 1, SYN, "" ) );
+	ret |= expect( "evicted with data", tcp.evicted(), 1 );
+	/* idle flows go silently */
+	add( tcp, segment( size + 1, 1, SYN, "" ) );
+	ret |= expect( "evicted idle", tcp.evicted(), 1 );
+	return ret | expect( "flows", tcp.flows(), size );
+}
+
+/*! @brief FIN and RST end the flow and free its buffer. */
+static int test_close()
+{
+	Probe tcp( 1 << 20 );
+	const string a = framed( 12, 'a' );
+	int ret = expect( "start",
+	  add( tcp, segment( 1, 1, ACK, a.substr( 0, 6 ) ) ), 0 );
+	ret |= expect( "with FIN",
+	  add( tcp, segment( 1, 7, ACK | FIN, a.substr( 6 ) ) ), 1 );
+	if ( ret )
+		return ret;
+	/* the message is still valid until the next segment */
+	ret |= check( tcp, 0, 12, 'a' );
+
+	ret |= expect( "other",
+	  add( tcp, segment( 2, 1, ACK, a.substr( 0, 6 ) ) ), 0 );
+	ret |= expect( "flows after FIN", tcp.flows(), 1 );
+	ret |= expect( "RST", add( tcp, segment( 2, 7, RST, "" ) ), 0 );
+	ret |= expect( "flows after RST", tcp.flows(), 0 );
+	ret |= expect( "buffered after RST", tcp.buffered(), 0 );
+
+	/* the rest after the RST finds no flow to complete */
+	ret |= expect( "after RST",
+	  add( tcp, segment( 2, 7, ACK, a.substr( 6 ) ) ), 0 );
+	return ret | expect( "evicted", tcp.evicted(), 0 );
+}
+
+static FunTest t0( test_split, "TcpReassembler split message" );
+static FunTest t1( test_coalesced, "TcpReassembler coalesced messages" );
+static FunTest t2( test_retransmission, "TcpReassembler retransmission" );
+static FunTest t3( test_gap, "TcpReassembler sequence gap" );
+static FunTest t4( test_memory, "TcpReassembler memory eviction" );
+static FunTest t5( test_table, "TcpReassembler table eviction" );
+static FunTest t6( test_close, "TcpReassembler FIN and RST" );
+
+int main()
+{
+	return TestRunner::instance().runAll( cout );
+}